@@ -175,6 +175,12 @@ HEADERS += src/qt/bitcoingui.h \
     src/script.h \
     src/init.h \
     src/bloom.h \
+    src/sha256.h \
+    src/sha256_multiway.h \
+    src/blockfile.h \
+    src/logdb.h \
+    src/pubsub.h \
+    src/blockencodings.h \
     src/mruset.h \
     src/checkqueue.h \
     src/json/json_spirit_writer_template.h \
@@ -184,6 +190,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/json/json_spirit_stream_reader.h \
     src/json/json_spirit_reader_template.h \
     src/json/json_spirit_reader.h \
+    src/json/json_spirit_fast_reader.h \
     src/json/json_spirit_error_position.h \
     src/json/json_spirit.h \
     src/qt/clientmodel.h \
@@ -250,6 +257,12 @@ SOURCES += src/qt/bitcoin.cpp \
     src/init.cpp \
     src/net.cpp \
     src/bloom.cpp \
+    src/sha256.cpp \
+    src/blockfile.cpp \
+    src/logdb.cpp \
+    src/rest.cpp \
+    src/pubsub.cpp \
+    src/blockencodings.cpp \
     src/checkpoints.cpp \
     src/addrman.cpp \
     src/db.cpp \
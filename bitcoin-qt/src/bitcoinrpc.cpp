@@ -23,6 +23,9 @@
 #include <boost/asio/ssl.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread.hpp>
+#include <deque>
 #include <list>
 
 using namespace std;
@@ -41,6 +44,20 @@ static asio::io_service* rpc_io_service = NULL;
 static ssl::context* rpc_ssl_context = NULL;
 static boost::thread_group* rpc_worker_group = NULL;
 
+/** Number and duration of the calls to one RPC method */
+class CRPCMethodStats
+{
+public:
+    int64 nCalls;
+    int64 nTotalMicros;
+    int64 nMaxMicros;
+
+    CRPCMethodStats() : nCalls(0), nTotalMicros(0), nMaxMicros(0) {}
+};
+
+static CCriticalSection cs_rpcStats;
+static map<string, CRPCMethodStats> mapRPCStats;
+
 static inline unsigned short GetDefaultRPCPort()
 {
     return GetBoolArg("-testnet", false) ? 18332 : 8332;
@@ -120,6 +137,77 @@ std::string HexBits(unsigned int nBits)
     return HexStr(BEGIN(uBits.cBits), END(uBits.cBits));
 }
 
+void CJSONWriter::BeginValue()
+{
+    if (fAfterKey)
+        fAfterKey = false;
+    else if (!vEmpty.empty())
+    {
+        if (!vEmpty.back())
+            strOut += ',';
+        vEmpty.back() = false;
+    }
+}
+
+void CJSONWriter::EndValue()
+{
+    if (strOut.size() >= FLUSH_SIZE)
+        Flush();
+}
+
+void CJSONWriter::BeginObject()
+{
+    BeginValue();
+    strOut += '{';
+    vEmpty.push_back(true);
+}
+
+void CJSONWriter::EndObject()
+{
+    vEmpty.pop_back();
+    strOut += '}';
+    EndValue();
+}
+
+void CJSONWriter::BeginArray()
+{
+    BeginValue();
+    strOut += '[';
+    vEmpty.push_back(true);
+}
+
+void CJSONWriter::EndArray()
+{
+    vEmpty.pop_back();
+    strOut += ']';
+    EndValue();
+}
+
+void CJSONWriter::WriteKey(const string& strKey)
+{
+    BeginValue();
+    strOut += write_string(Value(strKey), false);
+    strOut += ':';
+    fAfterKey = true;
+}
+
+void CJSONWriter::WriteValue(const Value& value)
+{
+    BeginValue();
+    strOut += write_string(value, false);
+    EndValue();
+}
+
+Value ValueFromStream(rpcstreamfn_type actor, const Array& params, bool fHelp)
+{
+    CJSONWriter writer;
+    actor(params, fHelp, writer);
+    Value result;
+    if (!read_string_fast(writer.str(), result))
+        throw runtime_error("ValueFromStream() : invalid JSON written");
+    return result;
+}
+
 
 
 ///
@@ -190,6 +278,29 @@ Value stop(const Array& params, bool fHelp)
 }
 
 
+Value getrpcstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcstats\n"
+            "Returns the number of calls to each RPC method since startup,\n"
+            "and their average and longest duration in milliseconds.");
+
+    Object ret;
+    LOCK(cs_rpcStats);
+    for (map<string, CRPCMethodStats>::const_iterator it = mapRPCStats.begin(); it != mapRPCStats.end(); ++it)
+    {
+        const CRPCMethodStats& stats = it->second;
+        Object obj;
+        obj.push_back(Pair("calls", (boost::int64_t)stats.nCalls));
+        obj.push_back(Pair("avgms", stats.nTotalMicros * 0.001 / stats.nCalls));
+        obj.push_back(Pair("maxms", stats.nMaxMicros * 0.001));
+        ret.push_back(Pair(it->first, obj));
+    }
+    return ret;
+}
+
+
 
 //
 // Call Table
@@ -197,70 +308,75 @@ Value stop(const Array& params, bool fHelp)
 
 
 static const CRPCCommand vRPCCommands[] =
-{ //  name                      actor (function)         okSafeMode threadSafe
-  //  ------------------------  -----------------------  ---------- ----------
-    { "help",                   &help,                   true,      true },
-    { "stop",                   &stop,                   true,      true },
-    { "getblockcount",          &getblockcount,          true,      false },
-    { "getconnectioncount",     &getconnectioncount,     true,      false },
-    { "getpeerinfo",            &getpeerinfo,            true,      false },
-    { "addnode",                &addnode,                true,      true },
-    { "getaddednodeinfo",       &getaddednodeinfo,       true,      true },
-    { "getdifficulty",          &getdifficulty,          true,      false },
-    { "getgenerate",            &getgenerate,            true,      false },
-    { "setgenerate",            &setgenerate,            true,      false },
-    { "gethashespersec",        &gethashespersec,        true,      false },
-    { "getinfo",                &getinfo,                true,      false },
-    { "getmininginfo",          &getmininginfo,          true,      false },
-    { "getnewaddress",          &getnewaddress,          true,      false },
-    { "getaccountaddress",      &getaccountaddress,      true,      false },
-    { "setaccount",             &setaccount,             true,      false },
-    { "getaccount",             &getaccount,             false,     false },
-    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false },
-    { "sendtoaddress",          &sendtoaddress,          false,     false },
-    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false },
-    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false },
-    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false },
-    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false },
-    { "backupwallet",           &backupwallet,           true,      false },
-    { "keypoolrefill",          &keypoolrefill,          true,      false },
-    { "walletpassphrase",       &walletpassphrase,       true,      false },
-    { "walletpassphrasechange", &walletpassphrasechange, false,     false },
-    { "walletlock",             &walletlock,             true,      false },
-    { "encryptwallet",          &encryptwallet,          false,     false },
-    { "validateaddress",        &validateaddress,        true,      false },
-    { "getbalance",             &getbalance,             false,     false },
-    { "move",                   &movecmd,                false,     false },
-    { "sendfrom",               &sendfrom,               false,     false },
-    { "sendmany",               &sendmany,               false,     false },
-    { "addmultisigaddress",     &addmultisigaddress,     false,     false },
-    { "createmultisig",         &createmultisig,         true,      true  },
-    { "getrawmempool",          &getrawmempool,          true,      false },
-    { "getblock",               &getblock,               false,     false },
-    { "getblockhash",           &getblockhash,           false,     false },
-    { "gettransaction",         &gettransaction,         false,     false },
-    { "listtransactions",       &listtransactions,       false,     false },
-    { "listaddressgroupings",   &listaddressgroupings,   false,     false },
-    { "signmessage",            &signmessage,            false,     false },
-    { "verifymessage",          &verifymessage,          false,     false },
-    { "getwork",                &getwork,                true,      false },
-    { "listaccounts",           &listaccounts,           false,     false },
-    { "settxfee",               &settxfee,               false,     false },
-    { "getblocktemplate",       &getblocktemplate,       true,      false },
-    { "submitblock",            &submitblock,            false,     false },
-    { "listsinceblock",         &listsinceblock,         false,     false },
-    { "dumpprivkey",            &dumpprivkey,            true,      false },
-    { "importprivkey",          &importprivkey,          false,     false },
-    { "listunspent",            &listunspent,            false,     false },
-    { "getrawtransaction",      &getrawtransaction,      false,     false },
-    { "createrawtransaction",   &createrawtransaction,   false,     false },
-    { "decoderawtransaction",   &decoderawtransaction,   false,     false },
-    { "signrawtransaction",     &signrawtransaction,     false,     false },
-    { "sendrawtransaction",     &sendrawtransaction,     false,     false },
-    { "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false },
-    { "gettxout",               &gettxout,               true,      false },
-    { "lockunspent",            &lockunspent,            false,     false },
-    { "listlockunspent",        &listlockunspent,        false,     false },
+{ //  name                      actor (function)         okSafeMode locks            streamActor
+  //  ------------------------  -----------------------  ---------- ---------------  -----------
+    { "help",                   &help,                   true,      RPC_LOCK_NONE,   NULL },
+    { "stop",                   &stop,                   true,      RPC_LOCK_NONE,   NULL },
+    { "getrpcstats",            &getrpcstats,            true,      RPC_LOCK_NONE,   NULL },
+    { "getblockcount",          &getblockcount,          true,      RPC_LOCK_NONE,   NULL },
+    { "getconnectioncount",     &getconnectioncount,     true,      RPC_LOCK_NONE,   NULL },
+    { "getpeerinfo",            &getpeerinfo,            true,      RPC_LOCK_NONE,   NULL },
+    { "addnode",                &addnode,                true,      RPC_LOCK_NONE,   NULL },
+    { "getaddednodeinfo",       &getaddednodeinfo,       true,      RPC_LOCK_NONE,   NULL },
+    { "getpublisherinfo",       &getpublisherinfo,       true,      RPC_LOCK_NONE,   NULL },
+    { "getdifficulty",          &getdifficulty,          true,      RPC_LOCK_NONE,   NULL },
+    { "getgenerate",            &getgenerate,            true,      RPC_LOCK_NONE,   NULL },
+    { "setgenerate",            &setgenerate,            true,      RPC_LOCK_ALL,    NULL },
+    { "gethashespersec",        &gethashespersec,        true,      RPC_LOCK_NONE,   NULL },
+    { "getinfo",                &getinfo,                true,      RPC_LOCK_ALL,    NULL },
+    { "getmininginfo",          &getmininginfo,          true,      RPC_LOCK_MAIN,   NULL },
+    { "getnewaddress",          &getnewaddress,          true,      RPC_LOCK_WALLET, NULL },
+    { "getaccountaddress",      &getaccountaddress,      true,      RPC_LOCK_WALLET, NULL },
+    { "setaccount",             &setaccount,             true,      RPC_LOCK_WALLET, NULL },
+    { "getaccount",             &getaccount,             false,     RPC_LOCK_WALLET, NULL },
+    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,      RPC_LOCK_WALLET, NULL },
+    { "sendtoaddress",          &sendtoaddress,          false,     RPC_LOCK_ALL,    NULL },
+    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,     RPC_LOCK_ALL,    NULL },
+    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,     RPC_LOCK_ALL,    NULL },
+    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,     RPC_LOCK_ALL,    NULL },
+    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,     RPC_LOCK_ALL,    NULL },
+    { "backupwallet",           &backupwallet,           true,      RPC_LOCK_WALLET, NULL },
+    { "keypoolrefill",          &keypoolrefill,          true,      RPC_LOCK_WALLET, NULL },
+    { "walletpassphrase",       &walletpassphrase,       true,      RPC_LOCK_WALLET, NULL },
+    { "walletpassphrasechange", &walletpassphrasechange, false,     RPC_LOCK_WALLET, NULL },
+    { "walletlock",             &walletlock,             true,      RPC_LOCK_WALLET, NULL },
+    { "encryptwallet",          &encryptwallet,          false,     RPC_LOCK_ALL,    NULL },
+    { "validateaddress",        &validateaddress,        true,      RPC_LOCK_WALLET, NULL },
+    { "getbalance",             &getbalance,             false,     RPC_LOCK_ALL,    NULL },
+    { "move",                   &movecmd,                false,     RPC_LOCK_ALL,    NULL },
+    { "sendfrom",               &sendfrom,               false,     RPC_LOCK_ALL,    NULL },
+    { "sendmany",               &sendmany,               false,     RPC_LOCK_ALL,    NULL },
+    { "addmultisigaddress",     &addmultisigaddress,     false,     RPC_LOCK_WALLET, NULL },
+    { "createmultisig",         &createmultisig,         true,      RPC_LOCK_NONE,   NULL },
+    { "getrawmempool",          &getrawmempool,          true,      RPC_LOCK_NONE,   &streamgetrawmempool },
+    { "getblock",               &getblock,               false,     RPC_LOCK_NONE,   &streamgetblock },
+    { "getblockhash",           &getblockhash,           false,     RPC_LOCK_NONE,   NULL },
+    { "gettransaction",         &gettransaction,         false,     RPC_LOCK_ALL,    NULL },
+    { "listtransactions",       &listtransactions,       false,     RPC_LOCK_ALL,    NULL },
+    { "listaddressgroupings",   &listaddressgroupings,   false,     RPC_LOCK_ALL,    NULL },
+    { "signmessage",            &signmessage,            false,     RPC_LOCK_WALLET, NULL },
+    { "verifymessage",          &verifymessage,          false,     RPC_LOCK_NONE,   NULL },
+    { "getwork",                &getwork,                true,      RPC_LOCK_ALL,    NULL },
+    { "listaccounts",           &listaccounts,           false,     RPC_LOCK_ALL,    NULL },
+    { "settxfee",               &settxfee,               false,     RPC_LOCK_WALLET, NULL },
+    { "getblocktemplate",       &getblocktemplate,       true,      RPC_LOCK_ALL,    NULL },
+    { "submitblock",            &submitblock,            false,     RPC_LOCK_ALL,    NULL },
+    { "listsinceblock",         &listsinceblock,         false,     RPC_LOCK_ALL,    NULL },
+    { "dumpprivkey",            &dumpprivkey,            true,      RPC_LOCK_WALLET, NULL },
+    { "importprivkey",          &importprivkey,          false,     RPC_LOCK_ALL,    NULL },
+    { "listunspent",            &listunspent,            false,     RPC_LOCK_ALL,    &streamlistunspent },
+    { "getrawtransaction",      &getrawtransaction,      false,     RPC_LOCK_NONE,   NULL },
+    { "getaddresshistory",      &getaddresshistory,      false,     RPC_LOCK_NONE,   NULL },
+    { "getspentinfo",           &getspentinfo,           false,     RPC_LOCK_NONE,   NULL },
+    { "createrawtransaction",   &createrawtransaction,   false,     RPC_LOCK_NONE,   NULL },
+    { "decoderawtransaction",   &decoderawtransaction,   false,     RPC_LOCK_NONE,   NULL },
+    { "signrawtransaction",     &signrawtransaction,     false,     RPC_LOCK_ALL,    NULL },
+    { "sendrawtransaction",     &sendrawtransaction,     false,     RPC_LOCK_ALL,    NULL },
+    { "gettxoutsetinfo",        &gettxoutsetinfo,        true,      RPC_LOCK_MAIN,   NULL },
+    { "getdbstats",             &getdbstats,             true,      RPC_LOCK_MAIN,   NULL },
+    { "gettxout",               &gettxout,               true,      RPC_LOCK_MAIN,   NULL },
+    { "lockunspent",            &lockunspent,            false,     RPC_LOCK_WALLET, NULL },
+    { "listlockunspent",        &listlockunspent,        false,     RPC_LOCK_WALLET, NULL },
 };
 
 CRPCTable::CRPCTable()
@@ -320,6 +436,9 @@ string rfc1123Time()
     return string(buffer);
 }
 
+static string HTTPReplyHeader(int nStatus, size_t nContentLength, bool fChunked, bool keepalive,
+                             const char *pszContentType = "application/json");
+
 static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
 {
     if (nStatus == HTTP_UNAUTHORIZED)
@@ -339,29 +458,36 @@ static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
             "</HEAD>\r\n"
             "<BODY><H1>401 Unauthorized.</H1></BODY>\r\n"
             "</HTML>\r\n", rfc1123Time().c_str(), FormatFullVersion().c_str());
+    return HTTPReplyHeader(nStatus, strMsg.size(), false, keepalive) + strMsg;
+}
+
+// Status line and headers of a reply whose body is strMsg, or is sent in chunks if fChunked
+static string HTTPReplyHeader(int nStatus, size_t nContentLength, bool fChunked, bool keepalive,
+                             const char *pszContentType)
+{
     const char *cStatus;
          if (nStatus == HTTP_OK) cStatus = "OK";
     else if (nStatus == HTTP_BAD_REQUEST) cStatus = "Bad Request";
     else if (nStatus == HTTP_FORBIDDEN) cStatus = "Forbidden";
     else if (nStatus == HTTP_NOT_FOUND) cStatus = "Not Found";
     else if (nStatus == HTTP_INTERNAL_SERVER_ERROR) cStatus = "Internal Server Error";
+    else if (nStatus == HTTP_SERVICE_UNAVAILABLE) cStatus = "Service Unavailable";
     else cStatus = "";
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
             "Date: %s\r\n"
             "Connection: %s\r\n"
-            "Content-Length: %"PRIszu"\r\n"
-            "Content-Type: application/json\r\n"
+            "%s"
+            "Content-Type: %s\r\n"
             "Server: bitcoin-json-rpc/%s\r\n"
-            "\r\n"
-            "%s",
+            "\r\n",
         nStatus,
         cStatus,
         rfc1123Time().c_str(),
         keepalive ? "keep-alive" : "close",
-        strMsg.size(),
-        FormatFullVersion().c_str(),
-        strMsg.c_str());
+        fChunked ? "Transfer-Encoding: chunked\r\n" : strprintf("Content-Length: %"PRIszu"\r\n", nContentLength).c_str(),
+        pszContentType,
+        FormatFullVersion().c_str());
 }
 
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
@@ -519,7 +645,7 @@ string JSONRPCReply(const Value& result, const Value& error, const Value& id)
     return write_string(Value(reply), false) + "\n";
 }
 
-void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
+static string ErrorReply(const Object& objError, const Value& id, bool fKeepAlive)
 {
     // Send error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
@@ -527,7 +653,7 @@ void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
     if (code == RPC_INVALID_REQUEST) nStatus = HTTP_BAD_REQUEST;
     else if (code == RPC_METHOD_NOT_FOUND) nStatus = HTTP_NOT_FOUND;
     string strReply = JSONRPCReply(Value::null, objError, id);
-    stream << HTTPReply(nStatus, strReply, false) << std::flush;
+    return HTTPReply(nStatus, strReply, fKeepAlive);
 }
 
 bool ClientAllowed(const boost::asio::ip::address& address)
@@ -606,61 +732,389 @@ private:
     asio::ssl::stream<typename Protocol::socket>& stream;
 };
 
-class AcceptedConnection
+class CRPCConnection;
+
+/** A request read off a connection, waiting for a worker */
+class CRPCRequest
 {
 public:
-    virtual ~AcceptedConnection() {}
+    boost::shared_ptr<CRPCConnection> conn;
+    int nProto;
+    string strMethod;
+    string strURI;
+    map<string, string> mapHeaders;
+    string strRequest;
+};
+
+/** Requests waiting for the -rpcthreads workers */
+class CRPCWorkQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<boost::shared_ptr<CRPCRequest> > queue;
+    unsigned int nMaxDepth;
+    bool fStop;
+
+public:
+    CRPCWorkQueue(unsigned int nMaxDepthIn) : nMaxDepth(nMaxDepthIn), fStop(false) {}
+
+    // Returns false if the queue is full
+    bool Push(const boost::shared_ptr<CRPCRequest>& req)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (queue.size() >= nMaxDepth)
+            return false;
+        queue.push_back(req);
+        cond.notify_one();
+        return true;
+    }
+
+    // Wait for a request; returns an empty pointer once stopped
+    boost::shared_ptr<CRPCRequest> Pop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.empty() && !fStop)
+            cond.wait(lock);
+        boost::shared_ptr<CRPCRequest> req;
+        if (!fStop)
+        {
+            req = queue.front();
+            queue.pop_front();
+        }
+        return req;
+    }
 
-    virtual std::iostream& stream() = 0;
-    virtual std::string peer_address_to_string() const = 0;
-    virtual void close() = 0;
+    void Stop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+        queue.clear();
+        cond.notify_all();
+    }
 };
 
-template <typename Protocol>
-class AcceptedConnectionImpl : public AcceptedConnection
+static CRPCWorkQueue* rpc_work_queue = NULL;
+static CRPCWorkQueue* rest_work_queue = NULL; // -rest requests, served by their own -restthreads workers
+
+static bool IsRESTRequest(const string& strURI)
+{
+    return rest_work_queue != NULL && boost::algorithm::starts_with(strURI, "/rest/");
+}
+
+/**
+ * A connection to the RPC server. It is only read and written from the I/O
+ * thread, asynchronously, so idle keep-alive connections don't tie up a
+ * thread. Each complete request is handed to the work queue, and the next one
+ * is only read after its reply has been written, which keeps the replies to
+ * pipelined requests in order.
+ */
+class CRPCConnection : public boost::enable_shared_from_this<CRPCConnection>
 {
 public:
-    AcceptedConnectionImpl(
-            asio::io_service& io_service,
-            ssl::context &context,
-            bool fUseSSL) :
-        sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+    ip::tcp::endpoint peer;
+    asio::ssl::stream<ip::tcp::socket> sslStream;
+
+    CRPCConnection(asio::io_service& io_serviceIn, ssl::context& context, bool fUseSSLIn) :
+        sslStream(io_serviceIn, context),
+        io_service(io_serviceIn),
+        timer(io_serviceIn),
+        buf(MAX_SIZE),
+        fUseSSL(fUseSSLIn),
+        fBusy(false)
+    {
+    }
+
+    void Start()
+    {
+        if (fUseSSL)
+        {
+            SetTimeout();
+            sslStream.async_handshake(ssl::stream_base::server,
+                boost::bind(&CRPCConnection::HandleHandshake, shared_from_this(), asio::placeholders::error));
+        }
+        else
+            ReadRequest();
+    }
+
+    // Called by a worker with the reply to the last request
+    void Reply(const string& strReplyIn, bool fKeepAlive)
+    {
+        io_service.post(boost::bind(&CRPCConnection::Write, shared_from_this(), strReplyIn, fKeepAlive));
+    }
+
+    // Called by a worker to send part of its reply before calling Reply().
+    // The I/O thread leaves the connection alone until then.
+    bool WriteSync(const std::vector<asio::const_buffer>& vBuffers)
+    {
+        boost::system::error_code error;
+        if (fUseSSL)
+            asio::write(sslStream, vBuffers, asio::transfer_all(), error);
+        else
+            asio::write(sslStream.next_layer(), vBuffers, asio::transfer_all(), error);
+        return !error;
+    }
+
+private:
+    asio::io_service& io_service;
+    asio::deadline_timer timer;
+    asio::streambuf buf; // read but not yet parsed, may hold pipelined requests
+    string strReply;     // being written
+    bool fUseSSL;
+    bool fBusy;          // a worker has the last request
+
+    void SetTimeout()
+    {
+        timer.expires_from_now(posix_time::seconds(GetArg("-rpcservertimeout", 30)));
+        timer.async_wait(boost::bind(&CRPCConnection::HandleTimeout, shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleTimeout(const boost::system::error_code& error)
+    {
+        // The pending read or handshake fails once the socket is closed
+        if (error != asio::error::operation_aborted && !fBusy)
+        {
+            boost::system::error_code ignored;
+            sslStream.lowest_layer().close(ignored);
+        }
+    }
+
+    void Close()
+    {
+        boost::system::error_code ignored;
+        timer.cancel(ignored);
+        sslStream.lowest_layer().close(ignored);
+    }
+
+    void HandleHandshake(const boost::system::error_code& error)
+    {
+        if (error)
+            Close();
+        else
+            ReadRequest();
+    }
+
+    void ReadRequest()
+    {
+        SetTimeout();
+        if (fUseSSL)
+            asio::async_read_until(sslStream, buf, "\r\n\r\n",
+                boost::bind(&CRPCConnection::HandleHeader, shared_from_this(), asio::placeholders::error, asio::placeholders::bytes_transferred));
+        else
+            asio::async_read_until(sslStream.next_layer(), buf, "\r\n\r\n",
+                boost::bind(&CRPCConnection::HandleHeader, shared_from_this(), asio::placeholders::error, asio::placeholders::bytes_transferred));
+    }
+
+    void HandleHeader(const boost::system::error_code& error, size_t nHeaderSize)
+    {
+        if (error)
+        {
+            Close();
+            return;
+        }
+
+        // Only look for the body length here, the request is taken out of
+        // buf once all of it has been read
+        string strHeader(asio::buffers_begin(buf.data()), asio::buffers_begin(buf.data()) + nHeaderSize);
+        std::istringstream stream(strHeader);
+        int nProto = 0;
+        string strMethod, strURI;
+        map<string, string> mapHeaders;
+        if (!ReadHTTPRequestLine(stream, nProto, strMethod, strURI))
+        {
+            Close();
+            return;
+        }
+        int nLen = ReadHTTPHeaders(stream, mapHeaders);
+        if (nLen < 0 || nLen > (int)MAX_SIZE - (int)nHeaderSize)
+        {
+            Close();
+            return;
+        }
+
+        size_t nSize = nHeaderSize + nLen;
+        if (buf.size() >= nSize)
+            HandleBody(boost::system::error_code());
+        else if (fUseSSL)
+            asio::async_read(sslStream, buf, asio::transfer_at_least(nSize - buf.size()),
+                boost::bind(&CRPCConnection::HandleBody, shared_from_this(), asio::placeholders::error));
+        else
+            asio::async_read(sslStream.next_layer(), buf, asio::transfer_at_least(nSize - buf.size()),
+                boost::bind(&CRPCConnection::HandleBody, shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleBody(const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            Close();
+            return;
+        }
+        boost::system::error_code ignored;
+        timer.cancel(ignored);
+
+        boost::shared_ptr<CRPCRequest> req(new CRPCRequest());
+        req->conn = shared_from_this();
+        std::istream stream(&buf);
+        ReadHTTPRequestLine(stream, req->nProto, req->strMethod, req->strURI);
+        ReadHTTPMessage(stream, req->mapHeaders, req->strRequest, req->nProto);
+
+        fBusy = true;
+        CRPCWorkQueue* queue = IsRESTRequest(req->strURI) ? rest_work_queue : rpc_work_queue;
+        if (!queue->Push(req))
+        {
+            printf("ThreadRPCServer work queue full, rejecting request from %s\n", peer.address().to_string().c_str());
+            Write(HTTPReply(HTTP_SERVICE_UNAVAILABLE, "", false), false);
+        }
+    }
+
+    void Write(const string& strReplyIn, bool fKeepAlive)
     {
+        // strReply must stay alive until the write completes
+        fBusy = false;
+        strReply = strReplyIn;
+        if (fUseSSL)
+            asio::async_write(sslStream, asio::buffer(strReply),
+                boost::bind(&CRPCConnection::HandleWrite, shared_from_this(), asio::placeholders::error, fKeepAlive));
+        else
+            asio::async_write(sslStream.next_layer(), asio::buffer(strReply),
+                boost::bind(&CRPCConnection::HandleWrite, shared_from_this(), asio::placeholders::error, fKeepAlive));
     }
 
-    virtual std::iostream& stream()
+    void HandleWrite(const boost::system::error_code& error, bool fKeepAlive)
     {
-        return _stream;
+        strReply.clear();
+        if (error || !fKeepAlive)
+            Close();
+        else
+            ReadRequest();
     }
+};
 
-    virtual std::string peer_address_to_string() const
+/**
+ * Sends a reply on a connection as it is written, with chunked transfer
+ * encoding. Nothing is sent until the first chunk is full, so errors
+ * raised early can still get a proper error reply.
+ */
+class CRPCChunkedWriter : public CJSONWriter
+{
+private:
+    CRPCConnection& conn;
+    bool fKeepAlive;
+    bool fStarted;
+
+    void SendChunk(const string& strTrailer)
     {
-        return peer.address().to_string();
+        string strHeader;
+        if (!fStarted)
+            strHeader = HTTPReplyHeader(HTTP_OK, 0, true, fKeepAlive);
+        fStarted = true;
+        if (!strOut.empty())
+            strHeader += strprintf("%x\r\n", (unsigned int)strOut.size());
+        std::vector<asio::const_buffer> vBuffers;
+        vBuffers.push_back(asio::buffer(strHeader));
+        vBuffers.push_back(asio::buffer(strOut));
+        string strEnd = strOut.empty() ? strTrailer : "\r\n" + strTrailer;
+        vBuffers.push_back(asio::buffer(strEnd));
+        bool fSent = conn.WriteSync(vBuffers);
+        strOut.clear();
+        if (!fSent)
+            throw runtime_error("RPC client went away");
     }
 
-    virtual void close()
+protected:
+    void Flush()
     {
-        _stream.close();
+        SendChunk("");
     }
 
-    typename Protocol::endpoint peer;
-    asio::ssl::stream<typename Protocol::socket> sslStream;
+public:
+    CRPCChunkedWriter(CRPCConnection& connIn, bool fKeepAliveIn) : conn(connIn), fKeepAlive(fKeepAliveIn), fStarted(false) {}
+
+    bool IsStarted() const { return fStarted; }
+
+    // Send the rest of the reply, or all of it in strReply if it fit in one chunk
+    void Finish(string& strReply)
+    {
+        if (fStarted)
+            SendChunk("0\r\n\r\n");
+        else
+            strReply = HTTPReply(HTTP_OK, strOut, fKeepAlive);
+    }
+};
 
+/**
+ * Sends a REST reply on a connection as it is written. Small replies are
+ * left in strReply by Finish(), so they are written by the I/O thread like
+ * any other.
+ */
+class CRPCReplyStream : public CHTTPReplyStream
+{
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
+    CRPCConnection& conn;
+    bool fKeepAlive;
+    bool fStarted;
+    string strOut;
+
+    void Send(const char *pch, size_t nSize)
+    {
+        std::vector<asio::const_buffer> vBuffers;
+        vBuffers.push_back(asio::buffer(strOut));
+        vBuffers.push_back(asio::buffer(pch, nSize));
+        fStarted = true;
+        bool fSent = conn.WriteSync(vBuffers);
+        strOut.clear();
+        if (!fSent)
+            throw runtime_error("REST client went away");
+    }
+
+public:
+    CRPCReplyStream(CRPCConnection& connIn, bool fKeepAliveIn) : conn(connIn), fKeepAlive(fKeepAliveIn), fStarted(false) {}
+
+    bool IsStarted() const { return fStarted; }
+
+    void WriteHeader(int nStatus, const char *pszContentType, size_t nContentLength)
+    {
+        strOut = HTTPReplyHeader(nStatus, nContentLength, false, fKeepAlive, pszContentType);
+    }
+
+    void Write(const char *pch, size_t nSize)
+    {
+        // Large pieces, such as whole blocks, go out without being copied
+        if (strOut.size() + nSize >= CJSONWriter::FLUSH_SIZE)
+            Send(pch, nSize);
+        else
+            strOut.append(pch, nSize);
+    }
+
+    void Finish(string& strReply)
+    {
+        strReply.swap(strOut);
+    }
 };
 
-void ServiceConnection(AcceptedConnection *conn);
+static bool ServiceRequest(CRPCRequest& req, string& strReply);
+
+static void ThreadRPCWorker(CRPCWorkQueue* queue)
+{
+    RenameThread("bitcoin-rpcworker");
+    loop
+    {
+        boost::shared_ptr<CRPCRequest> req = queue->Pop();
+        if (!req)
+            return;
+        string strReply;
+        bool fKeepAlive = ServiceRequest(*req, strReply);
+        req->conn->Reply(strReply, fKeepAlive);
+    }
+}
 
 // Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              bool fUseSSL,
-                             AcceptedConnection* conn,
+                             boost::shared_ptr<CRPCConnection> conn,
                              const boost::system::error_code& error);
 
 /**
@@ -672,7 +1126,7 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
                    const bool fUseSSL)
 {
     // Accept connection
-    AcceptedConnectionImpl<Protocol>* conn = new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL);
+    boost::shared_ptr<CRPCConnection> conn(new CRPCConnection(acceptor->get_io_service(), context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
@@ -692,36 +1146,32 @@ template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              const bool fUseSSL,
-                             AcceptedConnection* conn,
+                             boost::shared_ptr<CRPCConnection> conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast< AcceptedConnectionImpl<ip::tcp>* >(conn);
-
     // TODO: Actually handle errors
     if (error)
-    {
-        delete conn;
-    }
+        return;
 
     // Restrict callers by IP.  It is important to
-    // do this before starting client thread, to filter out
+    // do this before reading anything, to filter out
     // certain DoS and misbehaving clients.
-    else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address()))
+    if (!ClientAllowed(conn->peer.address()))
     {
         // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
         if (!fUseSSL)
-            conn->stream() << HTTPReply(HTTP_FORBIDDEN, "", false) << std::flush;
-        delete conn;
-    }
-    else {
-        ServiceConnection(conn);
-        conn->close();
-        delete conn;
+        {
+            boost::system::error_code ignored;
+            asio::write(conn->sslStream.next_layer(), asio::buffer(HTTPReply(HTTP_FORBIDDEN, "", false)), ignored);
+        }
+        return;
     }
+
+    conn->Start();
 }
 
 void StartRPCThreads()
@@ -841,9 +1291,21 @@ void StartRPCThreads()
         return;
     }
 
+    // One thread does all the network I/O, the workers run the calls
+    rpc_work_queue = new CRPCWorkQueue(std::max((int)GetArg("-rpcworkqueue", 16), 1));
     rpc_worker_group = new boost::thread_group();
+    rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
     for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+        rpc_worker_group->create_thread(boost::bind(&ThreadRPCWorker, rpc_work_queue));
+
+    // REST requests get workers of their own, so that indexers pulling
+    // blocks don't hold up RPC calls
+    if (GetBoolArg("-rest"))
+    {
+        rest_work_queue = new CRPCWorkQueue(std::max((int)GetArg("-rpcworkqueue", 16), 1));
+        for (int i = 0; i < std::max((int)GetArg("-restthreads", 2), 1); i++)
+            rpc_worker_group->create_thread(boost::bind(&ThreadRPCWorker, rest_work_queue));
+    }
 }
 
 void StopRPCThreads()
@@ -852,9 +1314,14 @@ void StopRPCThreads()
 
     if (rpc_io_service == NULL) return;
 
+    rpc_work_queue->Stop();
+    if (rest_work_queue)
+        rest_work_queue->Stop();
     rpc_io_service->stop();
     rpc_worker_group->join_all();
     delete rpc_worker_group; rpc_worker_group = NULL;
+    delete rpc_work_queue; rpc_work_queue = NULL;
+    delete rest_work_queue; rest_work_queue = NULL;
     delete rpc_ssl_context; rpc_ssl_context = NULL;
     delete rpc_io_service; rpc_io_service = NULL;
 }
@@ -924,6 +1391,17 @@ static Object JSONRPCExecOne(const Value& req)
     return rpc_result;
 }
 
+static void WriteJSONRPCReply(CJSONWriter& writer, const JSONRequest& jreq)
+{
+    writer.BeginObject();
+    writer.WriteKey("result");
+    tableRPC.execute(jreq.strMethod, jreq.params, writer);
+    writer.WritePair("error", Value::null);
+    writer.WritePair("id", jreq.id);
+    writer.EndObject();
+    writer.str() += "\n";
+}
+
 static string JSONRPCExecBatch(const Array& vReq)
 {
     Array ret;
@@ -933,89 +1411,153 @@ static string JSONRPCExecBatch(const Array& vReq)
     return write_string(Value(ret), false) + "\n";
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+// Reply to a /rest/ request, which needs no authorization
+static bool ServiceRESTRequest(CRPCRequest& req, string& strReply)
 {
-    bool fRun = true;
-    while (fRun)
+    bool fKeepAlive = (req.mapHeaders["connection"] != "close");
+    CRPCReplyStream stream(*req.conn, fKeepAlive);
+    try
     {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
-
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
-
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto);
+        ServiceREST(req.strMethod, req.strURI, stream);
+        stream.Finish(strReply);
+        return fKeepAlive;
+    }
+    catch (std::exception& e)
+    {
+        printf("ThreadRPCServer REST request %s failed: %s\n", req.strURI.c_str(), e.what());
+    }
 
-        if (strURI != "/") {
-            conn->stream() << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
-            break;
-        }
+    // Part of the reply has been sent already, all that can be done is to close
+    if (stream.IsStarted())
+    {
+        strReply.clear();
+        return false;
+    }
+    strReply = HTTPReply(HTTP_INTERNAL_SERVER_ERROR, "", false);
+    return false;
+}
 
-        // Check authorization
-        if (mapHeaders.count("authorization") == 0)
-        {
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
-        }
-        if (!HTTPAuthorized(mapHeaders))
-        {
-            printf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string().c_str());
-            /* Deter brute-forcing short passwords.
-               If this results in a DOS the user really
-               shouldn't have their RPC port exposed.*/
-            if (mapArgs["-rpcpassword"].size() < 20)
-                MilliSleep(250);
-
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
-        }
-        if (mapHeaders["connection"] == "close")
-            fRun = false;
+// Build the HTTP reply to a request; returns whether to keep the connection open
+static bool ServiceRequest(CRPCRequest& req, string& strReply)
+{
+    if (IsRESTRequest(req.strURI))
+        return ServiceRESTRequest(req, strReply);
 
-        JSONRequest jreq;
-        try
-        {
-            // Parse request
-            Value valRequest;
-            if (!read_string(strRequest, valRequest))
-                throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+    if (req.strURI != "/") {
+        strReply = HTTPReply(HTTP_NOT_FOUND, "", false);
+        return false;
+    }
 
-            string strReply;
+    // Check authorization
+    if (req.mapHeaders.count("authorization") == 0)
+    {
+        strReply = HTTPReply(HTTP_UNAUTHORIZED, "", false);
+        return false;
+    }
+    if (!HTTPAuthorized(req.mapHeaders))
+    {
+        printf("ThreadRPCServer incorrect password attempt from %s\n", req.conn->peer.address().to_string().c_str());
+        /* Deter brute-forcing short passwords.
+           If this results in a DOS the user really
+           shouldn't have their RPC port exposed.*/
+        if (mapArgs["-rpcpassword"].size() < 20)
+            MilliSleep(250);
+
+        strReply = HTTPReply(HTTP_UNAUTHORIZED, "", false);
+        return false;
+    }
+    bool fKeepAlive = (req.mapHeaders["connection"] != "close");
 
-            // singleton request
-            if (valRequest.type() == obj_type) {
-                jreq.parse(valRequest);
+    JSONRequest jreq;
+    CRPCChunkedWriter chunkedwriter(*req.conn, fKeepAlive);
+    try
+    {
+        // Parse request
+        Value valRequest;
+        if (!read_string_fast(req.strRequest, valRequest))
+            throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+
+        string strJSON;
+
+        // singleton request
+        if (valRequest.type() == obj_type) {
+            jreq.parse(valRequest);
+
+            // Results of commands that take no locks are sent as they are
+            // written; cs_main and cs_wallet mustn't wait on a slow client
+            const CRPCCommand *pcmd = tableRPC[jreq.strMethod];
+            if (pcmd && pcmd->streamActor && pcmd->nLocks == RPC_LOCK_NONE && req.nProto >= 1)
+            {
+                WriteJSONRPCReply(chunkedwriter, jreq);
+                chunkedwriter.Finish(strReply);
+                return fKeepAlive;
+            }
 
-                Value result = tableRPC.execute(jreq.strMethod, jreq.params);
+            // Send reply
+            CJSONWriter writer;
+            WriteJSONRPCReply(writer, jreq);
+            strJSON.swap(writer.str());
 
-                // Send reply
-                strReply = JSONRPCReply(result, Value::null, jreq.id);
+        // array of requests
+        } else if (valRequest.type() == array_type)
+            strJSON = JSONRPCExecBatch(valRequest.get_array());
+        else
+            throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
-            // array of requests
-            } else if (valRequest.type() == array_type)
-                strReply = JSONRPCExecBatch(valRequest.get_array());
-            else
-                throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
+        strReply = HTTPReply(HTTP_OK, strJSON, fKeepAlive);
+    }
+    catch (Object& objError)
+    {
+        strReply = ErrorReply(objError, jreq.id, fKeepAlive);
+    }
+    catch (std::exception& e)
+    {
+        strReply = ErrorReply(JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id, fKeepAlive);
+    }
 
-            conn->stream() << HTTPReply(HTTP_OK, strReply, fRun) << std::flush;
-        }
-        catch (Object& objError)
-        {
-            ErrorReply(conn->stream(), objError, jreq.id);
-            break;
-        }
-        catch (std::exception& e)
-        {
-            ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
-            break;
-        }
+    // Part of the reply has been sent already, all that can be done is to close
+    if (chunkedwriter.IsStarted())
+    {
+        printf("ThreadRPCServer streamed reply to %s failed\n", jreq.strMethod.c_str());
+        strReply.clear();
+        return false;
     }
+    return fKeepAlive;
+}
+
+static void RecordRPCCall(const string& strMethod, int64 nMicros)
+{
+    LOCK(cs_rpcStats);
+    CRPCMethodStats& stats = mapRPCStats[strMethod];
+    stats.nCalls++;
+    stats.nTotalMicros += nMicros;
+    stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
 }
 
 json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    Value result;
+    execute(strMethod, params, &result, NULL);
+    return result;
+}
+
+void CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, CJSONWriter& writer) const
+{
+    execute(strMethod, params, NULL, &writer);
+}
+
+// Call pcmd with whatever locks it needs taken
+static void CallRPCActor(const CRPCCommand *pcmd, const Array &params, Value* presult, CJSONWriter* pwriter)
+{
+    if (pwriter == NULL)
+        *presult = pcmd->actor(params, false);
+    else if (pcmd->streamActor)
+        pcmd->streamActor(params, false, *pwriter);
+    else
+        pwriter->WriteValue(pcmd->actor(params, false));
+}
+
+void CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, Value* presult, CJSONWriter* pwriter) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -1028,24 +1570,47 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    int64 nStart = GetTimeMicros();
     try
     {
         // Execute
-        Value result;
         {
-            if (pcmd->threadSafe)
-                result = pcmd->actor(params, false);
-            else {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                result = pcmd->actor(params, false);
+            switch (pcmd->nLocks)
+            {
+            case RPC_LOCK_ALL:
+                {
+                    LOCK2(cs_main, pwalletMain->cs_wallet);
+                    CallRPCActor(pcmd, params, presult, pwriter);
+                }
+                break;
+            case RPC_LOCK_MAIN:
+                {
+                    LOCK(cs_main);
+                    CallRPCActor(pcmd, params, presult, pwriter);
+                }
+                break;
+            case RPC_LOCK_WALLET:
+                {
+                    LOCK(pwalletMain->cs_wallet);
+                    CallRPCActor(pcmd, params, presult, pwriter);
+                }
+                break;
+            default:
+                CallRPCActor(pcmd, params, presult, pwriter);
             }
         }
-        return result;
+        RecordRPCCall(pcmd->name, GetTimeMicros() - nStart);
     }
     catch (std::exception& e)
     {
+        RecordRPCCall(pcmd->name, GetTimeMicros() - nStart);
         throw JSONRPCError(RPC_MISC_ERROR, e.what());
     }
+    catch (...)
+    {
+        RecordRPCCall(pcmd->name, GetTimeMicros() - nStart);
+        throw;
+    }
 }
 
 
@@ -1096,7 +1661,7 @@ Object CallRPC(const string& strMethod, const Array& params)
 
     // Parse reply
     Value valReply;
-    if (!read_string(strReply, valReply))
+    if (!read_string_fast(strReply, valReply))
         throw runtime_error("couldn't parse reply from server");
     const Object& reply = valReply.get_obj();
     if (reply.empty())
@@ -1118,7 +1683,7 @@ void ConvertTo(Value& value, bool fAllowNull=false)
         // reinterpret string as unquoted json value
         Value value2;
         string strJSON = value.get_str();
-        if (!read_string(strJSON, value2))
+        if (!read_string_fast(strJSON, value2))
             throw runtime_error(string("Error parsing JSON:")+strJSON);
         ConvertTo<T>(value2, fAllowNull);
         value = value2;
@@ -1175,6 +1740,9 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "listunspent"            && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "listunspent"            && n > 2) ConvertTo<Array>(params[2]);
     if (strMethod == "getrawtransaction"      && n > 1) ConvertTo<boost::int64_t>(params[1]);
+    if (strMethod == "getaddresshistory"      && n > 1) ConvertTo<boost::int64_t>(params[1]);
+    if (strMethod == "getaddresshistory"      && n > 2) ConvertTo<boost::int64_t>(params[2]);
+    if (strMethod == "getspentinfo"           && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "createrawtransaction"   && n > 0) ConvertTo<Array>(params[0]);
     if (strMethod == "createrawtransaction"   && n > 1) ConvertTo<Object>(params[1]);
     if (strMethod == "signrawtransaction"     && n > 1) ConvertTo<Array>(params[1], true);
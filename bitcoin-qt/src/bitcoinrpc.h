@@ -9,11 +9,13 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
 
 class CBlockIndex;
 class CReserveKey;
 
 #include "json/json_spirit_reader_template.h"
+#include "json/json_spirit_fast_reader.h"
 #include "json/json_spirit_writer_template.h"
 #include "json/json_spirit_utils.h"
 
@@ -28,6 +30,7 @@ enum HTTPStatusCode
     HTTP_FORBIDDEN             = 403,
     HTTP_NOT_FOUND             = 404,
     HTTP_INTERNAL_SERVER_ERROR = 500,
+    HTTP_SERVICE_UNAVAILABLE   = 503,
 };
 
 // Bitcoin RPC error codes
@@ -72,6 +75,22 @@ void StartRPCThreads();
 void StopRPCThreads();
 int CommandLineRPC(int argc, char *argv[]);
 
+/**
+ * HTTP reply whose body is sent as it is written, so that large bodies
+ * need not be held in memory. Write() throws if the client went away.
+ */
+class CHTTPReplyStream
+{
+public:
+    virtual ~CHTTPReplyStream() {}
+    // Status line and headers, for a body of exactly nContentLength bytes
+    virtual void WriteHeader(int nStatus, const char *pszContentType, size_t nContentLength) = 0;
+    virtual void Write(const char *pch, size_t nSize) = 0;
+};
+
+/** Serve a read-only /rest/ request (in rest.cpp) */
+void ServiceREST(const std::string& strMethod, const std::string& strURI, CHTTPReplyStream& stream);
+
 /** Convert parameter values for RPC call from strings to command-specific JSON objects. */
 json_spirit::Array RPCConvertValues(const std::string &strMethod, const std::vector<std::string> &strParams);
 
@@ -89,7 +108,62 @@ void RPCTypeCheck(const json_spirit::Array& params,
 void RPCTypeCheck(const json_spirit::Object& o,
                   const std::map<std::string, json_spirit::Value_type>& typesExpected, bool fAllowNull=false);
 
+/**
+ * Writes a JSON document piece by piece, so that large RPC results need not
+ * be built as a Value tree first. The output is compact, as from
+ * write_string(value, false). Writers that send their output as it is
+ * produced override Flush(), which is called between values once more than
+ * FLUSH_SIZE bytes are buffered.
+ */
+class CJSONWriter
+{
+public:
+    static const size_t FLUSH_SIZE = 65536;
+
+    CJSONWriter() : fAfterKey(false) {}
+    virtual ~CJSONWriter() {}
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    // Start a member of the current object, whose value is written next
+    void WriteKey(const std::string& strKey);
+    void WriteValue(const json_spirit::Value& value);
+    void WritePair(const std::string& strKey, const json_spirit::Value& value)
+    {
+        WriteKey(strKey);
+        WriteValue(value);
+    }
+
+    // Output that hasn't been flushed
+    std::string& str() { return strOut; }
+
+protected:
+    std::string strOut;
+
+    virtual void Flush() {}
+
+private:
+    std::vector<bool> vEmpty; // for each open object or array, whether it is still empty
+    bool fAfterKey;
+
+    void BeginValue();
+    void EndValue();
+};
+
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
+
+/** Locks a command is run under. Commands that need neither take the locks
+ *  of whatever they touch themselves, or read the published chain tip. */
+enum RPCLocks
+{
+    RPC_LOCK_NONE   = 0,
+    RPC_LOCK_MAIN   = (1U << 0), // cs_main
+    RPC_LOCK_WALLET = (1U << 1), // pwalletMain->cs_wallet
+    RPC_LOCK_ALL    = RPC_LOCK_MAIN | RPC_LOCK_WALLET
+};
 
 class CRPCCommand
 {
@@ -97,7 +171,8 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
-    bool threadSafe;
+    unsigned int nLocks;
+    rpcstreamfn_type streamActor; // writes the result itself, if set
 };
 
 /**
@@ -120,6 +195,15 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+
+    /**
+     * Execute a method, writing its result to writer. Methods without a
+     * stream actor have their result written as a whole.
+     */
+    void execute(const std::string &method, const json_spirit::Array &params, CJSONWriter& writer) const;
+
+private:
+    void execute(const std::string &method, const json_spirit::Array &params, json_spirit::Value* presult, CJSONWriter* pwriter) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -132,11 +216,14 @@ extern double GetDifficulty(const CBlockIndex* blockindex = NULL);
 extern std::string HexBits(unsigned int nBits);
 extern std::string HelpRequiringPassphrase();
 extern void EnsureWalletIsUnlocked();
+// Value tree result of a method with a stream actor, for callers that need one
+extern json_spirit::Value ValueFromStream(rpcstreamfn_type actor, const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getconnectioncount(const json_spirit::Array& params, bool fHelp); // in rpcnet.cpp
 extern json_spirit::Value getpeerinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value addnode(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getaddednodeinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getpublisherinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value dumpprivkey(const json_spirit::Array& params, bool fHelp); // in rpcdump.cpp
 extern json_spirit::Value importprivkey(const json_spirit::Array& params, bool fHelp);
 
@@ -181,7 +268,10 @@ extern json_spirit::Value validateaddress(const json_spirit::Array& params, bool
 extern json_spirit::Value getinfo(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
+extern json_spirit::Value getaddresshistory(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getspentinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
+extern void streamlistunspent(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value lockunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listlockunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool fHelp);
@@ -193,9 +283,12 @@ extern json_spirit::Value getblockcount(const json_spirit::Array& params, bool f
 extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern void streamgetrawmempool(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
+extern void streamgetblock(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value gettxoutsetinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getdbstats(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxout(const json_spirit::Array& params, bool fHelp);
 
 #endif
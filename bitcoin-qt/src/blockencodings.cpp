@@ -0,0 +1,126 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "hash.h"
+#include "util.h"
+
+#include <openssl/rand.h>
+
+using namespace std;
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock &block) :
+        header(block.GetBlockHeader()), vShortTxIDs(block.vtx.size() - 1)
+{
+    RAND_bytes((unsigned char*)&nNonce, sizeof(nNonce));
+    FillShortIDKey();
+
+    if (block.vMerkleTree.empty())
+        block.BuildMerkleTree();
+    vPrefilledTxn.push_back(CPrefilledTransaction(0, block.vtx[0]));
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        vShortTxIDs[i - 1] = GetShortID(block.GetTxHash(i));
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortIDKey()
+{
+    CHashWriter ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header << nNonce;
+    uint256 hashKey = ss.GetHash();
+    nShortIDKey0 = hashKey.Get64(0);
+    nShortIDKey1 = hashKey.Get64(1);
+}
+
+uint64 CBlockHeaderAndShortTxIDs::GetShortID(const uint256 &txhash) const
+{
+    return SipHashUint256(nShortIDKey0, nShortIDKey1, txhash) & 0xffffffffffffULL;
+}
+
+CPartialBlock::ReadStatus CPartialBlock::Init(const CBlockHeaderAndShortTxIDs &cmpctblock, CTxMemPool &pool)
+{
+    if (cmpctblock.header.IsNull() || (cmpctblock.vShortTxIDs.empty() && cmpctblock.vPrefilledTxn.empty()))
+        return READ_INVALID;
+    if (cmpctblock.BlockTxCount() > MAX_COMPACT_BLOCK_TXS)
+        return READ_INVALID;
+
+    header = cmpctblock.header;
+    vtx.assign(cmpctblock.BlockTxCount(), CTransaction());
+    vHave.assign(cmpctblock.BlockTxCount(), false);
+    nFromPool = 0;
+
+    BOOST_FOREACH(const CPrefilledTransaction &prefilled, cmpctblock.vPrefilledTxn) {
+        if (prefilled.nIndex >= vtx.size() || vHave[prefilled.nIndex] || prefilled.tx.IsNull())
+            return READ_INVALID;
+        vtx[prefilled.nIndex] = prefilled.tx;
+        vHave[prefilled.nIndex] = true;
+    }
+
+    // The short IDs fill the positions left free, in order
+    map<uint64, unsigned int> mapShortIDs;
+    unsigned int nIndex = 0;
+    BOOST_FOREACH(uint64 nShortID, cmpctblock.vShortTxIDs) {
+        while (vHave[nIndex])
+            nIndex++;
+        // Two transactions of the block with the same short ID can't be told
+        // apart, the peer will have to send the block
+        if (!mapShortIDs.insert(make_pair(nShortID, nIndex)).second)
+            return READ_FAILED;
+        nIndex++;
+    }
+
+    // A pool transaction matching a short ID taken already is a collision
+    // with another pool transaction; ask for that one instead of guessing
+    vector<bool> vCollision(vtx.size(), false);
+    {
+        LOCK(pool.cs);
+        for (map<uint256, CTransaction>::const_iterator mi = pool.mapTx.begin(); mi != pool.mapTx.end() && nFromPool < mapShortIDs.size(); ++mi) {
+            map<uint64, unsigned int>::const_iterator it = mapShortIDs.find(cmpctblock.GetShortID(mi->first));
+            if (it == mapShortIDs.end())
+                continue;
+            if (vCollision[it->second])
+                continue;
+            if (vHave[it->second]) {
+                vHave[it->second] = false;
+                vtx[it->second] = CTransaction();
+                vCollision[it->second] = true;
+                nFromPool--;
+                continue;
+            }
+            vtx[it->second] = mi->second;
+            vHave[it->second] = true;
+            nFromPool++;
+        }
+    }
+    return READ_OK;
+}
+
+void CPartialBlock::GetMissing(vector<unsigned int> &vIndexes) const
+{
+    vIndexes.clear();
+    for (unsigned int i = 0; i < vHave.size(); i++)
+        if (!vHave[i])
+            vIndexes.push_back(i);
+}
+
+CPartialBlock::ReadStatus CPartialBlock::Fill(const vector<CTransaction> &vMissing, CBlock &block) const
+{
+    block = CBlock(header);
+    block.vtx = vtx;
+    unsigned int nMissing = 0;
+    for (unsigned int i = 0; i < vHave.size(); i++) {
+        if (vHave[i])
+            continue;
+        if (nMissing >= vMissing.size())
+            return READ_INVALID;
+        block.vtx[i] = vMissing[nMissing++];
+    }
+    if (nMissing != vMissing.size())
+        return READ_INVALID;
+
+    // A pool transaction taken for a short ID it only collided with shows
+    // up as a wrong merkle root; so does a peer sending other transactions
+    if (block.BuildMerkleTree() != header.hashMerkleRoot)
+        return READ_FAILED;
+    return READ_OK;
+}
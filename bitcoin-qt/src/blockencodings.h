@@ -0,0 +1,213 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_BLOCKENCODINGS_H
+#define BITCOIN_BLOCKENCODINGS_H
+
+#include "main.h"
+
+/** No block can hold more transactions than fit with the smallest possible size */
+static const unsigned int MAX_COMPACT_BLOCK_TXS = MAX_BLOCK_SIZE / 60;
+
+/** A transaction sent along in a compact block, with its position in the block */
+class CPrefilledTransaction
+{
+public:
+    unsigned int nIndex;
+    CTransaction tx;
+
+    CPrefilledTransaction() : nIndex(0) {
+    }
+
+    CPrefilledTransaction(unsigned int nIndexIn, const CTransaction &txIn) : nIndex(nIndexIn), tx(txIn) {
+    }
+};
+
+/**
+ * A block announced as its header and a 6 byte short ID for each
+ * transaction ("cmpctblock"). Peers that already have most of the
+ * transactions in their memory pool rebuild the block from there and only
+ * ask for the rest, instead of downloading all of it.
+ *
+ * Short IDs are SipHash-2-4 of the txid, keyed with the header and a
+ * random nonce so that nobody can make transactions collide on purpose
+ * in every block. The coinbase, which no peer can have, is sent in full.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    uint64 nShortIDKey0, nShortIDKey1;
+
+    void FillShortIDKey();
+
+public:
+    static const unsigned int SHORTTXID_SIZE = 6;
+
+    CBlockHeader header;
+    uint64 nNonce;
+    std::vector<uint64> vShortTxIDs;
+    std::vector<CPrefilledTransaction> vPrefilledTxn;
+
+    CBlockHeaderAndShortTxIDs() : nShortIDKey0(0), nShortIDKey1(0), nNonce(0) {
+    }
+
+    // Prefill the coinbase, short IDs for everything else
+    CBlockHeaderAndShortTxIDs(const CBlock &block);
+
+    uint64 GetShortID(const uint256 &txhash) const;
+
+    unsigned int BlockTxCount() const {
+        return vShortTxIDs.size() + vPrefilledTxn.size();
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        unsigned int nSize = ::GetSerializeSize(header, nType, nVersion) + sizeof(nNonce);
+        nSize += GetSizeOfCompactSize(vShortTxIDs.size()) + vShortTxIDs.size() * SHORTTXID_SIZE;
+        nSize += GetSizeOfCompactSize(vPrefilledTxn.size());
+        unsigned int nLast = 0;
+        for (unsigned int i = 0; i < vPrefilledTxn.size(); i++) {
+            nSize += GetSizeOfCompactSize(vPrefilledTxn[i].nIndex - (i ? nLast + 1 : 0));
+            nSize += ::GetSerializeSize(vPrefilledTxn[i].tx, nType, nVersion);
+            nLast = vPrefilledTxn[i].nIndex;
+        }
+        return nSize;
+    }
+
+    // Prefilled transactions are stored with the distance from the previous one
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        s << header << nNonce;
+        WriteCompactSize(s, vShortTxIDs.size());
+        for (unsigned int i = 0; i < vShortTxIDs.size(); i++) {
+            unsigned char pch[SHORTTXID_SIZE];
+            for (unsigned int j = 0; j < SHORTTXID_SIZE; j++)
+                pch[j] = vShortTxIDs[i] >> (8 * j);
+            s.write((const char*)pch, SHORTTXID_SIZE);
+        }
+        WriteCompactSize(s, vPrefilledTxn.size());
+        unsigned int nLast = 0;
+        for (unsigned int i = 0; i < vPrefilledTxn.size(); i++) {
+            WriteCompactSize(s, vPrefilledTxn[i].nIndex - (i ? nLast + 1 : 0));
+            s << vPrefilledTxn[i].tx;
+            nLast = vPrefilledTxn[i].nIndex;
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        s >> header >> nNonce;
+        uint64 nCount = ReadCompactSize(s);
+        if (nCount > MAX_COMPACT_BLOCK_TXS)
+            throw std::ios_base::failure("CBlockHeaderAndShortTxIDs : too many short IDs");
+        vShortTxIDs.resize(nCount);
+        for (unsigned int i = 0; i < vShortTxIDs.size(); i++) {
+            unsigned char pch[SHORTTXID_SIZE];
+            s.read((char*)pch, SHORTTXID_SIZE);
+            vShortTxIDs[i] = 0;
+            for (unsigned int j = 0; j < SHORTTXID_SIZE; j++)
+                vShortTxIDs[i] |= (uint64)pch[j] << (8 * j);
+        }
+        nCount = ReadCompactSize(s);
+        if (nCount > MAX_COMPACT_BLOCK_TXS)
+            throw std::ios_base::failure("CBlockHeaderAndShortTxIDs : too many prefilled transactions");
+        vPrefilledTxn.resize(nCount);
+        uint64 nIndex = 0;
+        for (unsigned int i = 0; i < vPrefilledTxn.size(); i++) {
+            nIndex += ReadCompactSize(s) + (i ? 1 : 0);
+            if (nIndex >= MAX_COMPACT_BLOCK_TXS)
+                throw std::ios_base::failure("CBlockHeaderAndShortTxIDs : prefilled transaction index out of range");
+            vPrefilledTxn[i].nIndex = nIndex;
+            s >> vPrefilledTxn[i].tx;
+        }
+        FillShortIDKey();
+    }
+};
+
+/** Request for the transactions of a compact block the peer could not find ("getblocktxn") */
+class CBlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<unsigned int> vIndexes;
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        unsigned int nSize = sizeof(blockhash) + GetSizeOfCompactSize(vIndexes.size());
+        for (unsigned int i = 0; i < vIndexes.size(); i++)
+            nSize += GetSizeOfCompactSize(vIndexes[i] - (i ? vIndexes[i-1] + 1 : 0));
+        return nSize;
+    }
+
+    // Indexes are increasing and stored with the distance from the previous one
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        s << blockhash;
+        WriteCompactSize(s, vIndexes.size());
+        for (unsigned int i = 0; i < vIndexes.size(); i++)
+            WriteCompactSize(s, vIndexes[i] - (i ? vIndexes[i-1] + 1 : 0));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        s >> blockhash;
+        uint64 nCount = ReadCompactSize(s);
+        if (nCount > MAX_COMPACT_BLOCK_TXS)
+            throw std::ios_base::failure("CBlockTransactionsRequest : too many indexes");
+        vIndexes.resize(nCount);
+        uint64 nIndex = 0;
+        for (unsigned int i = 0; i < vIndexes.size(); i++) {
+            nIndex += ReadCompactSize(s) + (i ? 1 : 0);
+            if (nIndex >= MAX_COMPACT_BLOCK_TXS)
+                throw std::ios_base::failure("CBlockTransactionsRequest : index out of range");
+            vIndexes[i] = nIndex;
+        }
+    }
+};
+
+/** The transactions asked for with getblocktxn, in the same order ("blocktxn") */
+class CBlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> vtx;
+
+    CBlockTransactions() {
+    }
+
+    CBlockTransactions(const CBlockTransactionsRequest &req) : blockhash(req.blockhash), vtx(req.vIndexes.size()) {
+    }
+
+    IMPLEMENT_SERIALIZE(
+        READWRITE(blockhash);
+        READWRITE(vtx);
+    )
+};
+
+/** A block being rebuilt from a compact block, the memory pool and a blocktxn reply */
+class CPartialBlock
+{
+private:
+    std::vector<CTransaction> vtx;
+    std::vector<bool> vHave;
+
+public:
+    enum ReadStatus
+    {
+        READ_OK,
+        READ_INVALID, // the peer sent something malformed
+        READ_FAILED,  // short ID collision or bad reconstruction, fetch the full block instead
+    };
+
+    CBlockHeader header;
+    unsigned int nFromPool;
+
+    CPartialBlock() : nFromPool(0) {
+    }
+
+    ReadStatus Init(const CBlockHeaderAndShortTxIDs &cmpctblock, CTxMemPool &pool);
+    // Positions of the transactions that still need to be asked for
+    void GetMissing(std::vector<unsigned int> &vIndexes) const;
+    // Fill in the missing transactions, in GetMissing order, and check the result
+    ReadStatus Fill(const std::vector<CTransaction> &vMissing, CBlock &block) const;
+};
+
+#endif
@@ -0,0 +1,116 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "blockfile.h"
+
+using namespace std;
+
+CMappedFile::~CMappedFile()
+{
+    Close();
+}
+
+bool CMappedFile::Open(const string &strPath)
+{
+    Close();
+#ifndef WIN32
+    int fd = open(strPath.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (off_t)(size_t)st.st_size != st.st_size) {
+        close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    pdata = (const char*)p;
+    nSize = (size_t)st.st_size;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void CMappedFile::Close()
+{
+#ifndef WIN32
+    if (pdata != NULL)
+        munmap((void*)pdata, nSize);
+#endif
+    pdata = NULL;
+    nSize = 0;
+}
+
+void CMappedFile::Advise(bool fSequential) const
+{
+#if !defined(WIN32) && defined(MADV_SEQUENTIAL)
+    if (pdata != NULL)
+        madvise((void*)pdata, nSize, fSequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+#endif
+}
+
+boost::shared_ptr<const CMappedFile> CBlockFileMapper::Get(const string &strPath, size_t nMinSize)
+{
+    LOCK(cs);
+    map_type::iterator mi = mapFiles.find(strPath);
+    if (mi != mapFiles.end()) {
+        if ((*mi).second.first->size() >= nMinSize) {
+            lruFiles.splice(lruFiles.begin(), lruFiles, (*mi).second.second);
+            return (*mi).second.first;
+        }
+        // the file grew since it was mapped
+        lruFiles.erase((*mi).second.second);
+        mapFiles.erase(mi);
+    }
+
+    boost::shared_ptr<CMappedFile> pmap(new CMappedFile());
+    if (!pmap->Open(strPath) || pmap->size() < nMinSize)
+        return boost::shared_ptr<const CMappedFile>();
+    if (fSequential)
+        pmap->Advise(true);
+
+    lruFiles.push_front(strPath);
+    mapFiles[strPath] = make_pair(pmap, lruFiles.begin());
+    while (mapFiles.size() > nMaxFiles) {
+        mapFiles.erase(lruFiles.back());
+        lruFiles.pop_back();
+    }
+    return pmap;
+}
+
+void CBlockFileMapper::Forget(const string &strPath)
+{
+    LOCK(cs);
+    map_type::iterator mi = mapFiles.find(strPath);
+    if (mi == mapFiles.end())
+        return;
+    lruFiles.erase((*mi).second.second);
+    mapFiles.erase(mi);
+}
+
+void CBlockFileMapper::Clear()
+{
+    LOCK(cs);
+    mapFiles.clear();
+    lruFiles.clear();
+}
+
+void CBlockFileMapper::SetSequential(bool fSequentialIn)
+{
+    LOCK(cs);
+    fSequential = fSequentialIn;
+    for (map_type::iterator mi = mapFiles.begin(); mi != mapFiles.end(); mi++)
+        (*mi).second.first->Advise(fSequential);
+}
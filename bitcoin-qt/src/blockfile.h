@@ -0,0 +1,81 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_BLOCKFILE_H
+#define BITCOIN_BLOCKFILE_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+/** Read-only memory mapping of a whole file.
+ *
+ * Mapping is only supported on POSIX systems; elsewhere Open() fails and
+ * callers fall back to reading through stdio.
+ */
+class CMappedFile
+{
+private:
+    const char *pdata;
+    size_t nSize;
+
+    // not copyable
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+public:
+    CMappedFile() : pdata(NULL), nSize(0) {}
+    ~CMappedFile();
+
+    bool Open(const std::string &strPath);
+    void Close();
+
+    const char *begin() const { return pdata; }
+    const char *end() const { return pdata + nSize; }
+    size_t size() const { return nSize; }
+
+    // Hint the kernel whether the file is about to be read front to back
+    void Advise(bool fSequential) const;
+};
+
+/** Bounded set of memory mapped block (blk?????.dat) and undo (rev?????.dat)
+ *  files, least recently used ones are unmapped first.
+ *
+ * Readers hold on to the returned mapping while deserializing from it, so a
+ * file unmapped in the meantime stays valid until they are done.
+ */
+class CBlockFileMapper
+{
+private:
+    typedef std::list<std::string> lru_type;
+    typedef std::map<std::string, std::pair<boost::shared_ptr<const CMappedFile>, lru_type::iterator> > map_type;
+
+    CCriticalSection cs;
+    unsigned int nMaxFiles;
+    bool fSequential;
+    lru_type lruFiles; // most recently used first
+    map_type mapFiles;
+
+public:
+    CBlockFileMapper(unsigned int nMaxFilesIn) : nMaxFiles(nMaxFilesIn), fSequential(false) {}
+
+    // Return a mapping of strPath covering at least nMinSize bytes. Files
+    // that grew since they were mapped are mapped again. Returns an empty
+    // pointer if the file is too short or can't be mapped.
+    boost::shared_ptr<const CMappedFile> Get(const std::string &strPath, size_t nMinSize);
+
+    // Drop the mapping of a file that is about to be modified or deleted
+    void Forget(const std::string &strPath);
+
+    // Drop all mappings
+    void Clear();
+
+    // Set the access pattern hint for current and future mappings
+    void SetSequential(bool fSequentialIn);
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include "db.h"
 #include "util.h"
 #include "main.h"
+#include <errno.h>
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -139,8 +140,14 @@ CDBEnv::VerifyResult CDBEnv::Verify(std::string strFile, bool (*recoverFunc)(CDB
     LOCK(cs_db);
     assert(mapFileUseCount.count(strFile) == 0);
 
-    Db db(&dbenv, 0);
-    int result = db.verify(strFile.c_str(), NULL, NULL, 0);
+    int result;
+    if (IsLogDb(strFile))
+        result = CLogDB::Verify(GetDataDir() / strFile) ? 0 : DB_VERIFY_BAD;
+    else
+    {
+        Db db(&dbenv, 0);
+        result = db.verify(strFile.c_str(), NULL, NULL, 0);
+    }
     if (result == 0)
         return VERIFY_OK;
     else if (recoverFunc == NULL)
@@ -209,14 +216,354 @@ bool CDBEnv::Salvage(std::string strFile, bool fAggressive,
 void CDBEnv::CheckpointLSN(std::string strFile)
 {
     dbenv.txn_checkpoint(0, 0, 0);
-    if (fMockDb)
+    if (fMockDb || IsLogDb(strFile))
         return;
     dbenv.lsn_reset(strFile.c_str(), 0);
 }
 
+bool CDBEnv::IsLogDb(const std::string& strFile, bool fCreate)
+{
+    filesystem::path pathFile = GetDataDir() / strFile;
+    if (filesystem::exists(pathFile))
+        return CLogDB::IsLogFile(pathFile);
+    return fCreate && GetArg("-walletformat", "bdb") == "log";
+}
+
+
+//
+// CDBStorage implementations
+//
+
+namespace {
+
+class CBerkeleyCursor : public CDBCursor
+{
+private:
+    Dbc* pdbc;
+
+public:
+    CBerkeleyCursor(Dbc* pdbcIn) : pdbc(pdbcIn) {}
+    ~CBerkeleyCursor() { pdbc->close(); }
+
+    int Read(CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+    {
+        // Read at cursor
+        Dbt datKey;
+        if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
+        {
+            datKey.set_data(&ssKey[0]);
+            datKey.set_size(ssKey.size());
+        }
+        Dbt datValue;
+        if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
+        {
+            datValue.set_data(&ssValue[0]);
+            datValue.set_size(ssValue.size());
+        }
+        datKey.set_flags(DB_DBT_MALLOC);
+        datValue.set_flags(DB_DBT_MALLOC);
+        int ret = pdbc->get(&datKey, &datValue, fFlags);
+        if (ret != 0)
+            return ret;
+        else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
+            return 99999;
+
+        // Convert to streams
+        ssKey.SetType(SER_DISK);
+        ssKey.clear();
+        ssKey.write((char*)datKey.get_data(), datKey.get_size());
+        ssValue.SetType(SER_DISK);
+        ssValue.clear();
+        ssValue.write((char*)datValue.get_data(), datValue.get_size());
+
+        // Clear and free memory
+        memset(datKey.get_data(), 0, datKey.get_size());
+        memset(datValue.get_data(), 0, datValue.get_size());
+        free(datKey.get_data());
+        free(datValue.get_data());
+        return 0;
+    }
+};
+
+/** A Berkeley database in bitdb.dbenv */
+class CBerkeleyStorage : public CDBStorage
+{
+private:
+    Db* pdb;
+    DbTxn* activeTxn;
+
+public:
+    CBerkeleyStorage(Db* pdbIn) : pdb(pdbIn), activeTxn(NULL) {}
+    ~CBerkeleyStorage() { TxnAbort(); }
+
+    bool Read(CDataStream& ssKey, CDataStream& ssValue)
+    {
+        Dbt datKey(&ssKey[0], ssKey.size());
+
+        // Read
+        Dbt datValue;
+        datValue.set_flags(DB_DBT_MALLOC);
+        int ret = pdb->get(activeTxn, &datKey, &datValue, 0);
+        memset(datKey.get_data(), 0, datKey.get_size());
+        if (datValue.get_data() == NULL)
+            return false;
+        ssValue.write((char*)datValue.get_data(), datValue.get_size());
+
+        // Clear and free memory
+        memset(datValue.get_data(), 0, datValue.get_size());
+        free(datValue.get_data());
+        return (ret == 0);
+    }
+
+    bool Write(CDataStream& ssKey, CDataStream& ssValue, bool fOverwrite)
+    {
+        Dbt datKey(&ssKey[0], ssKey.size());
+        Dbt datValue(&ssValue[0], ssValue.size());
+
+        // Write
+        int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+
+        // Clear memory in case it was a private key
+        memset(datKey.get_data(), 0, datKey.get_size());
+        memset(datValue.get_data(), 0, datValue.get_size());
+        return (ret == 0);
+    }
+
+    bool Erase(CDataStream& ssKey)
+    {
+        Dbt datKey(&ssKey[0], ssKey.size());
+
+        // Erase
+        int ret = pdb->del(activeTxn, &datKey, 0);
+
+        // Clear memory
+        memset(datKey.get_data(), 0, datKey.get_size());
+        return (ret == 0 || ret == DB_NOTFOUND);
+    }
+
+    bool Exists(CDataStream& ssKey)
+    {
+        Dbt datKey(&ssKey[0], ssKey.size());
+
+        // Exists
+        int ret = pdb->exists(activeTxn, &datKey, 0);
+
+        // Clear memory
+        memset(datKey.get_data(), 0, datKey.get_size());
+        return (ret == 0);
+    }
+
+    CDBCursor* GetCursor()
+    {
+        Dbc* pdbc = NULL;
+        int ret = pdb->cursor(NULL, &pdbc, 0);
+        if (ret != 0)
+            return NULL;
+        return new CBerkeleyCursor(pdbc);
+    }
+
+    bool TxnBegin()
+    {
+        if (activeTxn)
+            return false;
+        DbTxn* ptxn = bitdb.TxnBegin();
+        if (!ptxn)
+            return false;
+        activeTxn = ptxn;
+        return true;
+    }
+
+    bool TxnCommit()
+    {
+        if (!activeTxn)
+            return false;
+        int ret = activeTxn->commit(0);
+        activeTxn = NULL;
+        return (ret == 0);
+    }
+
+    bool TxnAbort()
+    {
+        if (!activeTxn)
+            return false;
+        int ret = activeTxn->abort();
+        activeTxn = NULL;
+        return (ret == 0);
+    }
+
+    void Flush(bool fReadOnly)
+    {
+        if (activeTxn)
+            return;
+
+        // Flush database activity from memory pool to disk log
+        unsigned int nMinutes = 0;
+        if (fReadOnly)
+            nMinutes = 1;
+
+        bitdb.dbenv.txn_checkpoint(nMinutes ? GetArg("-dblogsize", 100)*1024 : 0, nMinutes, 0);
+    }
+};
+
+class CLogCursor : public CDBCursor
+{
+private:
+    const CLogDB* plog;
+    CLogDB::key_type vchKey; // key of the last record read
+    bool fStarted;
+
+public:
+    CLogCursor(const CLogDB* plogIn) : plog(plogIn), fStarted(false) {}
+
+    int Read(CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+    {
+        CLogDB::key_type vchSeek;
+        bool fAfter;
+        if (fFlags == DB_SET_RANGE)
+        {
+            vchSeek.assign(ssKey.begin(), ssKey.end());
+            fAfter = false;
+        }
+        else if (fFlags == DB_NEXT)
+        {
+            vchSeek = vchKey;
+            fAfter = fStarted;
+        }
+        else
+            return EINVAL;
+
+        // the cursor remembers its key, so records may change while it is open
+        CLogDB::value_type vchValue;
+        if (!plog->Seek(vchSeek, fAfter, vchKey, vchValue))
+            return DB_NOTFOUND;
+        fStarted = true;
+
+        // Convert to streams
+        ssKey.SetType(SER_DISK);
+        ssKey.clear();
+        if (!vchKey.empty())
+            ssKey.write((const char*)&vchKey[0], vchKey.size());
+        ssValue.SetType(SER_DISK);
+        ssValue.clear();
+        if (!vchValue.empty())
+            ssValue.write(&vchValue[0], vchValue.size());
+        return 0;
+    }
+};
+
+/** A CLogDB; transactions collect their changes in a batch that is
+ *  committed as one record */
+class CLogStorage : public CDBStorage
+{
+private:
+    CLogDB* plog;
+    CLogDB::CBatch* pbatch;
+
+public:
+    CLogStorage(CLogDB* plogIn) : plog(plogIn), pbatch(NULL) {}
+    ~CLogStorage() { delete pbatch; }
+
+    bool Read(CDataStream& ssKey, CDataStream& ssValue)
+    {
+        CLogDB::key_type vchKey(ssKey.begin(), ssKey.end());
+        CLogDB::value_type vchValue;
+        if (pbatch)
+        {
+            // changes of the active transaction hide the committed records
+            int nChange = pbatch->Lookup(vchKey, vchValue);
+            if (nChange == CLogDB::CBatch::ERASED)
+                return false;
+            if (nChange == CLogDB::CBatch::UNCHANGED && !plog->Read(vchKey, vchValue))
+                return false;
+        }
+        else if (!plog->Read(vchKey, vchValue))
+            return false;
+        if (!vchValue.empty())
+            ssValue.write(&vchValue[0], vchValue.size());
+        return true;
+    }
+
+    bool Write(CDataStream& ssKey, CDataStream& ssValue, bool fOverwrite)
+    {
+        if (!fOverwrite && Exists(ssKey))
+            return false;
+        CLogDB::key_type vchKey(ssKey.begin(), ssKey.end());
+        CLogDB::value_type vchValue(ssValue.begin(), ssValue.end());
+        if (pbatch)
+        {
+            pbatch->Write(vchKey, vchValue);
+            return true;
+        }
+        CLogDB::CBatch batch;
+        batch.Write(vchKey, vchValue);
+        return plog->Commit(batch);
+    }
+
+    bool Erase(CDataStream& ssKey)
+    {
+        CLogDB::key_type vchKey(ssKey.begin(), ssKey.end());
+        if (pbatch)
+        {
+            pbatch->Erase(vchKey);
+            return true;
+        }
+        if (!plog->Exists(vchKey))
+            return true;
+        CLogDB::CBatch batch;
+        batch.Erase(vchKey);
+        return plog->Commit(batch);
+    }
+
+    bool Exists(CDataStream& ssKey)
+    {
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        return Read(ssKey, ssValue);
+    }
+
+    CDBCursor* GetCursor()
+    {
+        return new CLogCursor(plog);
+    }
+
+    bool TxnBegin()
+    {
+        if (pbatch)
+            return false;
+        pbatch = new CLogDB::CBatch();
+        return true;
+    }
+
+    bool TxnCommit()
+    {
+        if (!pbatch)
+            return false;
+        bool fCommitted = plog->Commit(*pbatch);
+        delete pbatch;
+        pbatch = NULL;
+        return fCommitted;
+    }
+
+    bool TxnAbort()
+    {
+        if (!pbatch)
+            return false;
+        delete pbatch;
+        pbatch = NULL;
+        return true;
+    }
+
+    void Flush(bool fReadOnly)
+    {
+        if (!pbatch)
+            plog->Flush();
+    }
+};
+
+} // namespace
+
 
 CDB::CDB(const char *pszFile, const char* pszMode) :
-    pdb(NULL), activeTxn(NULL)
+    pstore(NULL)
 {
     int ret;
     if (pszFile == NULL)
@@ -235,8 +582,35 @@ CDB::CDB(const char *pszFile, const char* pszMode) :
 
         strFile = pszFile;
         ++bitdb.mapFileUseCount[strFile];
-        pdb = bitdb.mapDb[strFile];
-        if (pdb == NULL)
+        CLogDB* plog = bitdb.mapLogDb[strFile];
+        Db* pdb = NULL;
+        if (plog == NULL && bitdb.mapDb[strFile] == NULL && bitdb.IsLogDb(strFile, fCreate))
+        {
+            plog = new CLogDB();
+            if (!plog->Open(GetDataDir() / strFile, fCreate))
+            {
+                delete plog;
+                --bitdb.mapFileUseCount[strFile];
+                strFile = "";
+                throw runtime_error(strprintf("CDB() : can't open log database file %s", pszFile));
+            }
+            pstore = new CLogStorage(plog);
+
+            if (fCreate && !Exists(string("version")))
+            {
+                bool fTmp = fReadOnly;
+                fReadOnly = false;
+                WriteVersion(CLIENT_VERSION);
+                fReadOnly = fTmp;
+            }
+
+            bitdb.mapLogDb[strFile] = plog;
+        }
+        else if (plog != NULL)
+            pstore = new CLogStorage(plog);
+        else
+            pdb = bitdb.mapDb[strFile];
+        if (pstore == NULL && pdb == NULL)
         {
             pdb = new Db(&bitdb.dbenv, 0);
 
@@ -259,11 +633,11 @@ CDB::CDB(const char *pszFile, const char* pszMode) :
             if (ret != 0)
             {
                 delete pdb;
-                pdb = NULL;
                 --bitdb.mapFileUseCount[strFile];
                 strFile = "";
                 throw runtime_error(strprintf("CDB() : can't open database file %s, error %d", pszFile, ret));
             }
+            pstore = new CBerkeleyStorage(pdb);
 
             if (fCreate && !Exists(string("version")))
             {
@@ -275,32 +649,25 @@ CDB::CDB(const char *pszFile, const char* pszMode) :
 
             bitdb.mapDb[strFile] = pdb;
         }
+        else if (pstore == NULL)
+            pstore = new CBerkeleyStorage(pdb);
     }
 }
 
 void CDB::Flush()
 {
-    if (activeTxn)
-        return;
-
-    // Flush database activity from memory pool to disk log
-    unsigned int nMinutes = 0;
-    if (fReadOnly)
-        nMinutes = 1;
-
-    bitdb.dbenv.txn_checkpoint(nMinutes ? GetArg("-dblogsize", 100)*1024 : 0, nMinutes, 0);
+    if (pstore)
+        pstore->Flush(fReadOnly);
 }
 
 void CDB::Close()
 {
-    if (!pdb)
+    if (!pstore)
         return;
-    if (activeTxn)
-        activeTxn->abort();
-    activeTxn = NULL;
-    pdb = NULL;
-
+    pstore->TxnAbort();
     Flush();
+    delete pstore;
+    pstore = NULL;
 
     {
         LOCK(bitdb.cs_db);
@@ -320,6 +687,16 @@ void CDBEnv::CloseDb(const string& strFile)
             delete pdb;
             mapDb[strFile] = NULL;
         }
+        if (mapLogDb[strFile] != NULL)
+        {
+            // Drop overwritten records while nobody is using the file
+            CLogDB* plog = mapLogDb[strFile];
+            if (plog->NeedsCompaction())
+                plog->Compact();
+            plog->Close();
+            delete plog;
+            mapLogDb[strFile] = NULL;
+        }
     }
 }
 
@@ -345,6 +722,28 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                 bitdb.CheckpointLSN(strFile);
                 bitdb.mapFileUseCount.erase(strFile);
 
+                if (bitdb.IsLogDb(strFile))
+                {
+                    // Compaction leaves only the live records
+                    printf("Rewriting %s...\n", strFile.c_str());
+                    CLogDB logdb;
+                    bool fSuccess = logdb.Open(GetDataDir() / strFile, false);
+                    if (fSuccess)
+                    {
+                        // Update version:
+                        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+                        ssKey << string("version");
+                        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+                        ssValue << CLIENT_VERSION;
+                        CLogDB::CBatch batch;
+                        batch.Write(CLogDB::key_type(ssKey.begin(), ssKey.end()), CLogDB::value_type(ssValue.begin(), ssValue.end()));
+                        fSuccess = logdb.Commit(batch) && logdb.Compact(pszSkip);
+                    }
+                    if (!fSuccess)
+                        printf("Rewriting of %s FAILED!\n", strFile.c_str());
+                    return fSuccess;
+                }
+
                 bool fSuccess = true;
                 printf("Rewriting %s...\n", strFile.c_str());
                 string strFileRes = strFile + ".rewrite";
@@ -364,7 +763,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess)
                         {
@@ -373,12 +772,12 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                             int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
                             if (ret == DB_NOTFOUND)
                             {
-                                pcursor->close();
+                                delete pcursor;
                                 break;
                             }
                             else if (ret != 0)
                             {
-                                pcursor->close();
+                                delete pcursor;
                                 fSuccess = false;
                                 break;
                             }
@@ -425,6 +824,131 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
     return false;
 }
 
+bool CDB::Convert(const string& strFile, bool fLogDb)
+{
+    if (bitdb.IsLogDb(strFile) == fLogDb)
+        return true;
+    while (true)
+    {
+        {
+            LOCK(bitdb.cs_db);
+            if (!bitdb.mapFileUseCount.count(strFile) || bitdb.mapFileUseCount[strFile] == 0)
+            {
+                // Flush log data to the dat file
+                bitdb.CloseDb(strFile);
+                bitdb.CheckpointLSN(strFile);
+                bitdb.mapFileUseCount.erase(strFile);
+
+                printf("Converting %s to a %s database...\n", strFile.c_str(), fLogDb ? "log" : "Berkeley");
+                bool fSuccess = true;
+                string strFileRes = strFile + ".convert";
+                filesystem::path pathRes = GetDataDir() / strFileRes;
+                CLogDB logCopy;
+                Db* pdbCopy = NULL;
+                filesystem::remove(pathRes);
+                if (fLogDb)
+                    fSuccess = logCopy.Open(pathRes, true);
+                else
+                {
+                    pdbCopy = new Db(&bitdb.dbenv, 0);
+                    int ret = pdbCopy->open(NULL,                 // Txn pointer
+                                            strFileRes.c_str(),   // Filename
+                                            "main",    // Logical db name
+                                            DB_BTREE,  // Database type
+                                            DB_CREATE,    // Flags
+                                            0);
+                    if (ret > 0)
+                        fSuccess = false;
+                }
+                if (!fSuccess)
+                    printf("Cannot create database file %s\n", strFileRes.c_str());
+
+                { // surround usage of db with extra {}
+                    CDB db(strFile.c_str(), "r");
+                    CDBCursor* pcursor = db.GetCursor();
+                    CLogDB::CBatch batch;
+                    unsigned int nBatchSize = 0;
+                    while (pcursor && fSuccess)
+                    {
+                        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+                        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+                        int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+                        if (ret == DB_NOTFOUND)
+                            break;
+                        else if (ret != 0)
+                        {
+                            fSuccess = false;
+                            break;
+                        }
+                        if (fLogDb)
+                        {
+                            // keep the records of the new file well below MAX_SIZE
+                            batch.Write(CLogDB::key_type(ssKey.begin(), ssKey.end()), CLogDB::value_type(ssValue.begin(), ssValue.end()));
+                            nBatchSize += ssKey.size() + ssValue.size();
+                            if (nBatchSize >= 1000000)
+                            {
+                                fSuccess = logCopy.Commit(batch);
+                                batch.clear();
+                                nBatchSize = 0;
+                            }
+                            continue;
+                        }
+                        Dbt datKey(&ssKey[0], ssKey.size());
+                        Dbt datValue(&ssValue[0], ssValue.size());
+                        if (pdbCopy->put(NULL, &datKey, &datValue, DB_NOOVERWRITE) > 0)
+                            fSuccess = false;
+                    }
+                    delete pcursor;
+                    if (!pcursor)
+                        fSuccess = false;
+                    if (fSuccess && fLogDb)
+                        fSuccess = logCopy.Commit(batch);
+                    db.Close();
+                    bitdb.CloseDb(strFile);
+                }
+                if (fLogDb)
+                {
+                    fSuccess = fSuccess && logCopy.Flush();
+                    logCopy.Close();
+                }
+                else if (pdbCopy)
+                {
+                    if (pdbCopy->close(0))
+                        fSuccess = false;
+                    delete pdbCopy;
+                }
+
+                // Keep the old file around, move the new one into place
+                string strFileBak = strprintf("%s.%"PRI64d".bak", strFile.c_str(), GetTime());
+                if (fSuccess && !fLogDb)
+                    fSuccess = RenameOver(GetDataDir() / strFile, GetDataDir() / strFileBak);
+                if (fSuccess && !fLogDb)
+                {
+                    Db dbB(&bitdb.dbenv, 0);
+                    if (dbB.rename(strFileRes.c_str(), NULL, strFile.c_str(), 0))
+                        fSuccess = false;
+                }
+                if (fSuccess && fLogDb && !bitdb.IsMock())
+                {
+                    if (bitdb.dbenv.dbrename(NULL, strFile.c_str(), NULL, strFileBak.c_str(), DB_AUTO_COMMIT))
+                        fSuccess = false;
+                }
+                if (fSuccess && fLogDb)
+                    fSuccess = RenameOver(pathRes, GetDataDir() / strFile);
+                bitdb.mapFileUseCount.erase(strFile);
+
+                if (fSuccess)
+                    printf("Converted %s, the old file is kept as %s\n", strFile.c_str(), strFileBak.c_str());
+                else
+                    printf("Converting %s FAILED!\n", strFile.c_str());
+                return fSuccess;
+            }
+        }
+        MilliSleep(100);
+    }
+    return false;
+}
+
 
 void CDBEnv::Flush(bool fShutdown)
 {
@@ -449,7 +973,7 @@ void CDBEnv::Flush(bool fShutdown)
                 printf("%s checkpoint\n", strFile.c_str());
                 dbenv.txn_checkpoint(0, 0, 0);
                 printf("%s detach\n", strFile.c_str());
-                if (!fMockDb)
+                if (!fMockDb && !IsLogDb(strFile))
                     dbenv.lsn_reset(strFile.c_str(), 0);
                 printf("%s closed\n", strFile.c_str());
                 mapFileUseCount.erase(mi++);
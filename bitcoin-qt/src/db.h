@@ -6,6 +6,7 @@
 #define BITCOIN_DB_H
 
 #include "main.h"
+#include "logdb.h"
 
 #include <map>
 #include <string>
@@ -42,6 +43,7 @@ public:
     DbEnv dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    std::map<std::string, CLogDB*> mapLogDb;
 
     CDBEnv();
     ~CDBEnv();
@@ -74,6 +76,11 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
+    // Whether strFile is stored as a CLogDB rather than a Berkeley database.
+    // Files that don't exist yet are created in the format set by
+    // -walletformat if fCreate.
+    bool IsLogDb(const std::string& strFile, bool fCreate=false);
+
     DbTxn *TxnBegin(int flags=DB_TXN_WRITE_NOSYNC)
     {
         DbTxn* ptxn = NULL;
@@ -87,13 +94,44 @@ public:
 extern CDBEnv bitdb;
 
 
-/** RAII class that provides access to a Berkeley database */
+/** Cursor over the records of a CDB, in key order */
+class CDBCursor
+{
+public:
+    virtual ~CDBCursor() {}
+    // Read the next record (DB_NEXT), or the first one not before ssKey
+    // (DB_SET_RANGE), into ssKey and ssValue. Returns 0 or an error code.
+    virtual int Read(CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags) = 0;
+};
+
+/** Storage behind a CDB: a Berkeley database or a CLogDB, opened once and
+ *  shared through bitdb. Each CDB gets its own instance, which holds that
+ *  handle's transaction. Keys and values are passed serialized.
+ */
+class CDBStorage
+{
+public:
+    virtual ~CDBStorage() {}
+    virtual bool Read(CDataStream& ssKey, CDataStream& ssValue) = 0;
+    virtual bool Write(CDataStream& ssKey, CDataStream& ssValue, bool fOverwrite) = 0;
+    virtual bool Erase(CDataStream& ssKey) = 0;
+    virtual bool Exists(CDataStream& ssKey) = 0;
+    virtual CDBCursor* GetCursor() = 0;
+    virtual bool TxnBegin() = 0;
+    virtual bool TxnCommit() = 0;
+    virtual bool TxnAbort() = 0;
+    // Make what was committed durable, unless a transaction is active
+    virtual void Flush(bool fReadOnly) = 0;
+};
+
+/** RAII class that provides access to a wallet database, stored either as a
+ *  Berkeley database or as a CLogDB
+ */
 class CDB
 {
 protected:
-    Db* pdb;
+    CDBStorage* pstore;
     std::string strFile;
-    DbTxn *activeTxn;
     bool fReadOnly;
 
     explicit CDB(const char* pszFile, const char* pszMode="r+");
@@ -109,42 +147,33 @@ protected:
     template<typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        if (!pdb)
+        if (!pstore)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Read
-        Dbt datValue;
-        datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pdb->get(activeTxn, &datKey, &datValue, 0);
-        memset(datKey.get_data(), 0, datKey.get_size());
-        if (datValue.get_data() == NULL)
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        if (!pstore->Read(ssKey, ssValue))
             return false;
 
         // Unserialize value
         try {
-            CDataStream ssValue((char*)datValue.get_data(), (char*)datValue.get_data() + datValue.get_size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
         }
         catch (std::exception &e) {
             return false;
         }
-
-        // Clear and free memory
-        memset(datValue.get_data(), 0, datValue.get_size());
-        free(datValue.get_data());
-        return (ret == 0);
+        return true;
     }
 
     template<typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite=true)
     {
-        if (!pdb)
+        if (!pstore)
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
@@ -153,27 +182,20 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Value
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
-        Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
-        int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
-
-        // Clear memory in case it was a private key
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
-        return (ret == 0);
+        return pstore->Write(ssKey, ssValue, fOverwrite);
     }
 
     template<typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pstore)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -182,114 +204,59 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
-        int ret = pdb->del(activeTxn, &datKey, 0);
-
-        // Clear memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        return (ret == 0 || ret == DB_NOTFOUND);
+        return pstore->Erase(ssKey);
     }
 
     template<typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pstore)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
-        int ret = pdb->exists(activeTxn, &datKey, 0);
-
-        // Clear memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        return (ret == 0);
+        return pstore->Exists(ssKey);
     }
 
-    Dbc* GetCursor()
+    // Only DB_NEXT and DB_SET_RANGE are supported on log databases
+    CDBCursor* GetCursor()
     {
-        if (!pdb)
+        if (!pstore)
             return NULL;
-        Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
-        if (ret != 0)
-            return NULL;
-        return pcursor;
+        return pstore->GetCursor();
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
+    int ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
     {
-        // Read at cursor
-        Dbt datKey;
-        if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
-        {
-            datKey.set_data(&ssKey[0]);
-            datKey.set_size(ssKey.size());
-        }
-        Dbt datValue;
-        if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
-        {
-            datValue.set_data(&ssValue[0]);
-            datValue.set_size(ssValue.size());
-        }
-        datKey.set_flags(DB_DBT_MALLOC);
-        datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pcursor->get(&datKey, &datValue, fFlags);
-        if (ret != 0)
-            return ret;
-        else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
-            return 99999;
-
-        // Convert to streams
-        ssKey.SetType(SER_DISK);
-        ssKey.clear();
-        ssKey.write((char*)datKey.get_data(), datKey.get_size());
-        ssValue.SetType(SER_DISK);
-        ssValue.clear();
-        ssValue.write((char*)datValue.get_data(), datValue.get_size());
-
-        // Clear and free memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
-        free(datKey.get_data());
-        free(datValue.get_data());
-        return 0;
+        return pcursor->Read(ssKey, ssValue, fFlags);
     }
 
 public:
     bool TxnBegin()
     {
-        if (!pdb || activeTxn)
+        if (!pstore)
             return false;
-        DbTxn* ptxn = bitdb.TxnBegin();
-        if (!ptxn)
-            return false;
-        activeTxn = ptxn;
-        return true;
+        return pstore->TxnBegin();
     }
 
     bool TxnCommit()
     {
-        if (!pdb || !activeTxn)
+        if (!pstore)
             return false;
-        int ret = activeTxn->commit(0);
-        activeTxn = NULL;
-        return (ret == 0);
+        return pstore->TxnCommit();
     }
 
     bool TxnAbort()
     {
-        if (!pdb || !activeTxn)
+        if (!pstore)
             return false;
-        int ret = activeTxn->abort();
-        activeTxn = NULL;
-        return (ret == 0);
+        return pstore->TxnAbort();
     }
 
     bool ReadVersion(int& nVersion)
@@ -304,6 +271,9 @@ public:
     }
 
     bool static Rewrite(const std::string& strFile, const char* pszSkip = NULL);
+    // Copy strFile into a new log (fLogDb) or Berkeley database, keeping the
+    // old file as strFile.<timestamp>.bak
+    bool static Convert(const std::string& strFile, bool fLogDb);
 };
 
 
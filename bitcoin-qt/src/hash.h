@@ -7,6 +7,7 @@
 
 #include "uint256.h"
 #include "serialize.h"
+#include "sha256.h"
 
 #include <openssl/sha.h>
 #include <openssl/ripemd.h>
@@ -97,6 +98,17 @@ inline uint256 Hash(const T1 p1begin, const T1 p1end,
     return hash2;
 }
 
+// Merkle tree node: double-SHA256 of two concatenated 256-bit hashes
+inline uint256 HashPair(const uint256& left, const uint256& right)
+{
+    unsigned char pair[64];
+    memcpy(pair, (const unsigned char*)&left, 32);
+    memcpy(pair + 32, (const unsigned char*)&right, 32);
+    uint256 hash;
+    SHA256D64((unsigned char*)&hash, pair, 1);
+    return hash;
+}
+
 template<typename T>
 uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL_VERSION)
 {
@@ -116,4 +128,7 @@ inline uint160 Hash160(const std::vector<unsigned char>& vch)
 
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+/** SipHash-2-4 of a 256-bit value with the 128-bit key (k0, k1) */
+uint64 SipHashUint256(uint64 k0, uint64 k1, const uint256& val);
+
 #endif
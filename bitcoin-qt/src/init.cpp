@@ -9,9 +9,11 @@
 #include "txdb.h"
 #include "walletdb.h"
 #include "bitcoinrpc.h"
+#include "pubsub.h"
 #include "net.h"
 #include "init.h"
 #include "util.h"
+#include "sha256.h"
 #include "ui_interface.h"
 
 #include <boost/filesystem.hpp>
@@ -92,7 +94,6 @@ bool ShutdownRequested()
     return fRequestShutdown;
 }
 
-static CCoinsViewDB *pcoinsdbview;
 
 void Shutdown()
 {
@@ -103,14 +104,16 @@ void Shutdown()
     RenameThread("bitcoin-shutoff");
     nTransactionsUpdated++;
     StopRPCThreads();
+    StopPublisher();
     bitdb.Flush(false);
     StopNode();
     {
         LOCK(cs_main);
         if (pwalletMain)
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
+        // the block index must be on disk before coins that refer to it
         if (pblocktree)
-            pblocktree->Flush();
+            pblocktree->Sync();
         if (pcoinsTip)
             pcoinsTip->Flush();
         delete pcoinsTip; pcoinsTip = NULL;
@@ -310,6 +313,9 @@ std::string HelpMessage()
         "  -gen                   " + _("Generate coins (default: 0)") + "\n" +
         "  -datadir=<dir>         " + _("Specify data directory") + "\n" +
         "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n" +
+        "  -dbwritebuffer=<n>     " + _("Set coin database write buffer size in megabytes (default: 3/8 of its cache)") + "\n" +
+        "  -dbmaxopenfiles=<n>    " + _("Keep at most <n> coin database files open (default: 64)") + "\n" +
+        "  -dbsyncinterval=<n>    " + _("Once synced, write coins to disk at most every <n> seconds instead of every block (default: 0)") + "\n" +
         "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n" +
         "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n" +
         "  -socks=<n>             " + _("Select the version of socks proxy to use (4-5, default: 5)") + "\n" +
@@ -331,6 +337,7 @@ std::string HelpMessage()
         "  -bantime=<n>           " + _("Number of seconds to keep misbehaving peers from reconnecting (default: 86400)") + "\n" +
         "  -maxreceivebuffer=<n>  " + _("Maximum per-connection receive buffer, <n>*1000 bytes (default: 5000)") + "\n" +
         "  -maxsendbuffer=<n>     " + _("Maximum per-connection send buffer, <n>*1000 bytes (default: 1000)") + "\n" +
+        "  -compactblocks         " + _("Relay new blocks as short transaction IDs to peers that support it (default: 1)") + "\n" +
 #ifdef USE_UPNP
 #if USE_UPNP
         "  -upnp                  " + _("Use UPnP to map the listening port (default: 1 when listening)") + "\n" +
@@ -362,6 +369,12 @@ std::string HelpMessage()
         "  -rpcconnect=<ip>       " + _("Send commands to node running on <ip> (default: 127.0.0.1)") + "\n" +
 #endif
         "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC calls (default: 4)") + "\n" +
+        "  -rpcworkqueue=<n>      " + _("Set the depth of the queue of RPC calls waiting for a thread (default: 16)") + "\n" +
+        "  -rest                  " + _("Serve blocks, transactions and headers without authorization under /rest/ on the RPC port") + "\n" +
+        "  -restthreads=<n>       " + _("Set the number of threads to service REST requests (default: 2)") + "\n" +
+        "  -rpcservertimeout=<n>  " + _("Close idle RPC connections after <n> seconds (default: 30)") + "\n" +
+        "  -pubport=<port>        " + _("Publish new blocks and transactions to subscribers on local <port>") + "\n" +
+        "  -pubhwm=<n>            " + _("Queue up to <n> messages for each subscriber before dropping them (default: 1000)") + "\n" +
         "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n" +
         "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n" +
         "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received (%s in cmd is replaced by message)") + "\n" +
@@ -369,11 +382,18 @@ std::string HelpMessage()
         "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n" +
         "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n" +
         "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n" +
+        "  -walletformat=<format> " + _("Store a new wallet.dat as a Berkeley database (bdb) or as an append-only log (log) (default: bdb)") + "\n" +
+        "  -convertwallet         " + _("Convert wallet.dat to the format given by -walletformat on startup") + "\n" +
+        "  -checkaccounts         " + _("Check account balances against a full recount on every query (slow)") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 288, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-4, default: 3)") + "\n" +
         "  -txindex               " + _("Maintain a full transaction index (default: 0)") + "\n" +
+        "  -addrindex             " + _("Maintain an index of the transactions paying to and spending from each address (default: 0)") + "\n" +
+        "  -spentindex            " + _("Maintain an index of the inputs spending each transaction output (default: 0)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + "\n" +
         "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + "\n" +
+        "  -compressblocks        " + _("Store blocks in new block files in a compact format older versions can't read (default: 0)") + "\n" +
+        "  -prune=<n>             " + strprintf(_("Delete old block and undo files to keep them below <n> MiB (at least %u, default: 0 = disabled). Incompatible with -txindex"), (unsigned int)(MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024)) + "\n" +
         "  -par=<n>               " + _("Set the number of script verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
@@ -451,6 +471,17 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     }
 }
 
+// Compact the coin database once the initial download is over, so the
+// tables left behind by its write bursts don't slow down later lookups
+void ThreadCompactChainState()
+{
+    RenameThread("bitcoin-compact");
+
+    while (fReindex || fImporting || IsInitialBlockDownload())
+        MilliSleep(10000);
+    pcoinsdbview->Compact();
+}
+
 /** Initialize bitcoin.
  *  @pre Parameters should be parsed and config file should be read.
  */
@@ -581,6 +612,26 @@ bool AppInit2(boost::thread_group& threadGroup)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    fCompressBlocks = GetBoolArg("-compressblocks");
+    fCompactBlocks = GetBoolArg("-compactblocks", true);
+    if (fCompactBlocks)
+        nLocalServices |= NODE_COMPACT_BLOCKS;
+
+    // -prune=<MiB> deletes old block files, so this node can't serve the whole chain
+    if (GetArg("-prune", 0) < 0)
+        return InitError(_("Prune cannot be configured with a negative value."));
+    nPruneTarget = (uint64)GetArg("-prune", 0) * 1024 * 1024;
+    if (nPruneTarget) {
+        if (nPruneTarget < MIN_DISK_SPACE_FOR_BLOCK_FILES)
+            return InitError(strprintf(_("Prune configured below the minimum of %u MiB.  Please use a higher number."), (unsigned int)(MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024)));
+        if (GetBoolArg("-txindex", false))
+            return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-addrindex", false) || GetBoolArg("-spentindex", false))
+            return InitError(_("Prune mode is incompatible with -addrindex and -spentindex."));
+        fPruneMode = true;
+        nLocalServices &= ~NODE_NETWORK;
+    }
+
     // -debug implies fDebug*
     if (fDebug)
         fDebugNet = true;
@@ -664,6 +715,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     printf("I2P patch version %s (%s)\n", FormatI2PNativeFullVersion().c_str(), I2P_NATIVE_DATE.c_str());
 #endif
     printf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    printf("Using SHA256 implementation: %s\n", SHA256AutoDetect().c_str());
     if (!fLogTimestamps)
         printf("Startup time: %s\n", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()).c_str());
     printf("Default data directory %s\n", GetDefaultDataDir().string().c_str());
@@ -678,6 +730,8 @@ bool AppInit2(boost::thread_group& threadGroup)
         printf("Using %u threads for script verification\n", nScriptCheckThreads);
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadTxHash);
     }
 
     int64 nStart;
@@ -686,6 +740,10 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     uiInterface.InitMessage(_("Verifying wallet..."));
 
+    string strWalletFormat = GetArg("-walletformat", "bdb");
+    if (strWalletFormat != "bdb" && strWalletFormat != "log")
+        return InitError(strprintf(_("Unknown wallet format specified in -walletformat: '%s'"), strWalletFormat.c_str()));
+
     if (!bitdb.Open(GetDataDir()))
     {
         // try moving the database env out of the way
@@ -726,6 +784,9 @@ bool AppInit2(boost::thread_group& threadGroup)
         }
         if (r == CDBEnv::RECOVER_FAIL)
             return InitError(_("wallet.dat corrupt, salvage failed"));
+
+        if (GetBoolArg("-convertwallet") && !CDB::Convert("wallet.dat", strWalletFormat == "log"))
+            return InitError(_("Error converting wallet.dat"));
     }
 
     // ********************************************************* Step 6: network initialization
@@ -872,6 +933,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nDBSyncInterval = std::max(GetArg("-dbsyncinterval", 0), (int64)0);
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -889,7 +951,7 @@ bool AppInit2(boost::thread_group& threadGroup)
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
+                pcoinsdbview = new CCoinsViewDB(GetChainStateProfile(nCoinDBCache), false, fReindex);
                 pcoinsTip = new CCoinsViewCache(*pcoinsdbview);
 
                 if (fReindex)
@@ -940,6 +1002,26 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (mapArgs.count("-txindex") && fTxIndex != GetBoolArg("-txindex", false))
         return InitError(_("You need to rebuild the databases using -reindex to change -txindex"));
 
+    // -addrindex and -spentindex can be added later, they are built in the background
+    if (mapArgs.count("-addrindex") && fAddressIndex && !GetBoolArg("-addrindex", false))
+        return InitError(_("You need to rebuild the databases using -reindex to turn off -addrindex"));
+    if (mapArgs.count("-spentindex") && fSpentIndex && !GetBoolArg("-spentindex", false))
+        return InitError(_("You need to rebuild the databases using -reindex to turn off -spentindex"));
+    if ((GetBoolArg("-addrindex", false) && !EnableOptionalIndex("addrindex")) ||
+        (GetBoolArg("-spentindex", false) && !EnableOptionalIndex("spentindex")))
+        return InitError(_("Error writing to the block database"));
+    if ((fAddressIndex || fSpentIndex) && fHavePruned)
+        return InitError(_("Prune mode is incompatible with -addrindex and -spentindex."));
+
+    if (fHavePruned && !fPruneMode)
+        return InitError(_("You need to rebuild the databases using -reindex to go back to unpruned mode. This will redownload the entire block chain"));
+    if (fPruneMode) {
+        printf("Prune mode enabled, keeping block files below %"PRI64u" MiB\n", nPruneTarget / 1024 / 1024);
+        CValidationState state;
+        if (!PruneBlockFiles(state, nBestHeight))
+            return InitError(_("Error pruning block files"));
+    }
+
     // as LoadBlockIndex can take several minutes, it's possible the user
     // requested to kill bitcoin-qt during the last operation. If so, exit.
     // As the program has not fully started yet, Shutdown() is possibly overkill.
@@ -1059,6 +1141,15 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     if (pindexBest && pindexBest != pindexRescan)
     {
+        // Pruned nodes can only rescan the blocks they still have
+        if (fPruneMode)
+        {
+            CBlockIndex *pindex = pindexBest;
+            while (pindex && pindex != pindexRescan && (pindex->nStatus & BLOCK_HAVE_DATA))
+                pindex = pindex->pprev;
+            if (pindex != pindexRescan)
+                return InitError(_("Prune: last wallet synchronisation goes beyond pruned data. You need to -reindex (download the whole block chain again)"));
+        }
         uiInterface.InitMessage(_("Rescanning..."));
         printf("Rescanning last %i blocks (from block %i)...\n", pindexBest->nHeight - pindexRescan->nHeight, pindexRescan->nHeight);
         nStart = GetTimeMillis();
@@ -1082,6 +1173,10 @@ bool AppInit2(boost::thread_group& threadGroup)
             vImportFiles.push_back(strFile);
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    if (fReindex || IsInitialBlockDownload())
+        threadGroup.create_thread(&ThreadCompactChainState);
+    if (IsBuildingIndexes())
+        threadGroup.create_thread(&ThreadBuildIndexes);
 
     // ********************************************************* Step 10: load peers
 
@@ -1120,6 +1215,13 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (fServer)
         StartRPCThreads();
 
+    if (mapArgs.count("-pubport"))
+    {
+        std::string strError;
+        if (!StartPublisher((unsigned short)GetArg("-pubport", 0), strError))
+            return InitError(strError);
+    }
+
     // Generate coins in the background
     GenerateBitcoins(GetBoolArg("-gen", false), pwalletMain);
 
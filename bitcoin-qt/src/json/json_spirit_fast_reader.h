@@ -0,0 +1,408 @@
+#ifndef JSON_SPIRIT_FAST_READER
+#define JSON_SPIRIT_FAST_READER
+
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+///// Bitcoin: hand-written reader for RPC requests and replies
+
+#include "json_spirit_value.h"
+#include "json_spirit_reader_template.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace json_spirit
+{
+    // Recursive descent reader producing the same Values as read_string.
+    //
+    // Only plain JSON is handled here: numbers as the JSON grammar writes
+    // them, and the escapes \" \\ \/ \b \f \n \r \t and \uHHHH. Anything
+    // else, including all malformed input, is handed to the Spirit reader,
+    // so both readers accept and reject exactly the same documents.
+    //
+    // A first pass over the text counts the members of every array and
+    // object, so each one is reserved at its final size and the values
+    // already read into it are never copied by a reallocation. Strings are
+    // decoded straight into the Value that holds them.
+    class Fast_reader
+    {
+    public:
+        enum { MAX_DEPTH = 512 };
+
+        explicit Fast_reader( const std::string& s )
+        :   p_( s.data() )
+        ,   end_( s.data() + s.size() )
+        ,   next_size_( 0 )
+        {
+        }
+
+        bool read( Value& value )
+        {
+            skip_ws();
+
+            if( p_ != end_ && ( *p_ == '{' || *p_ == '[' ) ) index_sizes();
+
+            return read_value( value, 0 );
+        }
+
+    private:
+
+        const char* p_;
+        const char* end_;
+        std::vector< unsigned int > sizes_;  // member counts, in the order the containers open
+        size_t next_size_;
+
+        static bool is_ws( char c )
+        {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+        }
+
+        static bool is_digit( char c )
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        static int hex_value( char c )
+        {
+            if( c >= '0' && c <= '9' ) return c - '0';
+            if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+            if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+            return -1;
+        }
+
+        void skip_ws()
+        {
+            while( p_ != end_ && is_ws( *p_ ) ) ++p_;
+        }
+
+        // Count the members of the container starting at p_ and of all the
+        // containers nested in it. Malformed text only makes the counts
+        // wrong, which the second pass rejects anyway.
+        void index_sizes()
+        {
+            std::vector< size_t > open;
+
+            for( const char* p = p_; p != end_; )
+            {
+                const char c = *p++;
+
+                if( is_ws( c ) ) continue;
+
+                if( c == ']' || c == '}' )
+                {
+                    open.pop_back();
+                    if( open.empty() ) return;
+                    continue;
+                }
+
+                if( c == ',' )
+                {
+                    if( !open.empty() ) ++sizes_[ open.back() ];
+                    continue;
+                }
+
+                if( !open.empty() && sizes_[ open.back() ] == 0 ) sizes_[ open.back() ] = 1;
+
+                if( c == '{' || c == '[' )
+                {
+                    open.push_back( sizes_.size() );
+                    sizes_.push_back( 0 );
+                }
+                else if( c == '"' )
+                {
+                    while( p != end_ && *p != '"' )
+                    {
+                        if( *p == '\\' && ++p == end_ ) return;
+                        ++p;
+                    }
+                    if( p != end_ ) ++p;
+                }
+            }
+        }
+
+        size_t next_size()
+        {
+            return next_size_ < sizes_.size() ? sizes_[ next_size_++ ] : 0;
+        }
+
+        bool read_value( Value& value, int depth )
+        {
+            if( p_ == end_ ) return false;
+
+            switch( *p_ )
+            {
+                case '"':
+                    value = Value( std::string() );
+                    return read_string( value.get_str() );
+                case '{':
+                    return read_object( value, depth + 1 );
+                case '[':
+                    return read_array( value, depth + 1 );
+                case 't':
+                    return read_literal( "true", value, Value( true ) );
+                case 'f':
+                    return read_literal( "false", value, Value( false ) );
+                case 'n':
+                    return read_literal( "null", value, Value() );
+                default:
+                    return read_number( value );
+            }
+        }
+
+        bool read_literal( const char* literal, Value& value, const Value& literal_value )
+        {
+            const size_t len = strlen( literal );
+
+            if( size_t( end_ - p_ ) < len || memcmp( p_, literal, len ) != 0 ) return false;
+
+            p_ += len;
+            value = literal_value;
+            return true;
+        }
+
+        bool read_string( std::string& s )
+        {
+            const char* run = ++p_;  // skip the opening quote
+
+            while( p_ != end_ )
+            {
+                const char c = *p_;
+
+                if( c == '"' )
+                {
+                    s.append( run, p_++ );
+                    return true;
+                }
+
+                if( c != '\\' )
+                {
+                    ++p_;
+                    continue;
+                }
+
+                s.append( run, p_ );
+
+                if( end_ - p_ < 2 ) return false;
+
+                switch( p_[1] )
+                {
+                    case '"':  s += '"';  break;
+                    case '\\': s += '\\'; break;
+                    case '/':  s += '/';  break;
+                    case 'b':  s += '\b'; break;
+                    case 'f':  s += '\f'; break;
+                    case 'n':  s += '\n'; break;
+                    case 'r':  s += '\r'; break;
+                    case 't':  s += '\t'; break;
+                    case 'u':
+                    {
+                        if( end_ - p_ < 6 ) return false;
+
+                        int n = 0;
+                        for( int i = 2; i < 6; ++i )
+                        {
+                            const int h = hex_value( p_[i] );
+                            if( h < 0 ) return false;
+                            n = ( n << 4 ) + h;
+                        }
+                        s += char( n );  // the Spirit reader also keeps only the low byte
+                        p_ += 4;
+                        break;
+                    }
+                    default:
+                        return false;
+                }
+
+                p_ += 2;
+                run = p_;
+            }
+
+            return false;
+        }
+
+        bool read_array( Value& value, int depth )
+        {
+            if( depth > MAX_DEPTH ) return false;
+
+            ++p_;
+            value = Value( Array() );
+            Array& array = value.get_array();
+            array.reserve( next_size() );
+
+            skip_ws();
+            if( p_ != end_ && *p_ == ']' )
+            {
+                ++p_;
+                return true;
+            }
+
+            while( true )
+            {
+                array.push_back( Value() );
+                if( !read_value( array.back(), depth ) ) return false;
+
+                skip_ws();
+                if( p_ == end_ ) return false;
+
+                const char c = *p_++;
+
+                if( c == ']' ) return true;
+                if( c != ',' ) return false;
+
+                skip_ws();
+            }
+        }
+
+        bool read_object( Value& value, int depth )
+        {
+            if( depth > MAX_DEPTH ) return false;
+
+            ++p_;
+            value = Value( Object() );
+            Object& obj = value.get_obj();
+            obj.reserve( next_size() );
+
+            skip_ws();
+            if( p_ != end_ && *p_ == '}' )
+            {
+                ++p_;
+                return true;
+            }
+
+            while( true )
+            {
+                if( p_ == end_ || *p_ != '"' ) return false;
+
+                obj.push_back( Pair( std::string(), Value() ) );
+                Pair& pair = obj.back();
+                if( !read_string( pair.name_ ) ) return false;
+
+                skip_ws();
+                if( p_ == end_ || *p_++ != ':' ) return false;
+
+                skip_ws();
+                if( !read_value( pair.value_, depth ) ) return false;
+
+                skip_ws();
+                if( p_ == end_ ) return false;
+
+                const char c = *p_++;
+
+                if( c == '}' ) return true;
+                if( c != ',' ) return false;
+
+                skip_ws();
+            }
+        }
+
+        // -?digits(.digits)?([eE][+-]?digits)?, as an integer if there is
+        // no fraction or exponent. Signed values that do not fit in an
+        // int64 and reals with more than 19 significant digits or extreme
+        // exponents are left to the Spirit reader.
+        bool read_number( Value& value )
+        {
+            const bool negative = ( *p_ == '-' );
+            if( negative ) ++p_;
+
+            if( p_ == end_ || !is_digit( *p_ ) ) return false;
+
+            const boost::uint64_t max_mantissa = ~boost::uint64_t( 0 ) / 10 - 1;
+            boost::uint64_t mantissa = 0;
+            bool overflow = false;
+            int exponent = 0;
+            bool real = false;
+
+            while( p_ != end_ && is_digit( *p_ ) )
+            {
+                const unsigned int digit = *p_++ - '0';
+
+                if( mantissa > ( ~boost::uint64_t( 0 ) - digit ) / 10 ) overflow = true;
+                mantissa = mantissa * 10 + digit;
+            }
+
+            if( p_ != end_ && *p_ == '.' )
+            {
+                ++p_;
+                if( p_ == end_ || !is_digit( *p_ ) ) return false;
+
+                real = true;
+                while( p_ != end_ && is_digit( *p_ ) )
+                {
+                    if( mantissa > max_mantissa ) overflow = true;
+                    mantissa = mantissa * 10 + ( *p_++ - '0' );
+                    --exponent;
+                }
+            }
+
+            if( p_ != end_ && ( *p_ == 'e' || *p_ == 'E' ) )
+            {
+                ++p_;
+                bool negative_exp = false;
+                if( p_ != end_ && ( *p_ == '+' || *p_ == '-' ) ) negative_exp = ( *p_++ == '-' );
+                if( p_ == end_ || !is_digit( *p_ ) ) return false;
+
+                real = true;
+                int exp = 0;
+                while( p_ != end_ && is_digit( *p_ ) )
+                {
+                    if( exp > 1000 ) return false;
+                    exp = exp * 10 + ( *p_++ - '0' );
+                }
+                exponent += negative_exp ? -exp : exp;
+            }
+
+            // let the Spirit reader decide what "1.", "0x1" or "1e" are
+            if( p_ != end_ && ( *p_ == '.' || *p_ == '+' || *p_ == '-' || *p_ == '_' ||
+                                is_digit( *p_ ) || ( ( *p_ | 0x20 ) >= 'a' && ( *p_ | 0x20 ) <= 'z' ) ) )
+            {
+                return false;
+            }
+
+            if( overflow ) return false;
+
+            if( !real )
+            {
+                if( negative )
+                {
+                    if( mantissa > boost::uint64_t( 1 ) << 63 ) return false;
+                    value = Value( boost::int64_t( 0 - mantissa ) );
+                }
+                else if( mantissa >> 63 )
+                {
+                    value = Value( mantissa );
+                }
+                else
+                {
+                    value = Value( boost::int64_t( mantissa ) );
+                }
+                return true;
+            }
+
+            if( exponent > 300 || exponent < -300 ) return false;
+
+            double d = double( mantissa );
+            if( exponent > 0 )
+                d *= pow( 10.0, exponent );
+            else if( exponent < 0 )
+                d /= pow( 10.0, -exponent );
+
+            value = Value( negative ? -d : d );
+            return true;
+        }
+    };
+
+    inline bool read_string_fast( const std::string& s, Value& value )
+    {
+        Fast_reader reader( s );
+
+        if( reader.read( value ) ) return true;
+
+        return read_string( s, value );
+    }
+}
+
+#endif
@@ -71,6 +71,7 @@ namespace json_spirit
 
         Object& get_obj();
         Array&  get_array();
+        String_type& get_str();  ///// Bitcoin: lets the fast reader decode strings in place
 
         template< typename T > T get_value() const;  // example usage: int    i = value.get_value< int >();
                                                      // or             double d = value.get_value< double >();
@@ -435,6 +436,14 @@ namespace json_spirit
         return *boost::get< Array >( &v_ );
     }
 
+    template< class Config >
+    typename Config::String_type& Value_impl< Config >::get_str()
+    {
+        check_type(  str_type );
+
+        return *boost::get< String_type >( &v_ );
+    }
+
     template< class Config >
     Pair_impl< Config >::Pair_impl( const String_type& name, const Value_type& value )
     :   name_( name )
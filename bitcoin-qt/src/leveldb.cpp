@@ -12,6 +12,8 @@
 
 #include <boost/filesystem.hpp>
 
+#include <sstream>
+
 void HandleError(const leveldb::Status &status) throw(leveldb_error) {
     if (status.ok())
         return;
@@ -24,23 +26,23 @@ void HandleError(const leveldb::Status &status) throw(leveldb_error) {
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize) {
+static leveldb::Options GetOptions(const CLevelDBProfile &profile) {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.block_cache = leveldb::NewLRUCache(profile.nBlockCacheSize);
+    options.write_buffer_size = profile.nWriteBufferSize;
+    options.filter_policy = profile.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(profile.nBloomBits) : NULL;
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.max_open_files = profile.nMaxOpenFiles;
     return options;
 }
 
-CLevelDB::CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory, bool fWipe) {
+CLevelDB::CLevelDB(const boost::filesystem::path &path, const CLevelDBProfile &profileIn, bool fMemory, bool fWipe) : profile(profileIn), nBytesWritten(0) {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -56,7 +58,8 @@ CLevelDB::CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     if (!status.ok())
         throw std::runtime_error(strprintf("CLevelDB(): error opening database environment %s", status.ToString().c_str()));
-    printf("Opened LevelDB successfully\n");
+    printf("Opened LevelDB successfully (cache %uMiB, write buffer %uMiB, %d open files)\n",
+           (unsigned int)(profile.nBlockCacheSize >> 20), (unsigned int)(profile.nWriteBufferSize >> 20), profile.nMaxOpenFiles);
 }
 
 CLevelDB::~CLevelDB() {
@@ -77,5 +80,37 @@ bool CLevelDB::WriteBatch(CLevelDBBatch &batch, bool fSync) throw(leveldb_error)
         HandleError(status);
         return false;
     }
+    LOCK(cs_stats);
+    nBytesWritten += batch.nSize;
+    return true;
+}
+
+bool CLevelDB::GetStats(CLevelDBStats &stats) const {
+    {
+        LOCK(cs_stats);
+        stats.nBytesWritten = nBytesWritten;
+    }
+
+    // LevelDB only reports its compaction counters as a table, one line per level
+    std::string strStats;
+    if (!pdb->GetProperty("leveldb.stats", &strStats))
+        return false;
+    std::istringstream ss(strStats);
+    std::string strLine;
+    while (std::getline(ss, strLine)) {
+        int nLevel, nFiles;
+        double dSize, dTime, dRead, dWrite;
+        if (sscanf(strLine.c_str(), "%d %d %lf %lf %lf %lf", &nLevel, &nFiles, &dSize, &dTime, &dRead, &dWrite) != 6)
+            continue;
+        stats.nTables += nFiles;
+        stats.nTableBytes += (uint64)(dSize * 1048576);
+        stats.dCompactionTime += dTime;
+        stats.nCompactionRead += (uint64)(dRead * 1048576);
+        stats.nCompactionWritten += (uint64)(dWrite * 1048576);
+    }
     return true;
 }
+
+void CLevelDB::CompactRange(const leveldb::Slice *pbegin, const leveldb::Slice *pend) {
+    pdb->CompactRange(pbegin, pend);
+}
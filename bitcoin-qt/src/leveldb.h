@@ -5,6 +5,7 @@
 #define BITCOIN_LEVELDB_H
 
 #include "serialize.h"
+#include "sync.h"
 
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
@@ -26,8 +27,13 @@ class CLevelDBBatch
 
 private:
     leveldb::WriteBatch batch;
+    size_t nSize; // bytes of keys and values queued
 
 public:
+    CLevelDBBatch() : nSize(0) {}
+
+    bool IsEmpty() const { return nSize == 0; }
+
     template<typename K, typename V> void Write(const K& key, const V& value) {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
@@ -40,6 +46,7 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        nSize += ssKey.size() + ssValue.size();
     }
 
     template<typename K> void Erase(const K& key) {
@@ -49,6 +56,36 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        nSize += ssKey.size();
+    }
+};
+
+// Tuning of a CLevelDB, chosen per database by its owner
+struct CLevelDBProfile
+{
+    size_t nBlockCacheSize;  // LRU cache of uncompressed table blocks
+    size_t nWriteBufferSize; // memtable size; up to two may be held in memory at once
+    int nMaxOpenFiles;       // tables kept open in the table cache
+    int nBloomBits;          // bloom filter bits per key (0 = no filter)
+
+    CLevelDBProfile(size_t nCacheSize = 0) : nBlockCacheSize(nCacheSize / 2), nWriteBufferSize(nCacheSize / 4), nMaxOpenFiles(64), nBloomBits(10) {}
+};
+
+// Write and compaction counters of a CLevelDB
+struct CLevelDBStats
+{
+    uint64 nBytesWritten;      // bytes of keys and values written since opening
+    uint64 nTableBytes;        // size of all tables
+    int nTables;
+    uint64 nCompactionRead;    // bytes read by compactions
+    uint64 nCompactionWritten; // bytes of tables written, memtable flushes included
+    double dCompactionTime;    // seconds spent compacting
+
+    CLevelDBStats() : nBytesWritten(0), nTableBytes(0), nTables(0), nCompactionRead(0), nCompactionWritten(0), dCompactionTime(0) {}
+
+    // bytes that reached the disk (log and tables) per byte written
+    double GetWriteAmplification() const {
+        return nBytesWritten ? (double)(nBytesWritten + nCompactionWritten) / nBytesWritten : 0;
     }
 };
 
@@ -76,8 +113,14 @@ private:
     // the database itself
     leveldb::DB *pdb;
 
+    // tuning the database was opened with
+    CLevelDBProfile profile;
+
+    mutable CCriticalSection cs_stats;
+    uint64 nBytesWritten;
+
 public:
-    CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDB(const boost::filesystem::path &path, const CLevelDBProfile &profileIn, bool fMemory = false, bool fWipe = false);
     ~CLevelDB();
 
     template<typename K, typename V> bool Read(const K& key, V& value) throw(leveldb_error) {
@@ -144,6 +187,15 @@ public:
         return WriteBatch(batch, true);
     }
 
+    const CLevelDBProfile &GetProfile() const {
+        return profile;
+    }
+
+    bool GetStats(CLevelDBStats &stats) const;
+
+    // Compact the tables holding keys in [begin, end); NULL means unbounded
+    void CompactRange(const leveldb::Slice *pbegin, const leveldb::Slice *pend);
+
     // not exactly clean encapsulation, but it's easiest for now
     leveldb::Iterator *NewIterator() {
         return pdb->NewIterator(iteroptions);
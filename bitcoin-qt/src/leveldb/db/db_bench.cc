@@ -94,6 +94,10 @@ static int FLAGS_open_files = 0;
 // Negative means use default settings.
 static int FLAGS_bloom_bits = -1;
 
+// If true, reads check the crc32c of every block they fetch, as the
+// Bitcoin coin database does.
+static bool FLAGS_verify_checksums = false;
+
 // If true, do not destroy the existing database.  If you set this
 // flag and also specify a benchmark that wants a fresh database, that
 // benchmark will fail.
@@ -319,6 +323,9 @@ class Benchmark {
             FLAGS_value_size,
             static_cast<int>(FLAGS_value_size * FLAGS_compression_ratio + 0.5));
     fprintf(stdout, "Entries:    %d\n", num_);
+    fprintf(stdout, "Checksums:  %s, crc32c %s\n",
+            FLAGS_verify_checksums ? "verified" : "not verified",
+            crc32c::IsAccelerated() ? "accelerated" : "portable");
     fprintf(stdout, "RawSize:    %.1f MB (estimated)\n",
             ((static_cast<int64_t>(kKeySize + FLAGS_value_size) * num_)
              / 1048576.0));
@@ -768,6 +775,7 @@ class Benchmark {
 
   void ReadRandom(ThreadState* thread) {
     ReadOptions options;
+    options.verify_checksums = FLAGS_verify_checksums;
     std::string value;
     int found = 0;
     for (int i = 0; i < reads_; i++) {
@@ -786,6 +794,7 @@ class Benchmark {
 
   void ReadMissing(ThreadState* thread) {
     ReadOptions options;
+    options.verify_checksums = FLAGS_verify_checksums;
     std::string value;
     for (int i = 0; i < reads_; i++) {
       char key[100];
@@ -798,6 +807,7 @@ class Benchmark {
 
   void ReadHot(ThreadState* thread) {
     ReadOptions options;
+    options.verify_checksums = FLAGS_verify_checksums;
     std::string value;
     const int range = (FLAGS_num + 99) / 100;
     for (int i = 0; i < reads_; i++) {
@@ -811,6 +821,7 @@ class Benchmark {
 
   void SeekRandom(ThreadState* thread) {
     ReadOptions options;
+    options.verify_checksums = FLAGS_verify_checksums;
     std::string value;
     int found = 0;
     for (int i = 0; i < reads_; i++) {
@@ -939,6 +950,9 @@ int main(int argc, char** argv) {
     } else if (sscanf(argv[i], "--histogram=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_histogram = n;
+    } else if (sscanf(argv[i], "--verify_checksums=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_verify_checksums = n;
     } else if (sscanf(argv[i], "--use_existing_db=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_use_existing_db = n;
@@ -0,0 +1,103 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// crc32c using the SSE 4.2 crc32 instruction.  This is a separate file so
+// that only it is compiled with -msse4.2; whether the CPU actually has the
+// instruction is checked at runtime, see util/crc32c.cc.
+
+#include <stdint.h>
+#include <string.h>
+#include "port/port.h"
+
+#if defined(LEVELDB_PLATFORM_POSIX_SSE)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <nmmintrin.h>
+#elif defined(__GNUC__) && defined(__SSE4_2__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#else
+#undef LEVELDB_PLATFORM_POSIX_SSE
+#endif
+#endif
+
+namespace leveldb {
+namespace port {
+
+#if defined(LEVELDB_PLATFORM_POSIX_SSE)
+
+// x86 is little endian, and tolerates unaligned loads
+static inline uint32_t LoadLE32(const uint8_t* p) {
+  uint32_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+#if defined(_M_X64) || defined(__x86_64__)
+static inline uint64_t LoadLE64(const uint8_t* p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+#endif
+
+static bool HaveSSE42() {
+#if defined(_MSC_VER)
+  int cpu_info[4];
+  __cpuid(cpu_info, 1);
+  return (cpu_info[2] & (1 << 20)) != 0;
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return (ecx & bit_SSE4_2) != 0;
+#endif
+}
+
+#endif  // defined(LEVELDB_PLATFORM_POSIX_SSE)
+
+uint32_t AcceleratedCRC32C(uint32_t crc, const char* buf, size_t size) {
+#if !defined(LEVELDB_PLATFORM_POSIX_SSE)
+  return 0;
+#else
+  static const bool have = HaveSSE42();
+  if (!have) {
+    return 0;
+  }
+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
+  const uint8_t* e = p + size;
+  uint32_t l = crc ^ 0xffffffffu;
+
+  if (size >= 16) {
+    // Process bytes until p is 8-byte aligned
+    while (reinterpret_cast<uintptr_t>(p) & 7) {
+      l = _mm_crc32_u8(l, *p++);
+    }
+#if defined(_M_X64) || defined(__x86_64__)
+    // Process bytes 8 at a time (the 64-bit form only exists on x86-64)
+    uint64_t l64 = l;
+    while ((e-p) >= 8) {
+      l64 = _mm_crc32_u64(l64, LoadLE64(p));
+      p += 8;
+    }
+    l = static_cast<uint32_t>(l64);
+#endif
+  }
+  // Process bytes 4 at a time
+  while ((e-p) >= 4) {
+    l = _mm_crc32_u32(l, LoadLE32(p));
+    p += 4;
+  }
+  // Process the last few bytes
+  while (p != e) {
+    l = _mm_crc32_u8(l, *p++);
+  }
+  return l ^ 0xffffffffu;
+#endif  // defined(LEVELDB_PLATFORM_POSIX_SSE)
+}
+
+}  // namespace port
+}  // namespace leveldb
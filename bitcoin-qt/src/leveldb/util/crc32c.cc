@@ -3,11 +3,13 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 //
 // A portable implementation of crc32c, optimized to handle
-// four bytes at a time.
+// eight bytes at a time.  Where the CPU has a crc32 instruction
+// (x86 with SSE 4.2), port::AcceleratedCRC32C is used instead.
 
 #include "util/crc32c.h"
 
 #include <stdint.h>
+#include "port/port.h"
 #include "util/coding.h"
 
 namespace leveldb {
@@ -277,13 +279,277 @@ static const uint32_t table3_[256] = {
   0x31035088, 0xec46fa30, 0x8e647309, 0x5321d9b1,
   0x4a21617b, 0x9764cbc3, 0xf54642fa, 0x2803e842
 };
+static const uint32_t table4_[256] = {
+  0x00000000, 0x38116fac, 0x7022df58, 0x4833b0f4,
+  0xe045beb0, 0xd854d11c, 0x906761e8, 0xa8760e44,
+  0xc5670b91, 0xfd76643d, 0xb545d4c9, 0x8d54bb65,
+  0x2522b521, 0x1d33da8d, 0x55006a79, 0x6d1105d5,
+  0x8f2261d3, 0xb7330e7f, 0xff00be8b, 0xc711d127,
+  0x6f67df63, 0x5776b0cf, 0x1f45003b, 0x27546f97,
+  0x4a456a42, 0x725405ee, 0x3a67b51a, 0x0276dab6,
+  0xaa00d4f2, 0x9211bb5e, 0xda220baa, 0xe2336406,
+  0x1ba8b557, 0x23b9dafb, 0x6b8a6a0f, 0x539b05a3,
+  0xfbed0be7, 0xc3fc644b, 0x8bcfd4bf, 0xb3debb13,
+  0xdecfbec6, 0xe6ded16a, 0xaeed619e, 0x96fc0e32,
+  0x3e8a0076, 0x069b6fda, 0x4ea8df2e, 0x76b9b082,
+  0x948ad484, 0xac9bbb28, 0xe4a80bdc, 0xdcb96470,
+  0x74cf6a34, 0x4cde0598, 0x04edb56c, 0x3cfcdac0,
+  0x51eddf15, 0x69fcb0b9, 0x21cf004d, 0x19de6fe1,
+  0xb1a861a5, 0x89b90e09, 0xc18abefd, 0xf99bd151,
+  0x37516aae, 0x0f400502, 0x4773b5f6, 0x7f62da5a,
+  0xd714d41e, 0xef05bbb2, 0xa7360b46, 0x9f2764ea,
+  0xf236613f, 0xca270e93, 0x8214be67, 0xba05d1cb,
+  0x1273df8f, 0x2a62b023, 0x625100d7, 0x5a406f7b,
+  0xb8730b7d, 0x806264d1, 0xc851d425, 0xf040bb89,
+  0x5836b5cd, 0x6027da61, 0x28146a95, 0x10050539,
+  0x7d1400ec, 0x45056f40, 0x0d36dfb4, 0x3527b018,
+  0x9d51be5c, 0xa540d1f0, 0xed736104, 0xd5620ea8,
+  0x2cf9dff9, 0x14e8b055, 0x5cdb00a1, 0x64ca6f0d,
+  0xccbc6149, 0xf4ad0ee5, 0xbc9ebe11, 0x848fd1bd,
+  0xe99ed468, 0xd18fbbc4, 0x99bc0b30, 0xa1ad649c,
+  0x09db6ad8, 0x31ca0574, 0x79f9b580, 0x41e8da2c,
+  0xa3dbbe2a, 0x9bcad186, 0xd3f96172, 0xebe80ede,
+  0x439e009a, 0x7b8f6f36, 0x33bcdfc2, 0x0badb06e,
+  0x66bcb5bb, 0x5eadda17, 0x169e6ae3, 0x2e8f054f,
+  0x86f90b0b, 0xbee864a7, 0xf6dbd453, 0xcecabbff,
+  0x6ea2d55c, 0x56b3baf0, 0x1e800a04, 0x269165a8,
+  0x8ee76bec, 0xb6f60440, 0xfec5b4b4, 0xc6d4db18,
+  0xabc5decd, 0x93d4b161, 0xdbe70195, 0xe3f66e39,
+  0x4b80607d, 0x73910fd1, 0x3ba2bf25, 0x03b3d089,
+  0xe180b48f, 0xd991db23, 0x91a26bd7, 0xa9b3047b,
+  0x01c50a3f, 0x39d46593, 0x71e7d567, 0x49f6bacb,
+  0x24e7bf1e, 0x1cf6d0b2, 0x54c56046, 0x6cd40fea,
+  0xc4a201ae, 0xfcb36e02, 0xb480def6, 0x8c91b15a,
+  0x750a600b, 0x4d1b0fa7, 0x0528bf53, 0x3d39d0ff,
+  0x954fdebb, 0xad5eb117, 0xe56d01e3, 0xdd7c6e4f,
+  0xb06d6b9a, 0x887c0436, 0xc04fb4c2, 0xf85edb6e,
+  0x5028d52a, 0x6839ba86, 0x200a0a72, 0x181b65de,
+  0xfa2801d8, 0xc2396e74, 0x8a0ade80, 0xb21bb12c,
+  0x1a6dbf68, 0x227cd0c4, 0x6a4f6030, 0x525e0f9c,
+  0x3f4f0a49, 0x075e65e5, 0x4f6dd511, 0x777cbabd,
+  0xdf0ab4f9, 0xe71bdb55, 0xaf286ba1, 0x9739040d,
+  0x59f3bff2, 0x61e2d05e, 0x29d160aa, 0x11c00f06,
+  0xb9b60142, 0x81a76eee, 0xc994de1a, 0xf185b1b6,
+  0x9c94b463, 0xa485dbcf, 0xecb66b3b, 0xd4a70497,
+  0x7cd10ad3, 0x44c0657f, 0x0cf3d58b, 0x34e2ba27,
+  0xd6d1de21, 0xeec0b18d, 0xa6f30179, 0x9ee26ed5,
+  0x36946091, 0x0e850f3d, 0x46b6bfc9, 0x7ea7d065,
+  0x13b6d5b0, 0x2ba7ba1c, 0x63940ae8, 0x5b856544,
+  0xf3f36b00, 0xcbe204ac, 0x83d1b458, 0xbbc0dbf4,
+  0x425b0aa5, 0x7a4a6509, 0x3279d5fd, 0x0a68ba51,
+  0xa21eb415, 0x9a0fdbb9, 0xd23c6b4d, 0xea2d04e1,
+  0x873c0134, 0xbf2d6e98, 0xf71ede6c, 0xcf0fb1c0,
+  0x6779bf84, 0x5f68d028, 0x175b60dc, 0x2f4a0f70,
+  0xcd796b76, 0xf56804da, 0xbd5bb42e, 0x854adb82,
+  0x2d3cd5c6, 0x152dba6a, 0x5d1e0a9e, 0x650f6532,
+  0x081e60e7, 0x300f0f4b, 0x783cbfbf, 0x402dd013,
+  0xe85bde57, 0xd04ab1fb, 0x9879010f, 0xa0686ea3
+};
+static const uint32_t table5_[256] = {
+  0x00000000, 0xef306b19, 0xdb8ca0c3, 0x34bccbda,
+  0xb2f53777, 0x5dc55c6e, 0x697997b4, 0x8649fcad,
+  0x6006181f, 0x8f367306, 0xbb8ab8dc, 0x54bad3c5,
+  0xd2f32f68, 0x3dc34471, 0x097f8fab, 0xe64fe4b2,
+  0xc00c303e, 0x2f3c5b27, 0x1b8090fd, 0xf4b0fbe4,
+  0x72f90749, 0x9dc96c50, 0xa975a78a, 0x4645cc93,
+  0xa00a2821, 0x4f3a4338, 0x7b8688e2, 0x94b6e3fb,
+  0x12ff1f56, 0xfdcf744f, 0xc973bf95, 0x2643d48c,
+  0x85f4168d, 0x6ac47d94, 0x5e78b64e, 0xb148dd57,
+  0x370121fa, 0xd8314ae3, 0xec8d8139, 0x03bdea20,
+  0xe5f20e92, 0x0ac2658b, 0x3e7eae51, 0xd14ec548,
+  0x570739e5, 0xb83752fc, 0x8c8b9926, 0x63bbf23f,
+  0x45f826b3, 0xaac84daa, 0x9e748670, 0x7144ed69,
+  0xf70d11c4, 0x183d7add, 0x2c81b107, 0xc3b1da1e,
+  0x25fe3eac, 0xcace55b5, 0xfe729e6f, 0x1142f576,
+  0x970b09db, 0x783b62c2, 0x4c87a918, 0xa3b7c201,
+  0x0e045beb, 0xe13430f2, 0xd588fb28, 0x3ab89031,
+  0xbcf16c9c, 0x53c10785, 0x677dcc5f, 0x884da746,
+  0x6e0243f4, 0x813228ed, 0xb58ee337, 0x5abe882e,
+  0xdcf77483, 0x33c71f9a, 0x077bd440, 0xe84bbf59,
+  0xce086bd5, 0x213800cc, 0x1584cb16, 0xfab4a00f,
+  0x7cfd5ca2, 0x93cd37bb, 0xa771fc61, 0x48419778,
+  0xae0e73ca, 0x413e18d3, 0x7582d309, 0x9ab2b810,
+  0x1cfb44bd, 0xf3cb2fa4, 0xc777e47e, 0x28478f67,
+  0x8bf04d66, 0x64c0267f, 0x507ceda5, 0xbf4c86bc,
+  0x39057a11, 0xd6351108, 0xe289dad2, 0x0db9b1cb,
+  0xebf65579, 0x04c63e60, 0x307af5ba, 0xdf4a9ea3,
+  0x5903620e, 0xb6330917, 0x828fc2cd, 0x6dbfa9d4,
+  0x4bfc7d58, 0xa4cc1641, 0x9070dd9b, 0x7f40b682,
+  0xf9094a2f, 0x16392136, 0x2285eaec, 0xcdb581f5,
+  0x2bfa6547, 0xc4ca0e5e, 0xf076c584, 0x1f46ae9d,
+  0x990f5230, 0x763f3929, 0x4283f2f3, 0xadb399ea,
+  0x1c08b7d6, 0xf338dccf, 0xc7841715, 0x28b47c0c,
+  0xaefd80a1, 0x41cdebb8, 0x75712062, 0x9a414b7b,
+  0x7c0eafc9, 0x933ec4d0, 0xa7820f0a, 0x48b26413,
+  0xcefb98be, 0x21cbf3a7, 0x1577387d, 0xfa475364,
+  0xdc0487e8, 0x3334ecf1, 0x0788272b, 0xe8b84c32,
+  0x6ef1b09f, 0x81c1db86, 0xb57d105c, 0x5a4d7b45,
+  0xbc029ff7, 0x5332f4ee, 0x678e3f34, 0x88be542d,
+  0x0ef7a880, 0xe1c7c399, 0xd57b0843, 0x3a4b635a,
+  0x99fca15b, 0x76ccca42, 0x42700198, 0xad406a81,
+  0x2b09962c, 0xc439fd35, 0xf08536ef, 0x1fb55df6,
+  0xf9fab944, 0x16cad25d, 0x22761987, 0xcd46729e,
+  0x4b0f8e33, 0xa43fe52a, 0x90832ef0, 0x7fb345e9,
+  0x59f09165, 0xb6c0fa7c, 0x827c31a6, 0x6d4c5abf,
+  0xeb05a612, 0x0435cd0b, 0x308906d1, 0xdfb96dc8,
+  0x39f6897a, 0xd6c6e263, 0xe27a29b9, 0x0d4a42a0,
+  0x8b03be0d, 0x6433d514, 0x508f1ece, 0xbfbf75d7,
+  0x120cec3d, 0xfd3c8724, 0xc9804cfe, 0x26b027e7,
+  0xa0f9db4a, 0x4fc9b053, 0x7b757b89, 0x94451090,
+  0x720af422, 0x9d3a9f3b, 0xa98654e1, 0x46b63ff8,
+  0xc0ffc355, 0x2fcfa84c, 0x1b736396, 0xf443088f,
+  0xd200dc03, 0x3d30b71a, 0x098c7cc0, 0xe6bc17d9,
+  0x60f5eb74, 0x8fc5806d, 0xbb794bb7, 0x544920ae,
+  0xb206c41c, 0x5d36af05, 0x698a64df, 0x86ba0fc6,
+  0x00f3f36b, 0xefc39872, 0xdb7f53a8, 0x344f38b1,
+  0x97f8fab0, 0x78c891a9, 0x4c745a73, 0xa344316a,
+  0x250dcdc7, 0xca3da6de, 0xfe816d04, 0x11b1061d,
+  0xf7fee2af, 0x18ce89b6, 0x2c72426c, 0xc3422975,
+  0x450bd5d8, 0xaa3bbec1, 0x9e87751b, 0x71b71e02,
+  0x57f4ca8e, 0xb8c4a197, 0x8c786a4d, 0x63480154,
+  0xe501fdf9, 0x0a3196e0, 0x3e8d5d3a, 0xd1bd3623,
+  0x37f2d291, 0xd8c2b988, 0xec7e7252, 0x034e194b,
+  0x8507e5e6, 0x6a378eff, 0x5e8b4525, 0xb1bb2e3c
+};
+static const uint32_t table6_[256] = {
+  0x00000000, 0x68032cc8, 0xd0065990, 0xb8057558,
+  0xa5e0c5d1, 0xcde3e919, 0x75e69c41, 0x1de5b089,
+  0x4e2dfd53, 0x262ed19b, 0x9e2ba4c3, 0xf628880b,
+  0xebcd3882, 0x83ce144a, 0x3bcb6112, 0x53c84dda,
+  0x9c5bfaa6, 0xf458d66e, 0x4c5da336, 0x245e8ffe,
+  0x39bb3f77, 0x51b813bf, 0xe9bd66e7, 0x81be4a2f,
+  0xd27607f5, 0xba752b3d, 0x02705e65, 0x6a7372ad,
+  0x7796c224, 0x1f95eeec, 0xa7909bb4, 0xcf93b77c,
+  0x3d5b83bd, 0x5558af75, 0xed5dda2d, 0x855ef6e5,
+  0x98bb466c, 0xf0b86aa4, 0x48bd1ffc, 0x20be3334,
+  0x73767eee, 0x1b755226, 0xa370277e, 0xcb730bb6,
+  0xd696bb3f, 0xbe9597f7, 0x0690e2af, 0x6e93ce67,
+  0xa100791b, 0xc90355d3, 0x7106208b, 0x19050c43,
+  0x04e0bcca, 0x6ce39002, 0xd4e6e55a, 0xbce5c992,
+  0xef2d8448, 0x872ea880, 0x3f2bddd8, 0x5728f110,
+  0x4acd4199, 0x22ce6d51, 0x9acb1809, 0xf2c834c1,
+  0x7ab7077a, 0x12b42bb2, 0xaab15eea, 0xc2b27222,
+  0xdf57c2ab, 0xb754ee63, 0x0f519b3b, 0x6752b7f3,
+  0x349afa29, 0x5c99d6e1, 0xe49ca3b9, 0x8c9f8f71,
+  0x917a3ff8, 0xf9791330, 0x417c6668, 0x297f4aa0,
+  0xe6ecfddc, 0x8eefd114, 0x36eaa44c, 0x5ee98884,
+  0x430c380d, 0x2b0f14c5, 0x930a619d, 0xfb094d55,
+  0xa8c1008f, 0xc0c22c47, 0x78c7591f, 0x10c475d7,
+  0x0d21c55e, 0x6522e996, 0xdd279cce, 0xb524b006,
+  0x47ec84c7, 0x2fefa80f, 0x97eadd57, 0xffe9f19f,
+  0xe20c4116, 0x8a0f6dde, 0x320a1886, 0x5a09344e,
+  0x09c17994, 0x61c2555c, 0xd9c72004, 0xb1c40ccc,
+  0xac21bc45, 0xc422908d, 0x7c27e5d5, 0x1424c91d,
+  0xdbb77e61, 0xb3b452a9, 0x0bb127f1, 0x63b20b39,
+  0x7e57bbb0, 0x16549778, 0xae51e220, 0xc652cee8,
+  0x959a8332, 0xfd99affa, 0x459cdaa2, 0x2d9ff66a,
+  0x307a46e3, 0x58796a2b, 0xe07c1f73, 0x887f33bb,
+  0xf56e0ef4, 0x9d6d223c, 0x25685764, 0x4d6b7bac,
+  0x508ecb25, 0x388de7ed, 0x808892b5, 0xe88bbe7d,
+  0xbb43f3a7, 0xd340df6f, 0x6b45aa37, 0x034686ff,
+  0x1ea33676, 0x76a01abe, 0xcea56fe6, 0xa6a6432e,
+  0x6935f452, 0x0136d89a, 0xb933adc2, 0xd130810a,
+  0xccd53183, 0xa4d61d4b, 0x1cd36813, 0x74d044db,
+  0x27180901, 0x4f1b25c9, 0xf71e5091, 0x9f1d7c59,
+  0x82f8ccd0, 0xeafbe018, 0x52fe9540, 0x3afdb988,
+  0xc8358d49, 0xa036a181, 0x1833d4d9, 0x7030f811,
+  0x6dd54898, 0x05d66450, 0xbdd31108, 0xd5d03dc0,
+  0x8618701a, 0xee1b5cd2, 0x561e298a, 0x3e1d0542,
+  0x23f8b5cb, 0x4bfb9903, 0xf3feec5b, 0x9bfdc093,
+  0x546e77ef, 0x3c6d5b27, 0x84682e7f, 0xec6b02b7,
+  0xf18eb23e, 0x998d9ef6, 0x2188ebae, 0x498bc766,
+  0x1a438abc, 0x7240a674, 0xca45d32c, 0xa246ffe4,
+  0xbfa34f6d, 0xd7a063a5, 0x6fa516fd, 0x07a63a35,
+  0x8fd9098e, 0xe7da2546, 0x5fdf501e, 0x37dc7cd6,
+  0x2a39cc5f, 0x423ae097, 0xfa3f95cf, 0x923cb907,
+  0xc1f4f4dd, 0xa9f7d815, 0x11f2ad4d, 0x79f18185,
+  0x6414310c, 0x0c171dc4, 0xb412689c, 0xdc114454,
+  0x1382f328, 0x7b81dfe0, 0xc384aab8, 0xab878670,
+  0xb66236f9, 0xde611a31, 0x66646f69, 0x0e6743a1,
+  0x5daf0e7b, 0x35ac22b3, 0x8da957eb, 0xe5aa7b23,
+  0xf84fcbaa, 0x904ce762, 0x2849923a, 0x404abef2,
+  0xb2828a33, 0xda81a6fb, 0x6284d3a3, 0x0a87ff6b,
+  0x17624fe2, 0x7f61632a, 0xc7641672, 0xaf673aba,
+  0xfcaf7760, 0x94ac5ba8, 0x2ca92ef0, 0x44aa0238,
+  0x594fb2b1, 0x314c9e79, 0x8949eb21, 0xe14ac7e9,
+  0x2ed97095, 0x46da5c5d, 0xfedf2905, 0x96dc05cd,
+  0x8b39b544, 0xe33a998c, 0x5b3fecd4, 0x333cc01c,
+  0x60f48dc6, 0x08f7a10e, 0xb0f2d456, 0xd8f1f89e,
+  0xc5144817, 0xad1764df, 0x15121187, 0x7d113d4f
+};
+static const uint32_t table7_[256] = {
+  0x00000000, 0x493c7d27, 0x9278fa4e, 0xdb448769,
+  0x211d826d, 0x6821ff4a, 0xb3657823, 0xfa590504,
+  0x423b04da, 0x0b0779fd, 0xd043fe94, 0x997f83b3,
+  0x632686b7, 0x2a1afb90, 0xf15e7cf9, 0xb86201de,
+  0x847609b4, 0xcd4a7493, 0x160ef3fa, 0x5f328edd,
+  0xa56b8bd9, 0xec57f6fe, 0x37137197, 0x7e2f0cb0,
+  0xc64d0d6e, 0x8f717049, 0x5435f720, 0x1d098a07,
+  0xe7508f03, 0xae6cf224, 0x7528754d, 0x3c14086a,
+  0x0d006599, 0x443c18be, 0x9f789fd7, 0xd644e2f0,
+  0x2c1de7f4, 0x65219ad3, 0xbe651dba, 0xf759609d,
+  0x4f3b6143, 0x06071c64, 0xdd439b0d, 0x947fe62a,
+  0x6e26e32e, 0x271a9e09, 0xfc5e1960, 0xb5626447,
+  0x89766c2d, 0xc04a110a, 0x1b0e9663, 0x5232eb44,
+  0xa86bee40, 0xe1579367, 0x3a13140e, 0x732f6929,
+  0xcb4d68f7, 0x827115d0, 0x593592b9, 0x1009ef9e,
+  0xea50ea9a, 0xa36c97bd, 0x782810d4, 0x31146df3,
+  0x1a00cb32, 0x533cb615, 0x8878317c, 0xc1444c5b,
+  0x3b1d495f, 0x72213478, 0xa965b311, 0xe059ce36,
+  0x583bcfe8, 0x1107b2cf, 0xca4335a6, 0x837f4881,
+  0x79264d85, 0x301a30a2, 0xeb5eb7cb, 0xa262caec,
+  0x9e76c286, 0xd74abfa1, 0x0c0e38c8, 0x453245ef,
+  0xbf6b40eb, 0xf6573dcc, 0x2d13baa5, 0x642fc782,
+  0xdc4dc65c, 0x9571bb7b, 0x4e353c12, 0x07094135,
+  0xfd504431, 0xb46c3916, 0x6f28be7f, 0x2614c358,
+  0x1700aeab, 0x5e3cd38c, 0x857854e5, 0xcc4429c2,
+  0x361d2cc6, 0x7f2151e1, 0xa465d688, 0xed59abaf,
+  0x553baa71, 0x1c07d756, 0xc743503f, 0x8e7f2d18,
+  0x7426281c, 0x3d1a553b, 0xe65ed252, 0xaf62af75,
+  0x9376a71f, 0xda4ada38, 0x010e5d51, 0x48322076,
+  0xb26b2572, 0xfb575855, 0x2013df3c, 0x692fa21b,
+  0xd14da3c5, 0x9871dee2, 0x4335598b, 0x0a0924ac,
+  0xf05021a8, 0xb96c5c8f, 0x6228dbe6, 0x2b14a6c1,
+  0x34019664, 0x7d3deb43, 0xa6796c2a, 0xef45110d,
+  0x151c1409, 0x5c20692e, 0x8764ee47, 0xce589360,
+  0x763a92be, 0x3f06ef99, 0xe44268f0, 0xad7e15d7,
+  0x572710d3, 0x1e1b6df4, 0xc55fea9d, 0x8c6397ba,
+  0xb0779fd0, 0xf94be2f7, 0x220f659e, 0x6b3318b9,
+  0x916a1dbd, 0xd856609a, 0x0312e7f3, 0x4a2e9ad4,
+  0xf24c9b0a, 0xbb70e62d, 0x60346144, 0x29081c63,
+  0xd3511967, 0x9a6d6440, 0x4129e329, 0x08159e0e,
+  0x3901f3fd, 0x703d8eda, 0xab7909b3, 0xe2457494,
+  0x181c7190, 0x51200cb7, 0x8a648bde, 0xc358f6f9,
+  0x7b3af727, 0x32068a00, 0xe9420d69, 0xa07e704e,
+  0x5a27754a, 0x131b086d, 0xc85f8f04, 0x8163f223,
+  0xbd77fa49, 0xf44b876e, 0x2f0f0007, 0x66337d20,
+  0x9c6a7824, 0xd5560503, 0x0e12826a, 0x472eff4d,
+  0xff4cfe93, 0xb67083b4, 0x6d3404dd, 0x240879fa,
+  0xde517cfe, 0x976d01d9, 0x4c2986b0, 0x0515fb97,
+  0x2e015d56, 0x673d2071, 0xbc79a718, 0xf545da3f,
+  0x0f1cdf3b, 0x4620a21c, 0x9d642575, 0xd4585852,
+  0x6c3a598c, 0x250624ab, 0xfe42a3c2, 0xb77edee5,
+  0x4d27dbe1, 0x041ba6c6, 0xdf5f21af, 0x96635c88,
+  0xaa7754e2, 0xe34b29c5, 0x380faeac, 0x7133d38b,
+  0x8b6ad68f, 0xc256aba8, 0x19122cc1, 0x502e51e6,
+  0xe84c5038, 0xa1702d1f, 0x7a34aa76, 0x3308d751,
+  0xc951d255, 0x806daf72, 0x5b29281b, 0x1215553c,
+  0x230138cf, 0x6a3d45e8, 0xb179c281, 0xf845bfa6,
+  0x021cbaa2, 0x4b20c785, 0x906440ec, 0xd9583dcb,
+  0x613a3c15, 0x28064132, 0xf342c65b, 0xba7ebb7c,
+  0x4027be78, 0x091bc35f, 0xd25f4436, 0x9b633911,
+  0xa777317b, 0xee4b4c5c, 0x350fcb35, 0x7c33b612,
+  0x866ab316, 0xcf56ce31, 0x14124958, 0x5d2e347f,
+  0xe54c35a1, 0xac704886, 0x7734cfef, 0x3e08b2c8,
+  0xc451b7cc, 0x8d6dcaeb, 0x56294d82, 0x1f1530a5
+};
 
 // Used to fetch a naturally-aligned 32-bit word in little endian byte-order
 static inline uint32_t LE_LOAD32(const uint8_t *p) {
   return DecodeFixed32(reinterpret_cast<const char*>(p));
 }
 
-uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
+uint32_t ExtendPortable(uint32_t crc, const char* buf, size_t size) {
   const uint8_t *p = reinterpret_cast<const uint8_t *>(buf);
   const uint8_t *e = p + size;
   uint32_t l = crc ^ 0xffffffffu;
@@ -300,6 +566,19 @@ uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
         table1_[(c >> 16) & 0xff] ^             \
         table0_[c >> 24];                       \
 } while (0)
+#define STEP8 do {                              \
+    uint32_t c = l ^ LE_LOAD32(p);              \
+    uint32_t d = LE_LOAD32(p + 4);              \
+    p += 8;                                     \
+    l = table7_[c & 0xff] ^                     \
+        table6_[(c >> 8) & 0xff] ^              \
+        table5_[(c >> 16) & 0xff] ^             \
+        table4_[c >> 24] ^                      \
+        table3_[d & 0xff] ^                     \
+        table2_[(d >> 8) & 0xff] ^              \
+        table1_[(d >> 16) & 0xff] ^             \
+        table0_[d >> 24];                       \
+} while (0)
 
   // Point x at first 4-byte aligned byte in string.  This might be
   // just past the end of the string.
@@ -313,7 +592,11 @@ uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
   }
   // Process bytes 16 at a time
   while ((e-p) >= 16) {
-    STEP4; STEP4; STEP4; STEP4;
+    STEP8; STEP8;
+  }
+  // Process bytes 8 at a time
+  if ((e-p) >= 8) {
+    STEP8;
   }
   // Process bytes 4 at a time
   while ((e-p) >= 4) {
@@ -323,10 +606,32 @@ uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
   while (p != e) {
     STEP1;
   }
+#undef STEP8
 #undef STEP4
 #undef STEP1
   return l ^ 0xffffffffu;
 }
 
+// port::AcceleratedCRC32C returns 0 when the CPU (or the compiler) lacks
+// the crc32 instruction, which this known checksum tells apart.
+static bool CanAccelerateCRC32C() {
+  static const char kTestBuffer[] = "TestCRCBuffer";
+  static const uint32_t kTestValue = 0xdcbc59fa;
+  return port::AcceleratedCRC32C(0, kTestBuffer, sizeof(kTestBuffer) - 1) ==
+         kTestValue;
+}
+
+bool IsAccelerated() {
+  static const bool accelerate = CanAccelerateCRC32C();
+  return accelerate;
+}
+
+uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
+  if (IsAccelerated()) {
+    return port::AcceleratedCRC32C(crc, buf, size);
+  }
+  return ExtendPortable(crc, buf, size);
+}
+
 }  // namespace crc32c
 }  // namespace leveldb
@@ -16,6 +16,11 @@ namespace crc32c {
 // crc32c of a stream of data.
 extern uint32_t Extend(uint32_t init_crc, const char* data, size_t n);
 
+// Same as Extend(), always computed in software.  Extend() uses the
+// CPU's crc32 instruction instead when IsAccelerated().
+extern uint32_t ExtendPortable(uint32_t init_crc, const char* data, size_t n);
+extern bool IsAccelerated();
+
 // Return the crc32c of data[0,n-1]
 inline uint32_t Value(const char* data, size_t n) {
   return Extend(0, data, n);
@@ -3,6 +3,8 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "util/crc32c.h"
+#include "port/port.h"
+#include "util/random.h"
 #include "util/testharness.h"
 
 namespace leveldb {
@@ -47,6 +49,43 @@ TEST(CRC, StandardResults) {
   ASSERT_EQ(0xd9963a56, Value(reinterpret_cast<char*>(data), sizeof(data)));
 }
 
+TEST(CRC, PortableStandardResults) {
+  char buf[32];
+  memset(buf, 0, sizeof(buf));
+  ASSERT_EQ(0x8a9136aa, ExtendPortable(0, buf, sizeof(buf)));
+  memset(buf, 0xff, sizeof(buf));
+  ASSERT_EQ(0x62a8ab43, ExtendPortable(0, buf, sizeof(buf)));
+}
+
+// Every length and alignment goes through each of the byte, 4-byte and
+// 8-byte steps of both implementations
+TEST(CRC, AcceleratedMatchesPortable) {
+  // The detected path matches what the port layer can run: the accelerated
+  // code either computes the right checksum or returns 0
+  uint32_t probe = port::AcceleratedCRC32C(0, "a", 1);
+  ASSERT_EQ(IsAccelerated(), probe == ExtendPortable(0, "a", 1));
+  if (!IsAccelerated()) {
+    ASSERT_EQ(0u, probe);
+  }
+
+  Random rnd(301);
+  char buf[600];
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = static_cast<char>(rnd.Uniform(256));
+  }
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t n = 0; offset + n <= sizeof(buf); n++) {
+      uint32_t init = (n % 3 == 0) ? 0 : rnd.Next();
+      uint32_t expected = ExtendPortable(init, buf + offset, n);
+      ASSERT_EQ(expected, Extend(init, buf + offset, n));
+      uint32_t accelerated = port::AcceleratedCRC32C(init, buf + offset, n);
+      if (IsAccelerated()) {
+        ASSERT_EQ(expected, accelerated);
+      }
+    }
+  }
+}
+
 TEST(CRC, Values) {
   ASSERT_NE(Value("a", 1), Value("foo", 3));
 }
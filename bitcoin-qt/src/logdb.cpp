@@ -0,0 +1,512 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "logdb.h"
+#include "util.h"
+
+#include "leveldb/util/crc32c.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+// The last byte of the header is the format version
+static const unsigned char pchLogHeader[8] = {0xf9, 'w', 'a', 'l', 'l', 'o', 'g', 0x01};
+// Every record starts with this marker, followed by the size of its payload
+// and the masked crc32c of the payload
+static const unsigned char pchRecordMarker[4] = {0xf9, 'r', 'e', 'c'};
+static const unsigned int nRecordHeaderSize = 12;
+
+// Compaction writes the live records in chunks of about this size
+static const unsigned int nCompactChunkSize = 1 << 20;
+// Don't bother compacting files with less overwritten data than this
+static const uint64 nCompactMinWaste = 1 << 20;
+
+// A record's payload is a list of changes, each starting with its type
+enum
+{
+    LOG_WRITE = 'w',
+    LOG_ERASE = 'e',
+};
+
+static uint32_t GetChecksum(const char *pch, size_t nSize)
+{
+    return leveldb::crc32c::Mask(leveldb::crc32c::Value(pch, nSize));
+}
+
+static uint64 GetRecordSize(const CLogDB::key_type &key, const CLogDB::value_type &value)
+{
+    return 1 + ::GetSerializeSize(key, SER_DISK, CLIENT_VERSION) + ::GetSerializeSize(value, SER_DISK, CLIENT_VERSION);
+}
+
+// Append a record holding ssPayload to file and hand it to the OS
+static bool WriteRecord(FILE *file, const CDataStream &ssPayload)
+{
+    CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+    ssHeader << FLATDATA(pchRecordMarker) << (unsigned int)ssPayload.size() << (unsigned int)GetChecksum(&ssPayload[0], ssPayload.size());
+    return fwrite(&ssHeader[0], 1, ssHeader.size(), file) == ssHeader.size() &&
+           fwrite(&ssPayload[0], 1, ssPayload.size(), file) == ssPayload.size() &&
+           fflush(file) == 0;
+}
+
+/** Reads serialized data in place, so that loading copies every key and
+ *  value just once, straight into the database.
+ */
+class CBufferReader
+{
+private:
+    const char *p;
+    const char *pend;
+
+public:
+    CBufferReader(const char *pbegin, const char *pendIn) : p(pbegin), pend(pendIn) {}
+
+    bool empty() const { return p == pend; }
+
+    CBufferReader& read(char *pch, size_t nSize)
+    {
+        memcpy(pch, skip(nSize), nSize);
+        return *this;
+    }
+
+    // Move past nSize bytes and return where they start
+    const char *skip(size_t nSize)
+    {
+        if (nSize > (size_t)(pend - p))
+            throw std::ios_base::failure("CBufferReader::skip() : end of data");
+        const char *pbegin = p;
+        p += nSize;
+        return pbegin;
+    }
+};
+
+struct CLogChange
+{
+    char chType;
+    const char *pkey;
+    size_t nKeySize;
+    const char *pvalue;
+    size_t nValueSize;
+};
+
+// Decode the changes in the payload of a record
+static bool ReadPayload(const char *pbegin, const char *pend, vector<CLogChange> &vChanges)
+{
+    try {
+        CBufferReader reader(pbegin, pend);
+        while (!reader.empty())
+        {
+            CLogChange change;
+            change.chType = *reader.skip(1);
+            change.nKeySize = ReadCompactSize(reader);
+            change.pkey = reader.skip(change.nKeySize);
+            change.nValueSize = 0;
+            change.pvalue = NULL;
+            if (change.chType == LOG_WRITE)
+            {
+                change.nValueSize = ReadCompactSize(reader);
+                change.pvalue = reader.skip(change.nValueSize);
+            }
+            else if (change.chType != LOG_ERASE)
+                return false;
+            vChanges.push_back(change);
+        }
+    }
+    catch (std::exception &e) {
+        return false;
+    }
+    return true;
+}
+
+static bool ReadWholeFile(FILE *file, CLogDB::value_type &vchData)
+{
+    if (fseek(file, 0, SEEK_END) != 0)
+        return false;
+    long nSize = ftell(file);
+    if (nSize < 0 || fseek(file, 0, SEEK_SET) != 0)
+        return false;
+    vchData.resize(nSize);
+    return nSize == 0 || fread(&vchData[0], 1, nSize, file) == (size_t)nSize;
+}
+
+static bool HasLogHeader(const CLogDB::value_type &vchData)
+{
+    return vchData.size() >= sizeof(pchLogHeader) && memcmp(&vchData[0], pchLogHeader, sizeof(pchLogHeader)) == 0;
+}
+
+int CLogDB::CBatch::Lookup(const key_type &key, value_type &value) const
+{
+    std::map<key_type, std::pair<bool, value_type> >::const_iterator it = mapChanges.find(key);
+    if (it == mapChanges.end())
+        return UNCHANGED;
+    if (!(*it).second.first)
+        return ERASED;
+    value = (*it).second.second;
+    return WRITTEN;
+}
+
+CLogDB::CLogDB() : file(NULL), nFileSize(0), nLiveSize(0), fSyncNeeded(false)
+{
+}
+
+CLogDB::~CLogDB()
+{
+    Close();
+}
+
+size_t CLogDB::ParseRecords(const char *pbegin, const char *pend, map_type &mapRecordsIn, bool &fDamaged)
+{
+    fDamaged = false;
+    bool fSkipped = false;
+    const char *p = pbegin;
+    const char *pLastEnd = pbegin;
+    vector<CLogChange> vChanges;
+    while ((size_t)(pend - p) >= nRecordHeaderSize)
+    {
+        unsigned int nSize, nChecksum;
+        memcpy(&nSize, p + 4, sizeof(nSize));
+        memcpy(&nChecksum, p + 8, sizeof(nChecksum));
+        vChanges.clear();
+        if (memcmp(p, pchRecordMarker, sizeof(pchRecordMarker)) != 0 ||
+            nSize > (size_t)(pend - p) - nRecordHeaderSize ||
+            nChecksum != GetChecksum(p + nRecordHeaderSize, nSize) ||
+            !ReadPayload(p + nRecordHeaderSize, p + nRecordHeaderSize + nSize, vChanges))
+        {
+            // look for the next record
+            fSkipped = true;
+            p++;
+            continue;
+        }
+        if (fSkipped)
+            fDamaged = true;
+        fSkipped = false;
+        BOOST_FOREACH(const CLogChange &change, vChanges)
+        {
+            key_type key(change.pkey, change.pkey + change.nKeySize);
+            if (change.chType == LOG_WRITE)
+                mapRecordsIn[key].assign(change.pvalue, change.pvalue + change.nValueSize);
+            else
+                mapRecordsIn.erase(key);
+        }
+        p += nRecordHeaderSize + nSize;
+        pLastEnd = p;
+    }
+    return pLastEnd - pbegin;
+}
+
+bool CLogDB::Open(const boost::filesystem::path &pathIn, bool fCreate)
+{
+    LOCK(cs);
+    Close();
+    path = pathIn;
+    file = fopen(path.string().c_str(), "rb+");
+    if (file == NULL)
+    {
+        if (!fCreate || boost::filesystem::exists(path))
+            return error("CLogDB::Open() : cannot open %s", path.string().c_str());
+        file = fopen(path.string().c_str(), "wb+");
+        if (file == NULL)
+            return error("CLogDB::Open() : cannot create %s", path.string().c_str());
+        if (fwrite(pchLogHeader, 1, sizeof(pchLogHeader), file) != sizeof(pchLogHeader))
+        {
+            Close();
+            return error("CLogDB::Open() : cannot write to %s", path.string().c_str());
+        }
+        FileCommit(file);
+        nFileSize = nLiveSize = sizeof(pchLogHeader);
+        return true;
+    }
+
+    // Read the whole file in one go and replay it
+    int64 nStart = GetTimeMillis();
+    value_type vchData;
+    if (!ReadWholeFile(file, vchData) || !HasLogHeader(vchData))
+    {
+        Close();
+        return error("CLogDB::Open() : %s is not a log database", path.string().c_str());
+    }
+    bool fDamaged;
+    size_t nEnd = sizeof(pchLogHeader) + ParseRecords(&vchData[0] + sizeof(pchLogHeader), &vchData[0] + vchData.size(), mapRecords, fDamaged);
+    if (fDamaged)
+    {
+        Close();
+        return error("CLogDB::Open() : %s is corrupt", path.string().c_str());
+    }
+    if (nEnd < vchData.size())
+    {
+        printf("CLogDB::Open() : discarding %"PRIszu" bytes of an incomplete commit at the end of %s\n", vchData.size() - nEnd, path.string().c_str());
+        if (!TruncateFile(file, nEnd))
+        {
+            Close();
+            return error("CLogDB::Open() : cannot truncate %s", path.string().c_str());
+        }
+        FileCommit(file);
+    }
+    if (fseek(file, nEnd, SEEK_SET) != 0)
+    {
+        Close();
+        return error("CLogDB::Open() : cannot seek in %s", path.string().c_str());
+    }
+
+    nFileSize = nEnd;
+    nLiveSize = sizeof(pchLogHeader);
+    for (map_type::const_iterator mi = mapRecords.begin(); mi != mapRecords.end(); mi++)
+        nLiveSize += GetRecordSize((*mi).first, (*mi).second);
+    printf("Loaded %"PRIszu" records from %s  %"PRI64d"ms\n", mapRecords.size(), path.filename().string().c_str(), GetTimeMillis() - nStart);
+    return true;
+}
+
+void CLogDB::Close()
+{
+    LOCK(cs);
+    if (file != NULL)
+    {
+        Flush();
+        fclose(file);
+        file = NULL;
+    }
+    mapRecords.clear();
+    nFileSize = nLiveSize = 0;
+    fSyncNeeded = false;
+}
+
+bool CLogDB::IsOpen() const
+{
+    LOCK(cs);
+    return file != NULL;
+}
+
+bool CLogDB::Read(const key_type &key, value_type &value) const
+{
+    LOCK(cs);
+    map_type::const_iterator mi = mapRecords.find(key);
+    if (mi == mapRecords.end())
+        return false;
+    value = (*mi).second;
+    return true;
+}
+
+bool CLogDB::Exists(const key_type &key) const
+{
+    LOCK(cs);
+    return mapRecords.count(key) > 0;
+}
+
+bool CLogDB::Commit(const CBatch &batch)
+{
+    if (batch.empty())
+        return true;
+
+    CDataStream ssPayload(SER_DISK, CLIENT_VERSION);
+    for (std::map<key_type, std::pair<bool, value_type> >::const_iterator it = batch.mapChanges.begin(); it != batch.mapChanges.end(); it++)
+    {
+        if ((*it).second.first)
+            ssPayload << (char)LOG_WRITE << (*it).first << (*it).second.second;
+        else
+            ssPayload << (char)LOG_ERASE << (*it).first;
+    }
+
+    LOCK(cs);
+    if (file == NULL)
+        return false;
+    if (ssPayload.size() > MAX_SIZE)
+        return error("CLogDB::Commit() : commit of %"PRIszu" bytes is too large", ssPayload.size());
+    if (!WriteRecord(file, ssPayload))
+    {
+        // don't leave a partial record in front of the next commit
+        TruncateFile(file, nFileSize);
+        fseek(file, nFileSize, SEEK_SET);
+        return error("CLogDB::Commit() : write to %s failed", path.string().c_str());
+    }
+    nFileSize += nRecordHeaderSize + ssPayload.size();
+    fSyncNeeded = true;
+
+    for (std::map<key_type, std::pair<bool, value_type> >::const_iterator it = batch.mapChanges.begin(); it != batch.mapChanges.end(); it++)
+    {
+        map_type::iterator mi = mapRecords.find((*it).first);
+        if (mi != mapRecords.end())
+            nLiveSize -= GetRecordSize((*mi).first, (*mi).second);
+        if ((*it).second.first)
+        {
+            nLiveSize += GetRecordSize((*it).first, (*it).second.second);
+            if (mi != mapRecords.end())
+                (*mi).second = (*it).second.second;
+            else
+                mapRecords.insert(make_pair((*it).first, (*it).second.second));
+        }
+        else if (mi != mapRecords.end())
+            mapRecords.erase(mi);
+    }
+    return true;
+}
+
+bool CLogDB::Flush()
+{
+    LOCK(cs);
+    if (file == NULL)
+        return false;
+    if (fSyncNeeded)
+    {
+        FileCommit(file);
+        fSyncNeeded = false;
+    }
+    return true;
+}
+
+bool CLogDB::Seek(const key_type &key, bool fAfter, key_type &keyOut, value_type &valueOut) const
+{
+    LOCK(cs);
+    map_type::const_iterator mi = fAfter ? mapRecords.upper_bound(key) : mapRecords.lower_bound(key);
+    if (mi == mapRecords.end())
+        return false;
+    keyOut = (*mi).first;
+    valueOut = (*mi).second;
+    return true;
+}
+
+size_t CLogDB::GetCount() const
+{
+    LOCK(cs);
+    return mapRecords.size();
+}
+
+uint64 CLogDB::GetFileSize() const
+{
+    LOCK(cs);
+    return nFileSize;
+}
+
+uint64 CLogDB::GetLiveSize() const
+{
+    LOCK(cs);
+    return nLiveSize;
+}
+
+bool CLogDB::NeedsCompaction() const
+{
+    LOCK(cs);
+    return file != NULL && nFileSize - nLiveSize > std::max(nLiveSize, nCompactMinWaste);
+}
+
+bool CLogDB::Compact(const char *pszSkip)
+{
+    LOCK(cs);
+    if (file == NULL)
+        return false;
+
+    int64 nStart = GetTimeMillis();
+    boost::filesystem::path pathTmp = path.string() + ".compact";
+    FILE *fileTmp = fopen(pathTmp.string().c_str(), "wb");
+    if (fileTmp == NULL)
+        return error("CLogDB::Compact() : cannot create %s", pathTmp.string().c_str());
+
+    bool fSuccess = (fwrite(pchLogHeader, 1, sizeof(pchLogHeader), fileTmp) == sizeof(pchLogHeader));
+    uint64 nNewSize = sizeof(pchLogHeader);
+    vector<key_type> vSkipped;
+    CDataStream ssPayload(SER_DISK, CLIENT_VERSION);
+    for (map_type::const_iterator mi = mapRecords.begin(); fSuccess && mi != mapRecords.end(); mi++)
+    {
+        const key_type &key = (*mi).first;
+        if (pszSkip && !key.empty() &&
+            strncmp((const char*)&key[0], pszSkip, std::min(key.size(), strlen(pszSkip))) == 0)
+        {
+            vSkipped.push_back(key);
+            continue;
+        }
+        ssPayload << (char)LOG_WRITE << key << (*mi).second;
+        if (ssPayload.size() >= nCompactChunkSize)
+        {
+            fSuccess = WriteRecord(fileTmp, ssPayload);
+            nNewSize += nRecordHeaderSize + ssPayload.size();
+            ssPayload.clear();
+        }
+    }
+    if (fSuccess && !ssPayload.empty())
+    {
+        fSuccess = WriteRecord(fileTmp, ssPayload);
+        nNewSize += nRecordHeaderSize + ssPayload.size();
+    }
+    if (fSuccess)
+        FileCommit(fileTmp);
+    fclose(fileTmp);
+    if (!fSuccess)
+    {
+        boost::filesystem::remove(pathTmp);
+        return error("CLogDB::Compact() : write to %s failed", pathTmp.string().c_str());
+    }
+
+    // Switch over to the new file; until the rename the old one stays valid
+    fclose(file);
+    file = NULL;
+    bool fRenamed = RenameOver(pathTmp, path);
+    file = fopen(path.string().c_str(), "rb+");
+    if (file == NULL || fseek(file, 0, SEEK_END) != 0)
+        return error("CLogDB::Compact() : cannot reopen %s", path.string().c_str());
+    if (!fRenamed)
+    {
+        boost::filesystem::remove(pathTmp);
+        return error("CLogDB::Compact() : cannot rename %s", pathTmp.string().c_str());
+    }
+
+    BOOST_FOREACH(const key_type &key, vSkipped)
+    {
+        map_type::iterator mi = mapRecords.find(key);
+        nLiveSize -= GetRecordSize((*mi).first, (*mi).second);
+        mapRecords.erase(mi);
+    }
+    printf("Compacted %s from %"PRI64u" to %"PRI64u" bytes  %"PRI64d"ms\n", path.filename().string().c_str(), nFileSize, nNewSize, GetTimeMillis() - nStart);
+    nFileSize = nNewSize;
+    fSyncNeeded = false;
+    return true;
+}
+
+bool CLogDB::IsLogFile(const boost::filesystem::path &path)
+{
+    FILE *file = fopen(path.string().c_str(), "rb");
+    if (file == NULL)
+        return false;
+    unsigned char pchHeader[sizeof(pchLogHeader)];
+    bool fLogFile = (fread(pchHeader, 1, sizeof(pchHeader), file) == sizeof(pchHeader) &&
+                     memcmp(pchHeader, pchLogHeader, sizeof(pchHeader)) == 0);
+    fclose(file);
+    return fLogFile;
+}
+
+bool CLogDB::Verify(const boost::filesystem::path &path)
+{
+    FILE *file = fopen(path.string().c_str(), "rb");
+    if (file == NULL)
+        return false;
+    value_type vchData;
+    bool fRead = ReadWholeFile(file, vchData);
+    fclose(file);
+    if (!fRead || !HasLogHeader(vchData))
+        return false;
+
+    map_type mapRecordsTmp;
+    bool fDamaged;
+    ParseRecords(&vchData[0] + sizeof(pchLogHeader), &vchData[0] + vchData.size(), mapRecordsTmp, fDamaged);
+    return !fDamaged;
+}
+
+bool CLogDB::Salvage(const boost::filesystem::path &path, std::vector<std::pair<key_type, key_type> > &vResult)
+{
+    FILE *file = fopen(path.string().c_str(), "rb");
+    if (file == NULL)
+        return false;
+    value_type vchData;
+    bool fRead = ReadWholeFile(file, vchData);
+    fclose(file);
+    if (!fRead || vchData.size() < sizeof(pchLogHeader))
+        return false;
+
+    // records are found by their marker, so a damaged header doesn't matter
+    map_type mapRecordsTmp;
+    bool fDamaged;
+    size_t nEnd = sizeof(pchLogHeader) + ParseRecords(&vchData[0] + sizeof(pchLogHeader), &vchData[0] + vchData.size(), mapRecordsTmp, fDamaged);
+    for (map_type::const_iterator mi = mapRecordsTmp.begin(); mi != mapRecordsTmp.end(); mi++)
+        vResult.push_back(make_pair((*mi).first, key_type((*mi).second.begin(), (*mi).second.end())));
+    return !fDamaged && nEnd == vchData.size() && HasLogHeader(vchData);
+}
@@ -0,0 +1,107 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_LOGDB_H
+#define BITCOIN_LOGDB_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Key/value database kept as an append-only log of checksummed records.
+ *
+ * The file is read front to back once when it is opened and all live
+ * records are kept in memory. Each commit appends a single record holding
+ * all of its changes, so a commit torn by a crash fails its checksum and is
+ * cut off the next time the file is opened. Overwritten and erased values
+ * stay in the file until Compact() writes the live records to a new file
+ * and renames it over the old one.
+ */
+class CLogDB
+{
+public:
+    typedef std::vector<unsigned char> key_type;
+    typedef CSerializeData value_type; // values may hold private keys
+    typedef std::map<key_type, value_type> map_type;
+
+    /** Changes that are committed together */
+    class CBatch
+    {
+        friend class CLogDB;
+    private:
+        // erased keys are mapped to (false, empty value)
+        std::map<key_type, std::pair<bool, value_type> > mapChanges;
+
+    public:
+        enum { UNCHANGED, WRITTEN, ERASED };
+
+        void Write(const key_type &key, const value_type &value) { mapChanges[key] = std::make_pair(true, value); }
+        void Erase(const key_type &key) { mapChanges[key] = std::make_pair(false, value_type()); }
+        // Tell whether the batch changes key, and set value if it writes it
+        int Lookup(const key_type &key, value_type &value) const;
+        bool empty() const { return mapChanges.empty(); }
+        void clear() { mapChanges.clear(); }
+    };
+
+private:
+    mutable CCriticalSection cs;
+    boost::filesystem::path path;
+    FILE *file;
+    map_type mapRecords;
+    uint64 nFileSize; // bytes in the file, including overwritten records
+    uint64 nLiveSize; // bytes the live records take after compaction
+    bool fSyncNeeded;
+
+    // Apply the intact records in [pbegin, pend), skipping over damaged
+    // ones. fDamaged is set if an intact record follows a damaged one.
+    // Returns the number of bytes up to the end of the last intact record.
+    static size_t ParseRecords(const char *pbegin, const char *pend, map_type &mapRecordsIn, bool &fDamaged);
+
+    // not copyable
+    CLogDB(const CLogDB&);
+    CLogDB& operator=(const CLogDB&);
+
+public:
+    CLogDB();
+    ~CLogDB();
+
+    bool Open(const boost::filesystem::path &pathIn, bool fCreate);
+    void Close();
+    bool IsOpen() const;
+
+    bool Read(const key_type &key, value_type &value) const;
+    bool Exists(const key_type &key) const;
+    bool Commit(const CBatch &batch);
+
+    // Make all commits durable
+    bool Flush();
+
+    // Find the first record with a key not smaller than key (or larger, if
+    // fAfter). Returns false past the last record.
+    bool Seek(const key_type &key, bool fAfter, key_type &keyOut, value_type &valueOut) const;
+
+    size_t GetCount() const;
+    uint64 GetFileSize() const;
+    uint64 GetLiveSize() const;
+
+    // Overwritten records outweigh the live ones
+    bool NeedsCompaction() const;
+    // Rewrite the file with only the live records, dropping those whose key
+    // starts with pszSkip.
+    bool Compact(const char *pszSkip = NULL);
+
+    // Whether path starts with the header of a log database
+    static bool IsLogFile(const boost::filesystem::path &path);
+    // Whether every record of path is intact, apart from a torn last commit
+    static bool Verify(const boost::filesystem::path &path);
+    // Read the records that are still intact from a damaged file, skipping
+    // over the damaged ones. Returns true if nothing was damaged.
+    static bool Salvage(const boost::filesystem::path &path, std::vector<std::pair<key_type, key_type> > &vResult);
+};
+
+#endif
@@ -14,6 +14,8 @@
 #include "init.h"
 #include "ui_interface.h"
 #include "checkqueue.h"
+#include "pubsub.h"
+#include "blockencodings.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -42,6 +44,13 @@ uint256 nBestChainWork = 0;
 uint256 nBestInvalidWork = 0;
 uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
+// Taken for writes to mapBlockIndex and for reads by threads without cs_main
+static CCriticalSection cs_mapBlockIndex;
+// The active chain as of the last SetBestChain, indexed by height, for
+// readers that don't hold cs_main. Block index entries are never freed while
+// the node runs, so the pointers stay valid after the tip has moved on.
+static CCriticalSection cs_chainTip;
+static std::vector<CBlockIndex*> vChainTip;
 set<CBlockIndex*, CBlockIndexWorkComparator> setBlockIndexValid; // may contain all CBlockIndex*'s that have validness >=BLOCK_VALID_TRANSACTIONS, and must contain those who aren't failed
 int64 nTimeBestReceived = 0;
 int nScriptCheckThreads = 0;
@@ -49,7 +58,15 @@ bool fImporting = false;
 bool fReindex = false;
 bool fBenchmark = false;
 bool fTxIndex = false;
+bool fAddressIndex = false;
+bool fSpentIndex = false;
+bool fCompressBlocks = false;
+bool fCompactBlocks = true;
+bool fPruneMode = false;
+bool fHavePruned = false;
+uint64 nPruneTarget = 0;
 unsigned int nCoinCacheSize = 5000;
+int64 nDBSyncInterval = 0;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for transaction creation) */
 int64 CTransaction::nMinTxFee = 10000;  // Override with -mintxfee
@@ -280,6 +297,7 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) {
 
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -830,6 +848,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTransaction &tx)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
         nTransactionsUpdated++;
     }
+    PublishTransaction(hash, tx);
     return true;
 }
 
@@ -873,6 +892,17 @@ bool CTxMemPool::removeConflicts(const CTransaction &tx)
     return true;
 }
 
+void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx)
+{
+    // Remove transactions included in newly connected blocks, together with
+    // anything that conflicts with them, under a single lock acquisition
+    LOCK(cs);
+    BOOST_FOREACH(const CTransaction& tx, vtx) {
+        remove(tx);
+        removeConflicts(tx);
+    }
+}
+
 void CTxMemPool::clear()
 {
     LOCK(cs);
@@ -961,46 +991,70 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 {
     CBlockIndex *pindexSlow = NULL;
     {
-        LOCK(cs_main);
+        LOCK(mempool.cs);
+        if (mempool.exists(hash))
         {
-            LOCK(mempool.cs);
-            if (mempool.exists(hash))
-            {
-                txOut = mempool.lookup(hash);
-                return true;
-            }
+            txOut = mempool.lookup(hash);
+            return true;
         }
+    }
 
-        if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                CBlockHeader header;
-                try {
+    // The transaction index and block files are safe to read without cs_main
+    if (fTxIndex) {
+        CDiskTxPos postx;
+        if (pblocktree->ReadTxIndex(hash, postx)) {
+            // Transaction offsets don't apply to compressed blocks, look
+            // through the whole block instead
+            int nType;
+            unsigned int nSize;
+            if (ReadBlockRecordHeader(postx, nType, nSize) && nType == BLOCKRECORD_COMPRESSED) {
+                CBlock block;
+                if (!block.ReadFromDisk(postx))
+                    return false;
+                BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+                    if (tx.GetHash() == hash) {
+                        txOut = tx;
+                        hashBlock = block.GetHash();
+                        return true;
+                    }
+                }
+                return error("%s() : txid not found in block", __PRETTY_FUNCTION__);
+            }
+            CBlockHeader header;
+            try {
+                boost::shared_ptr<const CMappedFile> pmap = MapBlockFile(postx);
+                if (pmap) {
+                    CSpanReader file(pmap->begin() + postx.nPos, pmap->end(), SER_DISK, CLIENT_VERSION);
+                    file >> header;
+                    file.ignore(postx.nTxOffset);
+                    file >> txOut;
+                } else {
+                    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
                     file >> header;
                     fseek(file, postx.nTxOffset, SEEK_CUR);
                     file >> txOut;
-                } catch (std::exception &e) {
-                    return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
                 }
-                hashBlock = header.GetHash();
-                if (txOut.GetHash() != hash)
-                    return error("%s() : txid mismatch", __PRETTY_FUNCTION__);
-                return true;
+            } catch (std::exception &e) {
+                return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
             }
+            hashBlock = header.GetHash();
+            if (txOut.GetHash() != hash)
+                return error("%s() : txid mismatch", __PRETTY_FUNCTION__);
+            return true;
         }
+    }
 
-        if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
-            int nHeight = -1;
-            {
-                CCoinsViewCache &view = *pcoinsTip;
-                CCoins coins;
-                if (view.GetCoins(hash, coins))
-                    nHeight = coins.nHeight;
-            }
-            if (nHeight > 0)
-                pindexSlow = FindBlockByHeight(nHeight);
+    if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+        int nHeight = -1;
+        {
+            LOCK(cs_main);
+            CCoinsViewCache &view = *pcoinsTip;
+            CCoins coins;
+            if (view.GetCoins(hash, coins))
+                nHeight = coins.nHeight;
         }
+        if (nHeight > 0)
+            pindexSlow = GetChainBlockByHeight(nHeight);
     }
 
     if (pindexSlow) {
@@ -1047,6 +1101,52 @@ CBlockIndex* FindBlockByHeight(int nHeight)
     return pblockindex;
 }
 
+// Make pindexNew the published tip, called whenever pindexBest changes
+static void PublishChainTip(CBlockIndex* pindexNew)
+{
+    LOCK(cs_chainTip);
+    if (pindexNew == NULL)
+    {
+        vChainTip.clear();
+        return;
+    }
+    // Only the blocks above the fork point need replacing
+    vChainTip.resize(pindexNew->nHeight + 1);
+    for (CBlockIndex* pindex = pindexNew; pindex && vChainTip[pindex->nHeight] != pindex; pindex = pindex->pprev)
+        vChainTip[pindex->nHeight] = pindex;
+}
+
+CBlockIndex* GetChainTip()
+{
+    LOCK(cs_chainTip);
+    return vChainTip.empty() ? NULL : vChainTip.back();
+}
+
+CBlockIndex* GetChainBlockByHeight(int nHeight)
+{
+    LOCK(cs_chainTip);
+    if (nHeight < 0 || nHeight >= (int)vChainTip.size())
+        return NULL;
+    return vChainTip[nHeight];
+}
+
+int GetChainDepth(const CBlockIndex* pindex)
+{
+    LOCK(cs_chainTip);
+    if (pindex == NULL || pindex->nHeight >= (int)vChainTip.size() || vChainTip[pindex->nHeight] != pindex)
+        return 0;
+    return vChainTip.size() - pindex->nHeight;
+}
+
+CBlockIndex* LookupBlockIndex(const uint256& hash)
+{
+    LOCK(cs_mapBlockIndex);
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    if (mi == mapBlockIndex.end())
+        return NULL;
+    return mi->second;
+}
+
 bool CBlock::ReadFromDisk(const CBlockIndex* pindex)
 {
     if (!ReadFromDisk(pindex->GetBlockPos()))
@@ -1377,7 +1477,7 @@ bool CTransaction::HaveInputs(CCoinsViewCache &inputs) const
 
 bool CScriptCheck::operator()() const {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType))
+    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType, phasher.get()))
         return error("CScriptCheck() : %s VerifySignature failed", ptxTo->GetHash().ToString().c_str());
     return true;
 }
@@ -1441,12 +1541,18 @@ bool CTransaction::CheckInputs(CValidationState &state, CCoinsViewCache &inputs,
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // Share one signature hash context between all inputs, so the
+            // transaction is serialized once instead of once per input
+            boost::shared_ptr<const CSignatureHasher> phasher;
+            if (vin.size() > 1)
+                phasher.reset(new CSignatureHasher(*this));
+
             for (unsigned int i = 0; i < vin.size(); i++) {
                 const COutPoint &prevout = vin[i].prevout;
                 const CCoins &coins = inputs.GetCoins(prevout.hash);
 
                 // Verify signature
-                CScriptCheck check(coins, *this, i, flags, 0);
+                CScriptCheck check(coins, *this, i, flags, 0, phasher);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1454,7 +1560,7 @@ bool CTransaction::CheckInputs(CValidationState &state, CCoinsViewCache &inputs,
                     if (flags & SCRIPT_VERIFY_STRICTENC) {
                         // For now, check whether the failure was caused by non-canonical
                         // encodings or not; if so, don't trigger DoS protection.
-                        CScriptCheck check(coins, *this, i, flags & (~SCRIPT_VERIFY_STRICTENC), 0);
+                        CScriptCheck check(coins, *this, i, flags & (~SCRIPT_VERIFY_STRICTENC), 0, phasher);
                         if (check())
                             return state.Invalid();
                     }
@@ -1470,7 +1576,66 @@ bool CTransaction::CheckInputs(CValidationState &state, CCoinsViewCache &inputs,
 
 
 
-bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoinsViewCache &view, bool *pfClean)
+// The address index covers outputs with a standard address
+bool static GetAddressIndexHash(const CScript &script, unsigned char &chType, uint160 &hashAddress)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(script, dest))
+        return false;
+    if (const CKeyID *pkeyid = boost::get<CKeyID>(&dest)) {
+        chType = ADDRINDEX_PUBKEYHASH;
+        hashAddress = *pkeyid;
+        return true;
+    }
+    if (const CScriptID *pscriptid = boost::get<CScriptID>(&dest)) {
+        chType = ADDRINDEX_SCRIPTHASH;
+        hashAddress = *pscriptid;
+        return true;
+    }
+    return false;
+}
+
+// Collect the -addrindex and/or -spentindex entries of a transaction at nHeight.
+// vSpentOutputs are the outputs its inputs spend (none for a coinbase).
+void static GetIndexEntries(const CTransaction &tx, const uint256 &hash, int nHeight, const std::vector<CTxOut> &vSpentOutputs,
+                            bool fAddress, bool fSpent,
+                            std::vector<std::pair<CAddressIndexKey, int64> > &vAddress,
+                            std::vector<std::pair<COutPoint, CSpentIndexValue> > &vSpent)
+{
+    unsigned char chType;
+    uint160 hashAddress;
+    for (unsigned int i = 0; i < vSpentOutputs.size(); i++) {
+        const CTxOut &prevout = vSpentOutputs[i];
+        if (fAddress && GetAddressIndexHash(prevout.scriptPubKey, chType, hashAddress))
+            vAddress.push_back(std::make_pair(CAddressIndexKey(chType, hashAddress, nHeight, hash, i, true), -prevout.nValue));
+        if (fSpent)
+            vSpent.push_back(std::make_pair(tx.vin[i].prevout, CSpentIndexValue(hash, i, nHeight)));
+    }
+    if (fAddress) {
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            if (GetAddressIndexHash(tx.vout[i].scriptPubKey, chType, hashAddress))
+                vAddress.push_back(std::make_pair(CAddressIndexKey(chType, hashAddress, nHeight, hash, i, false), tx.vout[i].nValue));
+        }
+    }
+}
+
+// Same for a whole block, with the spent outputs taken from its undo data
+void static GetBlockIndexEntries(const CBlock &block, const CBlockUndo &blockUndo, int nHeight, bool fAddress, bool fSpent,
+                                 std::vector<std::pair<CAddressIndexKey, int64> > &vAddress,
+                                 std::vector<std::pair<COutPoint, CSpentIndexValue> > &vSpent)
+{
+    std::vector<CTxOut> vSpentOutputs;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        vSpentOutputs.clear();
+        if (i > 0) {
+            BOOST_FOREACH(const CTxInUndo &undo, blockUndo.vtxundo[i-1].vprevout)
+                vSpentOutputs.push_back(undo.txout);
+        }
+        GetIndexEntries(block.vtx[i], block.GetTxHash(i), nHeight, vSpentOutputs, fAddress, fSpent, vAddress, vSpent);
+    }
+}
+
+bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoinsViewCache &view, bool *pfClean, bool fJustCheck, CLevelDBBatch *pbatchIndexes)
 {
     assert(pindex == view.GetBestBlock());
 
@@ -1546,6 +1711,17 @@ bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoin
         }
     }
 
+    // remove the block from the address and spent indexes
+    if (!fJustCheck && (fAddressIndex || fSpentIndex)) {
+        std::vector<std::pair<CAddressIndexKey, int64> > vAddress;
+        std::vector<std::pair<COutPoint, CSpentIndexValue> > vSpent;
+        GetBlockIndexEntries(*this, blockUndo, pindex->nHeight, fAddressIndex, fSpentIndex, vAddress, vSpent);
+        if (pbatchIndexes)
+            pblocktree->EraseIndexes(*pbatchIndexes, vAddress, vSpent);
+        else if (!pblocktree->EraseIndexes(vAddress, vSpent))
+            return state.Abort(_("Failed to write address and spent indexes"));
+    }
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev);
 
@@ -1581,6 +1757,7 @@ void static FlushBlockFile(bool fFinalize = false)
 }
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
+bool static StartCompressedBlockFile(CValidationState &state);
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
@@ -1589,7 +1766,60 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
-bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsViewCache &view, bool fJustCheck)
+/** Closure computing a single transaction id, queued by GetTxHashes */
+class CTxHashCheck
+{
+private:
+    const CTransaction *ptx;
+    uint256 *phash;
+
+public:
+    CTxHashCheck() : ptx(NULL), phash(NULL) {}
+    CTxHashCheck(const CTransaction& txIn, uint256& hashOut) : ptx(&txIn), phash(&hashOut) {}
+
+    bool operator()() {
+        *phash = ptx->GetHash();
+        return true;
+    }
+
+    void swap(CTxHashCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(phash, check.phash);
+    }
+};
+
+static CCheckQueue<CTxHashCheck> txhashqueue(16);
+static CCriticalSection cs_txhashqueue;
+
+void ThreadTxHash() {
+    RenameThread("bitcoin-txhash");
+    txhashqueue.Thread();
+}
+
+void GetTxHashes(const std::vector<CTransaction>& vtx, uint256* phash)
+{
+    // Waking the workers costs more than hashing a handful of transactions.
+    // The queue has a single master, so concurrent callers hash serially.
+    if (nScriptCheckThreads && vtx.size() >= 64)
+    {
+        TRY_LOCK(cs_txhashqueue, lockQueue);
+        if (lockQueue)
+        {
+            CCheckQueueControl<CTxHashCheck> control(&txhashqueue);
+            std::vector<CTxHashCheck> vChecks;
+            vChecks.reserve(vtx.size());
+            for (unsigned int i = 0; i < vtx.size(); i++)
+                vChecks.push_back(CTxHashCheck(vtx[i], phash[i]));
+            control.Add(vChecks);
+            control.Wait();
+            return;
+        }
+    }
+    for (unsigned int i = 0; i < vtx.size(); i++)
+        phash[i] = vtx[i].GetHash();
+}
+
+bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsViewCache &view, bool fJustCheck, CLevelDBBatch *pbatchIndexes)
 {
     // Check it again in case a previous version let a bad block in
     if (!CheckBlock(state, !fJustCheck, !fJustCheck))
@@ -1649,6 +1879,10 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(vtx.size());
+    bool fIndexes = (fAddressIndex || fSpentIndex) && !fJustCheck;
+    std::vector<std::pair<CAddressIndexKey, int64> > vAddress;
+    std::vector<std::pair<COutPoint, CSpentIndexValue> > vSpent;
+    std::vector<CTxOut> vSpentOutputs;
     for (unsigned int i=0; i<vtx.size(); i++)
     {
         const CTransaction &tx = vtx[i];
@@ -1681,6 +1915,16 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
             control.Add(vChecks);
         }
 
+        // the outputs spent are gone from the view once the coins are updated
+        if (fIndexes) {
+            vSpentOutputs.clear();
+            if (!tx.IsCoinBase()) {
+                BOOST_FOREACH(const CTxIn &txin, tx.vin)
+                    vSpentOutputs.push_back(view.GetCoins(txin.prevout.hash).vout[txin.prevout.n]);
+            }
+            GetIndexEntries(tx, GetTxHash(i), pindex->nHeight, vSpentOutputs, fAddressIndex, fSpentIndex, vAddress, vSpent);
+        }
+
         CTxUndo txundo;
         tx.UpdateCoins(state, view, txundo, pindex->nHeight, GetTxHash(i));
         if (!tx.IsCoinBase())
@@ -1727,8 +1971,12 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
             return state.Abort(_("Failed to write block index"));
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
+    if (!fTxIndex)
+        vPos.clear();
+    if (pbatchIndexes)
+        pblocktree->WriteIndexes(*pbatchIndexes, vPos, vAddress, vSpent);
+    else if (!vPos.empty() || !vAddress.empty() || !vSpent.empty())
+        if (!pblocktree->WriteIndexes(vPos, vAddress, vSpent))
             return state.Abort(_("Failed to write transaction index"));
 
     // add this block to the view's block chain
@@ -1741,6 +1989,104 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex, CCoinsVi
     return true;
 }
 
+// Re-add transactions from disconnected blocks to the memory pool in one batch.
+// All inputs are fetched under a single mempool lock; the script checks of the
+// whole batch are then handed to the script check threads at once. Signatures
+// seen before (when the transactions first entered the pool) are answered by
+// the signature cache. If any script check fails, fall back to accepting the
+// transactions one by one so that only the offending ones are dropped.
+void static ResurrectMemPoolTransactions(std::list<CTransaction>& vResurrect)
+{
+    if (vResurrect.empty())
+        return;
+
+    int64 nStart = GetTimeMicros();
+    unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC;
+
+    CCoinsView dummy;
+    CCoinsViewCache view(dummy);
+    std::vector<CTransaction*> vCandidates;
+    vCandidates.reserve(vResurrect.size());
+    {
+        LOCK(mempool.cs);
+        CCoinsViewMemPool viewMemPool(*pcoinsTip, mempool);
+        view.SetBackend(viewMemPool);
+
+        BOOST_FOREACH(CTransaction& tx, vResurrect) {
+            if (mempool.exists(tx.GetHash()))
+                continue;
+            bool fConflict = false;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (mempool.mapNextTx.count(txin.prevout))
+                    fConflict = true;
+                view.HaveCoins(txin.prevout.hash);
+            }
+            if (fConflict)
+                continue;
+            view.HaveCoins(tx.GetHash());
+            vCandidates.push_back(&tx);
+        }
+
+        // Bring the best block into scope, then detach from the mempool
+        view.GetBestBlock();
+        view.SetBackend(dummy);
+    }
+
+    std::vector<CTransaction*> vAccepted;
+    vAccepted.reserve(vCandidates.size());
+    bool fScriptsOk = true;
+    {
+        CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? &scriptcheckqueue : NULL);
+        BOOST_FOREACH(CTransaction* ptx, vCandidates) {
+            const CTransaction& tx = *ptx;
+            uint256 hash = tx.GetHash();
+            CValidationState stateDummy;
+            if (!tx.CheckTransaction(stateDummy) || (!fTestNet && !tx.IsStandard()) ||
+                (int64)tx.nLockTime > std::numeric_limits<int>::max() ||
+                view.HaveCoins(hash) || !tx.HaveInputs(view) ||
+                (!fTestNet && !tx.AreInputsStandard(view))) {
+                mempool.remove(tx, true);
+                continue;
+            }
+            std::vector<CScriptCheck> vChecks;
+            if (!tx.CheckInputs(stateDummy, view, true, flags, nScriptCheckThreads ? &vChecks : NULL)) {
+                mempool.remove(tx, true);
+                continue;
+            }
+            control.Add(vChecks);
+
+            // Make the outputs visible to later transactions in the batch
+            CTxUndo txundo;
+            tx.UpdateCoins(stateDummy, view, txundo, MEMPOOL_HEIGHT, hash);
+            vAccepted.push_back(ptx);
+        }
+        fScriptsOk = control.Wait();
+    }
+
+    if (!fScriptsOk) {
+        printf("ResurrectMemPoolTransactions() : batch script check failed, retrying one by one\n");
+        BOOST_FOREACH(CTransaction* ptx, vAccepted) {
+            CValidationState stateDummy;
+            if (!ptx->AcceptToMemoryPool(stateDummy, true, false))
+                mempool.remove(*ptx, true);
+        }
+        return;
+    }
+
+    {
+        LOCK(mempool.cs);
+        BOOST_FOREACH(CTransaction* ptx, vAccepted)
+            mempool.addUnchecked(ptx->GetHash(), *ptx);
+    }
+    BOOST_FOREACH(CTransaction* ptx, vAccepted)
+        SyncWithWallets(ptx->GetHash(), *ptx, NULL, true);
+
+    printf("ResurrectMemPoolTransactions() : resurrected %"PRIszu" of %"PRIszu" transactions (poolsz %"PRIszu")\n",
+           vAccepted.size(), vResurrect.size(), mempool.size());
+    if (fBenchmark)
+        printf("- Resurrect: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+}
+
 bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
 {
     // All modifications to the coin state will be done in this cache.
@@ -1778,6 +2124,10 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
         printf("REORGANIZE: Connect %"PRIszu" blocks; ..%s\n", vConnect.size(), pindexNew->GetBlockHash().ToString().c_str());
     }
 
+    // Transaction, address and spent index changes, written together once
+    // the coin changes are in, so that a failure halfway leaves them alone
+    CLevelDBBatch batchIndexes;
+
     // Disconnect shorter branch
     list<CTransaction> vResurrect;
     BOOST_FOREACH(CBlockIndex* pindex, vDisconnect) {
@@ -1785,7 +2135,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
         if (!block.ReadFromDisk(pindex))
             return state.Abort(_("Failed to read block"));
         int64 nStart = GetTimeMicros();
-        if (!block.DisconnectBlock(state, pindex, view))
+        if (!block.DisconnectBlock(state, pindex, view, NULL, false, &batchIndexes))
             return error("SetBestBlock() : DisconnectBlock %s failed", pindex->GetBlockHash().ToString().c_str());
         if (fBenchmark)
             printf("- Disconnect: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
@@ -1800,12 +2150,13 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
 
     // Connect longer branch
     vector<CTransaction> vDelete;
+    vector<CBlock> vPublish;
     BOOST_FOREACH(CBlockIndex *pindex, vConnect) {
         CBlock block;
         if (!block.ReadFromDisk(pindex))
             return state.Abort(_("Failed to read block"));
         int64 nStart = GetTimeMicros();
-        if (!block.ConnectBlock(state, pindex, view)) {
+        if (!block.ConnectBlock(state, pindex, view, false, &batchIndexes)) {
             if (state.IsInvalid()) {
                 InvalidChainFound(pindexNew);
                 InvalidBlockFound(pindex);
@@ -1818,19 +2169,30 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
         // Queue memory transactions to delete
         BOOST_FOREACH(const CTransaction& tx, block.vtx)
             vDelete.push_back(tx);
+
+        // Keep the block for raw block subscribers
+        if (IsPublishing(PUB_RAWBLOCK))
+            vPublish.push_back(block);
     }
 
     // Flush changes to global coin state
     int64 nStart = GetTimeMicros();
     int nModified = view.GetCacheSize();
     assert(view.Flush());
+    if (!batchIndexes.IsEmpty() && !pblocktree->WriteBatch(batchIndexes))
+        return state.Abort(_("Failed to write transaction index"));
     int64 nTime = GetTimeMicros() - nStart;
     if (fBenchmark)
         printf("- Flush %i transactions: %.2fms (%.4fms/tx)\n", nModified, 0.001 * nTime, 0.001 * nTime / nModified);
 
     // Make sure it's successfully written to disk before changing memory structure
+    // (with -dbsyncinterval, changes may stay in the coin cache for a while
+    // after the initial download too; the coin database's best block is only
+    // moved after the block files and block index it refers to are synced, so
+    // a crash just leaves it at an earlier block)
+    static int64 nLastDBSync = 0;
     bool fIsInitialDownload = IsInitialBlockDownload();
-    if (!fIsInitialDownload || pcoinsTip->GetCacheSize() > nCoinCacheSize) {
+    if ((!fIsInitialDownload && GetTime() - nLastDBSync >= nDBSyncInterval) || pcoinsTip->GetCacheSize() > nCoinCacheSize) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
@@ -1842,6 +2204,9 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
         pblocktree->Sync();
         if (!pcoinsTip->Flush())
             return state.Abort(_("Failed to write to coin database"));
+        if (!PruneBlockFiles(state, pindexNew->nHeight))
+            return false;
+        nLastDBSync = GetTime();
     }
 
     // At this point, all changes have been done to the database.
@@ -1858,21 +2223,15 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
             pindex->pprev->pnext = pindex;
 
     // Resurrect memory transactions that were in the disconnected branch
-    BOOST_FOREACH(CTransaction& tx, vResurrect) {
-        // ignore validation errors in resurrected transactions
-        CValidationState stateDummy;
-        if (!tx.AcceptToMemoryPool(stateDummy, true, false))
-            mempool.remove(tx, true);
-    }
+    // (validation errors in resurrected transactions are ignored)
+    ResurrectMemPoolTransactions(vResurrect);
 
     // Delete redundant memory transactions that are in the connected branch
-    BOOST_FOREACH(CTransaction& tx, vDelete) {
-        mempool.remove(tx);
-        mempool.removeConflicts(tx);
-    }
+    mempool.removeForBlock(vDelete);
 
     // Update best block in wallet (so we can detect restored wallets)
-    if ((pindexNew->nHeight % 20160) == 0 || (!fIsInitialDownload && (pindexNew->nHeight % 144) == 0))
+    // (pruned nodes must not fall behind the data they still have)
+    if ((pindexNew->nHeight % 20160) == 0 || ((!fIsInitialDownload || fPruneMode) && (pindexNew->nHeight % 144) == 0))
     {
         const CBlockLocator locator(pindexNew);
         ::SetBestChain(locator);
@@ -1882,6 +2241,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
     hashBestChain = pindexNew->GetBlockHash();
     pindexBest = pindexNew;
     pblockindexFBBHLast = NULL;
+    PublishChainTip(pindexNew);
     nBestHeight = pindexBest->nHeight;
     nBestChainWork = pindexNew->nChainWork;
     nTimeBestReceived = GetTime();
@@ -1909,6 +2269,12 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
             strMiscWarning = _("Warning: This version is obsolete, upgrade required!");
     }
 
+    // Tell subscribers about every connected block, not just the new tip
+    BOOST_FOREACH(CBlockIndex* pindex, vConnect)
+        PublishBlockHash(pindex->GetBlockHash());
+    BOOST_FOREACH(const CBlock& block, vPublish)
+        PublishBlock(block);
+
     std::string strCmd = GetArg("-blocknotify", "");
 
     if (!fIsInitialDownload && !strCmd.empty())
@@ -1931,7 +2297,11 @@ bool CBlock::AddToBlockIndex(CValidationState &state, const CDiskBlockPos &pos)
     // Construct new block index object
     CBlockIndex* pindexNew = new CBlockIndex(*this);
     assert(pindexNew);
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    map<uint256, CBlockIndex*>::iterator mi;
+    {
+        LOCK(cs_mapBlockIndex);
+        mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    }
     pindexNew->phashBlock = &((*mi).first);
     map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
@@ -1971,7 +2341,7 @@ bool CBlock::AddToBlockIndex(CValidationState &state, const CDiskBlockPos &pos)
 }
 
 
-bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64 nTime, bool fKnown = false)
+bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64 nTime, bool fKnown = false, int nFormat = BLOCKFILE_FORMAT_RAW)
 {
     bool fUpdatedLast = false;
 
@@ -1993,11 +2363,21 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
             pblocktree->ReadBlockFileInfo(nLastBlockFile, infoLastBlockFile); // check whether data for the new file somehow already exist; can fail just fine
             fUpdatedLast = true;
         }
+        if (fCompressBlocks && infoLastBlockFile.nBlocks == 0 && infoLastBlockFile.nSize == 0)
+            if (!StartCompressedBlockFile(state))
+                return false;
         pos.nFile = nLastBlockFile;
         pos.nPos = infoLastBlockFile.nSize;
     }
 
-    infoLastBlockFile.nSize += nAddSize;
+    if (fKnown) {
+        // blocks may be found out of order, and compressed files start with a
+        // dictionary (pos is where the block's data starts, after its header)
+        infoLastBlockFile.nSize = std::max(pos.nPos - 8 + nAddSize, infoLastBlockFile.nSize);
+        if (nFormat != BLOCKFILE_FORMAT_RAW)
+            infoLastBlockFile.nFormat = nFormat;
+    } else
+        infoLastBlockFile.nSize += nAddSize;
     infoLastBlockFile.AddBlock(nHeight, nTime);
 
     if (!fKnown) {
@@ -2143,6 +2523,48 @@ bool CBlock::CheckBlock(CValidationState &state, bool fCheckPOW, bool fCheckMerk
     return true;
 }
 
+/** A recently accepted block, kept both parsed and serialized so that the
+ *  peers all asking for it right after it is announced don't each cost a
+ *  disk read, deserialization and reserialization. */
+struct CCachedBlock
+{
+    CBlock block;
+    CDataStream ssBlock;
+
+    CCachedBlock(const CBlock &blockIn) : block(blockIn), ssBlock(SER_NETWORK, PROTOCOL_VERSION) {
+        ssBlock << block;
+    }
+};
+
+static CCriticalSection cs_recentBlocks;
+static map<uint256, boost::shared_ptr<const CCachedBlock> > mapRecentBlocks;
+static deque<uint256> dequeRecentBlocks; // oldest first
+
+void static AddRecentBlock(const CBlock &block)
+{
+    boost::shared_ptr<const CCachedBlock> pcached(new CCachedBlock(block));
+    uint256 hash = block.GetHash();
+    LOCK(cs_recentBlocks);
+    if (mapRecentBlocks.count(hash))
+        return;
+    mapRecentBlocks[hash] = pcached;
+    dequeRecentBlocks.push_back(hash);
+    while (dequeRecentBlocks.size() > RECENT_BLOCK_CACHE_SIZE)
+    {
+        mapRecentBlocks.erase(dequeRecentBlocks.front());
+        dequeRecentBlocks.pop_front();
+    }
+}
+
+boost::shared_ptr<const CCachedBlock> static GetRecentBlock(const uint256 &hash)
+{
+    LOCK(cs_recentBlocks);
+    map<uint256, boost::shared_ptr<const CCachedBlock> >::iterator mi = mapRecentBlocks.find(hash);
+    if (mi == mapRecentBlocks.end())
+        return boost::shared_ptr<const CCachedBlock>();
+    return (*mi).second;
+}
+
 bool CBlock::AcceptBlock(CValidationState &state, CDiskBlockPos *dbp)
 {
     // Check for duplicate
@@ -2205,9 +2627,18 @@ bool CBlock::AcceptBlock(CValidationState &state, CDiskBlockPos *dbp)
     try {
         unsigned int nBlockSize = ::GetSerializeSize(*this, SER_DISK, CLIENT_VERSION);
         CDiskBlockPos blockPos;
-        if (dbp != NULL)
+        int nFormat = BLOCKFILE_FORMAT_RAW;
+        if (dbp != NULL) {
             blockPos = *dbp;
-        if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, nTime, dbp != NULL))
+            // blocks being reindexed may be stored compressed
+            int nType;
+            unsigned int nDiskSize;
+            if (ReadBlockRecordHeader(*dbp, nType, nDiskSize) && nType == BLOCKRECORD_COMPRESSED) {
+                nBlockSize = nDiskSize;
+                nFormat = BLOCKFILE_FORMAT_COMPRESSED;
+            }
+        }
+        if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, nTime, dbp != NULL, nFormat))
             return error("AcceptBlock() : FindBlockPos failed");
         if (dbp == NULL)
             if (!WriteToDisk(blockPos))
@@ -2222,10 +2653,39 @@ bool CBlock::AcceptBlock(CValidationState &state, CDiskBlockPos *dbp)
     int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
     if (hashBestChain == hash)
     {
+        // Peers will ask for the new tip as soon as it is announced
+        if (!IsInitialBlockDownload())
+            AddRecentBlock(*this);
+
+        // Peers that rebuild blocks from their memory pool get the compact
+        // block right away, saving the inv/getdata round trip
+        CInv inv(MSG_BLOCK, hash);
+        bool fCompact = fCompactBlocks && !IsInitialBlockDownload();
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        bool fBuilt = false;
         LOCK(cs_vNodes);
         BOOST_FOREACH(CNode* pnode, vNodes)
-            if (nBestHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                pnode->PushInventory(CInv(MSG_BLOCK, hash));
+        {
+            if (nBestHeight <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                continue;
+            if (fCompact && (pnode->nServices & NODE_COMPACT_BLOCKS))
+            {
+                {
+                    LOCK(pnode->cs_inventory);
+                    if (pnode->setInventoryKnown.count(inv))
+                        continue;
+                }
+                if (!fBuilt)
+                {
+                    cmpctblock = CBlockHeaderAndShortTxIDs(*this);
+                    fBuilt = true;
+                }
+                pnode->PushMessage("cmpctblock", cmpctblock);
+                pnode->AddInventoryKnown(inv);
+            }
+            else
+                pnode->PushInventory(inv);
+        }
     }
 
     return true;
@@ -2243,7 +2703,7 @@ bool CBlockIndex::IsSuperMajority(int minVersion, const CBlockIndex* pstart, uns
     return (nFound >= nRequired);
 }
 
-bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp)
+bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp, bool fCheckBlock)
 {
     // Check for duplicate
     uint256 hash = pblock->GetHash();
@@ -2253,7 +2713,7 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
         return state.Invalid(error("ProcessBlock() : already have block (orphan) %s", hash.ToString().c_str()));
 
     // Preliminary checks
-    if (!pblock->CheckBlock(state))
+    if (fCheckBlock && !pblock->CheckBlock(state))
         return error("ProcessBlock() : CheckBlock FAILED");
 
     CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
@@ -2375,7 +2835,7 @@ uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::ve
         else
             right = left;
         // combine subhashes
-        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+        return HashPair(left, right);
     }
 }
 
@@ -2423,7 +2883,7 @@ uint256 CPartialMerkleTree::TraverseAndExtract(int height, unsigned int pos, uns
         else
             right = left;
         // and combine them before returning
-        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+        return HashPair(left, right);
     }
 }
 
@@ -2536,78 +2996,710 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
     return OpenDiskFile(pos, "rev", fReadOnly);
 }
 
-CBlockIndex * InsertBlockIndex(uint256 hash)
+static CBlockFileMapper blockfilemapper(MAX_MAPPED_BLOCK_FILES);
+
+boost::shared_ptr<const CMappedFile> static MapDiskFile(const CDiskBlockPos &pos, const char *prefix, unsigned int nTrailer)
 {
-    if (hash == 0)
-        return NULL;
+    // Records are stored preceded by the message start and their size
+    if (pos.IsNull() || pos.nPos < 8)
+        return boost::shared_ptr<const CMappedFile>();
+    {
+        // The last file may still be pre-allocated or truncated under us
+        LOCK(cs_LastBlockFile);
+        if (pos.nFile >= nLastBlockFile)
+            return boost::shared_ptr<const CMappedFile>();
+    }
+    std::string strPath = (GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile)).string();
+    boost::shared_ptr<const CMappedFile> pmap = blockfilemapper.Get(strPath, pos.nPos);
+    if (!pmap)
+        return pmap;
+
+    // Undo data can still be appended to older files during a reorganization,
+    // so make sure the whole record is inside the mapping
+    unsigned int nSize;
+    memcpy(&nSize, pmap->begin() + pos.nPos - sizeof(nSize), sizeof(nSize));
+    uint64 nEnd = (uint64)pos.nPos + nSize + nTrailer;
+    if (nEnd > pmap->size())
+        pmap = blockfilemapper.Get(strPath, nEnd);
+    return pmap;
+}
 
-    // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
-    if (mi != mapBlockIndex.end())
-        return (*mi).second;
+boost::shared_ptr<const CMappedFile> MapBlockFile(const CDiskBlockPos &pos) {
+    return MapDiskFile(pos, "blk", 0);
+}
 
-    // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
-    mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
+boost::shared_ptr<const CMappedFile> MapUndoFile(const CDiskBlockPos &pos, unsigned int nTrailer) {
+    return MapDiskFile(pos, "rev", nTrailer);
+}
 
-    return pindexNew;
+void SetBlockFileSequential(bool fSequential) {
+    blockfilemapper.SetSequential(fSequential);
 }
 
-bool static LoadBlockIndexDB()
+void GetBlockRecordStart(int nType, unsigned char pchStart[4])
 {
-    if (!pblocktree->LoadBlockIndexGuts())
-        return false;
+    memcpy(pchStart, pchMessageStart, 4);
+    pchStart[3] ^= nType;
+}
 
-    boost::this_thread::interruption_point();
+int GetBlockRecordType(const unsigned char pchStart[4])
+{
+    if (memcmp(pchStart, pchMessageStart, 3) != 0)
+        return -1;
+    int nType = pchStart[3] ^ pchMessageStart[3];
+    if (nType != BLOCKRECORD_RAW && nType != BLOCKRECORD_COMPRESSED && nType != BLOCKRECORD_DICTIONARY)
+        return -1;
+    return nType;
+}
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWork().getuint256();
-        pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS && !(pindex->nStatus & BLOCK_FAILED_MASK))
-            setBlockIndexValid.insert(pindex);
+bool ReadBlockRecordHeader(const CDiskBlockPos &pos, int &nType, unsigned int &nSize)
+{
+    if (pos.IsNull() || pos.nPos < 8)
+        return false;
+    unsigned char pchHeader[8];
+    boost::shared_ptr<const CMappedFile> pmap = MapBlockFile(pos);
+    if (pmap) {
+        memcpy(pchHeader, pmap->begin() + pos.nPos - 8, 8);
+    } else {
+        FILE *file = OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 8), true);
+        if (!file)
+            return false;
+        size_t nRead = fread(pchHeader, 1, 8, file);
+        fclose(file);
+        if (nRead != 8)
+            return false;
     }
+    nType = GetBlockRecordType(pchHeader);
+    memcpy(&nSize, pchHeader + 4, sizeof(nSize));
+    return nType >= 0;
+}
 
-    // Load block file info
-    pblocktree->ReadLastBlockFile(nLastBlockFile);
-    printf("LoadBlockIndexDB(): last block file = %i\n", nLastBlockFile);
-    if (pblocktree->ReadBlockFileInfo(nLastBlockFile, infoLastBlockFile))
-        printf("LoadBlockIndexDB(): last block file info: %s\n", infoLastBlockFile.ToString().c_str());
+/** Dictionaries of compressed block files, read on demand */
+static CCriticalSection cs_mapBlockFileDictionaries;
+static map<int, boost::shared_ptr<const CScriptDictionary> > mapBlockFileDictionaries;
+static const unsigned int MAX_CACHED_DICTIONARIES = 16;
 
-    // Load nBestInvalidWork, OK if it doesn't exist
-    CBigNum bnBestInvalidWork;
-    pblocktree->ReadBestInvalidWork(bnBestInvalidWork);
-    nBestInvalidWork = bnBestInvalidWork.getuint256();
+boost::shared_ptr<const CScriptDictionary> GetBlockFileDictionary(int nFile)
+{
+    LOCK(cs_mapBlockFileDictionaries);
+    map<int, boost::shared_ptr<const CScriptDictionary> >::iterator mi = mapBlockFileDictionaries.find(nFile);
+    if (mi != mapBlockFileDictionaries.end())
+        return (*mi).second;
 
-    // Check whether we need to continue reindexing
-    bool fReindexing = false;
-    pblocktree->ReadReindexing(fReindexing);
-    fReindex |= fReindexing;
+    // The dictionary is the first record of the file
+    boost::shared_ptr<CScriptDictionary> pdict(new CScriptDictionary());
+    CAutoFile filein = CAutoFile(OpenBlockFile(CDiskBlockPos(nFile, 0), true), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return boost::shared_ptr<const CScriptDictionary>();
+    try {
+        unsigned char pchStart[4];
+        unsigned int nSize;
+        filein >> FLATDATA(pchStart) >> nSize;
+        if (GetBlockRecordType(pchStart) != BLOCKRECORD_DICTIONARY || nSize > MAX_BLOCK_SIZE) {
+            printf("GetBlockFileDictionary() : no dictionary at the start of blk%05u.dat\n", nFile);
+            return boost::shared_ptr<const CScriptDictionary>();
+        }
+        filein >> *pdict;
+    } catch (std::exception &e) {
+        printf("GetBlockFileDictionary() : deserialize or I/O error in blk%05u.dat\n", nFile);
+        return boost::shared_ptr<const CScriptDictionary>();
+    }
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    printf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
+    if (mapBlockFileDictionaries.size() >= MAX_CACHED_DICTIONARIES)
+        mapBlockFileDictionaries.erase(mapBlockFileDictionaries.begin());
+    mapBlockFileDictionaries[nFile] = pdict;
+    return pdict;
+}
 
-    // Load hashBestChain pointer to end of best chain
-    pindexBest = pcoinsTip->GetBestBlock();
+void static ForgetBlockFileDictionary(int nFile)
+{
+    LOCK(cs_mapBlockFileDictionaries);
+    mapBlockFileDictionaries.erase(nFile);
+}
+
+/** Output scripts of recently written blocks, the most used ones go into the
+ *  dictionary of the next compressed block file (protected by cs_LastBlockFile) */
+static map<CScript, unsigned int> mapScriptCounts;
+static const unsigned int MAX_SCRIPT_COUNTS = 200000;
+static const unsigned int MAX_DICTIONARY_SCRIPTS = 4096;
+static const unsigned int MAX_DICTIONARY_SCRIPT_SIZE = 100;
+
+void static CountBlockScripts(const CBlock &block)
+{
+    BOOST_FOREACH(const CTransaction &tx, block.vtx)
+        BOOST_FOREACH(const CTxOut &txout, tx.vout)
+            if (txout.scriptPubKey.size() <= MAX_DICTIONARY_SCRIPT_SIZE)
+                mapScriptCounts[txout.scriptPubKey]++;
+
+    if (mapScriptCounts.size() > MAX_SCRIPT_COUNTS) {
+        // forget scripts seen once, and let the other counts fade
+        map<CScript, unsigned int>::iterator it = mapScriptCounts.begin();
+        while (it != mapScriptCounts.end()) {
+            if ((*it).second <= 1)
+                mapScriptCounts.erase(it++);
+            else
+                ((*it++).second) /= 2;
+        }
+    }
+}
+
+boost::shared_ptr<CScriptDictionary> static BuildScriptDictionary()
+{
+    vector<pair<unsigned int, const CScript*> > vCounts;
+    for (map<CScript, unsigned int>::const_iterator it = mapScriptCounts.begin(); it != mapScriptCounts.end(); it++)
+        if ((*it).second > 1)
+            vCounts.push_back(make_pair((*it).second, &(*it).first));
+    unsigned int nScripts = std::min((unsigned int)vCounts.size(), MAX_DICTIONARY_SCRIPTS);
+    partial_sort(vCounts.begin(), vCounts.begin() + nScripts, vCounts.end(), greater<pair<unsigned int, const CScript*> >());
+
+    boost::shared_ptr<CScriptDictionary> pdict(new CScriptDictionary());
+    for (unsigned int i = 0; i < nScripts; i++)
+        pdict->vScripts.push_back(*vCounts[i].second);
+    pdict->BuildIndex();
+    return pdict;
+}
+
+// Begin the (empty) last block file with a dictionary, making it a compressed file
+bool static StartCompressedBlockFile(CValidationState &state)
+{
+    LOCK(cs_LastBlockFile);
+    boost::shared_ptr<CScriptDictionary> pdict = BuildScriptDictionary();
+
+    CAutoFile fileout = CAutoFile(OpenBlockFile(CDiskBlockPos(nLastBlockFile, 0)), SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+        return state.Abort(_("Failed to write block"));
+    unsigned char pchStart[4];
+    GetBlockRecordStart(BLOCKRECORD_DICTIONARY, pchStart);
+    unsigned int nSize = fileout.GetSerializeSize(*pdict);
+    try {
+        fileout << FLATDATA(pchStart) << nSize << *pdict;
+    } catch (std::exception &e) {
+        return state.Abort(_("Failed to write block"));
+    }
+    fflush(fileout);
+
+    infoLastBlockFile.nSize = nSize + 8;
+    infoLastBlockFile.nFormat = BLOCKFILE_FORMAT_COMPRESSED;
+    {
+        LOCK(cs_mapBlockFileDictionaries);
+        mapBlockFileDictionaries[nLastBlockFile] = pdict;
+    }
+    printf("Starting compressed block file %i with %"PRIszu" dictionary scripts\n", nLastBlockFile, pdict->vScripts.size());
+    return true;
+}
+
+// Encode block into ss, if that is shorter than its network serialization and
+// reproduces it exactly
+bool static CompressBlock(CBlock &block, const CScriptDictionary &dict, unsigned int nRawSize, CDataStream &ss)
+{
+    try {
+        ss << CBlockCompressor(block, dict);
+        if (ss.size() >= nRawSize)
+            return false;
+        CDataStream ssCheck(ss);
+        CBlock blockCheck;
+        ssCheck >> REF(CBlockCompressor(blockCheck, dict));
+        if (blockCheck.GetHash() == block.GetHash() && blockCheck.vtx == block.vtx)
+            return true;
+        printf("CompressBlock() : block %s does not round-trip, storing it uncompressed\n", block.GetHash().ToString().c_str());
+    } catch (std::exception &e) {
+        printf("CompressBlock() : %s\n", e.what());
+    }
+    return false;
+}
+
+template<typename Stream>
+bool static ReadBlockRecord(Stream &s, int nType, int nFile, CBlock &block)
+{
+    if (nType == BLOCKRECORD_RAW) {
+        s >> block;
+        return true;
+    }
+    if (nType == BLOCKRECORD_COMPRESSED) {
+        boost::shared_ptr<const CScriptDictionary> pdict = GetBlockFileDictionary(nFile);
+        if (!pdict)
+            return error("ReadBlockRecord() : no dictionary for blk%05u.dat", nFile);
+        s >> REF(CBlockCompressor(block, *pdict));
+        return true;
+    }
+    return error("ReadBlockRecord() : no block at this position in blk%05u.dat", nFile);
+}
+
+bool CBlock::WriteToDisk(CDiskBlockPos &pos)
+{
+    unsigned int nSize = ::GetSerializeSize(*this, SER_DISK, CLIENT_VERSION);
+    CDataStream ssCompressed(SER_DISK, CLIENT_VERSION);
+    if (fCompressBlocks) {
+        LOCK(cs_LastBlockFile);
+        CountBlockScripts(*this);
+        if (pos.nFile == nLastBlockFile && infoLastBlockFile.nFormat == BLOCKFILE_FORMAT_COMPRESSED) {
+            boost::shared_ptr<const CScriptDictionary> pdict = GetBlockFileDictionary(pos.nFile);
+            if (!pdict || !CompressBlock(*this, *pdict, nSize, ssCompressed))
+                ssCompressed.clear();
+        }
+    }
+
+    // Open history file to append
+    CAutoFile fileout = CAutoFile(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+        return error("CBlock::WriteToDisk() : OpenBlockFile failed");
+
+    // Write index header
+    unsigned int nPosReserved = pos.nPos;
+    unsigned int nDiskSize = ssCompressed.empty() ? nSize : ssCompressed.size();
+    unsigned char pchStart[4];
+    GetBlockRecordStart(ssCompressed.empty() ? BLOCKRECORD_RAW : BLOCKRECORD_COMPRESSED, pchStart);
+    fileout << FLATDATA(pchStart) << nDiskSize;
+
+    // Write block
+    long fileOutPos = ftell(fileout);
+    if (fileOutPos < 0)
+        return error("CBlock::WriteToDisk() : ftell failed");
+    pos.nPos = (unsigned int)fileOutPos;
+    if (ssCompressed.empty())
+        fileout << *this;
+    else
+        fileout.write(&ssCompressed[0], ssCompressed.size());
+
+    // Flush stdio buffers and commit to disk before returning
+    fflush(fileout);
+    if (!IsInitialBlockDownload())
+        FileCommit(fileout);
+
+    // Give back the part of the reservation the compressed block didn't use
+    if (nDiskSize < nSize) {
+        LOCK(cs_LastBlockFile);
+        if (pos.nFile == nLastBlockFile && infoLastBlockFile.nSize == nPosReserved + 8 + nSize) {
+            infoLastBlockFile.nSize = nPosReserved + 8 + nDiskSize;
+            if (!pblocktree->WriteBlockFileInfo(nLastBlockFile, infoLastBlockFile))
+                return error("CBlock::WriteToDisk() : failed to write file info");
+        }
+    }
+
+    return true;
+}
+
+bool CBlock::ReadFromDisk(const CDiskBlockPos &pos)
+{
+    SetNull();
+
+    // Blocks are stored preceded by their record type and size
+    if (pos.IsNull() || pos.nPos < 8)
+        return error("CBlock::ReadFromDisk() : invalid position");
+
+    // Read block, from the mapped file if possible
+    try {
+        boost::shared_ptr<const CMappedFile> pmap = MapBlockFile(pos);
+        if (pmap) {
+            int nType = GetBlockRecordType((const unsigned char*)pmap->begin() + pos.nPos - 8);
+            CSpanReader filein(pmap->begin() + pos.nPos, pmap->end(), SER_DISK, CLIENT_VERSION);
+            if (!ReadBlockRecord(filein, nType, pos.nFile, *this))
+                return false;
+        } else {
+            CAutoFile filein = CAutoFile(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 8), true), SER_DISK, CLIENT_VERSION);
+            if (!filein)
+                return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
+            unsigned char pchStart[4];
+            unsigned int nSize;
+            filein >> FLATDATA(pchStart) >> nSize;
+            if (!ReadBlockRecord(filein, GetBlockRecordType(pchStart), pos.nFile, *this))
+                return false;
+        }
+    }
+    catch (std::exception &e) {
+        return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+    }
+
+    // Check the header
+    if (!CheckProofOfWork(GetHash(), nBits))
+        return error("CBlock::ReadFromDisk() : errors in block header");
+
+    return true;
+}
+
+bool PruneBlockFiles(CValidationState &state, int nTipHeight)
+{
+    if (!fPruneMode)
+        return true;
+    // While reindexing or importing, files may hold blocks that arrived
+    // before their parents and are not connected yet; prune afterwards
+    if (fReindex || fImporting)
+        return true;
+
+    int nLastFile;
+    std::vector<CBlockFileInfo> vinfo;
+    {
+        LOCK(cs_LastBlockFile);
+        nLastFile = nLastBlockFile;
+        vinfo.resize(nLastFile + 1);
+        for (int nFile = 0; nFile < nLastFile; nFile++)
+            pblocktree->ReadBlockFileInfo(nFile, vinfo[nFile]);
+        vinfo[nLastFile] = infoLastBlockFile;
+    }
+
+    uint64 nCurrentUsage = 0;
+    BOOST_FOREACH(const CBlockFileInfo &info, vinfo)
+        nCurrentUsage += (uint64)info.nSize + info.nUndoSize;
+    if (nCurrentUsage <= nPruneTarget)
+        return true;
+
+    // Delete the oldest files first. The file being appended to and files
+    // holding blocks a reorganization could still need are always kept.
+    set<int> setPrune;
+    for (int nFile = 0; nFile < nLastFile && nCurrentUsage > nPruneTarget; nFile++) {
+        const CBlockFileInfo &info = vinfo[nFile];
+        if (info.nSize == 0 && info.nUndoSize == 0)
+            continue;
+        if ((int)info.nHeightLast + MIN_BLOCKS_TO_KEEP > nTipHeight)
+            continue;
+        setPrune.insert(nFile);
+        nCurrentUsage -= (uint64)info.nSize + info.nUndoSize;
+    }
+    if (setPrune.empty())
+        return true;
+
+    // Update the index before deleting anything, so it never points to missing data
+    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); mi++) {
+        CBlockIndex *pindex = (*mi).second;
+        if (!(pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)) || !setPrune.count(pindex->nFile))
+            continue;
+        pindex->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO);
+        CDiskBlockIndex blockindex(pindex);
+        if (!pblocktree->WriteBlockIndex(blockindex))
+            return state.Abort(_("Failed to write block index"));
+    }
+    BOOST_FOREACH(int nFile, setPrune) {
+        CBlockFileInfo &info = vinfo[nFile];
+        info.nSize = 0;
+        info.nUndoSize = 0;
+        if (!pblocktree->WriteBlockFileInfo(nFile, info))
+            return state.Abort(_("Failed to write file info"));
+    }
+    if (!fHavePruned) {
+        if (!pblocktree->WriteFlag("prunedblockfiles", true))
+            return state.Abort(_("Failed to write block index"));
+        fHavePruned = true;
+    }
+    pblocktree->Sync();
+
+    BOOST_FOREACH(int nFile, setPrune) {
+        static const char *ppszPrefix[] = {"blk", "rev"};
+        for (int i = 0; i < 2; i++) {
+            boost::filesystem::path path = GetDataDir() / "blocks" / strprintf("%s%05u.dat", ppszPrefix[i], nFile);
+            blockfilemapper.Forget(path.string());
+            try {
+                boost::filesystem::remove(path);
+            } catch (boost::filesystem::filesystem_error &e) {
+                printf("PruneBlockFiles() : unable to delete %s : %s\n", path.string().c_str(), e.what());
+            }
+        }
+        ForgetBlockFileDictionary(nFile);
+        printf("Pruned block file %i: %s\n", nFile, vinfo[nFile].ToString().c_str());
+    }
+    return true;
+}
+
+bool ReadRawBlockFromDisk(CDataStream &ssBlock, const CDiskBlockPos &pos)
+{
+    // Blocks are stored preceded by their record type and size
+    if (pos.IsNull() || pos.nPos < 8)
+        return error("ReadRawBlockFromDisk() : invalid position");
+
+    int nType;
+    boost::shared_ptr<const CMappedFile> pmap = MapBlockFile(pos);
+    if (pmap) {
+        const char *pchHeader = pmap->begin() + pos.nPos - 8;
+        unsigned int nSize;
+        memcpy(&nSize, pchHeader + 4, sizeof(nSize));
+        nType = GetBlockRecordType((const unsigned char*)pchHeader);
+        if (nType == BLOCKRECORD_RAW) {
+            if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                return error("ReadRawBlockFromDisk() : invalid block size %u", nSize);
+            ssBlock.write(pchHeader + 8, nSize);
+            return true;
+        }
+    } else {
+        CDiskBlockPos posHeader(pos.nFile, pos.nPos - 8);
+        CAutoFile filein = CAutoFile(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+        if (!filein)
+            return error("ReadRawBlockFromDisk() : OpenBlockFile failed");
+
+        try {
+            unsigned char pchStart[4];
+            unsigned int nSize;
+            filein >> FLATDATA(pchStart) >> nSize;
+            nType = GetBlockRecordType(pchStart);
+            if (nType == BLOCKRECORD_RAW) {
+                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                    return error("ReadRawBlockFromDisk() : invalid block size %u", nSize);
+                ssBlock.resize(nSize);
+                filein.read((char*)&ssBlock[0], nSize);
+                return true;
+            }
+        }
+        catch (std::exception &e) {
+            return error("%s() : I/O error", __PRETTY_FUNCTION__);
+        }
+    }
+    if (nType != BLOCKRECORD_COMPRESSED)
+        return error("ReadRawBlockFromDisk() : message start mismatch at %d:%u", pos.nFile, pos.nPos);
+
+    // Compressed blocks are decoded and serialized again
+    CBlock block;
+    if (!block.ReadFromDisk(pos))
+        return false;
+    ssBlock << block;
+    return true;
+}
+
+CBlockIndex * InsertBlockIndex(uint256 hash)
+{
+    if (hash == 0)
+        return NULL;
+
+    // Return existing
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    if (mi != mapBlockIndex.end())
+        return (*mi).second;
+
+    // Create new
+    CBlockIndex* pindexNew = new CBlockIndex();
+    if (!pindexNew)
+        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    {
+        LOCK(cs_mapBlockIndex);
+        mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    }
+    pindexNew->phashBlock = &((*mi).first);
+
+    return pindexNew;
+}
+
+// -addrindex and -spentindex can be turned on for an existing database: the blocks
+// connected before then are indexed by ThreadBuildIndexes, which records how far
+// it got in the block tree database
+struct COptionalIndex
+{
+    const char *pszName;
+    bool *pfEnabled;
+    CBlockIndex *pindexBuilt; // last block indexed while catching up, NULL if complete
+};
+
+enum { OPTINDEX_ADDRESS, OPTINDEX_SPENT };
+
+static COptionalIndex optionalIndexes[] = {
+    { "addrindex",  &fAddressIndex, NULL },
+    { "spentindex", &fSpentIndex,   NULL },
+};
+
+static COptionalIndex *FindOptionalIndex(const std::string &strName)
+{
+    for (unsigned int i = 0; i < ARRAYLEN(optionalIndexes); i++)
+        if (strName == optionalIndexes[i].pszName)
+            return &optionalIndexes[i];
+    return NULL;
+}
+
+void static LoadOptionalIndexes()
+{
+    for (unsigned int i = 0; i < ARRAYLEN(optionalIndexes); i++) {
+        COptionalIndex &index = optionalIndexes[i];
+        *index.pfEnabled = false;
+        index.pindexBuilt = NULL;
+        pblocktree->ReadFlag(index.pszName, *index.pfEnabled);
+        uint256 hashBuilt;
+        if (*index.pfEnabled && pblocktree->ReadIndexBuildProgress(index.pszName, hashBuilt)) {
+            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBuilt);
+            index.pindexBuilt = (mi != mapBlockIndex.end()) ? mi->second : pindexGenesisBlock;
+        }
+        printf("LoadBlockIndexDB(): %s %s\n", index.pszName, !*index.pfEnabled ? "disabled" : index.pindexBuilt ? "being built" : "enabled");
+    }
+}
+
+bool EnableOptionalIndex(const std::string &strName)
+{
+    LOCK(cs_main);
+    COptionalIndex *pindex = FindOptionalIndex(strName);
+    assert(pindex);
+    if (*pindex->pfEnabled)
+        return true;
+
+    // Blocks connected from now on are indexed by ConnectBlock
+    *pindex->pfEnabled = true;
+    pindex->pindexBuilt = pindexBest == pindexGenesisBlock ? NULL : pindexGenesisBlock;
+    if (pindex->pindexBuilt && !pblocktree->WriteIndexBuildProgress(pindex->pszName, pindex->pindexBuilt->GetBlockHash()))
+        return false;
+    printf("EnableOptionalIndex(): %s enabled, %s\n", pindex->pszName, pindex->pindexBuilt ? "indexing the existing chain" : "chain is empty");
+    return pblocktree->WriteFlag(pindex->pszName, true);
+}
+
+int GetIndexBuildHeight(const std::string &strName)
+{
+    LOCK(cs_main);
+    COptionalIndex *pindex = FindOptionalIndex(strName);
+    assert(pindex);
+    return pindex->pindexBuilt ? pindex->pindexBuilt->nHeight : -1;
+}
+
+bool IsBuildingIndexes()
+{
+    LOCK(cs_main);
+    for (unsigned int i = 0; i < ARRAYLEN(optionalIndexes); i++)
+        if (optionalIndexes[i].pindexBuilt)
+            return true;
+    return false;
+}
+
+void ThreadBuildIndexes()
+{
+    RenameThread("bitcoin-buildidx");
+
+    // Blocks are read and their entries collected without cs_main; the entries
+    // are only written if the blocks are still in the best chain, so none of a
+    // block that was disconnected in the meantime come back
+    const unsigned int nBatchSize = 100;
+    int64 nStart = GetTimeMillis();
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        std::vector<CBlockIndex*> vBlocks;
+        CBlockIndex *pindexFrom = NULL;
+        {
+            LOCK(cs_main);
+            for (unsigned int i = 0; i < ARRAYLEN(optionalIndexes); i++) {
+                CBlockIndex *&pindexBuilt = optionalIndexes[i].pindexBuilt;
+                if (!pindexBuilt)
+                    continue;
+                // back up to the best chain after a reorganization
+                while (pindexBuilt->pnext == NULL && pindexBuilt != pindexBest)
+                    pindexBuilt = pindexBuilt->pprev;
+                if (pindexBuilt == pindexBest) {
+                    pindexBuilt = NULL;
+                    pblocktree->EraseIndexBuildProgress(optionalIndexes[i].pszName);
+                    printf("ThreadBuildIndexes(): %s complete  %"PRI64d"ms\n", optionalIndexes[i].pszName, GetTimeMillis() - nStart);
+                    continue;
+                }
+                if (!pindexFrom || pindexBuilt->nHeight < pindexFrom->nHeight)
+                    pindexFrom = pindexBuilt;
+            }
+            if (!pindexFrom)
+                return;
+            for (CBlockIndex *pindex = pindexFrom->pnext; pindex && vBlocks.size() < nBatchSize; pindex = pindex->pnext)
+                vBlocks.push_back(pindex);
+        }
+
+        std::vector<std::vector<std::pair<CAddressIndexKey, int64> > > vAddress(vBlocks.size());
+        std::vector<std::vector<std::pair<COutPoint, CSpentIndexValue> > > vSpent(vBlocks.size());
+        for (unsigned int i = 0; i < vBlocks.size(); i++) {
+            CBlockIndex *pindex = vBlocks[i];
+            CBlock block;
+            CBlockUndo blockUndo;
+            CDiskBlockPos pos = pindex->GetUndoPos();
+            if (!block.ReadFromDisk(pindex) || pos.IsNull() || !blockUndo.ReadFromDisk(pos, pindex->pprev->GetBlockHash())) {
+                printf("ThreadBuildIndexes(): failed to read block %s or its undo data, giving up\n", pindex->GetBlockHash().ToString().c_str());
+                return;
+            }
+            if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
+                return (void)error("ThreadBuildIndexes() : block and undo data inconsistent");
+            GetBlockIndexEntries(block, blockUndo, pindex->nHeight, true, true, vAddress[i], vSpent[i]);
+        }
+
+        {
+            LOCK(cs_main);
+            std::vector<std::pair<uint256, CDiskTxPos> > vNoTxPos;
+            std::vector<std::pair<CAddressIndexKey, int64> > vAddressWrite;
+            std::vector<std::pair<COutPoint, CSpentIndexValue> > vSpentWrite;
+            CBlockIndex *pindexLast = NULL;
+            for (unsigned int i = 0; i < vBlocks.size(); i++) {
+                CBlockIndex *pindex = vBlocks[i];
+                if (pindex->pnext == NULL && pindex != pindexBest)
+                    break;
+                const CBlockIndex *pindexAddress = optionalIndexes[OPTINDEX_ADDRESS].pindexBuilt;
+                const CBlockIndex *pindexSpent = optionalIndexes[OPTINDEX_SPENT].pindexBuilt;
+                if (pindexAddress && pindexAddress->nHeight < pindex->nHeight)
+                    vAddressWrite.insert(vAddressWrite.end(), vAddress[i].begin(), vAddress[i].end());
+                if (pindexSpent && pindexSpent->nHeight < pindex->nHeight)
+                    vSpentWrite.insert(vSpentWrite.end(), vSpent[i].begin(), vSpent[i].end());
+                pindexLast = pindex;
+            }
+            if (pindexLast == NULL)
+                continue;
+            if (!pblocktree->WriteIndexes(vNoTxPos, vAddressWrite, vSpentWrite)) {
+                printf("ThreadBuildIndexes(): failed to write to the block tree database, giving up\n");
+                return;
+            }
+            for (unsigned int i = 0; i < ARRAYLEN(optionalIndexes); i++) {
+                CBlockIndex *&pindexBuilt = optionalIndexes[i].pindexBuilt;
+                if (pindexBuilt && pindexBuilt->nHeight < pindexLast->nHeight) {
+                    pindexBuilt = pindexLast;
+                    pblocktree->WriteIndexBuildProgress(optionalIndexes[i].pszName, pindexLast->GetBlockHash());
+                }
+            }
+        }
+    }
+}
+
+bool static LoadBlockIndexDB()
+{
+    if (!pblocktree->LoadBlockIndexGuts())
+        return false;
+
+    boost::this_thread::interruption_point();
+
+    // Calculate nChainWork
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+    {
+        CBlockIndex* pindex = item.second;
+        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+    }
+    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    {
+        CBlockIndex* pindex = item.second;
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWork().getuint256();
+        pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS && !(pindex->nStatus & BLOCK_FAILED_MASK))
+            setBlockIndexValid.insert(pindex);
+    }
+
+    // Load block file info
+    pblocktree->ReadLastBlockFile(nLastBlockFile);
+    printf("LoadBlockIndexDB(): last block file = %i\n", nLastBlockFile);
+    if (pblocktree->ReadBlockFileInfo(nLastBlockFile, infoLastBlockFile))
+        printf("LoadBlockIndexDB(): last block file info: %s\n", infoLastBlockFile.ToString().c_str());
+
+    // Load nBestInvalidWork, OK if it doesn't exist
+    CBigNum bnBestInvalidWork;
+    pblocktree->ReadBestInvalidWork(bnBestInvalidWork);
+    nBestInvalidWork = bnBestInvalidWork.getuint256();
+
+    // Check whether we need to continue reindexing
+    bool fReindexing = false;
+    pblocktree->ReadReindexing(fReindexing);
+    fReindex |= fReindexing;
+
+    // Check whether we have a transaction index
+    pblocktree->ReadFlag("txindex", fTxIndex);
+    printf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
+
+    // Check for the optional address and spent indexes, and whether they are still being built
+    LoadOptionalIndexes();
+
+    // Check whether block files were ever pruned
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        printf("LoadBlockIndexDB(): block files have previously been pruned\n");
+
+    // Load hashBestChain pointer to end of best chain
+    pindexBest = pcoinsTip->GetBestBlock();
     if (pindexBest == NULL)
         return true;
     hashBestChain = pindexBest->GetBlockHash();
     nBestHeight = pindexBest->nHeight;
     nBestChainWork = pindexBest->nChainWork;
+    PublishChainTip(pindexBest);
 
     // set 'next' pointers in best chain
     CBlockIndex *pindex = pindexBest;
@@ -2646,6 +3738,9 @@ bool VerifyDB() {
         boost::this_thread::interruption_point();
         if (pindex->nHeight < nBestHeight-nCheckDepth)
             break;
+        // pruned blocks can't be checked
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!block.ReadFromDisk(pindex))
@@ -2665,7 +3760,7 @@ bool VerifyDB() {
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= 2*nCoinCacheSize + 32000) {
             bool fClean = true;
-            if (!block.DisconnectBlock(state, pindex, coins, &fClean))
+            if (!block.DisconnectBlock(state, pindex, coins, &fClean, true))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
             pindexState = pindex->pprev;
             if (!fClean) {
@@ -2699,8 +3794,14 @@ bool VerifyDB() {
 
 void UnloadBlockIndex()
 {
-    mapBlockIndex.clear();
+    PublishChainTip(NULL);
+    {
+        LOCK(cs_mapBlockIndex);
+        mapBlockIndex.clear();
+    }
     setBlockIndexValid.clear();
+    for (unsigned int i = 0; i < ARRAYLEN(optionalIndexes); i++)
+        optionalIndexes[i].pindexBuilt = NULL;
     pindexGenesisBlock = NULL;
     nBestHeight = 0;
     nBestChainWork = 0;
@@ -2738,6 +3839,11 @@ bool InitBlockIndex() {
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", false);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    for (unsigned int i = 0; i < ARRAYLEN(optionalIndexes); i++) {
+        *optionalIndexes[i].pfEnabled = GetBoolArg(std::string("-") + optionalIndexes[i].pszName, false);
+        optionalIndexes[i].pindexBuilt = NULL;
+        pblocktree->WriteFlag(optionalIndexes[i].pszName, *optionalIndexes[i].pfEnabled);
+    }
     printf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -2872,13 +3978,131 @@ void PrintBlockTree()
     }
 }
 
+/** A block read during an import, with the result of its context-free checks */
+struct CImportBlock
+{
+    uint64 nPos;
+    CBlock block;
+    bool fValid;
+
+    CImportBlock(uint64 nPosIn) : nPos(nPosIn), fValid(false) {}
+};
+
+/** Closure running CheckBlock on a block read during an import */
+class CBlockCheck
+{
+private:
+    CImportBlock *pimport;
+
+public:
+    CBlockCheck() : pimport(NULL) {}
+    CBlockCheck(CImportBlock& importIn) : pimport(&importIn) {}
+
+    bool operator()() {
+        CValidationState state;
+        pimport->fValid = pimport->block.CheckBlock(state);
+        return true;
+    }
+
+    void swap(CBlockCheck &check) {
+        std::swap(pimport, check.pimport);
+    }
+};
+
+static CCheckQueue<CBlockCheck> blockcheckqueue(1);
+
+void static ThreadBlockCheck() {
+    RenameThread("bitcoin-blkcheck");
+    blockcheckqueue.Thread();
+}
+
+/** Block check workers for the duration of an import. Finishes all queued
+ *  checks before the blocks they point to go away. */
+class CBlockCheckWorkers
+{
+private:
+    boost::thread_group threadGroup;
+
+public:
+    CBlockCheckWorkers(int nThreads) {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(&ThreadBlockCheck);
+    }
+
+    ~CBlockCheckWorkers() {
+        blockcheckqueue.Wait();
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+};
+
+typedef std::deque<CImportBlock> ImportBatch;
+
+// Blocks found in a block file before their parent, by parent hash. Only their
+// position is kept; they are read again once the parent has been processed.
+static multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+// Process checked blocks in file order. Returns false on a fatal error.
+bool static ProcessImportBatch(ImportBatch &batch, CDiskBlockPos *dbp, int &nLoaded)
+{
+    LOCK(cs_main);
+    for (ImportBatch::iterator it = batch.begin(); it != batch.end(); it++) {
+        CBlock &block = (*it).block;
+        uint256 hash = block.GetHash();
+        if (!(*it).fValid) {
+            printf("LoadExternalBlockFile() : skipping invalid block %s\n", hash.ToString().c_str());
+            continue;
+        }
+        if (dbp) {
+            dbp->nPos = (*it).nPos;
+            if (block.hashPrevBlock != 0 && !mapBlockIndex.count(block.hashPrevBlock) && !mapBlockIndex.count(hash)) {
+                mapBlocksUnknownParent.insert(make_pair(block.hashPrevBlock, *dbp));
+                continue;
+            }
+        }
+        CValidationState state;
+        if (ProcessBlock(state, NULL, &block, dbp, false))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+
+        // Process any parked descendants that can now be connected
+        vector<uint256> vWorkQueue;
+        vWorkQueue.push_back(hash);
+        for (unsigned int i = 0; i < vWorkQueue.size(); i++) {
+            pair<multimap<uint256, CDiskBlockPos>::iterator, multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(vWorkQueue[i]);
+            while (range.first != range.second) {
+                CDiskBlockPos posChild = (*range.first).second;
+                mapBlocksUnknownParent.erase(range.first++);
+                CBlock blockChild;
+                if (!blockChild.ReadFromDisk(posChild))
+                    continue;
+                CValidationState stateChild;
+                if (ProcessBlock(stateChild, NULL, &blockChild, &posChild)) {
+                    nLoaded++;
+                    vWorkQueue.push_back(blockChild.GetHash());
+                }
+                if (stateChild.IsError())
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
 {
     int64 nStart = GetTimeMillis();
 
     int nLoaded = 0;
+    FileAdviseSequential(fileIn);
+
+    // Pipeline: while one batch of blocks is checked by the workers, the next
+    // batch is read here and the previous one is processed in file order.
+    ImportBatch batchReading, batchChecking;
+    CBlockCheckWorkers workers(nScriptCheckThreads - 1);
     try {
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        CBufferedFile blkdat(fileIn, 8*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64 nStartByte = 0;
         if (dbp) {
             // (try to) skip already indexed part
@@ -2889,50 +4113,93 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
             }
         }
         uint64 nRewind = blkdat.GetPos();
-        while (blkdat.good() && !blkdat.eof()) {
+        unsigned int nBatchBytes = 0;
+        bool fEnd = false;
+        // dictionary for the compressed blocks that follow it
+        boost::shared_ptr<const CScriptDictionary> pdict;
+        while (!fEnd) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[4];
-                blkdat.FindByte(pchMessageStart[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, pchMessageStart, 4))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (std::exception &e) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64 nBlockPos = blkdat.GetPos();
-                blkdat.SetLimit(nBlockPos + nSize);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // process block
-                if (nBlockPos >= nStartByte) {
-                    LOCK(cs_main);
-                    if (dbp)
-                        dbp->nPos = nBlockPos;
-                    CValidationState state;
-                    if (ProcessBlock(state, NULL, &block, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
+            if (blkdat.good() && !blkdat.eof()) {
+                blkdat.SetPos(nRewind);
+                nRewind++; // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                unsigned int nSize = 0;
+                int nType = -1;
+                try {
+                    // locate a header
+                    unsigned char buf[4];
+                    blkdat.FindByte(pchMessageStart[0]);
+                    nRewind = blkdat.GetPos()+1;
+                    blkdat >> FLATDATA(buf);
+                    nType = GetBlockRecordType(buf);
+                    if (nType < 0)
+                        continue;
+                    // read size
+                    blkdat >> nSize;
+                    if (nSize > MAX_BLOCK_SIZE || (nSize < 80 && nType != BLOCKRECORD_DICTIONARY))
+                        continue;
+                } catch (std::exception &e) {
+                    // no valid block header found; don't complain
+                    fEnd = true;
                 }
-            } catch (std::exception &e) {
-                printf("%s() : Deserialize or I/O error caught during load\n", __PRETTY_FUNCTION__);
+                if (!fEnd) {
+                    try {
+                        // read block
+                        uint64 nBlockPos = blkdat.GetPos();
+                        blkdat.SetLimit(nBlockPos + nSize);
+                        if (nType == BLOCKRECORD_DICTIONARY) {
+                            boost::shared_ptr<CScriptDictionary> pdictRead(new CScriptDictionary());
+                            blkdat >> *pdictRead;
+                            pdict = pdictRead;
+                            nRewind = blkdat.GetPos();
+                            continue;
+                        }
+                        if (nType == BLOCKRECORD_COMPRESSED && !pdict && dbp)
+                            pdict = GetBlockFileDictionary(dbp->nFile);
+                        if (nType == BLOCKRECORD_COMPRESSED && !pdict)
+                            throw std::ios_base::failure("compressed block without dictionary");
+                        batchReading.push_back(CImportBlock(nBlockPos));
+                        try {
+                            if (nType == BLOCKRECORD_COMPRESSED)
+                                blkdat >> REF(CBlockCompressor(batchReading.back().block, *pdict));
+                            else
+                                blkdat >> batchReading.back().block;
+                        } catch (std::exception &e) {
+                            batchReading.pop_back();
+                            throw;
+                        }
+                        nRewind = blkdat.GetPos();
+                        if (nBlockPos >= nStartByte)
+                            nBatchBytes += nSize;
+                        else
+                            batchReading.pop_back();
+                    } catch (std::exception &e) {
+                        printf("%s() : Deserialize or I/O error caught during load\n", __PRETTY_FUNCTION__);
+                    }
+                    if (nBatchBytes < 8*MAX_BLOCK_SIZE && batchReading.size() < 1000)
+                        continue;
+                }
+            } else {
+                fEnd = true;
+            }
+
+            // Hand the batch just read to the workers, and process the previous one
+            blockcheckqueue.Wait();
+            vector<CBlockCheck> vChecks;
+            vChecks.reserve(batchReading.size());
+            for (ImportBatch::iterator it = batchReading.begin(); it != batchReading.end(); it++)
+                vChecks.push_back(CBlockCheck(*it));
+            blockcheckqueue.Add(vChecks);
+            if (!ProcessImportBatch(batchChecking, dbp, nLoaded))
+                break;
+            batchChecking.clear();
+            batchChecking.swap(batchReading);
+            nBatchBytes = 0;
+
+            if (fEnd) {
+                blockcheckqueue.Wait();
+                ProcessImportBatch(batchChecking, dbp, nLoaded);
             }
         }
         fclose(fileIn);
@@ -3069,19 +4336,47 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 // Send block from disk
                 map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
+                if (mi != mapBlockIndex.end() && !((*mi).second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    CBlock block;
-                    block.ReadFromDisk((*mi).second);
+                    // The block was pruned, tell them instead of going silent
+                    vNotFound.push_back(inv);
+                }
+                else if (mi != mapBlockIndex.end())
+                {
+                    boost::shared_ptr<const CCachedBlock> pcached = GetRecentBlock(inv.hash);
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    {
+                        if (pcached)
+                            pfrom->PushMessage("block", pcached->ssBlock);
+                        else
+                        {
+                            // Disk and network serialization of blocks are identical,
+                            // so send the stored bytes without parsing them
+                            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+                            if (ReadRawBlockFromDisk(ssBlock, (*mi).second->GetBlockPos()))
+                                pfrom->PushMessage("block", ssBlock);
+                        }
+                    }
+                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        CBlock blockRead;
+                        if (!pcached)
+                            blockRead.ReadFromDisk((*mi).second);
+                        const CBlock &block = pcached ? pcached->block : blockRead;
+                        if (!block.vtx.empty())
+                            pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
+                        CBlock blockRead;
+                        if (pfrom->pfilter && !pcached)
+                            blockRead.ReadFromDisk((*mi).second);
+                        const CBlock &block = pcached ? pcached->block : blockRead;
                         if (pfrom->pfilter)
                         {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -3161,6 +4456,35 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+// Finish a compact block with the transactions the memory pool didn't have
+void static ProcessPartialBlock(CNode* pfrom, const CPartialBlock& partial, const vector<CTransaction>& vMissing)
+{
+    uint256 hash = partial.header.GetHash();
+    CInv inv(MSG_BLOCK, hash);
+    CBlock block;
+    CPartialBlock::ReadStatus status = partial.Fill(vMissing, block);
+    if (status == CPartialBlock::READ_INVALID)
+    {
+        pfrom->Misbehaving(100);
+        printf("ERROR: peer=%s sent the wrong number of transactions for block %s\n", pfrom->addr.ToString().c_str(), hash.ToString().c_str());
+        return;
+    }
+    if (status == CPartialBlock::READ_FAILED)
+    {
+        // Most likely a short ID matched the wrong pool transaction
+        printf("could not rebuild compact block %s, asking for all of it\n", hash.ToString().c_str());
+        pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+        return;
+    }
+
+    CValidationState state;
+    if (ProcessBlock(state, pfrom, &block))
+        mapAlreadyAskedFor.erase(inv);
+    int nDoS;
+    if (state.IsInvalid(nDoS))
+        pfrom->Misbehaving(nDoS);
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 {
     RandAddSeedPerfmon();
@@ -3468,6 +4792,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 printf("  getblocks stopping at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
                 break;
             }
+            // Don't announce blocks we can no longer send
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            {
+                printf("  getblocks stopping at pruned block %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
+                break;
+            }
             pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
             if (--nLimit <= 0)
             {
@@ -3609,6 +4939,113 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     }
 
 
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex)
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        uint256 hash = cmpctblock.header.GetHash();
+        CInv inv(MSG_BLOCK, hash);
+        pfrom->AddInventoryKnown(inv);
+        if (AlreadyHave(inv))
+            return true;
+
+        // Without its parent the header can't be checked, nor the block
+        // connected; fetch it whole so it goes the orphan block way. The
+        // memory pool follows our tip, so a block on another one is fetched
+        // whole too
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(cmpctblock.header.hashPrevBlock);
+        if (mi == mapBlockIndex.end() || mi->second != pindexBest)
+        {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
+        // Rebuilding goes through the whole memory pool, don't do it for
+        // headers that lack the work required
+        if (cmpctblock.header.nBits != GetNextWorkRequired(mi->second, &cmpctblock.header) ||
+            !CheckProofOfWork(hash, cmpctblock.header.nBits))
+        {
+            pfrom->Misbehaving(100);
+            return error("message cmpctblock : block %s has the wrong proof of work", hash.ToString().c_str());
+        }
+
+        boost::shared_ptr<CPartialBlock> partial(new CPartialBlock());
+        CPartialBlock::ReadStatus status = partial->Init(cmpctblock, mempool);
+        if (status == CPartialBlock::READ_INVALID)
+        {
+            pfrom->Misbehaving(100);
+            return error("message cmpctblock : invalid compact block %s", hash.ToString().c_str());
+        }
+        if (status == CPartialBlock::READ_FAILED)
+        {
+            printf("received compact block %s with colliding short IDs, asking for all of it\n", hash.ToString().c_str());
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
+        CBlockTransactionsRequest req;
+        req.blockhash = hash;
+        partial->GetMissing(req.vIndexes);
+        printf("received compact block %s, %u of %u transactions from the memory pool\n",
+               hash.ToString().c_str(), partial->nFromPool, cmpctblock.BlockTxCount());
+        if (req.vIndexes.empty())
+            ProcessPartialBlock(pfrom, *partial, vector<CTransaction>());
+        else
+        {
+            pfrom->pPartialBlock = partial;
+            pfrom->PushMessage("getblocktxn", req);
+        }
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !((*mi).second->nStatus & BLOCK_HAVE_DATA))
+        {
+            printf("peer=%s asked for transactions of unknown block %s\n", pfrom->addr.ToString().c_str(), req.blockhash.ToString().c_str());
+            return true;
+        }
+        boost::shared_ptr<const CCachedBlock> pcached = GetRecentBlock(req.blockhash);
+        CBlock blockRead;
+        if (!pcached && !blockRead.ReadFromDisk((*mi).second))
+            return error("message getblocktxn : failed to read block %s", req.blockhash.ToString().c_str());
+        const CBlock &block = pcached ? pcached->block : blockRead;
+
+        CBlockTransactions resp(req);
+        for (unsigned int i = 0; i < req.vIndexes.size(); i++)
+        {
+            if (req.vIndexes[i] >= block.vtx.size())
+            {
+                pfrom->Misbehaving(100);
+                return error("message getblocktxn : index out of range");
+            }
+            resp.vtx[i] = block.vtx[req.vIndexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex)
+    {
+        CBlockTransactions resp;
+        vRecv >> resp;
+
+        boost::shared_ptr<CPartialBlock> partial = pfrom->pPartialBlock;
+        if (!partial || partial->header.GetHash() != resp.blockhash)
+        {
+            printf("received unrequested blocktxn for block %s\n", resp.blockhash.ToString().c_str());
+            return true;
+        }
+        pfrom->pPartialBlock.reset();
+        ProcessPartialBlock(pfrom, *partial, resp.vtx);
+    }
+
+
     else if (strCommand == "getaddr")
     {
         pfrom->vAddrToSend.clear();
@@ -4018,6 +5455,18 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         vector<CInv> vGetData;
         int64 nNow = GetTime() * 1000000;
+        // New blocks from peers that can send them compact. Only a block on
+        // top of our tip can be rebuilt from the memory pool, so not during
+        // initial download nor when several blocks are missing
+        bool fAskCompact = fCompactBlocks && (pto->nServices & NODE_COMPACT_BLOCKS) && !IsInitialBlockDownload() && mapOrphanBlocks.empty();
+        if (fAskCompact)
+        {
+            int nBlocks = 0;
+            for (multimap<int64, CInv>::iterator mi = pto->mapAskFor.begin(); mi != pto->mapAskFor.end() && (*mi).first <= nNow; ++mi)
+                if ((*mi).second.type == MSG_BLOCK && !AlreadyHave((*mi).second))
+                    nBlocks++;
+            fAskCompact = (nBlocks == 1);
+        }
         while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
         {
             const CInv& inv = (*pto->mapAskFor.begin()).second;
@@ -4025,7 +5474,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             {
                 if (fDebugNet)
                     printf("sending getdata: %s\n", inv.ToString().c_str());
-                vGetData.push_back(inv);
+                if (fAskCompact && inv.type == MSG_BLOCK)
+                    vGetData.push_back(CInv(MSG_CMPCT_BLOCK, inv.hash));
+                else
+                    vGetData.push_back(inv);
                 if (vGetData.size() >= 1000)
                 {
                     pto->PushMessage("getdata", vGetData);
@@ -4447,7 +5899,8 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     pblock->vtx[0].vin[0].scriptSig = (CScript() << nHeight << CBigNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(pblock->vtx[0].vin[0].scriptSig.size() <= 100);
 
-    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    // Only the coinbase changed since the tree was last built
+    pblock->hashMerkleRoot = pblock->UpdateMerkleTreeCoinbase();
 }
 
 
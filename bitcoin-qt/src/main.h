@@ -9,9 +9,12 @@
 #include "sync.h"
 #include "net.h"
 #include "script.h"
+#include "blockfile.h"
 
 #include <list>
 
+#include <boost/shared_ptr.hpp>
+
 class CWallet;
 class CBlock;
 class CBlockIndex;
@@ -53,6 +56,14 @@ static const int COINBASE_MATURITY = 100;
 static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20 1985 UTC
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
+/** Maximum number of block and undo files kept memory mapped for reading */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = sizeof(void*) >= 8 ? 64 : 4;
+/** Number of recently accepted blocks kept in memory to answer getdata requests */
+static const unsigned int RECENT_BLOCK_CACHE_SIZE = 8;
+/** Number of blocks below the tip whose data is never pruned, to allow reorganizations */
+static const int MIN_BLOCKS_TO_KEEP = 288;
+/** Smallest -prune target, so the files above MIN_BLOCKS_TO_KEEP always fit */
+static const uint64 MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
 #ifdef USE_UPNP
 static const int fHaveUPnP = true;
 #else
@@ -92,7 +103,15 @@ extern bool fReindex;
 extern bool fBenchmark;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
+extern bool fCompressBlocks;
+extern bool fCompactBlocks;
+extern bool fPruneMode;
+extern bool fHavePruned;
+extern uint64 nPruneTarget;
 extern unsigned int nCoinCacheSize;
+extern int64 nDBSyncInterval;
 
 // Settings
 extern int64 nTransactionFee;
@@ -104,6 +123,8 @@ static const uint64 nMinDiskSpace = 52428800;
 class CReserveKey;
 class CCoinsDB;
 class CBlockTreeDB;
+class CLevelDBBatch;
+class CCoinsViewDB;
 struct CDiskBlockPos;
 class CCoins;
 class CTxUndo;
@@ -111,8 +132,10 @@ class CCoinsView;
 class CCoinsViewCache;
 class CScriptCheck;
 class CValidationState;
+class CTransaction;
 
 struct CBlockTemplate;
+class CScriptDictionary;
 
 /** Register a wallet to receive updates from core */
 void RegisterWallet(CWallet* pwalletIn);
@@ -120,14 +143,35 @@ void RegisterWallet(CWallet* pwalletIn);
 void UnregisterWallet(CWallet* pwalletIn);
 /** Push an updated transaction to all registered wallets */
 void SyncWithWallets(const uint256 &hash, const CTransaction& tx, const CBlock* pblock = NULL, bool fUpdate = false);
-/** Process an incoming block */
-bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp = NULL);
+/** Process an incoming block. fCheckBlock=false skips CheckBlock, for callers that already ran it. */
+bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp = NULL, bool fCheckBlock = true);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64 nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Open an undo file (rev?????.dat) */
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+/** Memory map the block file holding the block at pos, if that file is no longer
+ *  appended to. Returns an empty pointer if the caller should read with stdio. */
+boost::shared_ptr<const CMappedFile> MapBlockFile(const CDiskBlockPos &pos);
+/** Same for the undo data at pos, followed by nTrailer bytes (its checksum) */
+boost::shared_ptr<const CMappedFile> MapUndoFile(const CDiskBlockPos &pos, unsigned int nTrailer);
+/** Hint that block files are about to be read in order, as during a rescan */
+void SetBlockFileSequential(bool fSequential);
+/** Read the serialized bytes of the block stored at pos, without deserializing them */
+bool ReadRawBlockFromDisk(CDataStream &ssBlock, const CDiskBlockPos &pos);
+/** Write the 4 bytes starting a block file record of type nType (see BlockRecordType) */
+void GetBlockRecordStart(int nType, unsigned char pchStart[4]);
+/** Type of the block file record starting with pchStart, or -1 if there is none */
+int GetBlockRecordType(const unsigned char pchStart[4]);
+/** Read the type and size of the block file record whose data starts at pos */
+bool ReadBlockRecordHeader(const CDiskBlockPos &pos, int &nType, unsigned int &nSize);
+/** Script dictionary stored at the start of compressed block file nFile */
+boost::shared_ptr<const CScriptDictionary> GetBlockFileDictionary(int nFile);
+/** In -prune mode, delete the oldest block and undo files more than MIN_BLOCKS_TO_KEEP
+ *  below nTipHeight until the block files fit in nPruneTarget. Does nothing
+ *  while reindexing or importing */
+bool PruneBlockFiles(CValidationState &state, int nTipHeight);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
 /** Initialize a new block tree database + block data on disk */
@@ -142,12 +186,24 @@ bool VerifyDB();
 void PrintBlockTree();
 /** Find a block by height in the currently-connected chain */
 CBlockIndex* FindBlockByHeight(int nHeight);
+/** Get the tip of the active chain as last published by SetBestChain, without holding cs_main */
+CBlockIndex* GetChainTip();
+/** Find a block by height in the chain ending at the published tip, without holding cs_main (NULL above the tip) */
+CBlockIndex* GetChainBlockByHeight(int nHeight);
+/** Number of blocks from pindex to the published tip, or 0 if pindex is not in that chain */
+int GetChainDepth(const CBlockIndex* pindex);
+/** Find a block index entry by hash, without holding cs_main */
+CBlockIndex* LookupBlockIndex(const uint256& hash);
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /** Send queued protocol messages to be sent to a give node */
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the transaction hashing thread */
+void ThreadTxHash();
+/** Compute the hashes of vtx into phash[0..vtx.size()), in parallel for large blocks */
+void GetTxHashes(const std::vector<CTransaction>& vtx, uint256* phash);
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet);
 /** Generate a new block, without valid proof-of-work */
@@ -168,6 +224,15 @@ int GetNumBlocksOfPeers();
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core */
 std::string GetWarnings(std::string strFor);
+/** Turn on -addrindex or -spentindex for a block tree database that doesn't have it yet */
+bool EnableOptionalIndex(const std::string &strName);
+/** Height up to which an optional index was built for blocks connected before it
+ *  was enabled, or -1 if it is complete */
+int GetIndexBuildHeight(const std::string &strName);
+/** Whether ThreadBuildIndexes has blocks left to index */
+bool IsBuildingIndexes();
+/** Index the blocks connected before an optional index was enabled */
+void ThreadBuildIndexes();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fAllowSlow = false);
 /** Connect/disconnect blocks until pindexNew is the new tip of the active block chain */
@@ -246,6 +311,89 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+enum AddressIndexType
+{
+    ADDRINDEX_PUBKEYHASH = 1,
+    ADDRINDEX_SCRIPTHASH = 2,
+};
+
+/** Key of an -addrindex entry: an output paying to an address, or an input
+ *  spending one. Height and index are stored big endian so that the entries
+ *  of an address are read back in chain order. The value is the amount,
+ *  negative for inputs. */
+struct CAddressIndexKey
+{
+    unsigned char chType; // AddressIndexType
+    uint160 hashAddress;
+    int nHeight;
+    uint256 txid;
+    unsigned int nIndex;  // output number, or input number if fSpending
+    bool fSpending;
+
+    CAddressIndexKey() : chType(0), nHeight(0), nIndex(0), fSpending(false) {
+    }
+
+    CAddressIndexKey(unsigned char chTypeIn, const uint160 &hashAddressIn, int nHeightIn, const uint256 &txidIn, unsigned int nIndexIn, bool fSpendingIn) :
+        chType(chTypeIn), hashAddress(hashAddressIn), nHeight(nHeightIn), txid(txidIn), nIndex(nIndexIn), fSpending(fSpendingIn) {
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return 1 + 20 + 4 + 32 + 4 + 1;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        unsigned char pch[4];
+        s << chType << hashAddress;
+        WriteBE32(pch, nHeight);
+        s.write((const char*)pch, 4);
+        s << txid;
+        WriteBE32(pch, nIndex);
+        s.write((const char*)pch, 4);
+        s << fSpending;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned char pch[4];
+        s >> chType >> hashAddress;
+        s.read((char*)pch, 4);
+        nHeight = ReadBE32(pch);
+        s >> txid;
+        s.read((char*)pch, 4);
+        nIndex = ReadBE32(pch);
+        s >> fSpending;
+    }
+
+    static void WriteBE32(unsigned char *pch, unsigned int n) {
+        pch[0] = n >> 24; pch[1] = n >> 16; pch[2] = n >> 8; pch[3] = n;
+    }
+
+    static unsigned int ReadBE32(const unsigned char *pch) {
+        return ((unsigned int)pch[0] << 24) | ((unsigned int)pch[1] << 16) | ((unsigned int)pch[2] << 8) | pch[3];
+    }
+};
+
+/** Value of a -spentindex entry: the input spending an output */
+struct CSpentIndexValue
+{
+    uint256 txid;
+    unsigned int nIndex;
+    int nHeight;
+
+    IMPLEMENT_SERIALIZE(
+        READWRITE(txid);
+        READWRITE(VARINT(nIndex));
+        READWRITE(VARINT(nHeight));
+    )
+
+    CSpentIndexValue() : nIndex(0), nHeight(0) {
+    }
+
+    CSpentIndexValue(const uint256 &txidIn, unsigned int nIndexIn, int nHeightIn) : txid(txidIn), nIndex(nIndexIn), nHeight(nHeightIn) {
+    }
+};
+
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
 class CInPoint
@@ -796,16 +944,21 @@ public:
 
     bool ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock)
     {
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-        if (!filein)
-            return error("CBlockUndo::ReadFromDisk() : OpenBlockFile failed");
-
-        // Read block
+        // Read block, from the mapped file if possible
         uint256 hashChecksum;
         try {
-            filein >> *this;
-            filein >> hashChecksum;
+            boost::shared_ptr<const CMappedFile> pmap = MapUndoFile(pos, sizeof(hashChecksum));
+            if (pmap) {
+                CSpanReader filein(pmap->begin() + pos.nPos, pmap->end(), SER_DISK, CLIENT_VERSION);
+                filein >> *this;
+                filein >> hashChecksum;
+            } else {
+                CAutoFile filein = CAutoFile(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+                if (!filein)
+                    return error("CBlockUndo::ReadFromDisk() : OpenBlockFile failed");
+                filein >> *this;
+                filein >> hashChecksum;
+            }
         }
         catch (std::exception &e) {
             return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
@@ -1081,12 +1234,14 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     int nHashType;
+    boost::shared_ptr<const CSignatureHasher> phasher; // shared by all inputs of *ptxTo
 
 public:
     CScriptCheck() {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn) :
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn,
+                 const boost::shared_ptr<const CSignatureHasher>& phasherIn = boost::shared_ptr<const CSignatureHasher>()) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn), phasher(phasherIn) { }
 
     bool operator()() const;
 
@@ -1096,6 +1251,7 @@ public:
         std::swap(nIn, check.nIn);
         std::swap(nFlags, check.nFlags);
         std::swap(nHashType, check.nHashType);
+        phasher.swap(check.phasher);
     }
 };
 
@@ -1356,25 +1512,51 @@ public:
         return block;
     }
 
+    // Number of nodes in the merkle tree over nTx transactions
+    static unsigned int GetMerkleTreeSize(unsigned int nTx)
+    {
+        unsigned int nTotal = nTx;
+        for (unsigned int nSize = nTx; nSize > 1; nSize = (nSize + 1) / 2)
+            nTotal += (nSize + 1) / 2;
+        return nTotal;
+    }
+
     uint256 BuildMerkleTree() const
     {
-        vMerkleTree.clear();
-        BOOST_FOREACH(const CTransaction& tx, vtx)
-            vMerkleTree.push_back(tx.GetHash());
-        int j = 0;
-        for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        // Size the tree up front so each level is contiguous and its pairs
+        // can be hashed in one batch
+        vMerkleTree.resize(GetMerkleTreeSize(vtx.size()));
+        if (!vtx.empty())
+            GetTxHashes(vtx, &vMerkleTree[0]);
+        unsigned int j = 0;
+        for (unsigned int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = std::min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
+            SHA256D64(UBEGIN(vMerkleTree[j + nSize]), UBEGIN(vMerkleTree[j]), nSize / 2);
+            // An odd last node is paired with itself
+            if (nSize & 1)
+                vMerkleTree[j + nSize + nSize / 2] = HashPair(vMerkleTree[j + nSize - 1], vMerkleTree[j + nSize - 1]);
             j += nSize;
         }
         return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
     }
 
+    // Update the merkle tree after only the coinbase has changed. Just the
+    // nodes on the coinbase's path to the root are rehashed. Falls back to
+    // BuildMerkleTree if no tree for this number of transactions exists.
+    uint256 UpdateMerkleTreeCoinbase() const
+    {
+        if (vtx.empty() || vMerkleTree.size() != GetMerkleTreeSize(vtx.size()))
+            return BuildMerkleTree();
+        vMerkleTree[0] = vtx[0].GetHash();
+        unsigned int j = 0;
+        for (unsigned int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        {
+            vMerkleTree[j + nSize] = HashPair(vMerkleTree[j], vMerkleTree[j + 1]);
+            j += nSize;
+        }
+        return vMerkleTree.back();
+    }
+
     const uint256 &GetTxHash(unsigned int nIndex) const {
         assert(vMerkleTree.size() > 0); // BuildMerkleTree must have been called first
         assert(nIndex < vtx.size());
@@ -1404,63 +1586,19 @@ public:
         BOOST_FOREACH(const uint256& otherside, vMerkleBranch)
         {
             if (nIndex & 1)
-                hash = Hash(BEGIN(otherside), END(otherside), BEGIN(hash), END(hash));
+                hash = HashPair(otherside, hash);
             else
-                hash = Hash(BEGIN(hash), END(hash), BEGIN(otherside), END(otherside));
+                hash = HashPair(hash, otherside);
             nIndex >>= 1;
         }
         return hash;
     }
 
-    bool WriteToDisk(CDiskBlockPos &pos)
-    {
-        // Open history file to append
-        CAutoFile fileout = CAutoFile(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-        if (!fileout)
-            return error("CBlock::WriteToDisk() : OpenBlockFile failed");
-
-        // Write index header
-        unsigned int nSize = fileout.GetSerializeSize(*this);
-        fileout << FLATDATA(pchMessageStart) << nSize;
-
-        // Write block
-        long fileOutPos = ftell(fileout);
-        if (fileOutPos < 0)
-            return error("CBlock::WriteToDisk() : ftell failed");
-        pos.nPos = (unsigned int)fileOutPos;
-        fileout << *this;
-
-        // Flush stdio buffers and commit to disk before returning
-        fflush(fileout);
-        if (!IsInitialBlockDownload())
-            FileCommit(fileout);
-
-        return true;
-    }
-
-    bool ReadFromDisk(const CDiskBlockPos &pos)
-    {
-        SetNull();
-
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-        if (!filein)
-            return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
-
-        // Read block
-        try {
-            filein >> *this;
-        }
-        catch (std::exception &e) {
-            return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
-        }
+    // Append this block at pos, where space for its network serialization was
+    // reserved with FindBlockPos. Blocks in compressed files take up less.
+    bool WriteToDisk(CDiskBlockPos &pos);
 
-        // Check the header
-        if (!CheckProofOfWork(GetHash(), nBits))
-            return error("CBlock::ReadFromDisk() : errors in block header");
-
-        return true;
-    }
+    bool ReadFromDisk(const CDiskBlockPos &pos);
 
 
 
@@ -1488,11 +1626,12 @@ public:
     /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
      *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
      *  will be true if no problems were found. Otherwise, the return value will be false in case
-     *  of problems. Note that in any case, coins may be modified. */
-    bool DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoinsViewCache &coins, bool *pfClean = NULL);
+     *  of problems. Note that in any case, coins may be modified. With fJustCheck, the
+     *  address and spent indexes are left alone. */
+    bool DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoinsViewCache &coins, bool *pfClean = NULL, bool fJustCheck = false, CLevelDBBatch *pbatchIndexes = NULL);
 
     // Apply the effects of this block (with given index) on the UTXO set represented by coins
-    bool ConnectBlock(CValidationState &state, CBlockIndex *pindex, CCoinsViewCache &coins, bool fJustCheck=false);
+    bool ConnectBlock(CValidationState &state, CBlockIndex *pindex, CCoinsViewCache &coins, bool fJustCheck=false, CLevelDBBatch *pbatchIndexes=NULL);
 
     // Read a block from disk
     bool ReadFromDisk(const CBlockIndex* pindex);
@@ -1509,6 +1648,225 @@ public:
 };
 
 
+/** Formats in which blocks are appended to a block file */
+enum BlockFileFormat
+{
+    BLOCKFILE_FORMAT_RAW        = 0, // network serialization
+    BLOCKFILE_FORMAT_COMPRESSED = 1, // CBlockCompressor, the file starts with a CScriptDictionary
+};
+
+/** Records in block files. Each type starts with its own variant of
+ *  pchMessageStart, followed by its size, so files can be read without
+ *  knowing their format. */
+enum BlockRecordType
+{
+    BLOCKRECORD_RAW        = 0,
+    BLOCKRECORD_COMPRESSED = 1,
+    BLOCKRECORD_DICTIONARY = 2,
+};
+
+/** Output scripts used often in recent blocks, stored at the start of a
+ *  compressed block file so the blocks in it can refer to them by number */
+class CScriptDictionary
+{
+private:
+    std::map<CScript, unsigned int> mapIndex;
+
+public:
+    std::vector<CScript> vScripts;
+
+    IMPLEMENT_SERIALIZE(
+        READWRITE(vScripts);
+        if (fRead)
+            const_cast<CScriptDictionary*>(this)->BuildIndex();
+    )
+
+    void BuildIndex() {
+        mapIndex.clear();
+        for (unsigned int i = 0; i < vScripts.size(); i++)
+            mapIndex.insert(std::make_pair(vScripts[i], i));
+    }
+
+    bool Find(const CScript &script, unsigned int &nIndex) const {
+        std::map<CScript, unsigned int>::const_iterator it = mapIndex.find(script);
+        if (it == mapIndex.end())
+            return false;
+        nIndex = it->second;
+        return true;
+    }
+};
+
+/** CScriptCompressor that can also refer to the scripts of a dictionary
+ *
+ *  Codes below nSpecialScripts are encoded as by CScriptCompressor, the next
+ *  dict.vScripts.size() codes refer to dictionary entries, and higher codes
+ *  are followed by a script of (code - nSpecialScripts - dictionary size) bytes.
+ */
+class CScriptDictCompressor : public CScriptCompressor
+{
+private:
+    const CScriptDictionary &dict;
+
+public:
+    CScriptDictCompressor(CScript &scriptIn, const CScriptDictionary &dictIn) : CScriptCompressor(scriptIn), dict(dictIn) { }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        unsigned int nIndex = 0;
+        if (dict.Find(script, nIndex)) {
+            unsigned int nCode = nSpecialScripts + nIndex;
+            s << VARINT(nCode);
+            return;
+        }
+        std::vector<unsigned char> compr;
+        if (Compress(compr)) {
+            s << CFlatData(&compr[0], &compr[compr.size()]);
+            return;
+        }
+        unsigned int nCode = nSpecialScripts + dict.vScripts.size() + script.size();
+        s << VARINT(nCode);
+        if (!script.empty())
+            s << CFlatData(&script[0], &script[script.size()]);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        s >> VARINT(nCode);
+        if (nCode < nSpecialScripts) {
+            std::vector<unsigned char> vch(GetSpecialSize(nCode), 0x00);
+            s >> REF(CFlatData(&vch[0], &vch[vch.size()]));
+            Decompress(nCode, vch);
+            return;
+        }
+        nCode -= nSpecialScripts;
+        if (nCode < dict.vScripts.size()) {
+            script = dict.vScripts[nCode];
+            return;
+        }
+        nCode -= dict.vScripts.size();
+        if (nCode > MAX_BLOCK_SIZE)
+            throw std::ios_base::failure("CScriptDictCompressor::Unserialize() : script too large");
+        script.resize(nCode);
+        if (!script.empty())
+            s >> REF(CFlatData(&script[0], &script[script.size()]));
+    }
+};
+
+/** Compact encoding of a block, used in compressed block files
+ *
+ *  The header is stored as is, transaction fields as variable length
+ *  integers. Outputs use the amount compression of CTxOutCompressor and a
+ *  CScriptDictCompressor for their script. Inputs spending an earlier
+ *  transaction of the same block refer to it by position instead of hash.
+ */
+class CBlockCompressor
+{
+private:
+    CBlock &block;
+    const CScriptDictionary &dict;
+
+public:
+    CBlockCompressor(CBlock &blockIn, const CScriptDictionary &dictIn) : block(blockIn), dict(dictIn) { }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        s << static_cast<const CBlockHeader&>(block);
+        unsigned int nTx = block.vtx.size();
+        s << VARINT(nTx);
+        std::map<uint256, unsigned int> mapTxPos;
+        for (unsigned int i = 0; i < nTx; i++) {
+            const CTransaction &tx = block.vtx[i];
+            unsigned int nTxVersion = tx.nVersion;
+            s << VARINT(nTxVersion);
+            unsigned int nIn = tx.vin.size();
+            s << VARINT(nIn);
+            BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+                // prevout.n plus one (making the coinbase's null prevout small),
+                // and whether the hash is replaced by a position in this block
+                std::map<uint256, unsigned int>::const_iterator it = mapTxPos.find(txin.prevout.hash);
+                uint64 nPrevout = ((uint64)(unsigned int)(txin.prevout.n + 1) << 1) | (it != mapTxPos.end() ? 1 : 0);
+                s << VARINT(nPrevout);
+                if (it != mapTxPos.end()) {
+                    unsigned int nTxPos = it->second;
+                    s << VARINT(nTxPos);
+                } else
+                    s << txin.prevout.hash;
+                s << txin.scriptSig;
+                // stored plus one, so final inputs take a single byte
+                unsigned int nSequence = txin.nSequence + 1;
+                s << VARINT(nSequence);
+            }
+            unsigned int nOut = tx.vout.size();
+            s << VARINT(nOut);
+            BOOST_FOREACH(const CTxOut &txout, tx.vout) {
+                uint64 nValue = CTxOutCompressor::CompressAmount(txout.nValue);
+                s << VARINT(nValue);
+                s << CScriptDictCompressor(REF(txout.scriptPubKey), dict);
+            }
+            unsigned int nLockTime = tx.nLockTime;
+            s << VARINT(nLockTime);
+            mapTxPos.insert(std::make_pair(tx.GetHash(), i));
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        s >> static_cast<CBlockHeader&>(block);
+        block.vtx.clear();
+        block.vMerkleTree.clear();
+        unsigned int nTx = 0;
+        s >> VARINT(nTx);
+        // hashes of transactions referred to by later ones in the block
+        std::map<unsigned int, uint256> mapTxHash;
+        for (unsigned int i = 0; i < nTx; i++) {
+            block.vtx.push_back(CTransaction());
+            CTransaction &tx = block.vtx.back();
+            unsigned int nTxVersion = 0;
+            s >> VARINT(nTxVersion);
+            tx.nVersion = nTxVersion;
+            unsigned int nIn = 0;
+            s >> VARINT(nIn);
+            for (unsigned int j = 0; j < nIn; j++) {
+                CTxIn txin;
+                uint64 nPrevout = 0;
+                s >> VARINT(nPrevout);
+                txin.prevout.n = (unsigned int)(nPrevout >> 1) - 1;
+                if (nPrevout & 1) {
+                    unsigned int nTxPos = 0;
+                    s >> VARINT(nTxPos);
+                    if (nTxPos >= i)
+                        throw std::ios_base::failure("CBlockCompressor::Unserialize() : invalid transaction reference");
+                    std::map<unsigned int, uint256>::iterator it = mapTxHash.find(nTxPos);
+                    if (it == mapTxHash.end())
+                        it = mapTxHash.insert(std::make_pair(nTxPos, block.vtx[nTxPos].GetHash())).first;
+                    txin.prevout.hash = it->second;
+                } else
+                    s >> txin.prevout.hash;
+                s >> txin.scriptSig;
+                unsigned int nSequence = 0;
+                s >> VARINT(nSequence);
+                txin.nSequence = nSequence - 1;
+                tx.vin.push_back(txin);
+            }
+            unsigned int nOut = 0;
+            s >> VARINT(nOut);
+            for (unsigned int j = 0; j < nOut; j++) {
+                CTxOut txout;
+                uint64 nValue = 0;
+                s >> VARINT(nValue);
+                txout.nValue = CTxOutCompressor::DecompressAmount(nValue);
+                s >> REF(CScriptDictCompressor(txout.scriptPubKey, dict));
+                tx.vout.push_back(txout);
+            }
+            unsigned int nLockTime = 0;
+            s >> VARINT(nLockTime);
+            tx.nLockTime = nLockTime;
+        }
+    }
+};
+
+
 
 
 
@@ -1522,6 +1880,7 @@ public:
     unsigned int nHeightLast;  // highest height of block in file
     uint64 nTimeFirst;         // earliest time of block in file
     uint64 nTimeLast;          // latest time of block in file
+    int nFormat;               // format new blocks are appended in (BlockFileFormat)
 
     IMPLEMENT_SERIALIZE(
         READWRITE(VARINT(nBlocks));
@@ -1531,6 +1890,16 @@ public:
         READWRITE(VARINT(nHeightLast));
         READWRITE(VARINT(nTimeFirst));
         READWRITE(VARINT(nTimeLast));
+        // entries written before compressed block files existed end here
+        if (fRead) {
+            try {
+                READWRITE(VARINT(nFormat));
+            } catch (std::ios_base::failure &e) {
+                const_cast<CBlockFileInfo*>(this)->nFormat = BLOCKFILE_FORMAT_RAW;
+            }
+        } else {
+            READWRITE(VARINT(nFormat));
+        }
      )
 
      void SetNull() {
@@ -1541,6 +1910,7 @@ public:
          nHeightLast = 0;
          nTimeFirst = 0;
          nTimeLast = 0;
+         nFormat = BLOCKFILE_FORMAT_RAW;
      }
 
      CBlockFileInfo() {
@@ -1551,6 +1921,11 @@ public:
          return strprintf("CBlockFileInfo(blocks=%u, size=%u, heights=%u...%u, time=%s...%s)", nBlocks, nSize, nHeightFirst, nHeightLast, DateTimeStrFormat("%Y-%m-%d", nTimeFirst).c_str(), DateTimeStrFormat("%Y-%m-%d", nTimeLast).c_str());
      }
 
+     // whether the file's block and undo data were deleted by -prune
+     bool IsPruned() const {
+         return nBlocks > 0 && nSize == 0 && nUndoSize == 0;
+     }
+
      // update statistics (does not update nSize)
      void AddBlock(unsigned int nHeightIn, uint64 nTimeIn) {
          if (nBlocks==0 || nHeightFirst > nHeightIn)
@@ -1558,7 +1933,7 @@ public:
          if (nBlocks==0 || nTimeFirst > nTimeIn)
              nTimeFirst = nTimeIn;
          nBlocks++;
-         if (nHeightIn > nHeightFirst)
+         if (nHeightIn > nHeightLast)
              nHeightLast = nHeightIn;
          if (nTimeIn > nTimeLast)
              nTimeLast = nTimeIn;
@@ -2070,6 +2445,7 @@ public:
     bool addUnchecked(const uint256& hash, const CTransaction &tx);
     bool remove(const CTransaction &tx, bool fRecursive = false);
     bool removeConflicts(const CTransaction &tx);
+    void removeForBlock(const std::vector<CTransaction>& vtx);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
@@ -2207,6 +2583,9 @@ extern CCoinsViewCache *pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Global variable that points to the coin database under pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 struct CBlockTemplate
 {
     CBlock block;
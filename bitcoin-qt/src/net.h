@@ -11,6 +11,7 @@
 #include <deque>
 #include <boost/array.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <openssl/rand.h>
 
 #ifndef WIN32
@@ -27,6 +28,7 @@
 
 class CNode;
 class CBlockIndex;
+class CPartialBlock;
 extern int nBestHeight;
 
 
@@ -214,6 +216,8 @@ protected:
 
 public:
     uint256 hashContinue;
+    // compact block waiting for the blocktxn reply to our getblocktxn
+    boost::shared_ptr<CPartialBlock> pPartialBlock;
     CBlockIndex* pindexLastGetBlocksBegin;
     uint256 hashLastGetBlocksEnd;
     int nStartingHeight;
@@ -72,6 +72,8 @@ class CMessageHeader
 enum
 {
     NODE_NETWORK = (1 << 0),
+    // rebuilds blocks from short transaction IDs ("cmpctblock")
+    NODE_COMPACT_BLOCKS = (1 << 1),
 
 #ifdef USE_NATIVE_I2P
     NODE_I2P     = (1 << 7),
@@ -149,6 +151,9 @@ enum
     // Nodes may always request a MSG_FILTERED_BLOCK in a getdata, however,
     // MSG_FILTERED_BLOCK should not appear in any invs except as a part of getdata.
     MSG_FILTERED_BLOCK,
+    // Asks for a block as a "cmpctblock"; only used in getdata, to peers
+    // advertising NODE_COMPACT_BLOCKS
+    MSG_CMPCT_BLOCK,
 };
 
 #endif // __INCLUDED_PROTOCOL_H__
@@ -0,0 +1,333 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pubsub.h"
+#include "main.h"
+#include "sync.h"
+#include "ui_interface.h"
+#include "util.h"
+
+#include <deque>
+#include <list>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+using namespace boost;
+using namespace boost::asio;
+
+static const char *pszTopics[PUB_TOPIC_COUNT] = {
+    "hashblock",
+    "rawblock",
+    "hashtx",
+    "rawtx",
+    "hashwallettx",
+};
+
+/** A connected subscriber. Only used from the publisher's I/O thread. */
+class CSubscriber : public enable_shared_from_this<CSubscriber>
+{
+public:
+    ip::tcp::socket socket;
+    asio::streambuf buf;
+    bool fWants[PUB_TOPIC_COUNT];
+    bool fSubscribed;
+    bool fWriting;
+    std::deque<boost::shared_ptr<const string> > queue;
+
+    CSubscriber(asio::io_service& io_service) : socket(io_service), buf(MAX_PUB_SUBSCRIBE_SIZE), fSubscribed(false), fWriting(false)
+    {
+        for (int i = 0; i < PUB_TOPIC_COUNT; i++)
+            fWants[i] = false;
+    }
+};
+
+static CCriticalSection cs_publisher;
+static asio::io_service* pub_io_service = NULL;
+static ip::tcp::acceptor* pub_acceptor = NULL;
+static boost::thread* pub_thread = NULL;
+static unsigned int nPubHWM = DEFAULT_PUB_HWM;
+static unsigned short nPubPort = 0;
+static list<boost::shared_ptr<CSubscriber> > lSubscribers; // I/O thread only
+
+// guarded by cs_publisher
+static int nTopicSubscribers[PUB_TOPIC_COUNT];
+static unsigned int nTopicSequence[PUB_TOPIC_COUNT];
+static uint64 nPubDropped = 0;
+
+static void PubAccept();
+
+static void PubRemove(boost::shared_ptr<CSubscriber> sub)
+{
+    if (sub->fSubscribed)
+    {
+        LOCK(cs_publisher);
+        for (int i = 0; i < PUB_TOPIC_COUNT; i++)
+            if (sub->fWants[i])
+                nTopicSubscribers[i]--;
+    }
+    sub->fSubscribed = false;
+    lSubscribers.remove(sub);
+    boost::system::error_code ignored;
+    sub->socket.close(ignored);
+}
+
+// Subscribers send nothing after their topics, so a completed read means
+// they hung up
+static void PubHandleRead(boost::shared_ptr<CSubscriber> sub, const boost::system::error_code& error)
+{
+    if (error != asio::error::operation_aborted)
+        PubRemove(sub);
+}
+
+static void PubHandleSubscribe(boost::shared_ptr<CSubscriber> sub, const boost::system::error_code& error, size_t nSize)
+{
+    // Also fails with a line longer than the buffer allows
+    if (error)
+        return PubRemove(sub);
+
+    string strLine(asio::buffers_begin(sub->buf.data()), asio::buffers_begin(sub->buf.data()) + nSize);
+    sub->buf.consume(nSize);
+    boost::trim(strLine);
+    vector<string> vTopics;
+    boost::split(vTopics, strLine, boost::is_any_of(" ,"), boost::token_compress_on);
+    BOOST_FOREACH(const string& strTopic, vTopics)
+    {
+        int nTopic = 0;
+        while (nTopic < PUB_TOPIC_COUNT && strTopic != pszTopics[nTopic])
+            nTopic++;
+        if (nTopic == PUB_TOPIC_COUNT)
+        {
+            printf("Publisher: subscriber asked for an unknown topic\n");
+            return PubRemove(sub);
+        }
+        sub->fWants[nTopic] = true;
+    }
+
+    {
+        LOCK(cs_publisher);
+        for (int i = 0; i < PUB_TOPIC_COUNT; i++)
+            if (sub->fWants[i])
+                nTopicSubscribers[i]++;
+    }
+    sub->fSubscribed = true;
+    asio::async_read(sub->socket, sub->buf, asio::transfer_at_least(1),
+        boost::bind(&PubHandleRead, sub, asio::placeholders::error));
+}
+
+static void PubHandleAccept(boost::shared_ptr<CSubscriber> sub, const boost::system::error_code& error)
+{
+    if (error == asio::error::operation_aborted || !pub_acceptor->is_open())
+        return;
+    PubAccept();
+    if (error)
+        return;
+
+    lSubscribers.push_back(sub);
+    asio::async_read_until(sub->socket, sub->buf, '\n',
+        boost::bind(&PubHandleSubscribe, sub, asio::placeholders::error, asio::placeholders::bytes_transferred));
+}
+
+static void PubAccept()
+{
+    boost::shared_ptr<CSubscriber> sub(new CSubscriber(*pub_io_service));
+    pub_acceptor->async_accept(sub->socket, boost::bind(&PubHandleAccept, sub, asio::placeholders::error));
+}
+
+static void PubWrite(boost::shared_ptr<CSubscriber> sub);
+
+static void PubHandleWrite(boost::shared_ptr<CSubscriber> sub, const boost::system::error_code& error)
+{
+    if (error)
+        return PubRemove(sub);
+    sub->queue.pop_front();
+    sub->fWriting = false;
+    PubWrite(sub);
+}
+
+static void PubWrite(boost::shared_ptr<CSubscriber> sub)
+{
+    if (sub->fWriting || sub->queue.empty() || !sub->fSubscribed)
+        return;
+    sub->fWriting = true;
+    asio::async_write(sub->socket, asio::buffer(*sub->queue.front()),
+        boost::bind(&PubHandleWrite, sub, asio::placeholders::error));
+}
+
+// Queue a message for everyone subscribed to its topic
+static void PubDeliver(int nTopic, boost::shared_ptr<const string> pmsg)
+{
+    unsigned int nDropped = 0;
+    BOOST_FOREACH(boost::shared_ptr<CSubscriber> sub, lSubscribers)
+    {
+        if (!sub->fSubscribed || !sub->fWants[nTopic])
+            continue;
+        if (sub->queue.size() >= nPubHWM)
+        {
+            nDropped++;
+            continue;
+        }
+        sub->queue.push_back(pmsg);
+        PubWrite(sub);
+    }
+    if (nDropped > 0)
+    {
+        LOCK(cs_publisher);
+        nPubDropped += nDropped;
+    }
+}
+
+static void Publish(int nTopic, const CDataStream& ssBody)
+{
+    LOCK(cs_publisher);
+    if (pub_io_service == NULL || nTopicSubscribers[nTopic] == 0)
+        return;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << string(pszTopics[nTopic]) << ++nTopicSequence[nTopic];
+    ss.insert(ss.end(), ssBody.begin(), ssBody.end());
+    unsigned int nSize = ss.size();
+    boost::shared_ptr<string> pmsg(new string());
+    pmsg->reserve(sizeof(nSize) + nSize);
+    pmsg->append((const char*)&nSize, sizeof(nSize));
+    pmsg->append(ss.begin(), ss.end());
+
+    // Posted with cs_publisher held, so messages go out in sequence order
+    pub_io_service->post(boost::bind(&PubDeliver, nTopic, boost::shared_ptr<const string>(pmsg)));
+}
+
+bool IsPublishing(int nTopic)
+{
+    LOCK(cs_publisher);
+    return pub_io_service != NULL && nTopicSubscribers[nTopic] > 0;
+}
+
+void PublishBlockHash(const uint256& hash)
+{
+    if (!IsPublishing(PUB_HASHBLOCK))
+        return;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hash;
+    Publish(PUB_HASHBLOCK, ss);
+}
+
+void PublishBlock(const CBlock& block)
+{
+    if (!IsPublishing(PUB_RAWBLOCK))
+        return;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    Publish(PUB_RAWBLOCK, ss);
+}
+
+void PublishTransaction(const uint256& hash, const CTransaction& tx)
+{
+    if (IsPublishing(PUB_HASHTX))
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << hash;
+        Publish(PUB_HASHTX, ss);
+    }
+    if (IsPublishing(PUB_RAWTX))
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << tx;
+        Publish(PUB_RAWTX, ss);
+    }
+}
+
+void PublishWalletTransaction(const uint256& hash)
+{
+    if (!IsPublishing(PUB_HASHWALLETTX))
+        return;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hash;
+    Publish(PUB_HASHWALLETTX, ss);
+}
+
+void GetPublisherStats(int& nSubscribers, uint64& nDropped)
+{
+    LOCK(cs_publisher);
+    nSubscribers = 0;
+    for (int i = 0; i < PUB_TOPIC_COUNT; i++)
+        nSubscribers = std::max(nSubscribers, nTopicSubscribers[i]);
+    nDropped = nPubDropped;
+}
+
+unsigned short GetPublisherPort()
+{
+    LOCK(cs_publisher);
+    return nPubPort;
+}
+
+static void ThreadPublisher()
+{
+    RenameThread("bitcoin-publisher");
+    pub_io_service->run();
+}
+
+bool StartPublisher(unsigned short nPort, string& strError)
+{
+    assert(pub_io_service == NULL);
+    nPubHWM = std::max((int)GetArg("-pubhwm", DEFAULT_PUB_HWM), 1);
+
+    // Subscribers are local services, so only listen on the loopback address
+    asio::io_service* io_service = new asio::io_service();
+    ip::tcp::endpoint endpoint(ip::address_v4::loopback(), nPort);
+    try
+    {
+        pub_acceptor = new ip::tcp::acceptor(*io_service);
+        pub_acceptor->open(endpoint.protocol());
+        pub_acceptor->set_option(ip::tcp::acceptor::reuse_address(true));
+        pub_acceptor->bind(endpoint);
+        pub_acceptor->listen(socket_base::max_connections);
+        nPort = pub_acceptor->local_endpoint().port();
+    }
+    catch (boost::system::system_error &e)
+    {
+        strError = strprintf(_("Unable to bind to %s for publishing: %s"), endpoint.address().to_string().c_str(), e.what());
+        delete pub_acceptor; pub_acceptor = NULL;
+        delete io_service;
+        return false;
+    }
+
+    {
+        LOCK(cs_publisher);
+        pub_io_service = io_service;
+        for (int i = 0; i < PUB_TOPIC_COUNT; i++)
+            nTopicSubscribers[i] = 0;
+        nPubDropped = 0;
+        nPubPort = nPort;
+    }
+    PubAccept();
+    pub_thread = new boost::thread(&ThreadPublisher);
+    printf("Publisher: listening on port %u\n", (unsigned int)nPort);
+    return true;
+}
+
+void StopPublisher()
+{
+    asio::io_service* io_service;
+    {
+        LOCK(cs_publisher);
+        io_service = pub_io_service;
+        pub_io_service = NULL;
+        nPubPort = 0;
+    }
+    if (io_service == NULL)
+        return;
+
+    io_service->stop();
+    pub_thread->join();
+    delete pub_thread; pub_thread = NULL;
+    lSubscribers.clear();
+    delete pub_acceptor; pub_acceptor = NULL;
+    delete io_service;
+}
@@ -0,0 +1,63 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_PUBSUB_H
+#define BITCOIN_PUBSUB_H
+
+#include <string>
+
+#include "uint256.h"
+
+class CBlock;
+class CTransaction;
+
+/** Events subscribers can ask for */
+enum PubTopic
+{
+    PUB_HASHBLOCK,    // hash of each block connected to the best chain
+    PUB_RAWBLOCK,     // the serialized block
+    PUB_HASHTX,       // hash of each transaction added to the memory pool
+    PUB_RAWTX,        // the serialized transaction
+    PUB_HASHWALLETTX, // hash of each transaction added to or updated in the wallet
+
+    PUB_TOPIC_COUNT
+};
+
+/** Default number of messages queued for a subscriber before new ones are dropped */
+static const unsigned int DEFAULT_PUB_HWM = 1000;
+/** Longest topic line a subscriber may send */
+static const unsigned int MAX_PUB_SUBSCRIBE_SIZE = 1000;
+
+/**
+ * Publishes events to subscribers connected to a local TCP port, so that
+ * services need not poll or have a process spawned for each event.
+ *
+ * A subscriber sends one line with the names of the topics it wants,
+ * separated by spaces (e.g. "hashblock rawtx\n"). It is then sent a message
+ * for each event: a 4 byte little endian length of the rest, followed by the
+ * serialized topic name, a 4 byte sequence number counted per topic, and the
+ * hash or serialized block or transaction.
+ *
+ * Messages are queued for each subscriber up to -pubhwm. A subscriber that
+ * reads too slowly loses the messages that don't fit, which shows as a gap
+ * in the sequence numbers; publishing never waits on it.
+ */
+bool StartPublisher(unsigned short nPort, std::string& strError);
+void StopPublisher();
+
+// The port subscribers connect to, which StartPublisher picks itself if
+// given 0; 0 if not publishing
+unsigned short GetPublisherPort();
+
+// Whether anyone subscribed to nTopic, so events can be skipped cheaply
+bool IsPublishing(int nTopic);
+
+void PublishBlockHash(const uint256& hash);
+void PublishBlock(const CBlock& block);
+void PublishTransaction(const uint256& hash, const CTransaction& tx);
+void PublishWalletTransaction(const uint256& hash);
+
+// Number of subscribers, and of messages dropped because a queue was full
+void GetPublisherStats(int& nSubscribers, uint64& nDropped);
+
+#endif
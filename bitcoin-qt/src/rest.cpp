@@ -0,0 +1,301 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "bitcoinrpc.h"
+#include "blockfile.h"
+
+#include <boost/algorithm/string.hpp>
+
+using namespace json_spirit;
+using namespace std;
+
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, CJSONWriter& writer);
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
+
+static const unsigned int MAX_REST_HEADERS = 2000;
+static const size_t REST_READ_SIZE = 65536;
+
+enum RESTFormat
+{
+    RF_BINARY,
+    RF_HEX,
+    RF_JSON,
+};
+
+static const struct {
+    RESTFormat rf;
+    const char *pszName;
+    const char *pszContentType;
+} rf_names[] = {
+    { RF_BINARY, "bin",  "application/octet-stream" },
+    { RF_HEX,    "hex",  "text/plain" },
+    { RF_JSON,   "json", "application/json" },
+};
+
+static void RESTReply(CHTTPReplyStream& stream, int nStatus, const char *pszContentType, const string& strBody)
+{
+    stream.WriteHeader(nStatus, pszContentType, strBody.size());
+    stream.Write(strBody.data(), strBody.size());
+}
+
+static void RESTError(CHTTPReplyStream& stream, int nStatus, const string& strMessage)
+{
+    RESTReply(stream, nStatus, "text/plain", strMessage + "\r\n");
+}
+
+// Reply with serialized data in the requested format
+static void RESTReplyData(CHTTPReplyStream& stream, RESTFormat rf, const CDataStream& ssData)
+{
+    if (rf == RF_BINARY)
+    {
+        stream.WriteHeader(HTTP_OK, rf_names[rf].pszContentType, ssData.size());
+        if (!ssData.empty())
+            stream.Write(&ssData[0], ssData.size());
+    }
+    else
+        RESTReply(stream, HTTP_OK, rf_names[rf].pszContentType, HexStr(ssData.begin(), ssData.end()) + "\n");
+}
+
+// Split "<param>.<format>" off the end of a URI path
+static bool ParseDataFormat(const string& strPath, string& strParam, RESTFormat& rf)
+{
+    size_t nDot = strPath.rfind('.');
+    if (nDot == string::npos)
+        return false;
+    string strFormat = strPath.substr(nDot + 1);
+    for (unsigned int i = 0; i < ARRAYLEN(rf_names); i++)
+    {
+        if (strFormat == rf_names[i].pszName)
+        {
+            strParam = strPath.substr(0, nDot);
+            rf = rf_names[i].rf;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ParseHashStr(const string& strHash, uint256& hash)
+{
+    if (strHash.size() != 64 || !IsHex(strHash))
+        return false;
+    hash.SetHex(strHash);
+    return true;
+}
+
+// Send a block that is stored uncompressed straight out of its block file.
+// Returns false if it has to be read and serialized again instead.
+static bool RESTWriteRawBlock(CHTTPReplyStream& stream, const CDiskBlockPos& pos)
+{
+    int nType;
+    unsigned int nSize;
+    if (!ReadBlockRecordHeader(pos, nType, nSize) || nType != BLOCKRECORD_RAW || nSize > MAX_BLOCK_SIZE)
+        return false;
+
+    boost::shared_ptr<const CMappedFile> pmap = MapBlockFile(pos);
+    if (pmap && (uint64)pos.nPos + nSize <= pmap->size())
+    {
+        stream.WriteHeader(HTTP_OK, rf_names[RF_BINARY].pszContentType, nSize);
+        stream.Write(pmap->begin() + pos.nPos, nSize);
+        return true;
+    }
+
+    // The last block file isn't mapped, read it in pieces
+    FILE *file = OpenBlockFile(pos, true);
+    if (!file)
+        return false;
+    vector<char> vch(std::min((size_t)nSize, REST_READ_SIZE));
+    size_t nRead = fread(&vch[0], 1, vch.size(), file);
+    if (nRead != vch.size())
+    {
+        fclose(file);
+        return false;
+    }
+    try
+    {
+        stream.WriteHeader(HTTP_OK, rf_names[RF_BINARY].pszContentType, nSize);
+        for (unsigned int nLeft = nSize; nLeft > 0; nLeft -= nRead)
+        {
+            if (nLeft < nSize)
+            {
+                nRead = fread(&vch[0], 1, std::min((size_t)nLeft, vch.size()), file);
+                // The header is out, all that can be done is to give up on the connection
+                if (nRead == 0)
+                    throw runtime_error("RESTWriteRawBlock() : block file read failed");
+            }
+            stream.Write(&vch[0], nRead);
+        }
+    }
+    catch (...)
+    {
+        fclose(file);
+        throw;
+    }
+    fclose(file);
+    return true;
+}
+
+static void RESTBlock(CHTTPReplyStream& stream, const string& strPath)
+{
+    string strHash;
+    RESTFormat rf;
+    uint256 hash;
+    if (!ParseDataFormat(strPath, strHash, rf))
+        return RESTError(stream, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)");
+    if (!ParseHashStr(strHash, hash))
+        return RESTError(stream, HTTP_BAD_REQUEST, "Invalid hash: " + strHash);
+
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (pblockindex == NULL)
+        return RESTError(stream, HTTP_NOT_FOUND, strHash + " not found");
+    if (!(pblockindex->nStatus & BLOCK_HAVE_DATA))
+        return RESTError(stream, HTTP_NOT_FOUND, strHash + " not available (pruned data)");
+
+    if (rf == RF_BINARY && RESTWriteRawBlock(stream, pblockindex->GetBlockPos()))
+        return;
+
+    CBlock block;
+    if (!block.ReadFromDisk(pblockindex))
+        return RESTError(stream, HTTP_NOT_FOUND, strHash + " not available (pruned data)");
+
+    if (rf == RF_JSON)
+    {
+        CJSONWriter writer;
+        blockToJSON(block, pblockindex, writer);
+        writer.str() += "\n";
+        return RESTReply(stream, HTTP_OK, rf_names[rf].pszContentType, writer.str());
+    }
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    RESTReplyData(stream, rf, ssBlock);
+}
+
+static void RESTTx(CHTTPReplyStream& stream, const string& strPath)
+{
+    string strHash;
+    RESTFormat rf;
+    uint256 hash;
+    if (!ParseDataFormat(strPath, strHash, rf))
+        return RESTError(stream, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)");
+    if (!ParseHashStr(strHash, hash))
+        return RESTError(stream, HTTP_BAD_REQUEST, "Invalid hash: " + strHash);
+
+    CTransaction tx;
+    uint256 hashBlock = 0;
+    if (!GetTransaction(hash, tx, hashBlock, true))
+        return RESTError(stream, HTTP_NOT_FOUND, strHash + " not found");
+
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    if (rf == RF_JSON)
+    {
+        Object result;
+        result.push_back(Pair("hex", HexStr(ssTx.begin(), ssTx.end())));
+        TxToJSON(tx, hashBlock, result);
+        return RESTReply(stream, HTTP_OK, rf_names[rf].pszContentType, write_string(Value(result), false) + "\n");
+    }
+    RESTReplyData(stream, rf, ssTx);
+}
+
+// Up to <count> headers of the best chain, starting with <hash>
+static void RESTHeaders(CHTTPReplyStream& stream, const string& strPath)
+{
+    string strParam;
+    RESTFormat rf;
+    if (!ParseDataFormat(strPath, strParam, rf))
+        return RESTError(stream, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)");
+    vector<string> vParams;
+    boost::split(vParams, strParam, boost::is_any_of("/"));
+    if (vParams.size() != 2)
+        return RESTError(stream, HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+
+    int nCount = atoi(vParams[0]);
+    if (nCount < 1 || nCount > (int)MAX_REST_HEADERS)
+        return RESTError(stream, HTTP_BAD_REQUEST, strprintf("Header count out of range: %s", vParams[0].c_str()));
+    uint256 hash;
+    if (!ParseHashStr(vParams[1], hash))
+        return RESTError(stream, HTTP_BAD_REQUEST, "Invalid hash: " + vParams[1]);
+
+    vector<CBlockIndex*> vHeaders;
+    CBlockIndex* pindex = LookupBlockIndex(hash);
+    if (pindex != NULL && GetChainDepth(pindex) > 0)
+    {
+        // the snapshot of the chain may move on between lookups
+        while (pindex != NULL && (int)vHeaders.size() < nCount)
+        {
+            vHeaders.push_back(pindex);
+            CBlockIndex* pnext = GetChainBlockByHeight(pindex->nHeight + 1);
+            pindex = (pnext && pnext->pprev == pindex) ? pnext : NULL;
+        }
+    }
+
+    if (rf == RF_JSON)
+    {
+        CJSONWriter writer;
+        writer.BeginArray();
+        BOOST_FOREACH(const CBlockIndex* pindexHeader, vHeaders)
+        {
+            writer.BeginObject();
+            writer.WritePair("hash", pindexHeader->GetBlockHash().GetHex());
+            writer.WritePair("height", pindexHeader->nHeight);
+            writer.WritePair("version", pindexHeader->nVersion);
+            writer.WritePair("merkleroot", pindexHeader->hashMerkleRoot.GetHex());
+            writer.WritePair("time", (boost::int64_t)pindexHeader->GetBlockTime());
+            writer.WritePair("nonce", (boost::uint64_t)pindexHeader->nNonce);
+            writer.WritePair("bits", HexBits(pindexHeader->nBits));
+            writer.WritePair("difficulty", GetDifficulty(pindexHeader));
+            if (pindexHeader->pprev)
+                writer.WritePair("previousblockhash", pindexHeader->pprev->GetBlockHash().GetHex());
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.str() += "\n";
+        return RESTReply(stream, HTTP_OK, rf_names[rf].pszContentType, writer.str());
+    }
+    CDataStream ssHeaders(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_FOREACH(const CBlockIndex* pindexHeader, vHeaders)
+        ssHeaders << pindexHeader->GetBlockHeader();
+    RESTReplyData(stream, rf, ssHeaders);
+}
+
+static void RESTChainInfo(CHTTPReplyStream& stream, const string& strPath)
+{
+    string strParam;
+    RESTFormat rf;
+    if (!ParseDataFormat(strPath, strParam, rf) || !strParam.empty() || rf != RF_JSON)
+        return RESTError(stream, HTTP_NOT_FOUND, "output format not found (available: .json)");
+
+    CBlockIndex* pindexTip = GetChainTip();
+    Object result;
+    result.push_back(Pair("chain", fTestNet ? "testnet" : "main"));
+    result.push_back(Pair("blocks", pindexTip ? pindexTip->nHeight : -1));
+    result.push_back(Pair("bestblockhash", pindexTip ? pindexTip->GetBlockHash().GetHex() : ""));
+    result.push_back(Pair("difficulty", GetDifficulty(pindexTip)));
+    RESTReply(stream, HTTP_OK, rf_names[rf].pszContentType, write_string(Value(result), false) + "\n");
+}
+
+static const struct {
+    const char *pszPrefix;
+    void (*handler)(CHTTPReplyStream& stream, const string& strPath);
+} uri_prefixes[] = {
+    { "/rest/block/",   RESTBlock },
+    { "/rest/tx/",      RESTTx },
+    { "/rest/headers/", RESTHeaders },
+    { "/rest/chaininfo", RESTChainInfo },
+};
+
+void ServiceREST(const string& strMethod, const string& strURI, CHTTPReplyStream& stream)
+{
+    if (strMethod != "GET")
+        return RESTError(stream, HTTP_BAD_REQUEST, "Only GET requests are supported");
+
+    string strPath = strURI.substr(0, strURI.find('?'));
+    for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
+    {
+        if (boost::algorithm::starts_with(strPath, uri_prefixes[i].pszPrefix))
+            return uri_prefixes[i].handler(stream, strPath.substr(strlen(uri_prefixes[i].pszPrefix)));
+    }
+    RESTError(stream, HTTP_NOT_FOUND, "Not found");
+}
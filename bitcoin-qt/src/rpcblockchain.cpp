@@ -5,6 +5,7 @@
 
 #include "main.h"
 #include "bitcoinrpc.h"
+#include "txdb.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -17,10 +18,9 @@ double GetDifficulty(const CBlockIndex* blockindex)
     // minimum difficulty = 1.0.
     if (blockindex == NULL)
     {
-        if (pindexBest == NULL)
+        blockindex = GetChainTip();
+        if (blockindex == NULL)
             return 1.0;
-        else
-            blockindex = pindexBest;
     }
 
     int nShift = (blockindex->nBits >> 24) & 0xff;
@@ -43,31 +43,32 @@ double GetDifficulty(const CBlockIndex* blockindex)
 }
 
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex)
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, CJSONWriter& writer)
 {
-    Object result;
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
-    CMerkleTx txGen(block.vtx[0]);
-    txGen.SetMerkleBranch(&block);
-    result.push_back(Pair("confirmations", (int)txGen.GetDepthInMainChain()));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    Array txs;
+    writer.BeginObject();
+    writer.WritePair("hash", block.GetHash().GetHex());
+    int nDepth = GetChainDepth(blockindex);
+    writer.WritePair("confirmations", nDepth);
+    writer.WritePair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.WritePair("height", blockindex->nHeight);
+    writer.WritePair("version", block.nVersion);
+    writer.WritePair("merkleroot", block.hashMerkleRoot.GetHex());
+    writer.WriteKey("tx");
+    writer.BeginArray();
     BOOST_FOREACH(const CTransaction&tx, block.vtx)
-        txs.push_back(tx.GetHash().GetHex());
-    result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", (boost::int64_t)block.GetBlockTime()));
-    result.push_back(Pair("nonce", (boost::uint64_t)block.nNonce));
-    result.push_back(Pair("bits", HexBits(block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+        writer.WriteValue(tx.GetHash().GetHex());
+    writer.EndArray();
+    writer.WritePair("time", (boost::int64_t)block.GetBlockTime());
+    writer.WritePair("nonce", (boost::uint64_t)block.nNonce);
+    writer.WritePair("bits", HexBits(block.nBits));
+    writer.WritePair("difficulty", GetDifficulty(blockindex));
 
     if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    if (blockindex->pnext)
-        result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
-    return result;
+        writer.WritePair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+    CBlockIndex *pnext = nDepth > 0 ? GetChainBlockByHeight(blockindex->nHeight + 1) : NULL;
+    if (pnext && pnext->pprev == blockindex)
+        writer.WritePair("nextblockhash", pnext->GetBlockHash().GetHex());
+    writer.EndObject();
 }
 
 
@@ -78,7 +79,8 @@ Value getblockcount(const Array& params, bool fHelp)
             "getblockcount\n"
             "Returns the number of blocks in the longest block chain.");
 
-    return nBestHeight;
+    CBlockIndex *pindexTip = GetChainTip();
+    return pindexTip ? pindexTip->nHeight : -1;
 }
 
 
@@ -109,7 +111,7 @@ Value settxfee(const Array& params, bool fHelp)
     return true;
 }
 
-Value getrawmempool(const Array& params, bool fHelp)
+void streamgetrawmempool(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error(
@@ -119,11 +121,15 @@ Value getrawmempool(const Array& params, bool fHelp)
     vector<uint256> vtxid;
     mempool.queryHashes(vtxid);
 
-    Array a;
+    writer.BeginArray();
     BOOST_FOREACH(const uint256& hash, vtxid)
-        a.push_back(hash.ToString());
+        writer.WriteValue(hash.ToString());
+    writer.EndArray();
+}
 
-    return a;
+Value getrawmempool(const Array& params, bool fHelp)
+{
+    return ValueFromStream(streamgetrawmempool, params, fHelp);
 }
 
 Value getblockhash(const Array& params, bool fHelp)
@@ -134,14 +140,14 @@ Value getblockhash(const Array& params, bool fHelp)
             "Returns hash of block in best-block-chain at <index>.");
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
+    CBlockIndex* pblockindex = GetChainBlockByHeight(nHeight);
+    if (pblockindex == NULL)
         throw runtime_error("Block number out of range.");
 
-    CBlockIndex* pblockindex = FindBlockByHeight(nHeight);
     return pblockindex->phashBlock->GetHex();
 }
 
-Value getblock(const Array& params, bool fHelp)
+void streamgetblock(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() != 1)
         throw runtime_error(
@@ -151,14 +157,21 @@ Value getblock(const Array& params, bool fHelp)
     std::string strHash = params[0].get_str();
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (pblockindex == NULL)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
+    // the block files may be pruned under us, as cs_main isn't held
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-    block.ReadFromDisk(pblockindex);
+    if (!(pblockindex->nStatus & BLOCK_HAVE_DATA) || !block.ReadFromDisk(pblockindex))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    return blockToJSON(block, pblockindex);
+    blockToJSON(block, pblockindex, writer);
+}
+
+Value getblock(const Array& params, bool fHelp)
+{
+    return ValueFromStream(streamgetblock, params, fHelp);
 }
 
 Value gettxoutsetinfo(const Array& params, bool fHelp)
@@ -183,6 +196,43 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
     return ret;
 }
 
+static Object DBStatsToJSON(const CLevelDB &db)
+{
+    Object result;
+    const CLevelDBProfile &profile = db.GetProfile();
+    result.push_back(Pair("blockcache", (boost::int64_t)profile.nBlockCacheSize));
+    result.push_back(Pair("writebuffer", (boost::int64_t)profile.nWriteBufferSize));
+    result.push_back(Pair("maxopenfiles", profile.nMaxOpenFiles));
+
+    CLevelDBStats stats;
+    if (db.GetStats(stats)) {
+        result.push_back(Pair("tables", stats.nTables));
+        result.push_back(Pair("tablebytes", (boost::int64_t)stats.nTableBytes));
+        result.push_back(Pair("byteswritten", (boost::int64_t)stats.nBytesWritten));
+        result.push_back(Pair("compactionread", (boost::int64_t)stats.nCompactionRead));
+        result.push_back(Pair("compactionwritten", (boost::int64_t)stats.nCompactionWritten));
+        result.push_back(Pair("compactiontime", stats.dCompactionTime));
+        result.push_back(Pair("writeamplification", stats.GetWriteAmplification()));
+    }
+    return result;
+}
+
+Value getdbstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "Returns tuning and write statistics of the coin (chainstate) and block index databases.\n"
+            "Compaction counters are kept by LevelDB in whole megabytes and seconds, since startup.");
+
+    Object ret;
+    if (pcoinsdbview)
+        ret.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetDB())));
+    if (pblocktree)
+        ret.push_back(Pair("blockindex", DBStatsToJSON(*pblocktree)));
+    return ret;
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -4,6 +4,7 @@
 
 #include "net.h"
 #include "bitcoinrpc.h"
+#include "pubsub.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -202,3 +203,21 @@ Value getaddednodeinfo(const Array& params, bool fHelp)
     return ret;
 }
 
+Value getpublisherinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getpublisherinfo\n"
+            "Returns the port subscribers connect to (0 without -pubport), the number\n"
+            "of subscribers and how many messages were dropped because a subscriber's\n"
+            "queue was full.");
+
+    int nSubscribers = 0;
+    uint64 nDropped = 0;
+    GetPublisherStats(nSubscribers, nDropped);
+    Object obj;
+    obj.push_back(Pair("port",        (int)GetPublisherPort()));
+    obj.push_back(Pair("subscribers", nSubscribers));
+    obj.push_back(Pair("dropped",     (boost::uint64_t)nDropped));
+    return obj;
+}
@@ -11,6 +11,7 @@
 #include "init.h"
 #include "main.h"
 #include "net.h"
+#include "txdb.h"
 #include "wallet.h"
 
 using namespace std;
@@ -116,13 +117,13 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
     if (hashBlock != 0)
     {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
-        if (mi != mapBlockIndex.end() && (*mi).second)
+        CBlockIndex* pindex = LookupBlockIndex(hashBlock);
+        if (pindex)
         {
-            CBlockIndex* pindex = (*mi).second;
-            if (pindex->IsInMainChain())
+            int nDepth = GetChainDepth(pindex);
+            if (nDepth > 0)
             {
-                entry.push_back(Pair("confirmations", 1 + nBestHeight - pindex->nHeight));
+                entry.push_back(Pair("confirmations", nDepth));
                 entry.push_back(Pair("time", (boost::int64_t)pindex->nTime));
                 entry.push_back(Pair("blocktime", (boost::int64_t)pindex->nTime));
             }
@@ -166,7 +167,96 @@ Value getrawtransaction(const Array& params, bool fHelp)
     return result;
 }
 
-Value listunspent(const Array& params, bool fHelp)
+// The optional indexes are only complete once built for blocks connected before they were enabled
+static void CheckIndexBuilt(const string& strName, bool fEnabled)
+{
+    if (!fEnabled)
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("This needs -%s", strName.c_str()));
+    int nHeight = GetIndexBuildHeight(strName);
+    if (nHeight >= 0)
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("The -%s is still being built (at block %d)", strName.c_str(), nHeight));
+}
+
+Value getaddresshistory(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddresshistory <bitcoinaddress> [count=100] [from=0]\n"
+            "Returns up to [count] outputs paying to <bitcoinaddress> and inputs\n"
+            "spending from it in the best chain, oldest first, skipping the first [from].\n"
+            "Each is an Object {txid, height, vout or vin, amount}, with a negative\n"
+            "amount for inputs. Needs -addrindex.");
+
+    CheckIndexBuilt("addrindex", fAddressIndex);
+
+    CBitcoinAddress address(params[0].get_str());
+    CTxDestination dest = address.Get();
+    unsigned char chType;
+    uint160 hashAddress;
+    if (const CKeyID *pkeyid = boost::get<CKeyID>(&dest)) {
+        chType = ADDRINDEX_PUBKEYHASH;
+        hashAddress = *pkeyid;
+    } else if (const CScriptID *pscriptid = boost::get<CScriptID>(&dest)) {
+        chType = ADDRINDEX_SCRIPTHASH;
+        hashAddress = *pscriptid;
+    } else
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
+
+    int nCount = 100;
+    if (params.size() > 1)
+        nCount = params[1].get_int();
+    int nFrom = 0;
+    if (params.size() > 2)
+        nFrom = params[2].get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    if (nFrom < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
+
+    vector<pair<CAddressIndexKey, int64> > vEntries;
+    if (!pblocktree->ReadAddressIndex(chType, hashAddress, nFrom, nCount, vEntries))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    Array result;
+    BOOST_FOREACH(const PAIRTYPE(CAddressIndexKey, int64)& entry, vEntries)
+    {
+        Object obj;
+        obj.push_back(Pair("txid", entry.first.txid.GetHex()));
+        obj.push_back(Pair("height", entry.first.nHeight));
+        obj.push_back(Pair(entry.first.fSpending ? "vin" : "vout", (boost::int64_t)entry.first.nIndex));
+        obj.push_back(Pair("amount", ValueFromAmount(entry.second)));
+        result.push_back(obj);
+    }
+    return result;
+}
+
+Value getspentinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getspentinfo <txid> <n>\n"
+            "Returns the input spending output <n> of <txid> in the best chain,\n"
+            "as an Object {txid, vin, height}. Needs -spentindex.");
+
+    CheckIndexBuilt("spentindex", fSpentIndex);
+
+    uint256 hash = ParseHashV(params[0], "parameter 1");
+    int n = params[1].get_int();
+    if (n < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, vout must be positive");
+
+    CSpentIndexValue spent;
+    if (!pblocktree->ReadSpentIndex(COutPoint(hash, n), spent))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Output not spent in the best chain");
+
+    Object result;
+    result.push_back(Pair("txid", spent.txid.GetHex()));
+    result.push_back(Pair("vin", (boost::int64_t)spent.nIndex));
+    result.push_back(Pair("height", spent.nHeight));
+    return result;
+}
+
+void streamlistunspent(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() > 3)
         throw runtime_error(
@@ -202,7 +292,7 @@ Value listunspent(const Array& params, bool fHelp)
         }
     }
 
-    Array results;
+    writer.BeginArray();
     vector<COutput> vecOutputs;
     pwalletMain->AvailableCoins(vecOutputs, false);
     BOOST_FOREACH(const COutput& out, vecOutputs)
@@ -246,10 +336,14 @@ Value listunspent(const Array& params, bool fHelp)
         }
         entry.push_back(Pair("amount",ValueFromAmount(nValue)));
         entry.push_back(Pair("confirmations",out.nDepth));
-        results.push_back(entry);
+        writer.WriteValue(entry);
     }
+    writer.EndArray();
+}
 
-    return results;
+Value listunspent(const Array& params, bool fHelp)
+{
+    return ValueFromStream(streamlistunspent, params, fHelp);
 }
 
 Value createrawtransaction(const Array& params, bool fHelp)
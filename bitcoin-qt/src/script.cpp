@@ -16,7 +16,7 @@ using namespace boost;
 #include "sync.h"
 #include "util.h"
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
+bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSignatureHasher* phasher = NULL);
 
 
 
@@ -289,7 +289,7 @@ bool IsCanonicalSignature(const valtype &vchSig) {
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSignatureHasher* phasher)
 {
     CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
@@ -843,7 +843,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                     bool fSuccess = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
                     if (fSuccess)
-                        fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                        fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, phasher);
 
                     popstack(stack);
                     popstack(stack);
@@ -905,7 +905,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         // Check signature
                         bool fOk = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
                         if (fOk)
-                            fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                            fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, phasher);
 
                         if (fOk) {
                             isig++;
@@ -1025,6 +1025,66 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
 }
 
 
+CSignatureHasher::CSignatureHasher(const CTransaction& txToIn) : txTo(txToIn)
+{
+    // Same layout as serializing txTo with every scriptSig replaced by an
+    // empty script
+    CDataStream ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    WriteCompactSize(ss, txTo.vin.size());
+    vInputPos.reserve(txTo.vin.size());
+    BOOST_FOREACH(const CTxIn& txin, txTo.vin)
+    {
+        vInputPos.push_back(ss.size());
+        ss << txin.prevout << CScript() << txin.nSequence;
+    }
+    ss << txTo.vout << txTo.nLockTime;
+    vchBlank.assign(ss.begin(), ss.end());
+
+    // Save the midstate at the start of every input
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    vMidstate.reserve(vInputPos.size());
+    unsigned int nPos = 0;
+    BOOST_FOREACH(unsigned int nInputPos, vInputPos)
+    {
+        SHA256_Update(&ctx, &vchBlank[nPos], nInputPos - nPos);
+        nPos = nInputPos;
+        vMidstate.push_back(ctx);
+    }
+}
+
+uint256 CSignatureHasher::SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const
+{
+    if (nHashType != SIGHASH_ALL || nIn >= vInputPos.size())
+        return ::SignatureHash(scriptCode, txTo, nIn, nHashType);
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    // prevout, then scriptCode in place of the empty scriptSig, then the rest
+    const unsigned int nPrevoutSize = 36;
+    CDataStream ssScript(SER_GETHASH, 0);
+    ssScript << scriptCode;
+
+    SHA256_CTX ctx = vMidstate[nIn];
+    const unsigned char* pbegin = &vchBlank[vInputPos[nIn]];
+    SHA256_Update(&ctx, pbegin, nPrevoutSize);
+    SHA256_Update(&ctx, &ssScript[0], ssScript.size());
+    SHA256_Update(&ctx, pbegin + nPrevoutSize + 1, vchBlank.size() - vInputPos[nIn] - nPrevoutSize - 1);
+
+    unsigned char pchHashType[4];
+    for (int i = 0; i < 4; i++)
+        pchHashType[i] = (nHashType >> (8 * i)) & 0xff;
+    SHA256_Update(&ctx, pchHashType, sizeof(pchHashType));
+
+    uint256 hash1;
+    SHA256_Final((unsigned char*)&hash1, &ctx);
+    uint256 hash2;
+    SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+    return hash2;
+}
+
+
 // Valid signature cache, to avoid doing expensive ECDSA signature checking
 // twice for every transaction (once when accepted into memory pool, and
 // again when accepted into the block chain)
@@ -1082,7 +1142,7 @@ public:
 };
 
 bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags)
+              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSignatureHasher* phasher)
 {
     static CSignatureCache signatureCache;
 
@@ -1095,7 +1155,7 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = phasher ? phasher->SignatureHash(scriptCode, nIn, nHashType) : SignatureHash(scriptCode, txTo, nIn, nHashType);
 
     if (signatureCache.Get(sighash, vchSig, vchPubKey))
         return true;
@@ -1474,21 +1534,118 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
     return true;
 }
 
+// Fast path for scripts that consist of data pushes only (the usual scriptSig):
+// decode the pushes straight onto the stack, with the same limits EvalScript
+// enforces. Returns false if the script doesn't have that form, in which case
+// it has to go through EvalScript.
+static bool EvalPushDataOnly(vector<valtype>& stack, const CScript& script)
+{
+    if (script.size() > 10000)
+        return false;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vchPushValue;
+    while (pc < script.end())
+    {
+        if (!script.GetOp(pc, opcode, vchPushValue))
+            return false;
+        if (opcode > OP_PUSHDATA4 || vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        stack.push_back(vchPushValue);
+        if (stack.size() > 1000)
+            return false;
+    }
+    return true;
+}
+
+// Specialized evaluation of the pay-to-pubkey-hash, pay-to-pubkey and
+// pay-to-script-hash templates, giving the same result as running
+// scriptPubKey through EvalScript and checking the top of the stack.
+// Returns false if scriptPubKey (or the stack) isn't handled here; otherwise
+// fResultRet is set and stack is left untouched.
+static bool EvalStandardScript(const vector<valtype>& stack, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                               unsigned int flags, int nHashType, const CSignatureHasher* phasher, bool& fResultRet)
+{
+    bool fStrictEncodings = flags & SCRIPT_VERIFY_STRICTENC;
+    unsigned int nSize = scriptPubKey.size();
+
+    // OP_DUP OP_HASH160 <20 bytes> OP_EQUALVERIFY OP_CHECKSIG
+    if (nSize == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 && scriptPubKey[2] == 20 &&
+        scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG)
+    {
+        if (stack.size() < 2 || stack.size() + 2 > 1000)
+            return false;
+        const valtype& vchSig = stack[stack.size() - 2];
+        const valtype& vchPubKey = stack[stack.size() - 1];
+        uint160 hash = Hash160(vchPubKey);
+        if (memcmp(&hash, &scriptPubKey[3], 20) != 0)
+        {
+            fResultRet = false;
+            return true;
+        }
+        CScript scriptCode(scriptPubKey);
+        scriptCode.FindAndDelete(CScript(vchSig));
+        fResultRet = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey))) &&
+                     CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, phasher);
+        return true;
+    }
+
+    // <33 or 65 byte pubkey> OP_CHECKSIG
+    if ((nSize == 35 || nSize == 67) && scriptPubKey[0] == nSize - 2 && scriptPubKey[nSize - 1] == OP_CHECKSIG)
+    {
+        if (stack.size() < 1 || stack.size() + 1 > 1000)
+            return false;
+        const valtype& vchSig = stack.back();
+        valtype vchPubKey(scriptPubKey.begin() + 1, scriptPubKey.end() - 1);
+        CScript scriptCode(scriptPubKey);
+        scriptCode.FindAndDelete(CScript(vchSig));
+        fResultRet = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey))) &&
+                     CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, phasher);
+        return true;
+    }
+
+    // OP_HASH160 <20 bytes> OP_EQUAL
+    if (scriptPubKey.IsPayToScriptHash())
+    {
+        if (stack.size() < 1 || stack.size() + 1 > 1000)
+            return false;
+        uint160 hash = Hash160(stack.back());
+        fResultRet = (memcmp(&hash, &scriptPubKey[2], 20) == 0);
+        return true;
+    }
+
+    return false;
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  unsigned int flags, int nHashType)
+                  unsigned int flags, int nHashType, const CSignatureHasher* phasher)
 {
     vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
-        return false;
+    if (!EvalPushDataOnly(stack, scriptSig))
+    {
+        stack.clear();
+        if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType, phasher))
+            return false;
+    }
     if (flags & SCRIPT_VERIFY_P2SH)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType))
-        return false;
-    if (stack.empty())
-        return false;
 
-    if (CastToBool(stack.back()) == false)
-        return false;
+    bool fResult;
+    if (EvalStandardScript(stack, scriptPubKey, txTo, nIn, flags, nHashType, phasher, fResult))
+    {
+        if (!fResult)
+            return false;
+    }
+    else
+    {
+        if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType, phasher))
+            return false;
+        if (stack.empty())
+            return false;
+
+        if (CastToBool(stack.back()) == false)
+            return false;
+    }
 
     // Additional validation for spend-to-script-hash transactions:
     if ((flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash())
@@ -1505,7 +1662,9 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType))
+        if (EvalStandardScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType, phasher, fResult))
+            return fResult;
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType, phasher))
             return false;
         if (stackCopy.empty())
             return false;
@@ -11,6 +11,8 @@
 #include <boost/foreach.hpp>
 #include <boost/variant.hpp>
 
+#include <openssl/sha.h>
+
 #include "keystore.h"
 #include "bignum.h"
 
@@ -603,7 +605,7 @@ public:
  */
 class CScriptCompressor
 {
-private:
+protected:
     // make this static for now (there are only 6 special scripts defined)
     // this can potentially be extended together with a new nVersion for
     // transactions, in which case this value becomes dependent on nVersion
@@ -611,7 +613,7 @@ private:
     static const unsigned int nSpecialScripts = 6;
 
     CScript &script;
-protected:
+
     // These check for scripts for which a special case with a shorter encoding is defined.
     // They are implemented separately from the CScript test, as these test for exact byte
     // sequence correspondences, and are more strict. For example, IsToPubKey also verifies
@@ -666,7 +668,29 @@ public:
 bool IsCanonicalPubKey(const std::vector<unsigned char> &vchPubKey);
 bool IsCanonicalSignature(const std::vector<unsigned char> &vchSig);
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+/** Precomputed signature hash context for all inputs of one transaction.
+ *  The transaction is serialized once with all scriptSigs blanked, and the
+ *  SHA256 midstate at the start of every input is saved, so hashing input n
+ *  only continues from that midstate instead of copying and reserializing
+ *  the whole transaction. Results are identical to SignatureHash(); hash
+ *  types other than SIGHASH_ALL fall back to it.
+ */
+class CSignatureHasher
+{
+private:
+    const CTransaction& txTo;
+    std::vector<unsigned char> vchBlank;      // txTo with empty scriptSigs, without nHashType
+    std::vector<unsigned int> vInputPos;      // offset of each input within vchBlank
+    std::vector<SHA256_CTX> vMidstate;        // SHA256 state after hashing vchBlank[0, vInputPos[n])
+
+public:
+    CSignatureHasher(const CTransaction& txToIn);
+
+    uint256 SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const;
+};
+
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSignatureHasher* phasher = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey);
@@ -676,7 +700,7 @@ bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet)
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSignatureHasher* phasher = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
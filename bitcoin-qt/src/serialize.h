@@ -1234,6 +1234,57 @@ public:
     }
 };
 
+/** Read-only stream over a span of memory, such as a memory mapped file.
+ *  Deserializes directly from the span without copying it first.
+ */
+class CSpanReader
+{
+private:
+    const char* pbegin;
+    const char* pend;
+    const char* pcur;
+
+public:
+    int nType;
+    int nVersion;
+
+    CSpanReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn) :
+        pbegin(pbeginIn), pend(pendIn), pcur(pbeginIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    // number of bytes consumed so far, and left to read
+    size_t GetPos() const { return pcur - pbegin; }
+    size_t size() const   { return pend - pcur; }
+    bool empty() const    { return pcur == pend; }
+
+    int GetType()         { return nType; }
+    int GetVersion()      { return nVersion; }
+
+    CSpanReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    CSpanReader& ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore : end of data");
+        pcur += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 /** Wrapper around a FILE* that implements a ring buffer to
  *  deserialize from. It guarantees the ability to rewind
  *  a given number of bytes. */
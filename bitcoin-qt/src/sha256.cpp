@@ -0,0 +1,320 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <openssl/sha.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+// Padding block following a 64-byte message (bit length 512)
+static const unsigned char pchPad64[64] = {
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0x00,
+};
+
+// Padding following a 32-byte message (bit length 256)
+static const unsigned char pchPad32[32] = {
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0x00,
+};
+
+inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+inline void WriteBE32(unsigned char* p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+//
+// Generic implementation on top of OpenSSL's block function
+//
+void TransformD64Generic(unsigned char* out, const unsigned char* in)
+{
+    unsigned char buf[64];
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Transform(&ctx, in);
+    SHA256_Transform(&ctx, pchPad64);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(buf + 4*i, ctx.h[i]);
+    memcpy(buf + 32, pchPad32, 32);
+    SHA256_Init(&ctx);
+    SHA256_Transform(&ctx, buf);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4*i, ctx.h[i]);
+}
+
+#ifdef USE_SHA256_X86
+
+//
+// Multi-way implementation, one input per 32-bit vector lane. Written once
+// in sha256_multiway.h and included with the instruction set enabled (SSE4.1
+// for 4 lanes, AVX2 for 8 lanes).
+//
+namespace sse41
+{
+typedef uint32_t V __attribute__((vector_size(16)));
+static const int N = 4;
+#define SHA256_MULTIWAY_TARGET __attribute__((target("sse4.1")))
+#include "sha256_multiway.h"
+#undef SHA256_MULTIWAY_TARGET
+}
+
+namespace avx2
+{
+typedef uint32_t V __attribute__((vector_size(32)));
+static const int N = 8;
+#define SHA256_MULTIWAY_TARGET __attribute__((target("avx2")))
+#include "sha256_multiway.h"
+#undef SHA256_MULTIWAY_TARGET
+}
+
+//
+// Single block transform using the Intel SHA extensions
+//
+__attribute__((target("sha,sse4.1"))) void TransformSHANI(uint32_t* state, const unsigned char* data)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // Load state and reorder it into ABEF/CDGH as the instructions expect
+    __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);             // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);       // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);    // CDGH
+    __m128i abef = state0;
+    __m128i cdgh = state1;
+
+    __m128i msg0, msg1, msg2, msg3, wk;
+
+// Four rounds with message words m and round constants K[4*g, 4*g+4)
+#define QROUND(g, m) do { \
+        wk = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)&K[4*(g)])); \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, wk); \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0E)); \
+    } while (0)
+// Next four message words from the previous sixteen (m0 oldest, m3 newest)
+#define EXPAND(m0, m1, m2, m3) \
+    (m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3))
+
+    msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), MASK);
+    QROUND(0, msg0);
+    msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), MASK);
+    QROUND(1, msg1);
+    msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), MASK);
+    QROUND(2, msg2);
+    msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), MASK);
+    QROUND(3, msg3);
+    EXPAND(msg0, msg1, msg2, msg3); QROUND(4, msg0);
+    EXPAND(msg1, msg2, msg3, msg0); QROUND(5, msg1);
+    EXPAND(msg2, msg3, msg0, msg1); QROUND(6, msg2);
+    EXPAND(msg3, msg0, msg1, msg2); QROUND(7, msg3);
+    EXPAND(msg0, msg1, msg2, msg3); QROUND(8, msg0);
+    EXPAND(msg1, msg2, msg3, msg0); QROUND(9, msg1);
+    EXPAND(msg2, msg3, msg0, msg1); QROUND(10, msg2);
+    EXPAND(msg3, msg0, msg1, msg2); QROUND(11, msg3);
+    EXPAND(msg0, msg1, msg2, msg3); QROUND(12, msg0);
+    EXPAND(msg1, msg2, msg3, msg0); QROUND(13, msg1);
+    EXPAND(msg2, msg3, msg0, msg1); QROUND(14, msg2);
+    EXPAND(msg3, msg0, msg1, msg2); QROUND(15, msg3);
+
+#undef QROUND
+#undef EXPAND
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+
+    // Back to ABCD/EFGH
+    tmp = _mm_shuffle_epi32(state0, 0x1B);          // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);       // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);    // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);       // HGFE
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+void TransformD64SHANI(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[8];
+    unsigned char buf[64];
+    memcpy(s, IV, sizeof(s));
+    TransformSHANI(s, in);
+    TransformSHANI(s, pchPad64);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(buf + 4*i, s[i]);
+    memcpy(buf + 32, pchPad32, 32);
+    memcpy(s, IV, sizeof(s));
+    TransformSHANI(s, buf);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4*i, s[i]);
+}
+
+bool AVXEnabledByOS()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+
+void DetectCPUFeatures(bool& fSSE41, bool& fAVX2, bool& fSHANI)
+{
+    uint32_t eax, ebx, ecx, edx;
+    fSSE41 = fAVX2 = fSHANI = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        fSSE41 = (ecx >> 19) & 1;
+        bool fAVX = ((ecx >> 27) & 1) && ((ecx >> 28) & 1) && AVXEnabledByOS(); // OSXSAVE and AVX
+        if (__get_cpuid_max(0, NULL) >= 7)
+        {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            fAVX2 = fAVX && ((ebx >> 5) & 1);
+            fSHANI = fSSE41 && ((ebx >> 29) & 1);
+        }
+    }
+}
+
+#endif // USE_SHA256_X86
+
+typedef void (*TransformD64Type)(unsigned char* out, const unsigned char* in);
+
+TransformD64Type TransformD64 = TransformD64Generic;
+TransformD64Type TransformD64_4way = NULL;
+TransformD64Type TransformD64_8way = NULL;
+
+bool SelfTest(TransformD64Type transform, int nWays)
+{
+    unsigned char in[64 * 8], out[32 * 8], expected[32];
+    for (unsigned int i = 0; i < sizeof(in); i++)
+        in[i] = (unsigned char)(i * 7 + 3);
+    transform(out, in);
+    for (int j = 0; j < nWays; j++)
+    {
+        TransformD64Generic(expected, in + 64*j);
+        if (memcmp(out + 32*j, expected, 32) != 0)
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks)
+{
+    if (TransformD64_8way)
+    {
+        while (nBlocks >= 8)
+        {
+            TransformD64_8way(out, in);
+            out += 256;
+            in += 512;
+            nBlocks -= 8;
+        }
+    }
+    if (TransformD64_4way)
+    {
+        while (nBlocks >= 4)
+        {
+            TransformD64_4way(out, in);
+            out += 128;
+            in += 256;
+            nBlocks -= 4;
+        }
+    }
+    while (nBlocks)
+    {
+        TransformD64(out, in);
+        out += 32;
+        in += 64;
+        --nBlocks;
+    }
+}
+
+std::string SHA256AutoDetect()
+{
+    std::string ret = "generic";
+    TransformD64 = TransformD64Generic;
+    TransformD64_4way = NULL;
+    TransformD64_8way = NULL;
+#ifdef USE_SHA256_X86
+    bool fSSE41, fAVX2, fSHANI;
+    DetectCPUFeatures(fSSE41, fAVX2, fSHANI);
+
+    // The SHA extensions beat the multi-way code on every CPU that has them
+    if (fSHANI && SelfTest(TransformD64SHANI, 1))
+    {
+        TransformD64 = TransformD64SHANI;
+        return "shani(1way)";
+    }
+    if (fSSE41 && SelfTest(sse41::TransformD64, 4))
+    {
+        TransformD64_4way = sse41::TransformD64;
+        ret += ",sse41(4way)";
+    }
+    if (fAVX2 && SelfTest(avx2::TransformD64, 8))
+    {
+        TransformD64_8way = avx2::TransformD64;
+        ret += ",avx2(8way)";
+    }
+#endif
+    return ret;
+}
+
+bool SHA256ForceImplementation(const std::string& strName)
+{
+    TransformD64 = TransformD64Generic;
+    TransformD64_4way = NULL;
+    TransformD64_8way = NULL;
+    if (strName == "generic")
+        return true;
+#ifdef USE_SHA256_X86
+    bool fSSE41, fAVX2, fSHANI;
+    DetectCPUFeatures(fSSE41, fAVX2, fSHANI);
+    if (strName == "shani" && fSHANI)
+        TransformD64 = TransformD64SHANI;
+    else if (strName == "sse41" && fSSE41)
+        TransformD64_4way = sse41::TransformD64;
+    else if (strName == "avx2" && fAVX2)
+        TransformD64_8way = avx2::TransformD64;
+    else
+        return false;
+    return true;
+#else
+    return false;
+#endif
+}
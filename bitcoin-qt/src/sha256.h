@@ -0,0 +1,31 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SHA256_H
+#define BITCOIN_SHA256_H
+
+#include <stddef.h>
+#include <string>
+
+/** Compute the double-SHA256 of nBlocks independent 64-byte inputs.
+ *  Input i is read from in[64*i, 64*i+64) and its hash written to
+ *  out[32*i, 32*i+32). This is the operation behind every merkle tree node;
+ *  on capable CPUs several inputs are hashed in parallel (AVX2, SSE4.1) or
+ *  with the SHA extensions.
+ */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks);
+
+/** Select the fastest SHA256D64 implementation supported by this CPU.
+ *  Every candidate is checked against the generic (OpenSSL-based) code
+ *  before it is enabled. Returns a description of what was selected.
+ */
+std::string SHA256AutoDetect();
+
+/** For tests: use only the named implementation ("generic", "sse41",
+ *  "avx2" or "shani"), whatever autodetection would pick. Returns false,
+ *  leaving the generic code selected, if this CPU can't run it.
+ *  SHA256AutoDetect() restores the normal choice.
+ */
+bool SHA256ForceImplementation(const std::string& strName);
+
+#endif
@@ -0,0 +1,104 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Multi-way SHA256D64, one input per 32-bit vector lane. Only for sha256.cpp,
+// which includes this once per instruction set inside its own namespace,
+// after defining:
+//   V                     the vector type, N lanes of uint32_t
+//   N                     the number of lanes
+//   SHA256_MULTIWAY_TARGET the target attribute enabling the instructions
+// Every function taking or returning a V carries the target attribute, so
+// vectors never cross a function boundary compiled without them.
+
+#define MULTIWAY_INLINE inline SHA256_MULTIWAY_TARGET __attribute__((always_inline))
+
+MULTIWAY_INLINE V Ror(V x, int n) { return (x >> n) | (x << (32 - n)); }
+MULTIWAY_INLINE V Ch(V x, V y, V z) { return z ^ (x & (y ^ z)); }
+MULTIWAY_INLINE V Maj(V x, V y, V z) { return (x & y) | (z & (x | y)); }
+MULTIWAY_INLINE V Sigma0(V x) { return Ror(x, 2) ^ Ror(x, 13) ^ Ror(x, 22); }
+MULTIWAY_INLINE V Sigma1(V x) { return Ror(x, 6) ^ Ror(x, 11) ^ Ror(x, 25); }
+MULTIWAY_INLINE V sigma0(V x) { return Ror(x, 7) ^ Ror(x, 18) ^ (x >> 3); }
+MULTIWAY_INLINE V sigma1(V x) { return Ror(x, 17) ^ Ror(x, 19) ^ (x >> 10); }
+
+MULTIWAY_INLINE V Splat(uint32_t x)
+{
+    V v;
+    for (int j = 0; j < N; j++)
+        v[j] = x;
+    return v;
+}
+
+#define ROUND(a, b, c, d, e, f, g, h, k, w) do { \
+        V t1 = h + Sigma1(e) + Ch(e, f, g) + Splat(k) + w; \
+        V t2 = Sigma0(a) + Maj(a, b, c); \
+        d += t1; \
+        h = t1 + t2; \
+    } while (0)
+
+#define EXPAND(k) (w[k] += sigma1(w[(k + 14) & 15]) + w[(k + 9) & 15] + sigma0(w[(k + 1) & 15]))
+
+// s += compress(s, w); w holds the 16 message words and is clobbered
+MULTIWAY_INLINE void Compress(V* s, V* w)
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i += 16)
+    {
+        if (i)
+        {
+            EXPAND(0); EXPAND(1); EXPAND(2); EXPAND(3); EXPAND(4); EXPAND(5); EXPAND(6); EXPAND(7);
+            EXPAND(8); EXPAND(9); EXPAND(10); EXPAND(11); EXPAND(12); EXPAND(13); EXPAND(14); EXPAND(15);
+        }
+        ROUND(a, b, c, d, e, f, g, h, K[i + 0], w[0]);
+        ROUND(h, a, b, c, d, e, f, g, K[i + 1], w[1]);
+        ROUND(g, h, a, b, c, d, e, f, K[i + 2], w[2]);
+        ROUND(f, g, h, a, b, c, d, e, K[i + 3], w[3]);
+        ROUND(e, f, g, h, a, b, c, d, K[i + 4], w[4]);
+        ROUND(d, e, f, g, h, a, b, c, K[i + 5], w[5]);
+        ROUND(c, d, e, f, g, h, a, b, K[i + 6], w[6]);
+        ROUND(b, c, d, e, f, g, h, a, K[i + 7], w[7]);
+        ROUND(a, b, c, d, e, f, g, h, K[i + 8], w[8]);
+        ROUND(h, a, b, c, d, e, f, g, K[i + 9], w[9]);
+        ROUND(g, h, a, b, c, d, e, f, K[i + 10], w[10]);
+        ROUND(f, g, h, a, b, c, d, e, K[i + 11], w[11]);
+        ROUND(e, f, g, h, a, b, c, d, K[i + 12], w[12]);
+        ROUND(d, e, f, g, h, a, b, c, K[i + 13], w[13]);
+        ROUND(c, d, e, f, g, h, a, b, K[i + 14], w[14]);
+        ROUND(b, c, d, e, f, g, h, a, K[i + 15], w[15]);
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d; s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+#undef ROUND
+#undef EXPAND
+
+SHA256_MULTIWAY_TARGET void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    V s[8], w[16];
+
+    // First hash: the 64-byte input followed by its padding block
+    for (int i = 0; i < 8; i++)
+        s[i] = Splat(IV[i]);
+    for (int i = 0; i < 16; i++)
+        for (int j = 0; j < N; j++)
+            w[i][j] = ReadBE32(in + 64*j + 4*i);
+    Compress(s, w);
+    for (int i = 0; i < 16; i++)
+        w[i] = Splat(ReadBE32(pchPad64 + 4*i));
+    Compress(s, w);
+
+    // Second hash: the 32-byte result plus padding, in a single block
+    for (int i = 0; i < 8; i++)
+    {
+        w[i] = s[i];
+        w[i + 8] = Splat(ReadBE32(pchPad32 + 4*i));
+        s[i] = Splat(IV[i]);
+    }
+    Compress(s, w);
+
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < N; j++)
+            WriteBE32(out + 32*j + 4*i, s[i][j]);
+}
+
+#undef MULTIWAY_INLINE
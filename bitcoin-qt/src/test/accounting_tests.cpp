@@ -120,4 +120,51 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
     BOOST_CHECK(6 == vpwtx[1]->nOrderPos);
 }
 
+static void
+CheckOrderedTxItems()
+{
+    const CWallet::TxItems& txOrdered = pwalletMain->wtxOrdered;
+    BOOST_CHECK_EQUAL(txOrdered.size(), pwalletMain->mapWallet.size() + pwalletMain->laccentries.size());
+    for (CWallet::TxItems::const_iterator it = txOrdered.begin(); it != txOrdered.end(); ++it)
+    {
+        const CWalletTx *const pwtx = (*it).second.first;
+        const CAccountingEntry *const pacentry = (*it).second.second;
+        BOOST_CHECK_EQUAL((*it).first, pwtx ? pwtx->nOrderPos : pacentry->nOrderPos);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(acc_orderedlog)
+{
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    pwalletMain->LoadOrderedTxItems(walletdb);
+    CheckOrderedTxItems();
+    size_t nItems = pwalletMain->wtxOrdered.size();
+
+    // new entries go to the end of the log
+    CAccountingEntry ae;
+    ae.strAccount = "f";
+    ae.nCreditDebit = 2;
+    ae.nTime = 1333333340;
+    ae.nOrderPos = pwalletMain->IncOrderPosNext(&walletdb);
+    BOOST_CHECK(pwalletMain->AddAccountingEntry(ae, walletdb));
+    CWalletTx wtx;
+    wtx.nLockTime = 1234;
+    pwalletMain->AddToWallet(wtx);
+    BOOST_CHECK_EQUAL(pwalletMain->wtxOrdered.size(), nItems + 2);
+    CheckOrderedTxItems();
+    CWallet::TxItems::reverse_iterator it = pwalletMain->wtxOrdered.rbegin();
+    BOOST_CHECK((*it).second.first == &pwalletMain->mapWallet[wtx.GetHash()]);
+    ++it;
+    BOOST_CHECK((*it).second.second->strAccount == "f");
+
+    // and are the same when read back
+    pwalletMain->LoadOrderedTxItems(walletdb);
+    BOOST_CHECK_EQUAL(pwalletMain->wtxOrdered.size(), nItems + 2);
+    BOOST_CHECK((*pwalletMain->wtxOrdered.rbegin()).second.first == &pwalletMain->mapWallet[wtx.GetHash()]);
+
+    BOOST_CHECK(pwalletMain->EraseFromWallet(wtx.GetHash()));
+    BOOST_CHECK_EQUAL(pwalletMain->wtxOrdered.size(), nItems + 1);
+    CheckOrderedTxItems();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
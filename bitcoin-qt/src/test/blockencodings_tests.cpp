@@ -0,0 +1,186 @@
+#include <boost/test/unit_test.hpp>
+
+#include "blockencodings.h"
+#include "hash.h"
+#include "main.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+// A block of distinct transactions spending made up outputs
+static CBlock BuildBlock(unsigned int nTx)
+{
+    CBlock block;
+    block.nVersion = 2;
+    block.nTime = 1370000000;
+    block.nBits = 0x207fffff;
+    CTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 42 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    block.vtx.push_back(coinbase);
+    for (unsigned int i = 1; i < nTx; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(uint256(i), i % 3);
+        tx.vin[0].scriptSig = CScript() << vector<unsigned char>(72, i) << vector<unsigned char>(33, i);
+        tx.vout.resize(2);
+        tx.vout[0].nValue = i;
+        tx.vout[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        tx.vout[1].nValue = 2 * i;
+        tx.vout[1].scriptPubKey = tx.vout[0].scriptPubKey;
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    // SipHash-2-4 reference vector for the 32 byte message 00 01 .. 1f
+    uint256 val("0x1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100");
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, val), 0x7127512f72f27cceULL);
+}
+
+BOOST_AUTO_TEST_CASE(cmpctblock_serialize)
+{
+    CBlock block = BuildBlock(50);
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << cmpctblock;
+    BOOST_CHECK_EQUAL(ss.size(), cmpctblock.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION));
+    // header, nonce, 6 bytes per short ID and the coinbase
+    BOOST_CHECK_EQUAL(ss.size(), 80 + 8 + 1 + 49 * 6 + 1 + 1 + ::GetSerializeSize(block.vtx[0], SER_NETWORK, PROTOCOL_VERSION));
+
+    CBlockHeaderAndShortTxIDs cmpctRead;
+    ss >> cmpctRead;
+    BOOST_CHECK(cmpctRead.header.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(cmpctRead.nNonce, cmpctblock.nNonce);
+    BOOST_CHECK(cmpctRead.vShortTxIDs == cmpctblock.vShortTxIDs);
+    BOOST_CHECK_EQUAL(cmpctRead.vPrefilledTxn.size(), 1U);
+    BOOST_CHECK_EQUAL(cmpctRead.BlockTxCount(), 50U);
+    BOOST_CHECK_EQUAL(cmpctRead.GetShortID(block.vtx[7].GetHash()), cmpctblock.vShortTxIDs[6]);
+
+    CBlockTransactionsRequest req, reqRead;
+    req.blockhash = block.GetHash();
+    req.vIndexes.push_back(1);
+    req.vIndexes.push_back(2);
+    req.vIndexes.push_back(40);
+    ss << req;
+    ss >> reqRead;
+    BOOST_CHECK(reqRead.blockhash == req.blockhash && reqRead.vIndexes == req.vIndexes);
+}
+
+BOOST_AUTO_TEST_CASE(cmpctblock_rebuild)
+{
+    CBlock block = BuildBlock(200);
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+
+    // the pool has all but every 20th transaction, plus some unrelated ones
+    CTxMemPool pool;
+    vector<CTransaction> vMissing;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+    {
+        if (i % 20 == 0)
+            vMissing.push_back(block.vtx[i]);
+        else
+            pool.addUnchecked(block.vtx[i].GetHash(), block.vtx[i]);
+    }
+    CBlock blockOther = BuildBlock(250);
+    for (unsigned int i = 200; i < blockOther.vtx.size(); i++)
+        pool.addUnchecked(blockOther.vtx[i].GetHash(), blockOther.vtx[i]);
+
+    CPartialBlock partial;
+    BOOST_CHECK_EQUAL(partial.Init(cmpctblock, pool), CPartialBlock::READ_OK);
+    BOOST_CHECK_EQUAL(partial.nFromPool, 199U - vMissing.size());
+    vector<unsigned int> vIndexes;
+    partial.GetMissing(vIndexes);
+    BOOST_CHECK_EQUAL(vIndexes.size(), vMissing.size());
+    for (unsigned int i = 0; i < vIndexes.size(); i++)
+        BOOST_CHECK_EQUAL(vIndexes[i], 20 * (i + 1));
+
+    // the peer answers from its copy of the block
+    CBlockTransactionsRequest req;
+    req.blockhash = block.GetHash();
+    req.vIndexes = vIndexes;
+    CBlockTransactions resp(req);
+    for (unsigned int i = 0; i < vIndexes.size(); i++)
+        resp.vtx[i] = block.vtx[vIndexes[i]];
+
+    CBlock blockRebuilt;
+    BOOST_CHECK_EQUAL(partial.Fill(resp.vtx, blockRebuilt), CPartialBlock::READ_OK);
+    BOOST_CHECK(blockRebuilt.GetHash() == block.GetHash());
+    BOOST_CHECK(blockRebuilt.vtx == block.vtx);
+
+    // too few or too many transactions is the peer's fault
+    vector<CTransaction> vShort(resp.vtx.begin(), resp.vtx.end() - 1);
+    BOOST_CHECK_EQUAL(partial.Fill(vShort, blockRebuilt), CPartialBlock::READ_INVALID);
+    vector<CTransaction> vLong(resp.vtx);
+    vLong.push_back(block.vtx[1]);
+    BOOST_CHECK_EQUAL(partial.Fill(vLong, blockRebuilt), CPartialBlock::READ_INVALID);
+
+    // the wrong ones don't rebuild the block
+    vector<CTransaction> vWrong(resp.vtx);
+    vWrong[0] = blockOther.vtx[220];
+    BOOST_CHECK_EQUAL(partial.Fill(vWrong, blockRebuilt), CPartialBlock::READ_FAILED);
+
+    // a prefilled transaction past the end of the block
+    CBlockHeaderAndShortTxIDs cmpctBad(cmpctblock);
+    cmpctBad.vPrefilledTxn[0].nIndex = cmpctBad.BlockTxCount();
+    CPartialBlock partialBad;
+    BOOST_CHECK_EQUAL(partialBad.Init(cmpctBad, pool), CPartialBlock::READ_INVALID);
+
+    // two transactions with the same short ID
+    cmpctBad = cmpctblock;
+    cmpctBad.vShortTxIDs[5] = cmpctBad.vShortTxIDs[6];
+    BOOST_CHECK_EQUAL(partialBad.Init(cmpctBad, pool), CPartialBlock::READ_FAILED);
+}
+
+// Time for a block to cross nHops I2P tunnels, each with nRTT milliseconds
+// round trip and nBandwidth bytes per second
+static double RelayTime(unsigned int nHops, double nRTT, double nBandwidth, double nRoundTrips, unsigned int nBytes)
+{
+    return nHops * (nRoundTrips * nRTT + 1000.0 * nBytes / nBandwidth);
+}
+
+BOOST_AUTO_TEST_CASE(cmpctblock_propagation)
+{
+    // a full block of typical transactions, 95% of them already in the pool
+    CBlock block = BuildBlock(1500);
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    CBlockTransactionsRequest req;
+    req.blockhash = block.GetHash();
+    for (unsigned int i = 20; i < block.vtx.size(); i += 20)
+        req.vIndexes.push_back(i);
+    CBlockTransactions resp(req);
+    for (unsigned int i = 0; i < req.vIndexes.size(); i++)
+        resp.vtx[i] = block.vtx[req.vIndexes[i]];
+
+    unsigned int nBlockSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    unsigned int nCompactSize = ::GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION);
+    unsigned int nMissingSize = ::GetSerializeSize(req, SER_NETWORK, PROTOCOL_VERSION) + ::GetSerializeSize(resp, SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(nCompactSize * 20 < nBlockSize);
+
+    // inv, getdata and block against the compact block pushed right away,
+    // plus getblocktxn and blocktxn when the pool lacks some transactions
+    const unsigned int nHops = 4;
+    const double nRTT = 1000, nBandwidth = 20000;
+    double nFull = RelayTime(nHops, nRTT, nBandwidth, 1.5, nBlockSize);
+    double nCompact = RelayTime(nHops, nRTT, nBandwidth, 0.5, nCompactSize);
+    double nCompactMissing = RelayTime(nHops, nRTT, nBandwidth, 1.5, nCompactSize + nMissingSize);
+    if (fDebug)
+    {
+        printf("cmpctblock_propagation: %u byte block, %u byte compact block, %u bytes for %"PRIszu" missing transactions\n",
+               nBlockSize, nCompactSize, nMissingSize, req.vIndexes.size());
+        printf("cmpctblock_propagation: %u hops: full %.1fs, compact %.1fs, compact with missing transactions %.1fs\n",
+               nHops, nFull / 1000, nCompact / 1000, nCompactMissing / 1000);
+    }
+    BOOST_CHECK(nCompact < nCompactMissing);
+    BOOST_CHECK(nCompactMissing < nFull);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,382 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include "main.h"
+#include "blockfile.h"
+#include "txdb.h"
+#include "util.h"
+
+using namespace std;
+
+extern bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64 nTime, bool fKnown, int nFormat);
+
+static string WriteTestFile(const string& strName, const vector<char>& vch)
+{
+    string strPath = (GetDataDir() / strName).string();
+    FILE* file = fopen(strPath.c_str(), "wb");
+    BOOST_REQUIRE(file != NULL);
+    if (!vch.empty())
+        BOOST_REQUIRE(fwrite(&vch[0], 1, vch.size(), file) == vch.size());
+    fclose(file);
+    return strPath;
+}
+
+// Block with the genesis header and transactions exercising every case of the compressed encoding
+static CBlock CompressionTestBlock(CScript &scriptCommon)
+{
+    CBlock block;
+    BOOST_REQUIRE(block.ReadFromDisk(pindexGenesisBlock));
+
+    CKey key, keyCompressed;
+    key.MakeNewKey(false);
+    keyCompressed.MakeNewKey(true);
+    scriptCommon.SetDestination(keyCompressed.GetPubKey().GetID());
+
+    CTransaction txCoinBase;
+    txCoinBase.vin.resize(1);
+    txCoinBase.vin[0].scriptSig = CScript() << 486604799 << 4;
+    txCoinBase.vout.resize(4);
+    txCoinBase.vout[0].nValue = 50 * COIN;
+    txCoinBase.vout[0].scriptPubKey = CScript() << key.GetPubKey() << OP_CHECKSIG;
+    txCoinBase.vout[1].nValue = 1234567;
+    txCoinBase.vout[1].scriptPubKey = scriptCommon;
+    txCoinBase.vout[2].nValue = 0;
+    txCoinBase.vout[2].scriptPubKey = CScript() << OP_RETURN << 42;
+    txCoinBase.vout[3].nValue = 1;
+
+    CTransaction tx;
+    tx.nVersion = -3;
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(txCoinBase.GetHash(), 1);
+    tx.vin[0].scriptSig = CScript() << vector<unsigned char>(72, 0x30) << keyCompressed.GetPubKey();
+    tx.vin[1].prevout = COutPoint(GetRandHash(), 7);
+    tx.vin[1].nSequence = 0;
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 1000;
+    tx.vout[0].scriptPubKey.SetDestination(scriptCommon.GetID());
+    tx.vout[1].nValue = 1234000;
+    tx.vout[1].scriptPubKey = scriptCommon;
+    tx.nLockTime = 500000123;
+
+    block.vtx.clear();
+    block.vtx.push_back(txCoinBase);
+    block.vtx.push_back(tx);
+    return block;
+}
+
+BOOST_AUTO_TEST_SUITE(blockfile_tests)
+
+BOOST_AUTO_TEST_CASE(record_types)
+{
+    for (int nType = BLOCKRECORD_RAW; nType <= BLOCKRECORD_DICTIONARY; nType++) {
+        unsigned char pchStart[4];
+        GetBlockRecordStart(nType, pchStart);
+        BOOST_CHECK_EQUAL(GetBlockRecordType(pchStart), nType);
+        BOOST_CHECK_EQUAL(pchStart[0], pchMessageStart[0]);
+    }
+    unsigned char pchGarbage[4] = {pchMessageStart[0], pchMessageStart[1], pchMessageStart[2], (unsigned char)(pchMessageStart[3] ^ 0x80)};
+    BOOST_CHECK_EQUAL(GetBlockRecordType(pchGarbage), -1);
+    pchGarbage[3] = pchMessageStart[3];
+    pchGarbage[1] ^= 1;
+    BOOST_CHECK_EQUAL(GetBlockRecordType(pchGarbage), -1);
+}
+
+BOOST_AUTO_TEST_CASE(compressed_block)
+{
+    CScript scriptCommon;
+    CBlock block = CompressionTestBlock(scriptCommon);
+    unsigned int nRawSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+
+    CScriptDictionary dictEmpty, dict;
+    dict.vScripts.push_back(CScript() << OP_TRUE);
+    dict.vScripts.push_back(scriptCommon);
+    dict.BuildIndex();
+
+    // the dictionary survives serialization
+    CDataStream ssDict(SER_DISK, CLIENT_VERSION);
+    ssDict << dict;
+    CScriptDictionary dictRead;
+    ssDict >> dictRead;
+    unsigned int nIndex = 0;
+    BOOST_CHECK(dictRead.Find(scriptCommon, nIndex));
+    BOOST_CHECK_EQUAL(nIndex, 1U);
+    BOOST_CHECK(!dictRead.Find(CScript() << OP_FALSE, nIndex));
+
+    unsigned int nSizeNoDict = 0;
+    for (int i = 0; i < 2; i++) {
+        const CScriptDictionary &dictUsed = i ? dict : dictEmpty;
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << CBlockCompressor(block, dictUsed);
+        BOOST_CHECK(ss.size() < nRawSize);
+        if (i == 0)
+            nSizeNoDict = ss.size();
+        else
+            BOOST_CHECK(ss.size() < nSizeNoDict);
+
+        CBlock blockRead;
+        ss >> REF(CBlockCompressor(blockRead, dictUsed));
+        BOOST_CHECK(ss.empty());
+        BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+        BOOST_CHECK(blockRead.vtx == block.vtx);
+        BOOST_CHECK(blockRead.vtx[1].vin[0].prevout.hash == block.vtx[0].GetHash());
+    }
+
+    // spends of later transactions are stored by hash
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    std::swap(block.vtx[0], block.vtx[1]);
+    ss << CBlockCompressor(block, dict);
+    CBlock blockRead;
+    ss >> REF(CBlockCompressor(blockRead, dict));
+    BOOST_CHECK(blockRead.vtx == block.vtx);
+}
+
+BOOST_AUTO_TEST_CASE(compressed_block_file)
+{
+    LOCK(cs_main);
+    int nLastBlockFileOld = nLastBlockFile;
+    CBlockFileInfo infoLastBlockFileOld = infoLastBlockFile;
+
+    // Start a new compressed file
+    fCompressBlocks = true;
+    nLastBlockFile = 100;
+    infoLastBlockFile.SetNull();
+    CScript scriptCommon;
+    CBlock block = CompressionTestBlock(scriptCommon);
+    unsigned int nRawSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    CValidationState state;
+    CDiskBlockPos pos;
+    BOOST_REQUIRE(FindBlockPos(state, pos, nRawSize + 8, 1, block.nTime, false, BLOCKFILE_FORMAT_RAW));
+    BOOST_CHECK_EQUAL(pos.nFile, 100);
+    BOOST_CHECK(pos.nPos > 0);
+    BOOST_CHECK_EQUAL(infoLastBlockFile.nFormat, BLOCKFILE_FORMAT_COMPRESSED);
+    BOOST_CHECK(GetBlockFileDictionary(100));
+
+    // The block is written compressed, and the unused space given back
+    BOOST_REQUIRE(block.WriteToDisk(pos));
+    int nType;
+    unsigned int nDiskSize;
+    BOOST_CHECK(ReadBlockRecordHeader(pos, nType, nDiskSize));
+    BOOST_CHECK_EQUAL(nType, BLOCKRECORD_COMPRESSED);
+    BOOST_CHECK(nDiskSize < nRawSize);
+    BOOST_CHECK_EQUAL(infoLastBlockFile.nSize, pos.nPos + nDiskSize);
+
+    CBlock blockRead;
+    BOOST_CHECK(blockRead.ReadFromDisk(pos));
+    BOOST_CHECK(blockRead.vtx == block.vtx);
+    CDataStream ssRaw(SER_NETWORK, PROTOCOL_VERSION), ssExpected(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(ReadRawBlockFromDisk(ssRaw, pos));
+    ssExpected << block;
+    BOOST_CHECK(ssRaw.str() == ssExpected.str());
+
+    // The next block follows right after it, and reads the same when mapped
+    CDiskBlockPos pos2;
+    BOOST_REQUIRE(FindBlockPos(state, pos2, nRawSize + 8, 2, block.nTime, false, BLOCKFILE_FORMAT_RAW));
+    BOOST_REQUIRE(block.WriteToDisk(pos2));
+    BOOST_CHECK_EQUAL(pos2.nPos, pos.nPos + nDiskSize + 8);
+    nLastBlockFile++;
+    BOOST_CHECK(MapBlockFile(pos2));
+    CBlock blockMapped;
+    BOOST_CHECK(blockMapped.ReadFromDisk(pos2));
+    BOOST_CHECK(blockMapped.vtx == block.vtx);
+    CDataStream ssRawMapped(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(ReadRawBlockFromDisk(ssRawMapped, pos2));
+    BOOST_CHECK(ssRawMapped.str() == ssExpected.str());
+
+    fCompressBlocks = false;
+    nLastBlockFile = nLastBlockFileOld;
+    infoLastBlockFile = infoLastBlockFileOld;
+    SetBlockFileSequential(false);
+    boost::filesystem::remove(GetDataDir() / "blocks" / "blk00100.dat");
+    BOOST_CHECK(pblocktree->EraseBlockFileInfo(100));
+    CBlockFileInfo info;
+    BOOST_CHECK(!pblocktree->ReadBlockFileInfo(100, info));
+}
+
+BOOST_AUTO_TEST_CASE(spanreader)
+{
+    CTransaction tx;
+    tx.vin.resize(2);
+    tx.vout.resize(3);
+    tx.vout[1].nValue = 12345;
+    tx.nLockTime = 99;
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << tx << (unsigned int)0xdeadbeef;
+    vector<char> vch(ss.begin(), ss.end());
+
+    CSpanReader reader(&vch[0], &vch[0] + vch.size(), SER_DISK, CLIENT_VERSION);
+    CTransaction txRead;
+    unsigned int n;
+    reader >> txRead >> n;
+    BOOST_CHECK(txRead.GetHash() == tx.GetHash());
+    BOOST_CHECK_EQUAL(n, 0xdeadbeef);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_EQUAL(reader.GetPos(), vch.size());
+
+    // reading past the end throws
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+
+    CSpanReader reader2(&vch[0], &vch[0] + vch.size(), SER_DISK, CLIENT_VERSION);
+    reader2.ignore(vch.size() - 4);
+    reader2 >> n;
+    BOOST_CHECK_EQUAL(n, 0xdeadbeef);
+    BOOST_CHECK_THROW(reader2.ignore(1), std::ios_base::failure);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(mapper)
+{
+    vector<char> vch(5000);
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = (char)insecure_rand();
+    string strPath1 = WriteTestFile("blockfile_test1.dat", vch);
+    string strPath2 = WriteTestFile("blockfile_test2.dat", vch);
+    string strPath3 = WriteTestFile("blockfile_test3.dat", vch);
+
+    CBlockFileMapper mapper(2);
+    boost::shared_ptr<const CMappedFile> pmap1 = mapper.Get(strPath1, 0);
+    BOOST_REQUIRE(pmap1);
+    BOOST_CHECK_EQUAL(pmap1->size(), vch.size());
+    BOOST_CHECK(memcmp(pmap1->begin(), &vch[0], vch.size()) == 0);
+
+    // mappings are reused, and refused when the file is too short
+    BOOST_CHECK(mapper.Get(strPath1, 5000) == pmap1);
+    BOOST_CHECK(!mapper.Get(strPath1, 5001));
+    BOOST_CHECK(!mapper.Get((GetDataDir() / "blockfile_missing.dat").string(), 0));
+    pmap1 = mapper.Get(strPath1, 0);
+
+    // a file that grew is mapped again
+    vch.resize(6000, 'x');
+    WriteTestFile("blockfile_test1.dat", vch);
+    boost::shared_ptr<const CMappedFile> pmap1b = mapper.Get(strPath1, 6000);
+    BOOST_REQUIRE(pmap1b);
+    BOOST_CHECK(pmap1b != pmap1);
+    BOOST_CHECK_EQUAL(pmap1b->size(), 6000U);
+    // the old mapping stays usable while referenced
+    BOOST_CHECK_EQUAL(pmap1->size(), 5000U);
+    BOOST_CHECK(memcmp(pmap1->begin(), &vch[0], 5000) == 0);
+
+    // least recently used mapping is dropped first
+    boost::shared_ptr<const CMappedFile> pmap2 = mapper.Get(strPath2, 0);
+    BOOST_CHECK(mapper.Get(strPath1, 0) == pmap1b);
+    boost::shared_ptr<const CMappedFile> pmap3 = mapper.Get(strPath3, 0);
+    BOOST_CHECK(mapper.Get(strPath1, 0) == pmap1b);
+    BOOST_CHECK(mapper.Get(strPath2, 0) != pmap2);
+
+    mapper.Forget(strPath1);
+    BOOST_CHECK(mapper.Get(strPath1, 0) != pmap1b);
+
+    mapper.SetSequential(true);
+    mapper.Clear();
+    BOOST_CHECK(mapper.Get(strPath3, 0) != pmap3);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(mapped_block_read)
+{
+    // The file being appended to is never mapped
+    BOOST_REQUIRE(pindexGenesisBlock != NULL);
+    CDiskBlockPos pos = pindexGenesisBlock->GetBlockPos();
+    BOOST_CHECK_EQUAL(pos.nFile, nLastBlockFile);
+    BOOST_CHECK(!MapBlockFile(pos));
+
+    CBlock block;
+    BOOST_CHECK(block.ReadFromDisk(pos));
+    BOOST_CHECK(block.GetHash() == hashGenesisBlock);
+    CDataStream ssRaw(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(ReadRawBlockFromDisk(ssRaw, pos));
+
+    // Once a newer file is started, reads go through the mapping
+    nLastBlockFile++;
+    boost::shared_ptr<const CMappedFile> pmap = MapBlockFile(pos);
+    BOOST_CHECK(pmap);
+    CBlock blockMapped;
+    BOOST_CHECK(blockMapped.ReadFromDisk(pos));
+    BOOST_CHECK(blockMapped.GetHash() == hashGenesisBlock);
+    CDataStream ssRawMapped(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(ReadRawBlockFromDisk(ssRawMapped, pos));
+    BOOST_CHECK(ssRawMapped.str() == ssRaw.str());
+    BOOST_CHECK(!MapBlockFile(CDiskBlockPos(pos.nFile, 4)));
+    nLastBlockFile--;
+}
+
+BOOST_AUTO_TEST_CASE(prune)
+{
+    LOCK(cs_main);
+    int nLastBlockFileOld = nLastBlockFile;
+    CBlockFileInfo infoGenesisOld;
+    BOOST_REQUIRE(pblocktree->ReadBlockFileInfo(0, infoGenesisOld));
+
+    // keep the file with the genesis block out of the way
+    CBlockFileInfo infoGenesis = infoGenesisOld;
+    infoGenesis.nHeightLast = 100000;
+    BOOST_REQUIRE(pblocktree->WriteBlockFileInfo(0, infoGenesis));
+
+    // file 1 is deep below the tip, file 2 isn't, file 3 is being appended to
+    nLastBlockFile = 3;
+    CBlockFileInfo info1, info2;
+    info1.nSize = info2.nSize = 1000;
+    info1.nUndoSize = info2.nUndoSize = 100;
+    info1.AddBlock(10, 0);
+    info1.AddBlock(20, 0);
+    info2.AddBlock(950, 0);
+    info2.AddBlock(900, 0);
+    BOOST_CHECK_EQUAL(info2.nHeightLast, 950U);
+    BOOST_REQUIRE(pblocktree->WriteBlockFileInfo(1, info1));
+    BOOST_REQUIRE(pblocktree->WriteBlockFileInfo(2, info2));
+    vector<char> vch(1000, 'x');
+    string strBlk1 = WriteTestFile("blocks/blk00001.dat", vch);
+    string strRev1 = WriteTestFile("blocks/rev00001.dat", vch);
+    string strBlk2 = WriteTestFile("blocks/blk00002.dat", vch);
+
+    uint256 hash = GetRandHash();
+    CBlockIndex *pindex = new CBlockIndex();
+    pindex->phashBlock = &(mapBlockIndex.insert(make_pair(hash, pindex)).first->first);
+    pindex->nHeight = 15;
+    pindex->nFile = 1;
+    pindex->nDataPos = 8;
+    pindex->nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO;
+
+    // nothing happens unless pruning is enabled and the target exceeded
+    CValidationState state;
+    BOOST_CHECK(PruneBlockFiles(state, 1000));
+    fPruneMode = true;
+    nPruneTarget = 1024 * 1024 * 1024;
+    BOOST_CHECK(PruneBlockFiles(state, 1000));
+    BOOST_CHECK(boost::filesystem::exists(strBlk1));
+    BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_DATA);
+
+    nPruneTarget = 1;
+    BOOST_CHECK(PruneBlockFiles(state, 1000));
+    BOOST_CHECK(!boost::filesystem::exists(strBlk1));
+    BOOST_CHECK(!boost::filesystem::exists(strRev1));
+    BOOST_CHECK(boost::filesystem::exists(strBlk2));
+    BOOST_CHECK(!(pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)));
+    BOOST_CHECK(pindex->GetBlockPos().IsNull());
+    BOOST_CHECK(fHavePruned);
+    CBlockFileInfo info;
+    BOOST_CHECK(pblocktree->ReadBlockFileInfo(1, info));
+    BOOST_CHECK(info.IsPruned());
+    BOOST_CHECK_EQUAL(info.nHeightLast, 20U);
+    BOOST_CHECK(pblocktree->ReadBlockFileInfo(2, info));
+    BOOST_CHECK(!info.IsPruned());
+    BOOST_CHECK(pblocktree->ReadBlockFileInfo(0, info));
+    BOOST_CHECK(!info.IsPruned());
+
+    // once the tip moves far enough, the next file goes too
+    BOOST_CHECK(PruneBlockFiles(state, 1237));
+    BOOST_CHECK(boost::filesystem::exists(strBlk2));
+    BOOST_CHECK(PruneBlockFiles(state, 1238));
+    BOOST_CHECK(!boost::filesystem::exists(strBlk2));
+
+    mapBlockIndex.erase(hash);
+    delete pindex;
+    fPruneMode = false;
+    fHavePruned = false;
+    nPruneTarget = 0;
+    nLastBlockFile = nLastBlockFileOld;
+    pblocktree->WriteFlag("prunedblockfiles", false);
+    pblocktree->WriteBlockFileInfo(0, infoGenesisOld);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
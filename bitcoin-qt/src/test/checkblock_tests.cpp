@@ -63,4 +63,28 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(ReadRawBlock)
+{
+    // The genesis block is written to disk by InitBlockIndex
+    BOOST_REQUIRE(pindexGenesisBlock != NULL);
+    CDiskBlockPos pos = pindexGenesisBlock->GetBlockPos();
+
+    CBlock block;
+    BOOST_CHECK(block.ReadFromDisk(pos));
+    CDataStream ssExpected(SER_NETWORK, PROTOCOL_VERSION);
+    ssExpected << block;
+
+    CDataStream ssRaw(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(ReadRawBlockFromDisk(ssRaw, pos));
+    BOOST_CHECK(ssRaw.str() == ssExpected.str());
+
+    CBlock blockRaw;
+    ssRaw >> blockRaw;
+    BOOST_CHECK(blockRaw.GetHash() == block.GetHash());
+
+    // a position that does not point at a stored block is rejected
+    CDataStream ssBad(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(!ReadRawBlockFromDisk(ssBad, CDiskBlockPos(pos.nFile, pos.nPos + 1)));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,201 @@
+#include <boost/test/unit_test.hpp>
+
+#include <cmath>
+#include <limits>
+
+#include "json/json_spirit_fast_reader.h"
+#include "json/json_spirit_writer_template.h"
+#include "util.h"
+
+using namespace std;
+using namespace json_spirit;
+
+BOOST_AUTO_TEST_SUITE(json_tests)
+
+// Spirit and the fast reader convert reals along different paths, so they
+// may disagree in the last bits. Spirit reads huge exponents as infinity.
+static bool SameValue(const Value& a, const Value& b)
+{
+    if (a.type() != b.type())
+        return false;
+    switch (a.type())
+    {
+    case obj_type:
+    {
+        const Object& objA = a.get_obj();
+        const Object& objB = b.get_obj();
+        if (objA.size() != objB.size())
+            return false;
+        for (unsigned int i = 0; i < objA.size(); i++)
+            if (objA[i].name_ != objB[i].name_ || !SameValue(objA[i].value_, objB[i].value_))
+                return false;
+        return true;
+    }
+    case array_type:
+    {
+        const Array& arrA = a.get_array();
+        const Array& arrB = b.get_array();
+        if (arrA.size() != arrB.size())
+            return false;
+        for (unsigned int i = 0; i < arrA.size(); i++)
+            if (!SameValue(arrA[i], arrB[i]))
+                return false;
+        return true;
+    }
+    case real_type:
+        return a.get_real() == b.get_real() || fabs(a.get_real() - b.get_real()) <= 1e-12 * max(1.0, fabs(a.get_real()));
+    case int_type:
+        return a.get_int64() == b.get_int64() && a.is_uint64() == b.is_uint64();
+    default:
+        return a == b;
+    }
+}
+
+// Check that the fast reader only accepts what Spirit accepts, with the
+// same value, and that with the fallback both agree on everything.
+// Returns whether the fast path handled the text by itself.
+static bool CheckSameParse(const string& str)
+{
+    Value valSpirit;
+    bool fSpirit = read_string(str, valSpirit);
+
+    Value valFast;
+    bool fFast = Fast_reader(str).read(valFast);
+    if (fFast)
+        BOOST_CHECK_MESSAGE(fSpirit && SameValue(valSpirit, valFast), str);
+
+    Value valCombined;
+    bool fCombined = read_string_fast(str, valCombined);
+    BOOST_CHECK_MESSAGE(fCombined == fSpirit, str);
+    if (fSpirit)
+        BOOST_CHECK_MESSAGE(SameValue(valSpirit, valCombined), str);
+    return fFast;
+}
+
+static Value RandomValue(int nDepth)
+{
+    switch (insecure_rand() % (nDepth < 4 ? 8 : 6))
+    {
+    case 0: return Value();
+    case 1: return Value(insecure_rand() % 2 == 0);
+    case 2: return Value((boost::int64_t)insecure_rand() - (boost::int64_t)insecure_rand() * insecure_rand());
+    case 3: return Value(((int)insecure_rand() % 2000000000) / 100000000.0);
+    case 4:
+    {
+        string str;
+        for (int i = insecure_rand() % 20; i > 0; i--)
+            str += (char)(insecure_rand() % 4 == 0 ? insecure_rand() : 'a' + insecure_rand() % 26);
+        return Value(str);
+    }
+    case 5: return Value((boost::uint64_t)-1 - insecure_rand());
+    case 6:
+    {
+        Array arr;
+        for (int i = insecure_rand() % 6; i > 0; i--)
+            arr.push_back(RandomValue(nDepth + 1));
+        return Value(arr);
+    }
+    default:
+    {
+        Object obj;
+        for (int i = insecure_rand() % 6; i > 0; i--)
+            obj.push_back(Pair(strprintf("k%u", insecure_rand() % 10), RandomValue(nDepth + 1)));
+        return Value(obj);
+    }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_fast_reader)
+{
+    // integers keep Spirit's types, reals and escapes its values
+    Value value;
+    BOOST_CHECK(read_string_fast("[-9223372036854775808, 18446744073709551615, 0.5e1, -0]", value));
+    const Array& arr = value.get_array();
+    BOOST_CHECK_EQUAL(arr[0].get_int64(), std::numeric_limits<boost::int64_t>::min());
+    BOOST_CHECK(arr[1].is_uint64() && arr[1].get_uint64() == std::numeric_limits<boost::uint64_t>::max());
+    BOOST_CHECK_EQUAL(arr[2].get_real(), 5.0);
+    BOOST_CHECK(arr[3].type() == int_type);
+    BOOST_CHECK(read_string_fast("{\"a\\\"b\" : \"\\u00e9\\/\\n\"}", value));
+    BOOST_CHECK_EQUAL(value.get_obj()[0].name_, "a\"b");
+    BOOST_CHECK_EQUAL(value.get_obj()[0].value_.get_str(), "\xe9/\n");
+
+    const char* pszCases[] = {
+        "", " ", "{}", "[]", " [ ] ", "{\"a\":1}", "[1,2,3]", "[1,]", "{\"a\":}", "{\"a\" 1}", "{,}",
+        "true", "false", "null", "nul", "[truex]", "truex", "[1 2]", "1 2", "\"abc", "\"a\\\"", "\"a\\x41\"",
+        "\"\\u12\"", "\"\\u12zz\"", "\"\\q\"", "\"\\101\"", "1.", ".5", "+1", "-", "- 1", "1e", "1e5", "1E-5",
+        "1.5e+300", "1e400", "-1e-400", "0x10", "007", "[007]", "9223372036854775807", "9223372036854775808",
+        "-9223372036854775809", "18446744073709551616", "0.000000000000000000000000001", "123456789012345678901.5",
+        "[[[[[[1]]]]]]", "{\"a\":[{\"b\":[]}],\"c\":{}}", "\t\r\n\v\f1", "[\"a\",\"b\"]", "[\"]\",\"[\",\"\\\\\"]",
+    };
+    for (unsigned int i = 0; i < sizeof(pszCases) / sizeof(pszCases[0]); i++)
+        CheckSameParse(pszCases[i]);
+
+    // deeper nesting than the fast reader handles falls back to Spirit
+    string strDeep = string(Fast_reader::MAX_DEPTH + 1, '[') + string(Fast_reader::MAX_DEPTH + 1, ']');
+    BOOST_CHECK(!CheckSameParse(strDeep));
+}
+
+BOOST_AUTO_TEST_CASE(json_fast_reader_fuzz)
+{
+    const char* pszChars = "{}[],:\"\\ -+.eE0123456789tfnulx/ub";
+    for (int i = 0; i < 2000; i++)
+    {
+        string str = write_string(RandomValue(0), insecure_rand() % 2 == 0);
+
+        // whatever the writer produces is plain JSON
+        BOOST_CHECK_MESSAGE(CheckSameParse(str), str);
+
+        // damage it in a few places
+        for (int j = insecure_rand() % 3; j >= 0 && !str.empty(); j--)
+        {
+            size_t nPos = insecure_rand() % str.size();
+            char ch = pszChars[insecure_rand() % strlen(pszChars)];
+            switch (insecure_rand() % 4)
+            {
+            case 0: str[nPos] = ch; break;
+            case 1: str.erase(nPos, 1); break;
+            case 2: str.insert(nPos, 1, ch); break;
+            default: str.resize(nPos); break;
+            }
+        }
+        CheckSameParse(str);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_fast_reader_speed)
+{
+    // requests as large as RPC clients send: many inputs, many outputs,
+    // and a large signed transaction
+    string strInputs = "[";
+    string strOutputs = "{";
+    for (int i = 0; i < 2000; i++)
+    {
+        strInputs += strprintf("%s{\"txid\":\"%064x\",\"vout\":%d}", i ? "," : "", i, i % 4);
+        strOutputs += strprintf("%s\"mkKCunqr2dNwEMHJGHFtk6Zr4P%08d\":%d.%08d", i ? "," : "", i, i % 50, i);
+    }
+    strInputs += "]";
+    strOutputs += "}";
+    const string strRequests[] = {
+        "{\"method\":\"createrawtransaction\",\"params\":[" + strInputs + "," + strOutputs + "],\"id\":1}",
+        "{\"method\":\"sendrawtransaction\",\"params\":[\"" + string(200000, 'f') + "\"],\"id\":1}",
+    };
+
+    for (unsigned int i = 0; i < sizeof(strRequests) / sizeof(strRequests[0]); i++)
+    {
+        Value valSpirit, valFast;
+        int64 nStart = GetTimeMicros();
+        for (int j = 0; j < 10; j++)
+            BOOST_CHECK(read_string(strRequests[i], valSpirit));
+        int64 nSpirit = GetTimeMicros() - nStart;
+        nStart = GetTimeMicros();
+        for (int j = 0; j < 10; j++)
+            BOOST_CHECK(Fast_reader(strRequests[i]).read(valFast));
+        int64 nFast = GetTimeMicros() - nStart;
+        BOOST_CHECK(SameValue(valSpirit, valFast));
+        if (fDebug)
+            printf("json_fast_reader_speed: %"PRIszu" bytes parsed in %"PRI64d"us by Spirit, %"PRI64d"us by the fast reader\n",
+                   strRequests[i].size(), nSpirit / 10, nFast / 10);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
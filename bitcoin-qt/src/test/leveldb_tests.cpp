@@ -0,0 +1,69 @@
+#include <boost/test/unit_test.hpp>
+
+#include "leveldb.h"
+#include "txdb.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(leveldb_tests)
+
+BOOST_AUTO_TEST_CASE(leveldb_profile)
+{
+    // the default profile keeps the original cache split
+    CLevelDBProfile profileDefault(1 << 23);
+    BOOST_CHECK_EQUAL(profileDefault.nBlockCacheSize, (size_t)(1 << 22));
+    BOOST_CHECK_EQUAL(profileDefault.nWriteBufferSize, (size_t)(1 << 21));
+
+    mapArgs.erase("-dbwritebuffer");
+    mapArgs.erase("-dbmaxopenfiles");
+    CLevelDBProfile profile = GetChainStateProfile(1 << 23);
+    BOOST_CHECK_EQUAL(profile.nBlockCacheSize, (size_t)(1 << 21));
+    BOOST_CHECK_EQUAL(profile.nWriteBufferSize, (size_t)(3 << 20));
+    BOOST_CHECK_EQUAL(profile.nMaxOpenFiles, 64);
+
+    mapArgs["-dbwritebuffer"] = "32";
+    mapArgs["-dbmaxopenfiles"] = "1";
+    profile = GetChainStateProfile(1 << 23);
+    BOOST_CHECK_EQUAL(profile.nWriteBufferSize, (size_t)(32 << 20));
+    BOOST_CHECK_EQUAL(profile.nMaxOpenFiles, 16);
+    mapArgs.erase("-dbwritebuffer");
+    mapArgs.erase("-dbmaxopenfiles");
+}
+
+BOOST_AUTO_TEST_CASE(leveldb_stats)
+{
+    CLevelDBProfile profile(1 << 20);
+    CLevelDB db(GetDataDir() / "leveldb_stats", profile, true);
+    BOOST_CHECK_EQUAL(db.GetProfile().nWriteBufferSize, profile.nWriteBufferSize);
+
+    CLevelDBStats stats;
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nBytesWritten, 0U);
+    BOOST_CHECK_EQUAL(stats.GetWriteAmplification(), 0);
+
+    // keys and values are counted as serialized
+    CLevelDBBatch batch;
+    batch.Write('k', 1234567890U);
+    batch.Erase('e');
+    BOOST_CHECK(db.WriteBatch(batch));
+    CLevelDBStats stats2;
+    BOOST_CHECK(db.GetStats(stats2));
+    BOOST_CHECK_EQUAL(stats2.nBytesWritten, 1U + 4U + 1U);
+
+    // enough writes to flush the memtable into tables
+    for (unsigned int i = 0; i < 2000; i++)
+        BOOST_CHECK(db.Write(make_pair('c', i), vector<unsigned char>(1000, i & 0xff)));
+    db.CompactRange(NULL, NULL);
+    CLevelDBStats stats3;
+    BOOST_CHECK(db.GetStats(stats3));
+    BOOST_CHECK(stats3.nBytesWritten > 2000U * 1000U);
+    BOOST_CHECK(stats3.nTables > 0);
+    BOOST_CHECK(stats3.GetWriteAmplification() >= 1);
+
+    vector<unsigned char> v;
+    BOOST_CHECK(db.Read(make_pair('c', 1999U), v));
+    BOOST_CHECK(v == vector<unsigned char>(1000, 1999 & 0xff));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,264 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include "logdb.h"
+#include "wallet.h"
+#include "walletdb.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(logdb_tests)
+
+static CLogDB::key_type Key(const string &str)
+{
+    return CLogDB::key_type(str.begin(), str.end());
+}
+
+static CLogDB::value_type Value(const string &str)
+{
+    return CLogDB::value_type(str.begin(), str.end());
+}
+
+static string ReadString(const CLogDB &db, const string &strKey)
+{
+    CLogDB::value_type value;
+    if (!db.Read(Key(strKey), value))
+        return "";
+    return string(value.begin(), value.end());
+}
+
+BOOST_AUTO_TEST_CASE(logdb_commit)
+{
+    boost::filesystem::path path = GetDataDir() / "logdb_commit";
+    CLogDB db;
+    BOOST_CHECK(!db.Open(path, false));
+    BOOST_CHECK(db.Open(path, true));
+    BOOST_CHECK(CLogDB::IsLogFile(path));
+
+    CLogDB::CBatch batch;
+    batch.Write(Key("b"), Value("1"));
+    batch.Write(Key("a"), Value("2"));
+    batch.Write(Key("c"), Value("3"));
+    CLogDB::value_type value;
+    BOOST_CHECK(batch.Lookup(Key("a"), value) == CLogDB::CBatch::WRITTEN);
+    BOOST_CHECK(batch.Lookup(Key("d"), value) == CLogDB::CBatch::UNCHANGED);
+    BOOST_CHECK(db.Commit(batch));
+
+    batch.clear();
+    batch.Erase(Key("c"));
+    batch.Write(Key("b"), Value("4"));
+    BOOST_CHECK(batch.Lookup(Key("c"), value) == CLogDB::CBatch::ERASED);
+    BOOST_CHECK(db.Commit(batch));
+    BOOST_CHECK_EQUAL(db.GetCount(), 2U);
+    BOOST_CHECK(db.Flush());
+    db.Close();
+
+    // everything is replayed from the file
+    BOOST_CHECK(db.Open(path, false));
+    BOOST_CHECK_EQUAL(db.GetCount(), 2U);
+    BOOST_CHECK_EQUAL(ReadString(db, "a"), "2");
+    BOOST_CHECK_EQUAL(ReadString(db, "b"), "4");
+    BOOST_CHECK(!db.Exists(Key("c")));
+
+    // records are visited in key order
+    CLogDB::key_type key;
+    BOOST_CHECK(db.Seek(CLogDB::key_type(), false, key, value));
+    BOOST_CHECK(key == Key("a"));
+    BOOST_CHECK(db.Seek(key, true, key, value));
+    BOOST_CHECK(key == Key("b"));
+    BOOST_CHECK(!db.Seek(key, true, key, value));
+    BOOST_CHECK(db.Seek(Key("ab"), false, key, value));
+    BOOST_CHECK(key == Key("b"));
+    db.Close();
+}
+
+BOOST_AUTO_TEST_CASE(logdb_torn_commit)
+{
+    boost::filesystem::path path = GetDataDir() / "logdb_torn_commit";
+    CLogDB db;
+    BOOST_CHECK(db.Open(path, true));
+    CLogDB::CBatch batch;
+    batch.Write(Key("kept"), Value("1"));
+    BOOST_CHECK(db.Commit(batch));
+    uint64 nSize = db.GetFileSize();
+    batch.clear();
+    batch.Write(Key("lost"), Value("2"));
+    batch.Write(Key("kept"), Value("3"));
+    BOOST_CHECK(db.Commit(batch));
+    db.Close();
+
+    // cut the last commit short, as a crash while writing it would
+    boost::filesystem::resize_file(path, nSize + 10);
+    BOOST_CHECK(CLogDB::Verify(path));
+    BOOST_CHECK(db.Open(path, false));
+    BOOST_CHECK_EQUAL(db.GetCount(), 1U);
+    BOOST_CHECK_EQUAL(ReadString(db, "kept"), "1");
+    BOOST_CHECK_EQUAL(db.GetFileSize(), nSize);
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), nSize);
+
+    // new commits go after the intact ones
+    batch.clear();
+    batch.Write(Key("new"), Value("4"));
+    BOOST_CHECK(db.Commit(batch));
+    db.Close();
+    BOOST_CHECK(db.Open(path, false));
+    BOOST_CHECK_EQUAL(db.GetCount(), 2U);
+    db.Close();
+}
+
+BOOST_AUTO_TEST_CASE(logdb_damaged)
+{
+    boost::filesystem::path path = GetDataDir() / "logdb_damaged";
+    CLogDB db;
+    BOOST_CHECK(db.Open(path, true));
+    for (int i = 0; i < 3; i++)
+    {
+        CLogDB::CBatch batch;
+        batch.Write(Key(strprintf("key%d", i)), Value(strprintf("value%d", i)));
+        BOOST_CHECK(db.Commit(batch));
+    }
+    uint64 nSize = db.GetFileSize();
+    db.Close();
+
+    // flip a byte in the value of the middle record
+    FILE *file = fopen(path.string().c_str(), "rb+");
+    BOOST_CHECK(file != NULL);
+    fseek(file, nSize / 2, SEEK_SET);
+    fputc(0xff ^ fgetc(file), file);
+    fclose(file);
+
+    BOOST_CHECK(!CLogDB::Verify(path));
+    BOOST_CHECK(!db.Open(path, false));
+    vector<pair<CLogDB::key_type, CLogDB::key_type> > vResult;
+    BOOST_CHECK(!CLogDB::Salvage(path, vResult));
+    BOOST_CHECK_EQUAL(vResult.size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_compact)
+{
+    boost::filesystem::path path = GetDataDir() / "logdb_compact";
+    CLogDB db;
+    BOOST_CHECK(db.Open(path, true));
+    string strValue(1000, 'x');
+    for (int i = 0; i < 3000; i++)
+    {
+        CLogDB::CBatch batch;
+        batch.Write(Key(strprintf("key%d", i % 100)), Value(strValue));
+        if (i % 100 == 99)
+            batch.Write(Key(strprintf("skip%d", i)), Value(strValue));
+        BOOST_CHECK(db.Commit(batch));
+    }
+    BOOST_CHECK(db.NeedsCompaction());
+    BOOST_CHECK(db.GetFileSize() > 3000U * 1000U);
+    BOOST_CHECK(db.Compact("skip"));
+    BOOST_CHECK(!db.NeedsCompaction());
+    BOOST_CHECK_EQUAL(db.GetCount(), 100U);
+    BOOST_CHECK(db.GetFileSize() < 110U * 1000U);
+    BOOST_CHECK_EQUAL(db.GetFileSize(), boost::filesystem::file_size(path));
+    db.Close();
+
+    BOOST_CHECK(db.Open(path, false));
+    BOOST_CHECK_EQUAL(db.GetCount(), 100U);
+    BOOST_CHECK_EQUAL(ReadString(db, "key42"), strValue);
+    db.Close();
+}
+
+BOOST_AUTO_TEST_CASE(logdb_wallet)
+{
+    mapArgs["-walletformat"] = "log";
+    {
+        CWalletDB walletdb("logwallet.dat", "cr+");
+        BOOST_CHECK(walletdb.WriteName("address", "name"));
+        CAccount account;
+        account.vchPubKey = CPubKey(ParseHex("03a34b99f22c790c4e36b2b3c2c35a36db06226e41c692fc82b8b56ac1c540c5bd"));
+        BOOST_CHECK(walletdb.WriteAccount("a", account));
+
+        // uncommitted changes are only seen through the same handle
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.EraseName("address"));
+        BOOST_CHECK(walletdb.WriteAccount("b", account));
+        CAccount accountRead;
+        BOOST_CHECK(walletdb.ReadAccount("b", accountRead));
+        BOOST_CHECK(walletdb.TxnAbort());
+        BOOST_CHECK(!walletdb.ReadAccount("b", accountRead));
+        BOOST_CHECK(walletdb.ReadAccount("a", accountRead));
+        BOOST_CHECK(accountRead.vchPubKey == account.vchPubKey);
+
+        CAccountingEntry ae;
+        ae.strAccount = "a";
+        ae.nCreditDebit = 5;
+        ae.nTime = 1333333333;
+        BOOST_CHECK(walletdb.WriteAccountingEntry(ae));
+        ae.nCreditDebit = 7;
+        BOOST_CHECK(walletdb.WriteAccountingEntry(ae));
+        ae.strAccount = "b";
+        BOOST_CHECK(walletdb.WriteAccountingEntry(ae));
+        BOOST_CHECK_EQUAL(walletdb.GetAccountCreditDebit("a"), 12);
+    }
+    mapArgs.erase("-walletformat");
+    BOOST_CHECK(bitdb.IsLogDb("logwallet.dat"));
+    BOOST_CHECK(CDB::Rewrite("logwallet.dat"));
+    BOOST_CHECK(CDB::Rewrite("logwallet.dat"));
+    {
+        CWalletDB walletdb("logwallet.dat");
+        CAccount accountRead;
+        BOOST_CHECK(walletdb.ReadAccount("a", accountRead));
+        BOOST_CHECK_EQUAL(walletdb.GetAccountCreditDebit("b"), 7);
+    }
+    bitdb.CloseDb("logwallet.dat");
+}
+
+BOOST_AUTO_TEST_CASE(logdb_convert)
+{
+    {
+        CWalletDB walletdb("convertwallet.dat", "cr+");
+        BOOST_CHECK(walletdb.WriteName("address", "name"));
+        CAccountingEntry ae;
+        ae.strAccount = "a";
+        ae.nCreditDebit = 3;
+        BOOST_CHECK(walletdb.WriteAccountingEntry(ae));
+    }
+    BOOST_CHECK(!bitdb.IsLogDb("convertwallet.dat"));
+    BOOST_CHECK(CDB::Convert("convertwallet.dat", true));
+    BOOST_CHECK(bitdb.IsLogDb("convertwallet.dat"));
+    {
+        CWalletDB walletdb("convertwallet.dat");
+        BOOST_CHECK_EQUAL(walletdb.GetAccountCreditDebit("a"), 3);
+        BOOST_CHECK(walletdb.EraseName("address"));
+    }
+    bitdb.CloseDb("convertwallet.dat");
+}
+
+BOOST_AUTO_TEST_CASE(logdb_load_speed)
+{
+    // a wallet with 20000 transactions of 500 bytes, written one at a time
+    boost::filesystem::path path = GetDataDir() / "logdb_load_speed";
+    CLogDB db;
+    BOOST_CHECK(db.Open(path, true));
+    string strValue(500, 't');
+    for (int i = 0; i < 20000; i++)
+    {
+        CLogDB::CBatch batch;
+        batch.Write(Key(strprintf("tx%08d", i)), Value(strValue));
+        db.Commit(batch);
+    }
+    db.Close();
+
+    int64 nStart = GetTimeMicros();
+    BOOST_CHECK(db.Open(path, false));
+    int64 nLoad = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    CLogDB::key_type key;
+    CLogDB::value_type value;
+    size_t nCount = 0;
+    for (bool fFound = db.Seek(key, false, key, value); fFound; fFound = db.Seek(key, true, key, value))
+        nCount++;
+    int64 nScan = GetTimeMicros() - nStart;
+    BOOST_CHECK_EQUAL(nCount, 20000U);
+    if (fDebug) printf("logdb_load_speed: loaded %"PRIszu" records (%"PRI64u" bytes) in %"PRI64d"us, scanned in %"PRI64d"us\n",
+                       nCount, db.GetFileSize(), nLoad, nScan);
+    db.Close();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
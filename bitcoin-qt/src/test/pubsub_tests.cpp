@@ -0,0 +1,159 @@
+#include <boost/asio.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "bitcoinrpc.h"
+#include "main.h"
+#include "pubsub.h"
+#include "util.h"
+
+using namespace std;
+using namespace boost::asio;
+using namespace json_spirit;
+
+BOOST_AUTO_TEST_SUITE(pubsub_tests)
+
+// Read one message; with nTimeoutMillis, give up if none starts arriving in time
+static bool ReadMessage(ip::tcp::socket& socket, string& strTopic, unsigned int& nSequence, CDataStream& ssBody, int nTimeoutMillis = 0)
+{
+    for (int i = 0; nTimeoutMillis > 0 && socket.available() < 4; i += 10)
+    {
+        if (i >= nTimeoutMillis)
+            return false;
+        MilliSleep(10);
+    }
+    unsigned int nSize;
+    read(socket, buffer(&nSize, sizeof(nSize)));
+    vector<char> vch(nSize);
+    read(socket, buffer(vch));
+    ssBody = CDataStream(&vch[0], &vch[0] + vch.size(), SER_NETWORK, PROTOCOL_VERSION);
+    ssBody >> strTopic >> nSequence;
+    return true;
+}
+
+static void Subscribe(ip::tcp::socket& socket, const string& strTopics, int nTopic)
+{
+    socket.connect(ip::tcp::endpoint(ip::address_v4::loopback(), GetPublisherPort()));
+    write(socket, buffer(strTopics + "\n"));
+    for (int i = 0; i < 500 && !IsPublishing(nTopic); i++)
+        MilliSleep(10);
+    BOOST_CHECK(IsPublishing(nTopic));
+}
+
+BOOST_AUTO_TEST_CASE(pubsub_notify)
+{
+    mapArgs["-pubhwm"] = "4";
+    string strError;
+    BOOST_CHECK_EQUAL(GetPublisherPort(), 0);
+    BOOST_REQUIRE_MESSAGE(StartPublisher(0, strError), strError);
+    BOOST_CHECK(GetPublisherPort() != 0);
+
+    io_service io;
+    ip::tcp::socket socket(io);
+    Subscribe(socket, "hashblock rawtx", PUB_RAWTX);
+    BOOST_CHECK(IsPublishing(PUB_HASHBLOCK));
+    BOOST_CHECK(!IsPublishing(PUB_HASHTX));
+    BOOST_CHECK(!IsPublishing(PUB_RAWBLOCK));
+
+    // block hashes arrive in order, numbered from 1
+    string strTopic;
+    unsigned int nSequence;
+    CDataStream ssBody(SER_NETWORK, PROTOCOL_VERSION);
+    int64 nTotal = 0, nMax = 0;
+    for (unsigned int i = 1; i <= 100; i++)
+    {
+        int64 nStart = GetTimeMicros();
+        PublishBlockHash(uint256(i));
+        ReadMessage(socket, strTopic, nSequence, ssBody);
+        int64 nLatency = GetTimeMicros() - nStart;
+        nTotal += nLatency;
+        nMax = std::max(nMax, nLatency);
+
+        uint256 hash;
+        ssBody >> hash;
+        BOOST_CHECK_EQUAL(strTopic, "hashblock");
+        BOOST_CHECK_EQUAL(nSequence, i);
+        BOOST_CHECK(hash == uint256(i) && ssBody.empty());
+    }
+    if (fDebug)
+        printf("pubsub_notify: block hash latency %"PRI64d"us average, %"PRI64d"us max\n", nTotal / 100, nMax);
+
+    // transactions entering the memory pool, only the topics asked for
+    CTransaction tx;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+    PublishWalletTransaction(tx.GetHash());
+    int64 nStart = GetTimeMicros();
+    {
+        LOCK(mempool.cs);
+        mempool.addUnchecked(tx.GetHash(), tx);
+    }
+    BOOST_CHECK(ReadMessage(socket, strTopic, nSequence, ssBody, 2000));
+    if (fDebug)
+        printf("pubsub_notify: memory pool transaction latency %"PRI64d"us\n", GetTimeMicros() - nStart);
+    mempool.remove(tx);
+    CTransaction txRead;
+    ssBody >> txRead;
+    BOOST_CHECK_EQUAL(strTopic, "rawtx");
+    BOOST_CHECK_EQUAL(nSequence, 1U);
+    BOOST_CHECK(txRead.GetHash() == tx.GetHash());
+    BOOST_CHECK(!ReadMessage(socket, strTopic, nSequence, ssBody, 100));
+
+    // a subscriber that stops reading loses messages, publishing goes on
+    tx.vout[0].scriptPubKey = CScript() << vector<unsigned char>(100000, OP_TRUE);
+    const unsigned int nCount = 100;
+    for (unsigned int i = 0; i < nCount; i++)
+        PublishTransaction(tx.GetHash(), tx);
+    int nSubscribers;
+    uint64 nDropped = 0;
+    for (int i = 0; i < 500 && nDropped == 0; i++)
+    {
+        MilliSleep(10);
+        GetPublisherStats(nSubscribers, nDropped);
+    }
+    BOOST_CHECK_EQUAL(nSubscribers, 1);
+    BOOST_CHECK(nDropped > 0);
+
+    unsigned int nReceived = 0, nLast = 1;
+    while (ReadMessage(socket, strTopic, nSequence, ssBody, 500))
+    {
+        BOOST_CHECK(nSequence > nLast);
+        nLast = nSequence;
+        nReceived++;
+    }
+    GetPublisherStats(nSubscribers, nDropped);
+    BOOST_CHECK_EQUAL(nReceived + nDropped, nCount);
+    Object info = tableRPC.execute("getpublisherinfo", Array()).get_obj();
+    BOOST_CHECK_EQUAL(find_value(info, "port").get_int(), GetPublisherPort());
+    BOOST_CHECK_EQUAL(find_value(info, "subscribers").get_int(), 1);
+    BOOST_CHECK_EQUAL((uint64)find_value(info, "dropped").get_int64(), nDropped);
+
+    // hanging up unsubscribes
+    socket.close();
+    for (int i = 0; i < 500 && IsPublishing(PUB_RAWTX); i++)
+        MilliSleep(10);
+    BOOST_CHECK(!IsPublishing(PUB_RAWTX));
+
+    // unknown topics are refused
+    ip::tcp::socket socketBad(io);
+    socketBad.connect(ip::tcp::endpoint(ip::address_v4::loopback(), GetPublisherPort()));
+    write(socketBad, buffer(string("hashblock nosuchtopic\n")));
+    char ch;
+    boost::system::error_code error;
+    socketBad.read_some(buffer(&ch, 1), error);
+    BOOST_CHECK(error);
+    BOOST_CHECK(!IsPublishing(PUB_HASHBLOCK));
+
+    // and so is a topic line that never ends
+    ip::tcp::socket socketLong(io);
+    socketLong.connect(ip::tcp::endpoint(ip::address_v4::loopback(), GetPublisherPort()));
+    write(socketLong, buffer(string(MAX_PUB_SUBSCRIBE_SIZE, ' ')));
+    socketLong.read_some(buffer(&ch, 1), error);
+    BOOST_CHECK(error);
+
+    StopPublisher();
+    BOOST_CHECK(!IsPublishing(PUB_HASHBLOCK));
+    BOOST_CHECK_EQUAL(GetPublisherPort(), 0);
+    mapArgs.erase("-pubhwm");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
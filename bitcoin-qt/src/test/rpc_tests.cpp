@@ -5,6 +5,7 @@
 #include "base58.h"
 #include "util.h"
 #include "bitcoinrpc.h"
+#include "main.h"
 
 using namespace std;
 using namespace json_spirit;
@@ -147,4 +148,204 @@ BOOST_AUTO_TEST_CASE(rpc_rawsign)
     BOOST_CHECK(find_value(r.get_obj(), "complete").get_bool() == true);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_chaintip)
+{
+    // the published tip matches the one under cs_main
+    BOOST_CHECK(GetChainTip() == pindexBest);
+    BOOST_CHECK(GetChainBlockByHeight(0) == pindexGenesisBlock);
+    BOOST_CHECK(GetChainBlockByHeight(nBestHeight + 1) == NULL);
+    BOOST_CHECK(GetChainBlockByHeight(-1) == NULL);
+    BOOST_CHECK_EQUAL(GetChainDepth(pindexGenesisBlock), nBestHeight + 1);
+    BOOST_CHECK(LookupBlockIndex(hashGenesisBlock) == pindexGenesisBlock);
+    BOOST_CHECK(LookupBlockIndex(0) == NULL);
+
+    // chain queries run without taking cs_main or cs_wallet
+    BOOST_CHECK_EQUAL(tableRPC["getblockcount"]->nLocks, (unsigned int)RPC_LOCK_NONE);
+    BOOST_CHECK_EQUAL(tableRPC["validateaddress"]->nLocks, (unsigned int)RPC_LOCK_WALLET);
+    BOOST_CHECK_EQUAL(tableRPC["getbalance"]->nLocks, (unsigned int)RPC_LOCK_ALL);
+    BOOST_CHECK_EQUAL(CallRPC("getblockcount").get_int(), nBestHeight);
+    BOOST_CHECK_EQUAL(CallRPC("getblockhash 0").get_str(), hashGenesisBlock.GetHex());
+    Value r = CallRPC(string("getblock ") + hashGenesisBlock.GetHex());
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "confirmations").get_int(), nBestHeight + 1);
+    BOOST_CHECK_THROW(CallRPC("getblockhash 1000000"), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_stats)
+{
+    tableRPC.execute("getblockcount", Array());
+    tableRPC.execute("getblockcount", Array());
+    BOOST_CHECK_THROW(tableRPC.execute("getblockhash", Array()), Object);
+    Value r = tableRPC.execute("getrpcstats", Array());
+    BOOST_CHECK(find_value(find_value(r.get_obj(), "getblockcount").get_obj(), "calls").get_int() >= 2);
+    BOOST_CHECK(find_value(find_value(r.get_obj(), "getblockhash").get_obj(), "calls").get_int() >= 1);
+    BOOST_CHECK(find_value(r.get_obj(), "getbalance").type() == null_type);
+}
+
+// Keeps track of the most output buffered at once
+class CCountingJSONWriter : public CJSONWriter
+{
+public:
+    size_t nTotal;
+    size_t nMaxBuffered;
+
+    CCountingJSONWriter() : nTotal(0), nMaxBuffered(0) {}
+
+    void Flush()
+    {
+        nTotal += strOut.size();
+        nMaxBuffered = std::max(nMaxBuffered, strOut.size());
+        strOut.clear();
+    }
+};
+
+BOOST_AUTO_TEST_CASE(rpc_jsonwriter)
+{
+    // same output as a value tree
+    Object obj;
+    obj.push_back(Pair("a", "x\"y"));
+    Array arr;
+    arr.push_back(1);
+    arr.push_back(Value::null);
+    arr.push_back(Object());
+    arr.push_back(Array());
+    obj.push_back(Pair("b", arr));
+    obj.push_back(Pair("c", 1.5));
+
+    CJSONWriter writer;
+    writer.BeginObject();
+    writer.WritePair("a", "x\"y");
+    writer.WriteKey("b");
+    writer.BeginArray();
+    writer.WriteValue(1);
+    writer.WriteValue(Value::null);
+    writer.BeginObject();
+    writer.EndObject();
+    writer.BeginArray();
+    writer.EndArray();
+    writer.EndArray();
+    writer.WritePair("c", 1.5);
+    writer.EndObject();
+    BOOST_CHECK_EQUAL(writer.str(), write_string(Value(obj), false));
+
+    // a large result is never buffered whole
+    CCountingJSONWriter counter;
+    counter.BeginArray();
+    for (int i = 0; i < 200000; i++)
+        counter.WriteValue(uint256(i).GetHex());
+    counter.EndArray();
+    counter.Flush();
+    BOOST_CHECK_EQUAL(counter.nTotal, 200000U * 67U + 1U);
+    BOOST_CHECK(counter.nMaxBuffered < CJSONWriter::FLUSH_SIZE + 100);
+
+    // commands with a stream actor still return value trees
+    Value r = CallRPC("getrawmempool");
+    BOOST_CHECK(r.type() == array_type);
+    CJSONWriter writerBlock;
+    tableRPC.execute("getblock", RPCConvertValues("getblock", vector<string>(1, hashGenesisBlock.GetHex())), writerBlock);
+    BOOST_CHECK_EQUAL(writerBlock.str(), write_string(CallRPC(string("getblock ") + hashGenesisBlock.GetHex()), false));
+}
+
+// Collects a REST reply
+class CStringReplyStream : public CHTTPReplyStream
+{
+public:
+    int nStatus;
+    string strContentType;
+    size_t nContentLength;
+    string strBody;
+
+    CStringReplyStream() : nStatus(0), nContentLength(0) {}
+
+    void WriteHeader(int nStatusIn, const char *pszContentType, size_t nContentLengthIn)
+    {
+        nStatus = nStatusIn;
+        strContentType = pszContentType;
+        nContentLength = nContentLengthIn;
+    }
+
+    void Write(const char *pch, size_t nSize)
+    {
+        strBody.append(pch, nSize);
+    }
+};
+
+static CStringReplyStream CallREST(const string& strURI, const string& strMethod = "GET")
+{
+    CStringReplyStream stream;
+    ServiceREST(strMethod, strURI, stream);
+    BOOST_CHECK_EQUAL(stream.nContentLength, stream.strBody.size());
+    return stream;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_rest)
+{
+    CBlock block;
+    BOOST_CHECK(block.ReadFromDisk(pindexGenesisBlock));
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    string strBlock(ssBlock.begin(), ssBlock.end());
+    string strHash = hashGenesisBlock.GetHex();
+
+    // blocks in all three formats
+    CStringReplyStream r = CallREST("/rest/block/" + strHash + ".bin");
+    BOOST_CHECK_EQUAL(r.nStatus, HTTP_OK);
+    BOOST_CHECK_EQUAL(r.strContentType, "application/octet-stream");
+    BOOST_CHECK(r.strBody == strBlock);
+    r = CallREST("/rest/block/" + strHash + ".hex");
+    BOOST_CHECK_EQUAL(r.strBody, HexStr(strBlock.begin(), strBlock.end()) + "\n");
+    r = CallREST("/rest/block/" + strHash + ".json?unused=1");
+    BOOST_CHECK_EQUAL(r.strBody, write_string(CallRPC("getblock " + strHash), false) + "\n");
+
+    // transactions, here one from the memory pool
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1 * COIN;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    uint256 hashTx = tx.GetHash();
+    BOOST_CHECK(mempool.addUnchecked(hashTx, tx));
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    string strTx(ssTx.begin(), ssTx.end());
+    string strTxHash = hashTx.GetHex();
+    r = CallREST("/rest/tx/" + strTxHash + ".bin");
+    BOOST_CHECK_EQUAL(r.nStatus, HTTP_OK);
+    BOOST_CHECK_EQUAL(r.strContentType, "application/octet-stream");
+    BOOST_CHECK(r.strBody == strTx);
+    r = CallREST("/rest/tx/" + strTxHash + ".hex");
+    BOOST_CHECK_EQUAL(r.nStatus, HTTP_OK);
+    BOOST_CHECK_EQUAL(r.strBody, HexStr(strTx.begin(), strTx.end()) + "\n");
+    r = CallREST("/rest/tx/" + strTxHash + ".json");
+    BOOST_CHECK_EQUAL(r.nStatus, HTTP_OK);
+    BOOST_CHECK_EQUAL(r.strBody, write_string(CallRPC("getrawtransaction " + strTxHash + " 1"), false) + "\n");
+    mempool.remove(tx);
+    BOOST_CHECK_EQUAL(CallREST("/rest/tx/" + strTxHash + ".bin").nStatus, HTTP_NOT_FOUND);
+
+    // headers follow the best chain
+    r = CallREST("/rest/headers/5/" + strHash + ".bin");
+    BOOST_CHECK_EQUAL(r.nStatus, HTTP_OK);
+    BOOST_CHECK_EQUAL(r.strBody.size(), 80U * std::min(5, nBestHeight + 1));
+    BOOST_CHECK(r.strBody.substr(0, 80) == strBlock.substr(0, 80));
+    r = CallREST("/rest/headers/1/" + strHash + ".json");
+    Value v;
+    BOOST_CHECK(read_string(r.strBody, v));
+    BOOST_CHECK_EQUAL(find_value(v.get_array()[0].get_obj(), "hash").get_str(), strHash);
+
+    r = CallREST("/rest/chaininfo.json");
+    BOOST_CHECK(read_string(r.strBody, v));
+    BOOST_CHECK_EQUAL(find_value(v.get_obj(), "blocks").get_int(), nBestHeight);
+
+    // errors
+    BOOST_CHECK_EQUAL(CallREST("/rest/block/" + strHash).nStatus, HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(CallREST("/rest/block/" + strHash + ".xml").nStatus, HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(CallREST("/rest/block/1234.bin").nStatus, HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(CallREST("/rest/block/" + uint256(1).GetHex() + ".bin").nStatus, HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(CallREST("/rest/headers/0/" + strHash + ".bin").nStatus, HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(CallREST("/rest/headers/" + strHash + ".bin").nStatus, HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(CallREST("/rest/wallet.json").nStatus, HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(CallREST("/rest/chaininfo.json", "POST").nStatus, HTTP_BAD_REQUEST);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -20,6 +20,7 @@ using namespace json_spirit;
 using namespace boost::algorithm;
 
 extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+extern bool CastToBool(const std::vector<unsigned char>& vch);
 
 static const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC;
 
@@ -442,4 +443,139 @@ BOOST_AUTO_TEST_CASE(script_combineSigs)
     BOOST_CHECK(combined == partial3c);
 }
 
+// Reference evaluation that always goes through the generic interpreter
+static bool
+VerifyScriptGeneric(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int nFlags)
+{
+    vector<vector<unsigned char> > stack;
+    if (!EvalScript(stack, scriptSig, txTo, nIn, nFlags, 0))
+        return false;
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nFlags, 0))
+        return false;
+    return !stack.empty() && CastToBool(stack.back());
+}
+
+BOOST_AUTO_TEST_CASE(script_standard_templates)
+{
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+
+    CScript scriptP2PKH;
+    scriptP2PKH.SetDestination(key1.GetPubKey().GetID());
+    CScript scriptP2PK = CScript() << key2.GetPubKey() << OP_CHECKSIG;
+    CScript scriptP2SH;
+    scriptP2SH.SetDestination(scriptP2PK.GetID());
+
+    CTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vout.resize(1);
+    txTo.vout[0].nValue = 1;
+
+    vector<unsigned char> vchSig1, vchSig2;
+    BOOST_CHECK(key1.Sign(SignatureHash(scriptP2PKH, txTo, 0, SIGHASH_ALL), vchSig1));
+    vchSig1.push_back((unsigned char)SIGHASH_ALL);
+    BOOST_CHECK(key2.Sign(SignatureHash(scriptP2PK, txTo, 0, SIGHASH_ALL), vchSig2));
+    vchSig2.push_back((unsigned char)SIGHASH_ALL);
+    vector<unsigned char> vchBadSig(vchSig1);
+    vchBadSig[10] ^= 1;
+
+    vector<CScript> vScriptSig;
+    vScriptSig.push_back(CScript() << vchSig1 << key1.GetPubKey());
+    vScriptSig.push_back(CScript() << OP_0 << vchSig1 << key1.GetPubKey());
+    vScriptSig.push_back(CScript() << OP_1 << vchSig1 << key1.GetPubKey());
+    vScriptSig.push_back(CScript() << OP_NOP << vchSig1 << key1.GetPubKey());
+    vScriptSig.push_back(CScript() << vchBadSig << key1.GetPubKey());
+    vScriptSig.push_back(CScript() << vchSig1 << key2.GetPubKey());
+    vScriptSig.push_back(CScript() << key1.GetPubKey());
+    vScriptSig.push_back(CScript() << vchSig2);
+    vScriptSig.push_back(CScript() << vchSig1);
+    vScriptSig.push_back(CScript() << OP_0 << vchSig2);
+    vScriptSig.push_back(CScript() << vchSig2 << static_cast<vector<unsigned char> >(scriptP2PK));
+    vScriptSig.push_back(CScript());
+
+    // Stack size limit around the templates
+    CScript scriptSigFull;
+    for (int i = 0; i < 998; i++)
+        scriptSigFull << OP_0;
+    vScriptSig.push_back(scriptSigFull << vchSig1 << key1.GetPubKey());
+    vScriptSig.push_back(CScript(scriptSigFull) << vchSig2);
+
+    BOOST_FOREACH(const CScript& scriptSig, vScriptSig)
+    {
+        BOOST_CHECK(VerifyScript(scriptSig, scriptP2PKH, txTo, 0, flags, 0) == VerifyScriptGeneric(scriptSig, scriptP2PKH, txTo, 0, flags));
+        BOOST_CHECK(VerifyScript(scriptSig, scriptP2PKH, txTo, 0, SCRIPT_VERIFY_NONE, 0) == VerifyScriptGeneric(scriptSig, scriptP2PKH, txTo, 0, SCRIPT_VERIFY_NONE));
+        BOOST_CHECK(VerifyScript(scriptSig, scriptP2PK, txTo, 0, flags, 0) == VerifyScriptGeneric(scriptSig, scriptP2PK, txTo, 0, flags));
+        BOOST_CHECK(VerifyScript(scriptSig, scriptP2SH, txTo, 0, SCRIPT_VERIFY_NONE, 0) == VerifyScriptGeneric(scriptSig, scriptP2SH, txTo, 0, SCRIPT_VERIFY_NONE));
+    }
+
+    BOOST_CHECK(VerifyScript(vScriptSig[0], scriptP2PKH, txTo, 0, flags, 0));
+    BOOST_CHECK(VerifyScript(vScriptSig[1], scriptP2PKH, txTo, 0, flags, 0));
+    BOOST_CHECK(!VerifyScript(vScriptSig[4], scriptP2PKH, txTo, 0, flags, 0));
+    BOOST_CHECK(!VerifyScript(vScriptSig[5], scriptP2PKH, txTo, 0, flags, 0));
+    BOOST_CHECK(VerifyScript(vScriptSig[7], scriptP2PK, txTo, 0, flags, 0));
+    BOOST_CHECK(!VerifyScript(vScriptSig[8], scriptP2PK, txTo, 0, flags, 0));
+    BOOST_CHECK(VerifyScript(vScriptSig[10], scriptP2SH, txTo, 0, flags, 0));
+    BOOST_CHECK(!VerifyScript(vScriptSig[7], scriptP2SH, txTo, 0, flags, 0));
+}
+
+static void
+RandomScript(CScript &script)
+{
+    static const opcodetype oplist[] = {OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR};
+    script = CScript();
+    int ops = (insecure_rand() % 10);
+    for (int i=0; i<ops; i++)
+        script << oplist[insecure_rand() % (sizeof(oplist)/sizeof(oplist[0]))];
+}
+
+static void
+RandomTransaction(CTransaction &tx, int nInputs, int nOutputs)
+{
+    tx.nVersion = insecure_rand();
+    tx.nLockTime = (insecure_rand() % 2) ? insecure_rand() : 0;
+    tx.vin.resize(nInputs);
+    tx.vout.resize(nOutputs);
+    for (int in = 0; in < nInputs; in++) {
+        CTxIn &txin = tx.vin[in];
+        txin.prevout.hash = GetRandHash();
+        txin.prevout.n = insecure_rand() % 4;
+        RandomScript(txin.scriptSig);
+        txin.nSequence = (insecure_rand() % 2) ? insecure_rand() : (unsigned int)-1;
+    }
+    for (int out = 0; out < nOutputs; out++) {
+        CTxOut &txout = tx.vout[out];
+        txout.nValue = insecure_rand() % 100000000;
+        RandomScript(txout.scriptPubKey);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(script_signaturehasher)
+{
+    seed_insecure_rand(false);
+    static const int hashtypes[] = {SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, SIGHASH_ALL | SIGHASH_ANYONECANPAY, 0, 4};
+
+    for (int i = 0; i < 200; i++) {
+        CTransaction txTo;
+        RandomTransaction(txTo, 1 + insecure_rand() % 8, insecure_rand() % 8);
+        CSignatureHasher hasher(txTo);
+        for (unsigned int nIn = 0; nIn < txTo.vin.size(); nIn++) {
+            CScript scriptCode;
+            RandomScript(scriptCode);
+            int nHashType = hashtypes[insecure_rand() % (sizeof(hashtypes)/sizeof(hashtypes[0]))];
+            BOOST_CHECK(hasher.SignatureHash(scriptCode, nIn, nHashType) == SignatureHash(scriptCode, txTo, nIn, nHashType));
+            BOOST_CHECK(hasher.SignatureHash(scriptCode, nIn, SIGHASH_ALL) == SignatureHash(scriptCode, txTo, nIn, SIGHASH_ALL));
+        }
+    }
+
+    // Large consolidation transaction
+    CTransaction txBig;
+    RandomTransaction(txBig, 1000, 2);
+    CSignatureHasher hasherBig(txBig);
+    CScript scriptCode = CScript() << OP_DUP << OP_HASH160 << vector<unsigned char>(20, 0x42) << OP_EQUALVERIFY << OP_CHECKSIG;
+    for (unsigned int nIn = 0; nIn < txBig.vin.size(); nIn += 97)
+        BOOST_CHECK(hasherBig.SignatureHash(scriptCode, nIn, SIGHASH_ALL) == SignatureHash(scriptCode, txBig, nIn, SIGHASH_ALL));
+    BOOST_CHECK(hasherBig.SignatureHash(scriptCode, 999, SIGHASH_ALL) == SignatureHash(scriptCode, txBig, 999, SIGHASH_ALL));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
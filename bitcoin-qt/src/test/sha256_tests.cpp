@@ -0,0 +1,137 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "hash.h"
+#include "sha256.h"
+#include "util.h"
+
+using namespace std;
+
+// Merkle root computed the original way, one Hash() call per node
+static uint256 ReferenceMerkleRoot(vector<uint256> vHash)
+{
+    if (vHash.empty())
+        return 0;
+    while (vHash.size() > 1)
+    {
+        vector<uint256> vNext;
+        for (unsigned int i = 0; i < vHash.size(); i += 2)
+        {
+            unsigned int i2 = std::min(i + 1, (unsigned int)vHash.size() - 1);
+            vNext.push_back(Hash(BEGIN(vHash[i]), END(vHash[i]), BEGIN(vHash[i2]), END(vHash[i2])));
+        }
+        vHash.swap(vNext);
+    }
+    return vHash[0];
+}
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Block counts that exercise every combination of 8-way, 4-way and single transforms
+    for (unsigned int nBlocks = 0; nBlocks <= 35; nBlocks++)
+    {
+        vector<unsigned char> vIn(64 * nBlocks + 1);
+        for (unsigned int i = 0; i < vIn.size(); i++)
+            vIn[i] = insecure_rand();
+        vector<unsigned char> vOut(32 * nBlocks + 1, 0);
+        SHA256D64(&vOut[0], &vIn[0], nBlocks);
+        for (unsigned int i = 0; i < nBlocks; i++)
+        {
+            uint256 hash = Hash(vIn.begin() + 64 * i, vIn.begin() + 64 * (i + 1));
+            BOOST_CHECK(memcmp(&vOut[32 * i], &hash, 32) == 0);
+        }
+        // nothing written past the last output
+        BOOST_CHECK_EQUAL(vOut[32 * nBlocks], 0);
+    }
+
+    uint256 a = GetRandHash(), b = GetRandHash();
+    BOOST_CHECK(HashPair(a, b) == Hash(BEGIN(a), END(a), BEGIN(b), END(b)));
+    BOOST_CHECK(HashPair(a, a) == Hash(BEGIN(a), END(a), BEGIN(a), END(a)));
+}
+
+BOOST_AUTO_TEST_CASE(sha256d64_implementations)
+{
+    // Autodetection only enables the fastest code, so force each one this
+    // CPU can run in turn
+    static const char* pszNames[] = {"generic", "sse41", "avx2", "shani"};
+    vector<unsigned char> vIn(64 * 35);
+    for (unsigned int i = 0; i < vIn.size(); i++)
+        vIn[i] = insecure_rand();
+    vector<unsigned char> vOut(32 * 35);
+
+    for (unsigned int n = 0; n < sizeof(pszNames) / sizeof(pszNames[0]); n++)
+    {
+        if (!SHA256ForceImplementation(pszNames[n]))
+            continue;
+        SHA256D64(&vOut[0], &vIn[0], 35);
+        for (unsigned int i = 0; i < 35; i++)
+        {
+            uint256 hash = Hash(vIn.begin() + 64 * i, vIn.begin() + 64 * (i + 1));
+            BOOST_CHECK_MESSAGE(memcmp(&vOut[32 * i], &hash, 32) == 0, pszNames[n]);
+        }
+    }
+    BOOST_CHECK(SHA256ForceImplementation("generic"));
+    BOOST_CHECK(!SHA256ForceImplementation("nosuchimplementation"));
+    SHA256AutoDetect();
+}
+
+BOOST_AUTO_TEST_CASE(sha256_merkle_root)
+{
+    static const unsigned int nTxCounts[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 100, 513, 1000};
+
+    for (unsigned int n = 0; n < sizeof(nTxCounts) / sizeof(nTxCounts[0]); n++)
+    {
+        CBlock block;
+        vector<uint256> vTxid;
+        for (unsigned int j = 0; j < nTxCounts[n]; j++)
+        {
+            CTransaction tx;
+            tx.nLockTime = j;
+            block.vtx.push_back(tx);
+            vTxid.push_back(tx.GetHash());
+        }
+        uint256 hashRoot = block.BuildMerkleTree();
+        BOOST_CHECK(hashRoot == ReferenceMerkleRoot(vTxid));
+
+        // every branch leads back to the same root
+        for (unsigned int j = 0; j < nTxCounts[n]; j++)
+            BOOST_CHECK(CBlock::CheckMerkleBranch(vTxid[j], block.GetMerkleBranch(j), j) == hashRoot);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256_merkle_coinbase_update)
+{
+    static const unsigned int nTxCounts[] = {1, 2, 3, 7, 64, 65, 300};
+
+    for (unsigned int n = 0; n < sizeof(nTxCounts) / sizeof(nTxCounts[0]); n++)
+    {
+        CBlock block;
+        for (unsigned int j = 0; j < nTxCounts[n]; j++)
+        {
+            CTransaction tx;
+            tx.vin.resize(1);
+            tx.nLockTime = j;
+            block.vtx.push_back(tx);
+        }
+        block.BuildMerkleTree();
+
+        for (int nExtraNonce = 1; nExtraNonce < 4; nExtraNonce++)
+        {
+            block.vtx[0].vin[0].scriptSig = CScript() << nExtraNonce;
+            uint256 hashRoot = block.UpdateMerkleTreeCoinbase();
+            std::vector<uint256> vMerkleTree = block.vMerkleTree;
+            BOOST_CHECK(hashRoot == block.BuildMerkleTree());
+            BOOST_CHECK(vMerkleTree == block.vMerkleTree);
+        }
+    }
+
+    // without a tree to update, the whole tree is built
+    CBlock block;
+    block.vtx.resize(5);
+    uint256 hashRoot = block.UpdateMerkleTreeCoinbase();
+    BOOST_CHECK(hashRoot == block.BuildMerkleTree());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,136 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "txdb.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(txdb_tests)
+
+BOOST_AUTO_TEST_CASE(txdb_addrindex)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 hashAddress(123), hashOther(124);
+
+    // written out of order, across heights that don't sort as little endian
+    vector<pair<uint256, CDiskTxPos> > vNoTxPos;
+    vector<pair<CAddressIndexKey, int64> > vAddress;
+    vector<pair<COutPoint, CSpentIndexValue> > vSpent;
+    const int nHeights[] = { 300, 1, 256, 70000, 255 };
+    for (unsigned int i = 0; i < ARRAYLEN(nHeights); i++)
+    {
+        vAddress.push_back(make_pair(CAddressIndexKey(ADDRINDEX_PUBKEYHASH, hashAddress, nHeights[i], uint256(i), 1, false), 1000 * nHeights[i]));
+        vAddress.push_back(make_pair(CAddressIndexKey(ADDRINDEX_PUBKEYHASH, hashAddress, nHeights[i], uint256(i), 0, true), -5));
+    }
+    // other addresses and types don't show up
+    vAddress.push_back(make_pair(CAddressIndexKey(ADDRINDEX_PUBKEYHASH, hashOther, 2, uint256(9), 0, false), 1));
+    vAddress.push_back(make_pair(CAddressIndexKey(ADDRINDEX_SCRIPTHASH, hashAddress, 2, uint256(9), 0, false), 1));
+    vSpent.push_back(make_pair(COutPoint(uint256(7), 3), CSpentIndexValue(uint256(8), 2, 70000)));
+    BOOST_CHECK(db.WriteIndexes(vNoTxPos, vAddress, vSpent));
+
+    vector<pair<CAddressIndexKey, int64> > vEntries;
+    BOOST_CHECK(db.ReadAddressIndex(ADDRINDEX_PUBKEYHASH, hashAddress, 0, 100, vEntries));
+    BOOST_CHECK_EQUAL(vEntries.size(), 2 * ARRAYLEN(nHeights));
+    const int nSorted[] = { 1, 255, 256, 300, 70000 };
+    for (unsigned int i = 0; i < vEntries.size(); i++)
+    {
+        const CAddressIndexKey &key = vEntries[i].first;
+        BOOST_CHECK_EQUAL(key.nHeight, nSorted[i / 2]);
+        BOOST_CHECK(key.hashAddress == hashAddress && key.chType == ADDRINDEX_PUBKEYHASH);
+        // then by input or output number
+        BOOST_CHECK_EQUAL(key.nIndex, i % 2 == 0 ? 0U : 1U);
+        BOOST_CHECK_EQUAL(key.fSpending, i % 2 == 0);
+        BOOST_CHECK_EQUAL(vEntries[i].second, key.fSpending ? -5 : 1000 * key.nHeight);
+    }
+
+    // pages
+    vector<pair<CAddressIndexKey, int64> > vPage;
+    BOOST_CHECK(db.ReadAddressIndex(ADDRINDEX_PUBKEYHASH, hashAddress, 3, 4, vPage));
+    BOOST_CHECK_EQUAL(vPage.size(), 4U);
+    BOOST_CHECK(vPage[0].first.nHeight == 255 && !vPage[0].first.fSpending);
+    vPage.clear();
+    BOOST_CHECK(db.ReadAddressIndex(ADDRINDEX_PUBKEYHASH, hashAddress, 9, 4, vPage));
+    BOOST_CHECK_EQUAL(vPage.size(), 1U);
+    vPage.clear();
+    BOOST_CHECK(db.ReadAddressIndex(ADDRINDEX_SCRIPTHASH, hashAddress, 0, 100, vPage));
+    BOOST_CHECK_EQUAL(vPage.size(), 1U);
+
+    CSpentIndexValue spent;
+    BOOST_CHECK(db.ReadSpentIndex(COutPoint(uint256(7), 3), spent));
+    BOOST_CHECK(spent.txid == uint256(8) && spent.nIndex == 2 && spent.nHeight == 70000);
+    BOOST_CHECK(!db.ReadSpentIndex(COutPoint(uint256(7), 2), spent));
+
+    // disconnecting erases them again
+    BOOST_CHECK(db.EraseIndexes(vAddress, vSpent));
+    vEntries.clear();
+    BOOST_CHECK(db.ReadAddressIndex(ADDRINDEX_PUBKEYHASH, hashAddress, 0, 100, vEntries));
+    BOOST_CHECK(vEntries.empty());
+    BOOST_CHECK(!db.ReadSpentIndex(COutPoint(uint256(7), 3), spent));
+
+    uint256 hashBuilt;
+    BOOST_CHECK(!db.ReadIndexBuildProgress("addrindex", hashBuilt));
+    BOOST_CHECK(db.WriteIndexBuildProgress("addrindex", uint256(42)));
+    BOOST_CHECK(db.ReadIndexBuildProgress("addrindex", hashBuilt) && hashBuilt == uint256(42));
+    BOOST_CHECK(!db.ReadIndexBuildProgress("spentindex", hashBuilt));
+    BOOST_CHECK(db.EraseIndexBuildProgress("addrindex"));
+    BOOST_CHECK(!db.ReadIndexBuildProgress("addrindex", hashBuilt));
+}
+
+BOOST_AUTO_TEST_CASE(txdb_connect_indexes)
+{
+    // A block on top of the genesis block, mined in advance so that it can
+    // be connected and disconnected whatever the tip is
+    CKeyID keyID(uint160(1234));
+    CTransaction txCoinBase;
+    txCoinBase.vin.resize(1);
+    txCoinBase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    txCoinBase.vout.resize(1);
+    txCoinBase.vout[0].nValue = 50 * COIN;
+    txCoinBase.vout[0].scriptPubKey.SetDestination(keyID);
+    CBlock block;
+    block.hashPrevBlock = hashGenesisBlock;
+    block.nTime = pindexGenesisBlock->nTime + 600;
+    block.nBits = pindexGenesisBlock->nBits;
+    block.nNonce = 0;
+    block.vtx.push_back(txCoinBase);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    BOOST_REQUIRE(CheckProofOfWork(block.GetHash(), block.nBits));
+    uint256 hashTx = txCoinBase.GetHash();
+
+    LOCK(cs_main);
+    bool fTxIndexOld = fTxIndex, fAddressIndexOld = fAddressIndex, fSpentIndexOld = fSpentIndex;
+    fTxIndex = fAddressIndex = fSpentIndex = true;
+    CBlockIndex* pindexOld = pindexBest;
+
+    // connecting it, by a reorganisation if the chain is longer already,
+    // writes the indexes along with the coins
+    CValidationState state;
+    BOOST_REQUIRE(ProcessBlock(state, NULL, &block));
+    BOOST_REQUIRE(mapBlockIndex.count(block.GetHash()));
+    CBlockIndex* pindex = mapBlockIndex[block.GetHash()];
+    if (pindexBest != pindex)
+        BOOST_REQUIRE(SetBestChain(state, pindex));
+    BOOST_CHECK(pindexBest == pindex);
+    CDiskTxPos postx;
+    BOOST_CHECK(pblocktree->ReadTxIndex(hashTx, postx));
+    vector<pair<CAddressIndexKey, int64> > vEntries;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(ADDRINDEX_PUBKEYHASH, keyID, 0, 10, vEntries));
+    BOOST_REQUIRE_EQUAL(vEntries.size(), 1U);
+    BOOST_CHECK(vEntries[0].first.txid == hashTx && vEntries[0].first.nHeight == 1);
+    BOOST_CHECK_EQUAL(vEntries[0].second, 50 * COIN);
+
+    // and disconnecting it erases them
+    BOOST_REQUIRE(SetBestChain(state, pindexOld));
+    BOOST_CHECK(pindexBest == pindexOld);
+    vEntries.clear();
+    BOOST_CHECK(pblocktree->ReadAddressIndex(ADDRINDEX_PUBKEYHASH, keyID, 0, 10, vEntries));
+    BOOST_CHECK(vEntries.empty());
+    CCoins coins;
+    BOOST_CHECK(!pcoinsTip->GetCoins(hashTx, coins) || coins.IsPruned());
+
+    fTxIndex = fTxIndexOld;
+    fAddressIndex = fAddressIndexOld;
+    fSpentIndex = fSpentIndexOld;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 
 #include "main.h"
 #include "wallet.h"
+#include "walletdb.h"
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -14,6 +15,8 @@ using namespace std;
 
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
+extern bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64 nTime, bool fKnown, int nFormat);
+
 BOOST_AUTO_TEST_SUITE(wallet_tests)
 
 static CWallet wallet;
@@ -291,4 +294,332 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     }
 }
 
+static vector<CBlockIndex*> vFakeBlocks;
+
+// A block on top of the best chain holding only tx
+static CBlock fake_block(const CTransaction& tx)
+{
+    CBlock block;
+    block.hashPrevBlock = hashBestChain;
+    block.nTime = pindexBest->nTime + 1;
+    block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+// An index entry for block on top of the best chain, so that wallet
+// transactions can be placed in it. Nothing is connected or written.
+static CBlockIndex* add_fake_block(const CBlock& block)
+{
+    CBlockHeader header = block.GetBlockHeader();
+    CBlockIndex* pindex = new CBlockIndex(header);
+    pindex->phashBlock = &(mapBlockIndex.insert(make_pair(block.GetHash(), pindex)).first->first);
+    pindex->pprev = pindexBest;
+    pindex->nHeight = pindexBest->nHeight + 1;
+    vFakeBlocks.push_back(pindex);
+    return pindex;
+}
+
+// Make an index entry from add_fake_block the new tip
+static void connect_fake_block(CBlockIndex* pindex)
+{
+    BOOST_REQUIRE(pindex->pprev == pindexBest);
+    pindexBest->pnext = pindex;
+    pindexBest = pindex;
+    nBestHeight = pindex->nHeight;
+    hashBestChain = pindex->GetBlockHash();
+}
+
+// Take the tip back off the best chain; its index stays around, like that of
+// any block that was reorganised away, until free_fake_blocks
+static void disconnect_fake_block()
+{
+    pindexBest = pindexBest->pprev;
+    pindexBest->pnext = NULL;
+    nBestHeight = pindexBest->nHeight;
+    hashBestChain = pindexBest->GetBlockHash();
+}
+
+static void free_fake_blocks()
+{
+    while (pindexBest != pindexGenesisBlock && find(vFakeBlocks.begin(), vFakeBlocks.end(), pindexBest) != vFakeBlocks.end())
+        disconnect_fake_block();
+    BOOST_FOREACH(CBlockIndex* pindex, vFakeBlocks)
+    {
+        mapBlockIndex.erase(pindex->GetBlockHash());
+        delete pindex;
+    }
+    vFakeBlocks.clear();
+}
+
+static CWalletTx fake_wallet_tx(CWallet* pwallet, const CTransaction& tx, const CBlockIndex* pindex)
+{
+    CWalletTx wtx(pwallet, tx);
+    wtx.hashBlock = pindex->GetBlockHash();
+    wtx.nIndex = 0;
+    return wtx;
+}
+
+// the balances as they used to be computed, by going over all of mapWallet
+static void check_balances(const CWallet& w)
+{
+    LOCK(w.cs_wallet);
+    int64 nBalance = 0, nUnconfirmed = 0, nImmature = 0;
+    size_t nCoins = 0;
+    for (map<uint256, CWalletTx>::const_iterator it = w.mapWallet.begin(); it != w.mapWallet.end(); ++it)
+    {
+        const CWalletTx& wtx = (*it).second;
+        if (wtx.IsConfirmed())
+            nBalance += wtx.GetAvailableCredit(false);
+        if (!wtx.IsFinal() || !wtx.IsConfirmed())
+            nUnconfirmed += wtx.GetAvailableCredit(false);
+        nImmature += wtx.GetImmatureCredit(false);
+        for (unsigned int i = 0; i < wtx.vout.size(); i++)
+            if (!wtx.IsSpent(i) && w.IsMine(wtx.vout[i]) && wtx.vout[i].nValue > 0 && !w.IsLockedCoin((*it).first, i))
+                nCoins++;
+    }
+    BOOST_CHECK_EQUAL(w.GetBalance(), nBalance);
+    BOOST_CHECK_EQUAL(w.GetUnconfirmedBalance(), nUnconfirmed);
+    BOOST_CHECK_EQUAL(w.GetImmatureBalance(), nImmature);
+    vector<COutput> vAvailable;
+    w.AvailableCoins(vAvailable, false);
+    BOOST_CHECK_EQUAL(vAvailable.size(), nCoins);
+}
+
+BOOST_AUTO_TEST_CASE(balance_index_tests)
+{
+    {
+        CWalletDB walletdb("balancewallet.dat", "cr+");
+    }
+    CWallet w("balancewallet.dat");
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(w.AddKey(key));
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+    CScript scriptOther;
+    scriptOther << OP_TRUE;
+    check_balances(w);
+
+    // an unconfirmed payment to us, with one output that isn't ours
+    CTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx1.vout.resize(3);
+    tx1.vout[0].nValue = 5 * COIN;
+    tx1.vout[0].scriptPubKey = scriptMine;
+    tx1.vout[1].nValue = 2 * COIN;
+    tx1.vout[1].scriptPubKey = scriptMine;
+    tx1.vout[2].nValue = 7 * COIN;
+    tx1.vout[2].scriptPubKey = scriptOther;
+    BOOST_CHECK(w.AddToWallet(CWalletTx(&w, tx1)));
+    BOOST_CHECK_EQUAL(w.GetBalance(), 0);
+    BOOST_CHECK_EQUAL(w.GetUnconfirmedBalance(), 7 * COIN);
+    vector<COutput> vCoinsAvailable;
+    w.AvailableCoins(vCoinsAvailable);
+    BOOST_CHECK(vCoinsAvailable.empty());
+    check_balances(w);
+
+    // spending one output of it moves the change into the balance
+    CTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vout.resize(2);
+    tx2.vout[0].nValue = 1 * COIN;
+    tx2.vout[0].scriptPubKey = scriptOther;
+    tx2.vout[1].nValue = 3 * COIN;
+    tx2.vout[1].scriptPubKey = scriptMine;
+    BOOST_CHECK(w.AddToWallet(CWalletTx(&w, tx2)));
+    BOOST_CHECK(w.mapWallet[tx1.GetHash()].IsSpent(0));
+    BOOST_CHECK_EQUAL(w.GetUnconfirmedBalance(), 5 * COIN);
+    w.AvailableCoins(vCoinsAvailable, false);
+    BOOST_CHECK_EQUAL(vCoinsAvailable.size(), 2U);
+    check_balances(w);
+
+    // locked coins are not listed, but still counted
+    COutPoint outpoint(tx2.GetHash(), 1);
+    w.LockCoin(outpoint);
+    w.AvailableCoins(vCoinsAvailable, false);
+    BOOST_CHECK_EQUAL(vCoinsAvailable.size(), 1U);
+    BOOST_CHECK_EQUAL(w.GetUnconfirmedBalance(), 5 * COIN);
+    check_balances(w);
+    w.UnlockAllCoins();
+
+    BOOST_CHECK(w.EraseFromWallet(tx2.GetHash()));
+    BOOST_CHECK_EQUAL(w.GetUnconfirmedBalance(), 2 * COIN);
+    check_balances(w);
+
+    // a full rebuild agrees with the incremental updates
+    w.MarkDirty();
+    check_balances(w);
+    BOOST_CHECK_EQUAL(w.GetUnconfirmedBalance(), 2 * COIN);
+
+    // a payment in a block that is disconnected again
+    CTransaction tx3;
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx3.vout.resize(1);
+    tx3.vout[0].nValue = 4 * COIN;
+    tx3.vout[0].scriptPubKey = scriptMine;
+    CBlockIndex* pindex = add_fake_block(fake_block(tx3));
+    connect_fake_block(pindex);
+    BOOST_CHECK(w.AddToWallet(fake_wallet_tx(&w, tx3, pindex)));
+    BOOST_CHECK_EQUAL(w.GetBalance(), 4 * COIN);
+    check_balances(w);
+    disconnect_fake_block();
+    BOOST_CHECK_EQUAL(w.GetBalance(), 0);
+    BOOST_CHECK_EQUAL(w.GetUnconfirmedBalance(), 6 * COIN);
+    check_balances(w);
+
+    // the same, without the balance being looked at while the block was
+    // the tip
+    CTransaction tx4(tx3);
+    tx4.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    pindex = add_fake_block(fake_block(tx4));
+    connect_fake_block(pindex);
+    BOOST_CHECK(w.AddToWallet(fake_wallet_tx(&w, tx4, pindex)));
+    disconnect_fake_block();
+    BOOST_CHECK_EQUAL(w.GetBalance(), 0);
+    BOOST_CHECK_EQUAL(w.GetUnconfirmedBalance(), 10 * COIN);
+    check_balances(w);
+
+    free_fake_blocks();
+    bitdb.CloseDb("balancewallet.dat");
+}
+
+BOOST_AUTO_TEST_CASE(account_balance_tests)
+{
+    {
+        CWalletDB walletdb("accountwallet.dat", "cr+");
+    }
+    CWallet w("accountwallet.dat");
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(w.AddKey(key));
+    CKeyID keyID = key.GetPubKey().GetID();
+    w.SetAddressBookName(keyID, "a");
+    CScript scriptMine;
+    scriptMine.SetDestination(keyID);
+
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 5 * COIN;
+    tx.vout[0].scriptPubKey = scriptMine;
+    BOOST_CHECK(w.AddToWallet(CWalletTx(&w, tx)));
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("a", 0), 5 * COIN);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("a", 1), 0);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("", 0), 0);
+
+    // moves count at any depth
+    CWalletDB walletdb("accountwallet.dat");
+    CAccountingEntry ae;
+    ae.strAccount = "a";
+    ae.nCreditDebit = -2 * COIN;
+    ae.nOrderPos = w.IncOrderPosNext(&walletdb);
+    BOOST_CHECK(w.AddAccountingEntry(ae, walletdb));
+    ae.strAccount = "b";
+    ae.nCreditDebit = 2 * COIN;
+    ae.nOrderPos = w.IncOrderPosNext(&walletdb);
+    BOOST_CHECK(w.AddAccountingEntry(ae, walletdb));
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("a", 0), 3 * COIN);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("a", 1), -2 * COIN);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("b", 1), 2 * COIN);
+
+    // a new label moves what the address received
+    w.SetAddressBookName(keyID, "c");
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("a", 0), -2 * COIN);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("c", 0), 5 * COIN);
+    map<string, int64> mapBalances;
+    w.GetAccountBalances(mapBalances, 0);
+    BOOST_CHECK_EQUAL(mapBalances["a"], -2 * COIN);
+    BOOST_CHECK_EQUAL(mapBalances["b"], 2 * COIN);
+    BOOST_CHECK_EQUAL(mapBalances["c"], 5 * COIN);
+
+    // a height based lock time keeps the transaction out of the balance
+    tx.nLockTime = nBestHeight + 10;
+    tx.vin[0].nSequence = 0;
+    BOOST_CHECK(w.AddToWallet(CWalletTx(&w, tx)));
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("c", 0), 5 * COIN);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("c", 0, true), 10 * COIN);
+
+    // a block paying the account: as in ConnectBlock, the wallet hears of
+    // it before it becomes the tip
+    CTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx2.vout.resize(1);
+    tx2.vout[0].nValue = 4 * COIN;
+    tx2.vout[0].scriptPubKey = scriptMine;
+    CBlockIndex* pindex = add_fake_block(fake_block(tx2));
+    BOOST_CHECK(w.AddToWallet(fake_wallet_tx(&w, tx2, pindex)));
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("c", 0), 9 * COIN);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("c", 1), 0);
+    connect_fake_block(pindex);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("c", 0), 9 * COIN);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("c", 1), 4 * COIN);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("c", 2), 0);
+
+    // and leaving the chain again
+    disconnect_fake_block();
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("c", 1), 0);
+    BOOST_CHECK_EQUAL(w.GetAccountBalance("c", 0), 9 * COIN);
+
+    free_fake_blocks();
+    bitdb.CloseDb("accountwallet.dat");
+}
+
+BOOST_AUTO_TEST_CASE(rescan_tests)
+{
+    // the genesis block pays to a key nobody has
+    CWallet w;
+    BOOST_CHECK_EQUAL(w.ScanForWalletTransactions(pindexGenesisBlock, true), 0);
+    BOOST_CHECK(w.mapWallet.empty());
+
+    // a block paying one of our keys. Blocks are read back only if their
+    // proof of work checks out, so this one was mined in advance; it builds
+    // on the genesis block, but only the index places it in the chain here.
+    CKey key;
+    key.SetSecret(CSecret(32, 0x5a), true);
+    BOOST_CHECK(w.AddKey(key));
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(uint256(1), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 3 * COIN;
+    tx.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    CBlock block;
+    block.hashPrevBlock = hashGenesisBlock;
+    block.nTime = pindexGenesisBlock->nTime + 600;
+    block.nBits = pindexGenesisBlock->nBits;
+    block.nNonce = 0x10571b29;
+    block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    BOOST_REQUIRE(CheckProofOfWork(block.GetHash(), block.nBits));
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        CDiskBlockPos pos;
+        unsigned int nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(FindBlockPos(state, pos, nSize + 8, nBestHeight + 1, block.nTime, false, BLOCKFILE_FORMAT_RAW));
+        BOOST_REQUIRE(block.WriteToDisk(pos));
+        CBlockIndex* pindex = add_fake_block(block);
+        connect_fake_block(pindex);
+        pindex->nFile = pos.nFile;
+        pindex->nDataPos = pos.nPos;
+        pindex->nStatus |= BLOCK_HAVE_DATA;
+    }
+
+    BOOST_CHECK_EQUAL(w.ScanForWalletTransactions(pindexGenesisBlock, true), 1);
+    BOOST_CHECK(w.mapWallet.count(tx.GetHash()));
+    BOOST_CHECK(w.mapWallet[tx.GetHash()].hashBlock == block.GetHash());
+    BOOST_CHECK_EQUAL(w.GetBalance(), 3 * COIN);
+
+    {
+        LOCK(cs_main);
+        free_fake_blocks();
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
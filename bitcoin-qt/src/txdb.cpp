@@ -20,7 +20,21 @@ void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+CLevelDBProfile GetChainStateProfile(size_t nCacheSize) {
+    CLevelDBProfile profile;
+    profile.nBlockCacheSize = nCacheSize / 4;
+    profile.nWriteBufferSize = nCacheSize * 3 / 8;
+    if (mapArgs.count("-dbwritebuffer"))
+        profile.nWriteBufferSize = (size_t)GetArg("-dbwritebuffer", 0) << 20;
+    profile.nWriteBufferSize = std::max(profile.nWriteBufferSize, (size_t)(1 << 20));
+    profile.nMaxOpenFiles = std::max((int)GetArg("-dbmaxopenfiles", 64), 16);
+    return profile;
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", CLevelDBProfile(nCacheSize), fMemory, fWipe) {
+}
+
+CCoinsViewDB::CCoinsViewDB(const CLevelDBProfile &profile, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", profile, fMemory, fWipe) {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) { 
@@ -65,7 +79,20 @@ bool CCoinsViewDB::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockI
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+void CCoinsViewDB::Compact() {
+    int64 nStart = GetTimeMillis();
+    // Coin keys are 'c' followed by the txid, so split them on its first byte
+    for (int i = 0; i < 16; i++) {
+        boost::this_thread::interruption_point();
+        char pchBegin[2] = {'c', (char)(i << 4)};
+        char pchEnd[2] = {'c', (char)((i + 1) << 4)};
+        leveldb::Slice begin(pchBegin, 2), end(pchEnd, 2);
+        db.CompactRange(i == 0 ? NULL : &begin, i == 15 ? NULL : &end);
+    }
+    printf("Compacted coin database in %"PRI64d"ms\n", GetTimeMillis() - nStart);
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(GetDataDir() / "blocks" / "index", CLevelDBProfile(nCacheSize), fMemory, fWipe) {
 }
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
@@ -91,6 +118,10 @@ bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
     return Read(make_pair('f', nFile), info);
 }
 
+bool CBlockTreeDB::EraseBlockFileInfo(int nFile) {
+    return Erase(make_pair('f', nFile));
+}
+
 bool CBlockTreeDB::WriteLastBlockFile(int nFile) {
     return Write('l', nFile);
 }
@@ -166,13 +197,94 @@ bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair('t', txid), pos);
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
-    CLevelDBBatch batch;
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+void CBlockTreeDB::WriteIndexes(CLevelDBBatch &batch,
+                                const std::vector<std::pair<uint256, CDiskTxPos> > &vTxPos,
+                                const std::vector<std::pair<CAddressIndexKey, int64> > &vAddress,
+                                const std::vector<std::pair<COutPoint, CSpentIndexValue> > &vSpent) {
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vTxPos.begin(); it!=vTxPos.end(); it++)
         batch.Write(make_pair('t', it->first), it->second);
+    for (std::vector<std::pair<CAddressIndexKey,int64> >::const_iterator it=vAddress.begin(); it!=vAddress.end(); it++)
+        batch.Write(make_pair('a', it->first), it->second);
+    for (std::vector<std::pair<COutPoint,CSpentIndexValue> >::const_iterator it=vSpent.begin(); it!=vSpent.end(); it++)
+        batch.Write(make_pair('s', it->first), it->second);
+}
+
+void CBlockTreeDB::EraseIndexes(CLevelDBBatch &batch,
+                                const std::vector<std::pair<CAddressIndexKey, int64> > &vAddress,
+                                const std::vector<std::pair<COutPoint, CSpentIndexValue> > &vSpent) {
+    for (std::vector<std::pair<CAddressIndexKey,int64> >::const_iterator it=vAddress.begin(); it!=vAddress.end(); it++)
+        batch.Erase(make_pair('a', it->first));
+    for (std::vector<std::pair<COutPoint,CSpentIndexValue> >::const_iterator it=vSpent.begin(); it!=vSpent.end(); it++)
+        batch.Erase(make_pair('s', it->first));
+}
+
+bool CBlockTreeDB::WriteIndexes(const std::vector<std::pair<uint256, CDiskTxPos> > &vTxPos,
+                                const std::vector<std::pair<CAddressIndexKey, int64> > &vAddress,
+                                const std::vector<std::pair<COutPoint, CSpentIndexValue> > &vSpent) {
+    CLevelDBBatch batch;
+    WriteIndexes(batch, vTxPos, vAddress, vSpent);
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::EraseIndexes(const std::vector<std::pair<CAddressIndexKey, int64> > &vAddress,
+                                const std::vector<std::pair<COutPoint, CSpentIndexValue> > &vSpent) {
+    CLevelDBBatch batch;
+    EraseIndexes(batch, vAddress, vSpent);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressIndex(unsigned char chType, const uint160 &hashAddress, unsigned int nSkip, unsigned int nCount,
+                                    std::vector<std::pair<CAddressIndexKey, int64> > &vEntries) {
+    leveldb::Iterator *pcursor = NewIterator();
+
+    // The entries of an address share the key prefix 'a', type, hash
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'a' << chType << hashAddress;
+    std::string strPrefix = ssKeySet.str();
+    pcursor->Seek(strPrefix);
+
+    for (; pcursor->Valid() && vEntries.size() < nCount; pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (!slKey.starts_with(strPrefix))
+            break;
+        if (nSkip > 0) {
+            nSkip--;
+            continue;
+        }
+        try {
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            char chKey;
+            std::pair<CAddressIndexKey, int64> entry;
+            ssKey >> chKey >> entry.first;
+            ssValue >> entry.second;
+            vEntries.push_back(entry);
+        } catch (std::exception &e) {
+            delete pcursor;
+            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+        }
+    }
+    delete pcursor;
+    return true;
+}
+
+bool CBlockTreeDB::ReadSpentIndex(const COutPoint &out, CSpentIndexValue &value) {
+    return Read(make_pair('s', out), value);
+}
+
+bool CBlockTreeDB::ReadIndexBuildProgress(const std::string &name, uint256 &hashBlock) {
+    return Read(std::make_pair('P', name), hashBlock);
+}
+
+bool CBlockTreeDB::WriteIndexBuildProgress(const std::string &name, const uint256 &hashBlock) {
+    return Write(std::make_pair('P', name), hashBlock);
+}
+
+bool CBlockTreeDB::EraseIndexBuildProgress(const std::string &name) {
+    return Erase(std::make_pair('P', name));
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
 }
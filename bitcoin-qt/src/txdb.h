@@ -8,6 +8,11 @@
 #include "main.h"
 #include "leveldb.h"
 
+/** Tuning for the coin database. Coins are read through the in-memory coin
+ *  cache and flushed in large batches, so most of its cache goes to the
+ *  write buffer rather than to the block cache. */
+CLevelDBProfile GetChainStateProfile(size_t nCacheSize);
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
@@ -15,6 +20,7 @@ protected:
     CLevelDB db;
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(const CLevelDBProfile &profile, bool fMemory = false, bool fWipe = false);
 
     bool GetCoins(const uint256 &txid, CCoins &coins);
     bool SetCoins(const uint256 &txid, const CCoins &coins);
@@ -23,6 +29,10 @@ public:
     bool SetBestBlock(CBlockIndex *pindex);
     bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
     bool GetStats(CCoinsStats &stats);
+
+    const CLevelDB &GetDB() const { return db; }
+    // Compact the whole database, a slice at a time (interruptible between slices)
+    void Compact();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -39,12 +49,33 @@ public:
     bool WriteBestInvalidWork(const CBigNum& bnBestInvalidWork);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo &fileinfo);
+    bool EraseBlockFileInfo(int nFile);
     bool ReadLastBlockFile(int &nFile);
     bool WriteLastBlockFile(int nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    // Write the transaction, address and spent index entries of a block in one batch
+    bool WriteIndexes(const std::vector<std::pair<uint256, CDiskTxPos> > &vTxPos,
+                      const std::vector<std::pair<CAddressIndexKey, int64> > &vAddress,
+                      const std::vector<std::pair<COutPoint, CSpentIndexValue> > &vSpent);
+    bool EraseIndexes(const std::vector<std::pair<CAddressIndexKey, int64> > &vAddress,
+                      const std::vector<std::pair<COutPoint, CSpentIndexValue> > &vSpent);
+    // The same, only adding to batch, for WriteBatch to commit later
+    void WriteIndexes(CLevelDBBatch &batch,
+                      const std::vector<std::pair<uint256, CDiskTxPos> > &vTxPos,
+                      const std::vector<std::pair<CAddressIndexKey, int64> > &vAddress,
+                      const std::vector<std::pair<COutPoint, CSpentIndexValue> > &vSpent);
+    void EraseIndexes(CLevelDBBatch &batch,
+                      const std::vector<std::pair<CAddressIndexKey, int64> > &vAddress,
+                      const std::vector<std::pair<COutPoint, CSpentIndexValue> > &vSpent);
+    // Up to nCount entries of an address in chain order, after skipping nSkip
+    bool ReadAddressIndex(unsigned char chType, const uint160 &hashAddress, unsigned int nSkip, unsigned int nCount,
+                          std::vector<std::pair<CAddressIndexKey, int64> > &vEntries);
+    bool ReadSpentIndex(const COutPoint &out, CSpentIndexValue &value);
+    bool ReadIndexBuildProgress(const std::string &name, uint256 &hashBlock);
+    bool WriteIndexBuildProgress(const std::string &name, const uint256 &hashBlock);
+    bool EraseIndexBuildProgress(const std::string &name);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
@@ -7,7 +7,7 @@
 // Copyright (c) 2012-2013 giv
 
 #ifndef WIN32
-// for posix_fallocate
+// for posix_fallocate and posix_fadvise
 #ifdef __linux__
 #define _POSIX_C_SOURCE 200112L
 #endif
@@ -1240,6 +1240,14 @@ void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length) {
 #endif
 }
 
+// hint that the file will be read front to back, so the OS reads ahead further
+// it is advisory, and does nothing where unsupported
+void FileAdviseSequential(FILE *file) {
+#if defined(__linux__) && defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
 void ShrinkDebugFile()
 {
     // Scroll debug.log if it's getting too big
@@ -8,6 +8,8 @@
 #include "crypter.h"
 #include "ui_interface.h"
 #include "base58.h"
+#include "checkqueue.h"
+#include "pubsub.h"
 #include <boost/algorithm/string/replace.hpp>
 
 using namespace std;
@@ -308,28 +310,36 @@ int64 CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
+void CWallet::LoadOrderedTxItems(CWalletDB& walletdb)
 {
-    CWalletDB walletdb(strWalletFile);
-
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
-
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
+    LOCK(cs_wallet);
+    wtxOrdered.clear();
+    laccentries.clear();
     for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
     {
         CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        wtxOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
     }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH(CAccountingEntry& entry, acentries)
+    walletdb.ListAccountCreditDebit("*", laccentries);
+    BOOST_FOREACH(CAccountingEntry& entry, laccentries)
     {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+        wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
     }
+    fAccountsIndexed = false;
+}
+
+bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb)
+{
+    if (!walletdb.WriteAccountingEntry(acentry))
+        return false;
 
-    return txOrdered;
+    LOCK(cs_wallet);
+    laccentries.push_back(acentry);
+    CAccountingEntry& entry = laccentries.back();
+    wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+    if (fAccountsIndexed)
+        mapAccountLedgers[entry.strAccount].nCreditDebit += entry.nCreditDebit;
+    return true;
 }
 
 void CWallet::WalletUpdateSpent(const CTransaction &tx)
@@ -352,6 +362,7 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx)
                     printf("WalletUpdateSpent found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
                     wtx.MarkSpent(txin.prevout.n);
                     wtx.WriteToDisk();
+                    UpdateTxBalance(txin.prevout.hash);
                     NotifyTransactionChanged(this, txin.prevout.hash, CT_UPDATED);
                 }
             }
@@ -365,6 +376,8 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        fBalanceIndexed = false;
+        fAccountsIndexed = false;
     }
 }
 
@@ -382,6 +395,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         {
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext();
+            wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (wtxIn.hashBlock != 0)
@@ -393,9 +407,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
                     {
                         // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
                         int64 latestTolerated = latestNow + 300;
-                        std::list<CAccountingEntry> acentries;
-                        TxItems txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+                        for (TxItems::reverse_iterator it = wtxOrdered.rbegin(); it != wtxOrdered.rend(); ++it)
                         {
                             CWalletTx *const pwtx = (*it).second.first;
                             if (pwtx == &wtx)
@@ -460,6 +472,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         if (fInsertedNew || fUpdated)
             if (!wtx.WriteToDisk())
                 return false;
+        UpdateTxBalance(hash);
+        UpdateTxAccounts(hash);
 #ifndef QT_GUI
         // If default receiving address gets used, replace it with a new one
         if (vchDefaultKey.IsValid()) {
@@ -494,6 +508,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
             boost::thread t(runCommand, strCmd); // thread runs free
         }
 
+        // and any subscribers
+        PublishWalletTransaction(hash);
     }
     return true;
 }
@@ -527,8 +543,24 @@ bool CWallet::EraseFromWallet(uint256 hash)
         return false;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+        {
+            const CWalletTx* pwtx = &(*mi).second;
+            pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(pwtx->nOrderPos);
+            for (TxItems::iterator it = range.first; it != range.second; ++it)
+            {
+                if ((*it).second.first == pwtx)
+                {
+                    wtxOrdered.erase(it);
+                    break;
+                }
+            }
+            mapWallet.erase(mi);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
+        UpdateTxBalance(hash);
+        UpdateTxAccounts(hash);
     }
     return true;
 }
@@ -761,28 +793,184 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+/** The wallet's key hashes, matched against the common output templates
+ *  so that rescans don't run Solver and take the keystore lock for every
+ *  output in the chain.
+ */
+class CRescanFilter
+{
+private:
+    const CKeyStore &keystore;
+    std::set<CKeyID> setKeys;
+
+public:
+    CRescanFilter(const CKeyStore &keystoreIn) : keystore(keystoreIn)
+    {
+        keystore.GetKeys(setKeys);
+    }
+
+    // Whether the output may be ours; IsMine sorts out false positives
+    bool IsRelevant(const CScript &script) const
+    {
+        unsigned int nSize = script.size();
+        // pay to pubkey hash
+        if (nSize == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+            script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG)
+            return setKeys.count(CKeyID(uint160(vector<unsigned char>(script.begin() + 3, script.begin() + 23)))) > 0;
+        // pay to pubkey
+        if (((nSize == 35 && script[0] == 33) || (nSize == 67 && script[0] == 65)) && script[nSize - 1] == OP_CHECKSIG)
+            return setKeys.count(CKeyID(Hash160(vector<unsigned char>(script.begin() + 1, script.end() - 1)))) > 0;
+        // pay to script hash
+        if (script.IsPayToScriptHash())
+            return keystore.HaveCScript(CScriptID(uint160(vector<unsigned char>(script.begin() + 2, script.begin() + 22))));
+        return ::IsMine(keystore, script);
+    }
+};
+
+/** A block read and filtered by a rescan worker */
+class CRescanBlock
+{
+public:
+    CBlockIndex* pindex;
+    CBlock block;
+    bool fRead;
+    std::vector<uint256> vHash;
+    std::vector<char> vfRelevant; // outputs of the transaction may be ours
+
+    CRescanBlock(CBlockIndex* pindexIn) : pindex(pindexIn), fRead(false) {}
+};
+
+/** Closure reading a single block for a rescan, queued by ScanForWalletTransactions */
+class CRescanCheck
+{
+private:
+    const CRescanFilter *pfilter;
+    CRescanBlock *prescan;
+
+public:
+    CRescanCheck() : pfilter(NULL), prescan(NULL) {}
+    CRescanCheck(const CRescanFilter& filterIn, CRescanBlock& rescanIn) : pfilter(&filterIn), prescan(&rescanIn) {}
+
+    bool operator()() {
+        CBlock &block = prescan->block;
+        prescan->fRead = block.ReadFromDisk(prescan->pindex);
+        if (!prescan->fRead)
+            return true;
+        prescan->vHash.resize(block.vtx.size());
+        prescan->vfRelevant.assign(block.vtx.size(), false);
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+        {
+            const CTransaction &tx = block.vtx[i];
+            prescan->vHash[i] = tx.GetHash();
+            BOOST_FOREACH(const CTxOut& txout, tx.vout)
+            {
+                if (pfilter->IsRelevant(txout.scriptPubKey))
+                {
+                    prescan->vfRelevant[i] = true;
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    void swap(CRescanCheck &check) {
+        std::swap(pfilter, check.pfilter);
+        std::swap(prescan, check.prescan);
+    }
+};
+
+static CCheckQueue<CRescanCheck> rescanqueue(1);
+static CCriticalSection cs_rescanqueue;
+
+void static ThreadRescan() {
+    RenameThread("bitcoin-rescan");
+    rescanqueue.Thread();
+}
+
+/** Rescan workers for the duration of a rescan */
+class CRescanWorkers
+{
+private:
+    boost::thread_group threadGroup;
+
+public:
+    CRescanWorkers(int nThreads) {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(&ThreadRescan);
+    }
+
+    ~CRescanWorkers() {
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+};
+
+// Blocks read ahead by the rescan workers
+static const unsigned int RESCAN_BATCH_SIZE = 128;
+
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
 // exist in the wallet will be updated.
+// Blocks are read and their outputs matched against our keys by the
+// -par workers in batches; the results are added in chain order.
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
+    int64 nStart = GetTimeMillis();
+    unsigned int nBlocks = 0, nTx = 0;
 
     CBlockIndex* pindex = pindexStart;
     {
-        LOCK(cs_wallet);
+        LOCK2(cs_wallet, cs_rescanqueue);
+        CRescanFilter filter(*this);
+        CRescanWorkers workers(std::max(nScriptCheckThreads - 1, 0));
+        SetBlockFileSequential(true);
         while (pindex)
         {
-            CBlock block;
-            block.ReadFromDisk(pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            std::vector<CRescanBlock> vBatch;
+            vBatch.reserve(RESCAN_BATCH_SIZE);
+            for (; pindex && vBatch.size() < RESCAN_BATCH_SIZE; pindex = pindex->pnext)
             {
-                if (AddToWalletIfInvolvingMe(tx.GetHash(), tx, &block, fUpdate))
-                    ret++;
+                // blocks deleted by -prune can't be scanned
+                if (pindex->nStatus & BLOCK_HAVE_DATA)
+                    vBatch.push_back(CRescanBlock(pindex));
+            }
+            {
+                CCheckQueueControl<CRescanCheck> control(&rescanqueue);
+                std::vector<CRescanCheck> vChecks;
+                vChecks.reserve(vBatch.size());
+                BOOST_FOREACH(CRescanBlock& rescan, vBatch)
+                    vChecks.push_back(CRescanCheck(filter, rescan));
+                control.Add(vChecks);
+                control.Wait();
+            }
+
+            BOOST_FOREACH(CRescanBlock& rescan, vBatch)
+            {
+                if (!rescan.fRead)
+                    continue;
+                nBlocks++;
+                const CBlock &block = rescan.block;
+                for (unsigned int i = 0; i < block.vtx.size(); i++)
+                {
+                    const CTransaction &tx = block.vtx[i];
+                    const uint256 &hash = rescan.vHash[i];
+                    if (rescan.vfRelevant[i] || mapWallet.count(hash) || IsFromMe(tx))
+                    {
+                        if (AddToWalletIfInvolvingMe(hash, tx, &block, fUpdate))
+                            ret++;
+                    }
+                    else
+                        WalletUpdateSpent(tx);
+                }
+                nTx += block.vtx.size();
             }
-            pindex = pindex->pnext;
         }
+        SetBlockFileSequential(false);
     }
+    printf("ScanForWalletTransactions() : %u blocks, %u transactions, %d found  %"PRI64d"ms\n",
+           nBlocks, nTx, ret, GetTimeMillis() - nStart);
     return ret;
 }
 
@@ -822,6 +1010,7 @@ void CWallet::ReacceptWalletTransactions()
                     printf("ReacceptWalletTransactions found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
                     wtx.MarkDirty();
                     wtx.WriteToDisk();
+                    UpdateTxBalance(item.first);
                 }
             }
             else
@@ -909,17 +1098,115 @@ void CWallet::ResendWalletTransactions()
 //
 
 
+void CWallet::UpdateTxBalance(const uint256& hash) const
+{
+    if (!fBalanceIndexed)
+        return;
+
+    // Take out what the transaction counted for so far
+    map<uint256, CWalletTxBalance>::iterator mi = mapTxBalance.find(hash);
+    if (mi != mapTxBalance.end())
+    {
+        const CWalletTxBalance& balance = (*mi).second;
+        nBalanceCached -= balance.GetBalance();
+        nUnconfirmedBalanceCached -= balance.GetUnconfirmedBalance();
+        nImmatureBalanceCached -= balance.nImmature;
+        mapTxBalance.erase(mi);
+        setTxUnsettled.erase(hash);
+        setUnspentCoins.erase(setUnspentCoins.lower_bound(COutPoint(hash, 0)),
+                              setUnspentCoins.upper_bound(COutPoint(hash, std::numeric_limits<unsigned int>::max())));
+    }
+
+    map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+    if (it == mapWallet.end())
+        return;
+    const CWalletTx& wtx = (*it).second;
+
+    bool fUnspent = false;
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        if (!wtx.IsSpent(i) && IsMine(wtx.vout[i]) && wtx.vout[i].nValue > 0)
+        {
+            setUnspentCoins.insert(COutPoint(hash, i));
+            fUnspent = true;
+        }
+    }
+
+    // Spent transactions count for nothing and are not tracked
+    CWalletTxBalance balance;
+    balance.nImmature = wtx.GetImmatureCredit();
+    if (!fUnspent && balance.nImmature == 0)
+        return;
+    balance.fFinal = wtx.IsFinal();
+    balance.fConfirmed = wtx.IsConfirmed();
+    balance.fMature = !(wtx.IsCoinBase() && wtx.GetBlocksToMaturity() > 0);
+    balance.nAvailable = wtx.GetAvailableCredit();
+
+    nBalanceCached += balance.GetBalance();
+    nUnconfirmedBalanceCached += balance.GetUnconfirmedBalance();
+    nImmatureBalanceCached += balance.nImmature;
+    mapTxBalance.insert(make_pair(hash, balance));
+
+    // Mature transactions in a block, and generated ones whose block left
+    // the main chain, only change with a reorganisation
+    bool fSettled = (wtx.GetDepthInMainChain() > 0 ? balance.fMature : wtx.IsCoinBase());
+    if (!fSettled)
+    {
+        setTxUnsettled.insert(hash);
+        if (!balance.fFinal)
+            fBalanceNonFinal = true;
+    }
+    else if (pindexBest != pindexBalance)
+        setBalanceTips.insert(pindexBest);
+}
+
+void CWallet::RefreshBalances() const
+{
+    CBlockIndex* pindexTip = pindexBest;
+
+    // Blocks were disconnected since the last refresh, or since a
+    // transaction was settled at a newer tip: start over
+    if (fBalanceIndexed && pindexBalance != pindexTip && pindexBalance && !pindexBalance->IsInMainChain())
+        fBalanceIndexed = false;
+    BOOST_FOREACH(CBlockIndex* pindex, setBalanceTips)
+        if (!pindex->IsInMainChain())
+            fBalanceIndexed = false;
+    setBalanceTips.clear();
+    bool fTipChanged = (pindexBalance != pindexTip);
+    pindexBalance = pindexTip;
+
+    if (!fBalanceIndexed)
+    {
+        int64 nStart = GetTimeMillis();
+        mapTxBalance.clear();
+        setTxUnsettled.clear();
+        setUnspentCoins.clear();
+        nBalanceCached = nUnconfirmedBalanceCached = nImmatureBalanceCached = 0;
+        fBalanceNonFinal = false;
+        fBalanceIndexed = true;
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            UpdateTxBalance((*it).first);
+        printf("RefreshBalances() : %"PRIszu" unspent outputs in %"PRIszu" transactions  %"PRI64d"ms\n",
+               setUnspentCoins.size(), mapTxBalance.size(), GetTimeMillis() - nStart);
+    }
+    else if (fTipChanged || fBalanceNonFinal)
+    {
+        // The chain grew, or the time passed that a lock time was waiting
+        // for: only unsettled transactions can count differently
+        fBalanceNonFinal = false;
+        vector<uint256> vUnsettled(setTxUnsettled.begin(), setTxUnsettled.end());
+        BOOST_FOREACH(const uint256& hash, vUnsettled)
+            UpdateTxBalance(hash);
+    }
+}
+
 int64 CWallet::GetBalance() const
 {
     int64 nTotal = 0;
     {
         LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsConfirmed())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+        RefreshBalances();
+        nTotal = nBalanceCached;
     }
 
     return nTotal;
@@ -930,12 +1217,8 @@ int64 CWallet::GetUnconfirmedBalance() const
     int64 nTotal = 0;
     {
         LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsFinal() || !pcoin->IsConfirmed())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+        RefreshBalances();
+        nTotal = nUnconfirmedBalanceCached;
     }
     return nTotal;
 }
@@ -945,13 +1228,204 @@ int64 CWallet::GetImmatureBalance() const
     int64 nTotal = 0;
     {
         LOCK(cs_wallet);
+        RefreshBalances();
+        nTotal = nImmatureBalanceCached;
+    }
+    return nTotal;
+}
+
+int64 CAccountLedger::GetBalance(int nBestHeight, int nMinDepth, bool fIncludeNonFinal) const
+{
+    int64 nBalance = nCreditDebit - nSent + nReceived;
+    if (nMinDepth <= 0)
+        nBalance += nReceivedUnconfirmed;
+    else
+    {
+        // Take out what was received in the last nMinDepth - 1 blocks
+        int nMaxHeight = nBestHeight + 1 - nMinDepth;
+        for (map<int, int64>::const_reverse_iterator it = mapReceived.rbegin(); it != mapReceived.rend() && (*it).first > nMaxHeight; ++it)
+            nBalance -= (*it).second;
+    }
+    if (fIncludeNonFinal)
+    {
+        nBalance -= nSentNonFinal;
+        if (nMinDepth <= 0)
+            nBalance += nReceivedNonFinal;
+    }
+    return nBalance;
+}
+
+void CWallet::ApplyTxAccounts(const CTxAccountAmounts& amounts, int nSign) const
+{
+    CAccountLedger& ledgerSent = mapAccountLedgers[amounts.strSentAccount];
+    (amounts.fFinal ? ledgerSent.nSent : ledgerSent.nSentNonFinal) += nSign * amounts.nSent;
+    BOOST_FOREACH(const PAIRTYPE(string, int64)& r, amounts.vReceived)
+    {
+        CAccountLedger& ledger = mapAccountLedgers[r.first];
+        int64 nAmount = nSign * r.second;
+        if (!amounts.fFinal)
+            ledger.nReceivedNonFinal += nAmount;
+        else if (amounts.nHeight < 0)
+            ledger.nReceivedUnconfirmed += nAmount;
+        else
+        {
+            ledger.nReceived += nAmount;
+            int64& nAtHeight = ledger.mapReceived[amounts.nHeight];
+            nAtHeight += nAmount;
+            if (nAtHeight == 0)
+                ledger.mapReceived.erase(amounts.nHeight);
+        }
+    }
+}
+
+void CWallet::UpdateTxAccounts(const uint256& hash) const
+{
+    if (!fAccountsIndexed)
+        return;
+
+    map<uint256, CTxAccountAmounts>::iterator mi = mapTxAccountAmounts.find(hash);
+    if (mi != mapTxAccountAmounts.end())
+    {
+        ApplyTxAccounts((*mi).second, -1);
+        mapTxAccountAmounts.erase(mi);
+        setTxAccountsUnsettled.erase(hash);
+    }
+
+    map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+    if (it == mapWallet.end())
+        return;
+    const CWalletTx& wtx = (*it).second;
+
+    // The same amounts as CWalletTx::GetAccountAmounts
+    CTxAccountAmounts amounts;
+    int64 nFee;
+    list<pair<CTxDestination, int64> > listReceived;
+    list<pair<CTxDestination, int64> > listSent;
+    wtx.GetAmounts(listReceived, listSent, nFee, amounts.strSentAccount);
+    amounts.nSent = nFee;
+    BOOST_FOREACH(const PAIRTYPE(CTxDestination, int64)& s, listSent)
+        amounts.nSent += s.second;
+    map<string, int64> mapReceived;
+    BOOST_FOREACH(const PAIRTYPE(CTxDestination, int64)& r, listReceived)
+    {
+        map<CTxDestination, string>::const_iterator mi = mapAddressBook.find(r.first);
+        mapReceived[mi != mapAddressBook.end() ? (*mi).second : ""] += r.second;
+    }
+    amounts.vReceived.assign(mapReceived.begin(), mapReceived.end());
+    amounts.fFinal = wtx.IsFinal();
+    CBlockIndex* pindex;
+    if (wtx.GetDepthInMainChain(pindex) > 0)
+        amounts.nHeight = pindex->nHeight;
+
+    ApplyTxAccounts(amounts, 1);
+    mapTxAccountAmounts.insert(make_pair(hash, amounts));
+
+    // Transactions in a block keep their height until a reorganisation;
+    // the others may get into one whenever the chain grows
+    if (!amounts.fFinal || amounts.nHeight < 0)
+    {
+        setTxAccountsUnsettled.insert(hash);
+        if (!amounts.fFinal)
+            fAccountsNonFinal = true;
+    }
+    else if (pindexBest != pindexAccounts)
+        setAccountsTips.insert(pindexBest);
+}
+
+void CWallet::RefreshAccounts() const
+{
+    CBlockIndex* pindexTip = pindexBest;
+
+    // Depths follow from block heights, so a growing chain changes nothing,
+    // but blocks that were disconnected may have held our transactions
+    if (fAccountsIndexed && pindexAccounts != pindexTip && pindexAccounts && !pindexAccounts->IsInMainChain())
+        fAccountsIndexed = false;
+    BOOST_FOREACH(CBlockIndex* pindex, setAccountsTips)
+        if (!pindex->IsInMainChain())
+            fAccountsIndexed = false;
+    setAccountsTips.clear();
+    bool fTipChanged = (pindexAccounts != pindexTip);
+    pindexAccounts = pindexTip;
+
+    if (!fAccountsIndexed)
+    {
+        mapTxAccountAmounts.clear();
+        setTxAccountsUnsettled.clear();
+        mapAccountLedgers.clear();
+        fAccountsNonFinal = false;
+        fAccountsIndexed = true;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            UpdateTxAccounts((*it).first);
+        BOOST_FOREACH(const CAccountingEntry& entry, laccentries)
+            mapAccountLedgers[entry.strAccount].nCreditDebit += entry.nCreditDebit;
+    }
+    else if (fTipChanged || fAccountsNonFinal)
+    {
+        fAccountsNonFinal = false;
+        vector<uint256> vUnsettled(setTxAccountsUnsettled.begin(), setTxAccountsUnsettled.end());
+        BOOST_FOREACH(const uint256& hash, vUnsettled)
+            UpdateTxAccounts(hash);
+    }
+}
+
+// The account balance summed up over all transactions, for -checkaccounts
+int64 CWallet::TallyAccountBalance(const string& strAccount, int nMinDepth) const
+{
+    int64 nBalance = 0;
+
+    // Tally wallet transactions
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        const CWalletTx& wtx = (*it).second;
+        if (!wtx.IsFinal())
+            continue;
+
+        int64 nReceived, nSent, nFee;
+        wtx.GetAccountAmounts(strAccount, nReceived, nSent, nFee);
+
+        if (nReceived != 0 && wtx.GetDepthInMainChain() >= nMinDepth)
+            nBalance += nReceived;
+        nBalance -= nSent + nFee;
+    }
+
+    // Tally internal accounting entries
+    BOOST_FOREACH(const CAccountingEntry& entry, laccentries)
+        if (entry.strAccount == strAccount)
+            nBalance += entry.nCreditDebit;
+
+    return nBalance;
+}
+
+int64 CWallet::GetAccountBalance(const string& strAccount, int nMinDepth, bool fIncludeNonFinal) const
+{
+    LOCK(cs_wallet);
+    RefreshAccounts();
+    int64 nBalance = 0;
+    map<string, CAccountLedger>::const_iterator mi = mapAccountLedgers.find(strAccount);
+    if (mi != mapAccountLedgers.end())
+        nBalance = (*mi).second.GetBalance(pindexAccounts ? pindexAccounts->nHeight : -1, nMinDepth, fIncludeNonFinal);
+
+    if (!fIncludeNonFinal && GetBoolArg("-checkaccounts"))
+    {
+        int64 nTally = TallyAccountBalance(strAccount, nMinDepth);
+        if (nTally != nBalance)
         {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
+            printf("ERROR: GetAccountBalance() : balance of account '%s' is %s, not %s; recounting all accounts\n",
+                   strAccount.c_str(), FormatMoney(nTally).c_str(), FormatMoney(nBalance).c_str());
+            fAccountsIndexed = false;
+            return nTally;
         }
     }
-    return nTotal;
+    return nBalance;
+}
+
+void CWallet::GetAccountBalances(map<string, int64>& mapBalances, int nMinDepth) const
+{
+    LOCK(cs_wallet);
+    RefreshAccounts();
+    int nBestHeightAccounts = pindexAccounts ? pindexAccounts->nHeight : -1;
+    BOOST_FOREACH(const PAIRTYPE(string, CAccountLedger)& item, mapAccountLedgers)
+        mapBalances[item.first] += item.second.GetBalance(nBestHeightAccounts, nMinDepth, true);
 }
 
 // populate vCoins with vector of spendable COutputs
@@ -961,24 +1435,26 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed) const
 
     {
         LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        RefreshBalances();
+        const CWalletTx* pcoin = NULL;
+        uint256 hashCoin = 0;
+        bool fSpendable = false;
+        int nDepth = 0;
+        BOOST_FOREACH(const COutPoint& outpoint, setUnspentCoins)
         {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!pcoin->IsFinal())
-                continue;
-
-            if (fOnlyConfirmed && !pcoin->IsConfirmed())
-                continue;
-
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
-
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue > 0)
-                    vCoins.push_back(COutput(pcoin, i, pcoin->GetDepthInMainChain()));
+            // the outputs of a transaction are next to each other in the set
+            if (pcoin == NULL || outpoint.hash != hashCoin)
+            {
+                hashCoin = outpoint.hash;
+                pcoin = &(*mapWallet.find(hashCoin)).second;
+                const CWalletTxBalance& balance = (*mapTxBalance.find(hashCoin)).second;
+                fSpendable = balance.fFinal && balance.fMature && (balance.fConfirmed || !fOnlyConfirmed);
+                if (fSpendable)
+                    nDepth = pcoin->GetDepthInMainChain();
             }
+
+            if (fSpendable && !IsLockedCoin(outpoint.hash, outpoint.n))
+                vCoins.push_back(COutput(pcoin, outpoint.n, nDepth));
         }
     }
 }
@@ -1330,6 +1806,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 coin.BindWallet(this);
                 coin.MarkSpent(txin.prevout.n);
                 coin.WriteToDisk();
+                UpdateTxBalance(txin.prevout.hash);
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
 
@@ -1425,6 +1902,12 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    {
+        LOCK(cs_wallet);
+        fBalanceIndexed = false;
+        fAccountsIndexed = false;
+    }
+
     return DB_LOAD_OK;
 }
 
@@ -1433,6 +1916,11 @@ bool CWallet::SetAddressBookName(const CTxDestination& address, const string& st
 {
     std::map<CTxDestination, std::string>::iterator mi = mapAddressBook.find(address);
     mapAddressBook[address] = strName;
+    {
+        // Labels decide which account received what, and what is change
+        LOCK(cs_wallet);
+        fAccountsIndexed = false;
+    }
     NotifyAddressBookChanged(this, address, strName, ::IsMine(*this, address), (mi == mapAddressBook.end()) ? CT_NEW : CT_UPDATED);
     if (!fFileBacked)
         return false;
@@ -1442,6 +1930,10 @@ bool CWallet::SetAddressBookName(const CTxDestination& address, const string& st
 bool CWallet::DelAddressBookName(const CTxDestination& address)
 {
     mapAddressBook.erase(address);
+    {
+        LOCK(cs_wallet);
+        fAccountsIndexed = false;
+    }
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address), CT_DELETED);
     if (!fFileBacked)
         return false;
@@ -62,6 +62,66 @@ public:
     )
 };
 
+/** What a wallet transaction with unspent outputs adds to the wallet's balances */
+class CWalletTxBalance
+{
+public:
+    bool fFinal;
+    bool fConfirmed;
+    bool fMature;
+    int64 nAvailable;
+    int64 nImmature;
+
+    CWalletTxBalance()
+    {
+        fFinal = fConfirmed = fMature = false;
+        nAvailable = nImmature = 0;
+    }
+
+    int64 GetBalance() const { return fConfirmed ? nAvailable : 0; }
+    int64 GetUnconfirmedBalance() const { return (!fFinal || !fConfirmed) ? nAvailable : 0; }
+};
+
+/** What a wallet transaction adds to each account */
+class CTxAccountAmounts
+{
+public:
+    std::string strSentAccount;
+    int64 nSent; // including the fee
+    std::vector<std::pair<std::string, int64> > vReceived;
+    bool fFinal;
+    int nHeight; // of the block, -1 if not in the main chain
+
+    CTxAccountAmounts()
+    {
+        nSent = 0;
+        fFinal = false;
+        nHeight = -1;
+    }
+};
+
+/** Running totals of an account, with received amounts by block height so
+ *  that the balance at any number of confirmations is cheap to work out */
+class CAccountLedger
+{
+public:
+    int64 nCreditDebit;          // accounting entries
+    int64 nSent;                 // by final transactions
+    int64 nSentNonFinal;
+    int64 nReceived;             // the sum of mapReceived
+    int64 nReceivedUnconfirmed;  // by final transactions not in the main chain
+    int64 nReceivedNonFinal;
+    std::map<int, int64> mapReceived;
+
+    CAccountLedger()
+    {
+        nCreditDebit = nSent = nSentNonFinal = 0;
+        nReceived = nReceivedUnconfirmed = nReceivedNonFinal = 0;
+    }
+
+    int64 GetBalance(int nBestHeight, int nMinDepth, bool fIncludeNonFinal) const;
+};
+
 /** A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
  */
@@ -78,6 +138,44 @@ private:
     // the maximum wallet format version: memory-only variable that specifies to what version this wallet may be upgraded
     int nWalletMaxVersion;
 
+    // Balances and unspent outputs, kept up to date as transactions change
+    // instead of being summed over mapWallet on every query. Transactions
+    // that are in a block and mature can only count differently after a
+    // reorganisation, so when the chain grows only the others are looked at
+    // again (see RefreshBalances).
+    mutable bool fBalanceIndexed;
+    mutable CBlockIndex* pindexBalance;
+    mutable bool fBalanceNonFinal;
+    mutable std::map<uint256, CWalletTxBalance> mapTxBalance;
+    mutable std::set<uint256> setTxUnsettled;
+    // Tips other than pindexBalance that transactions were settled at, by
+    // AddToWallet and the like between refreshes
+    mutable std::set<CBlockIndex*> setBalanceTips;
+    mutable std::set<COutPoint> setUnspentCoins;
+    mutable int64 nBalanceCached;
+    mutable int64 nUnconfirmedBalanceCached;
+    mutable int64 nImmatureBalanceCached;
+
+    // Re-evaluate one transaction; cs_wallet must be held
+    void UpdateTxBalance(const uint256& hash) const;
+    void RefreshBalances() const;
+
+    // Account balances, kept up to date the same way. Besides transactions,
+    // accounting entries and labels, only transactions getting into a block
+    // and reorganisations change them.
+    mutable bool fAccountsIndexed;
+    mutable CBlockIndex* pindexAccounts;
+    mutable bool fAccountsNonFinal;
+    mutable std::map<uint256, CTxAccountAmounts> mapTxAccountAmounts;
+    mutable std::set<uint256> setTxAccountsUnsettled;
+    mutable std::set<CBlockIndex*> setAccountsTips;
+    mutable std::map<std::string, CAccountLedger> mapAccountLedgers;
+
+    void ApplyTxAccounts(const CTxAccountAmounts& amounts, int nSign) const;
+    void UpdateTxAccounts(const uint256& hash) const;
+    void RefreshAccounts() const;
+    int64 TallyAccountBalance(const std::string& strAccount, int nMinDepth) const;
+
 public:
     mutable CCriticalSection cs_wallet;
 
@@ -99,6 +197,13 @@ public:
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
+        fBalanceIndexed = false;
+        pindexBalance = NULL;
+        fBalanceNonFinal = false;
+        nBalanceCached = nUnconfirmedBalanceCached = nImmatureBalanceCached = 0;
+        fAccountsIndexed = false;
+        pindexAccounts = NULL;
+        fAccountsNonFinal = false;
     }
     CWallet(std::string strWalletFileIn)
     {
@@ -109,6 +214,13 @@ public:
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
+        fBalanceIndexed = false;
+        pindexBalance = NULL;
+        fBalanceNonFinal = false;
+        nBalanceCached = nUnconfirmedBalanceCached = nImmatureBalanceCached = 0;
+        fAccountsIndexed = false;
+        pindexAccounts = NULL;
+        fAccountsNonFinal = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -161,11 +273,15 @@ public:
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64, TxPair > TxItems;
 
-    /** Get the wallet's activity log
-        @return multimap of ordered transactions and accounting entries
-        @warning Returned pointers are *only* valid within the scope of passed acentries
+    /** The wallet's activity log: transactions and accounting entries by
+        nOrderPos, kept up to date as they are added and erased. The
+        accounting entries are read from the wallet file once, into laccentries.
      */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    TxItems wtxOrdered;
+    std::list<CAccountingEntry> laccentries;
+
+    void LoadOrderedTxItems(CWalletDB& walletdb);
+    bool AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb);
 
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn);
@@ -178,6 +294,11 @@ public:
     int64 GetBalance() const;
     int64 GetUnconfirmedBalance() const;
     int64 GetImmatureBalance() const;
+    // What the account's addresses received in transactions with at least
+    // nMinDepth confirmations, less what it sent, plus accounting entries.
+    // Transactions that aren't final yet only count with fIncludeNonFinal.
+    int64 GetAccountBalance(const std::string& strAccount, int nMinDepth, bool fIncludeNonFinal=false) const;
+    void GetAccountBalances(std::map<std::string, int64>& mapBalances, int nMinDepth) const;
     bool CreateTransaction(const std::vector<std::pair<CScript, int64> >& vecSend,
                            CWalletTx& wtxNew, CReserveKey& reservekey, int64& nFeeRet, std::string& strFailReason);
     bool CreateTransaction(CScript scriptPubKey, int64 nValue,
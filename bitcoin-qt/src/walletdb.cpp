@@ -68,7 +68,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit() : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -85,7 +85,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
             break;
         else if (ret != 0)
         {
-            pcursor->close();
+            delete pcursor;
             throw runtime_error("CWalletDB::ListAccountCreditDebit() : error scanning DB");
         }
 
@@ -104,7 +104,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
         entries.push_back(acentry);
     }
 
-    pcursor->close();
+    delete pcursor;
 }
 
 
@@ -177,6 +177,9 @@ CWalletDB::ReorderTransactions(CWallet* pwallet)
         }
     }
 
+    // Positions changed under the in-memory log
+    pwallet->LoadOrderedTxItems(*this);
+
     return DB_LOAD_OK;
 }
 
@@ -407,7 +410,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             printf("Error getting wallet database cursor\n");
@@ -449,7 +452,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             if (!strErr.empty())
                 printf("%s\n", strErr.c_str());
         }
-        pcursor->close();
+        delete pcursor;
     }
     catch (boost::thread_interrupted) {
         throw;
@@ -480,6 +483,8 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 
     if (fAnyUnordered)
         result = ReorderTransactions(pwallet);
+    else
+        pwallet->LoadOrderedTxItems(*this);
 
     return result;
 }
@@ -601,9 +606,14 @@ bool CWalletDB::Recover(CDBEnv& dbenv, std::string filename, bool fOnlyKeys)
     int64 now = GetTime();
     std::string newFilename = strprintf("wallet.%"PRI64d".bak", now);
 
-    int result = dbenv.dbenv.dbrename(NULL, filename.c_str(), NULL,
-                                      newFilename.c_str(), DB_AUTO_COMMIT);
-    if (result == 0)
+    bool fLogDb = dbenv.IsLogDb(filename);
+    bool fRenamed;
+    if (fLogDb)
+        fRenamed = RenameOver(GetDataDir() / filename, GetDataDir() / newFilename);
+    else
+        fRenamed = (dbenv.dbenv.dbrename(NULL, filename.c_str(), NULL,
+                                         newFilename.c_str(), DB_AUTO_COMMIT) == 0);
+    if (fRenamed)
         printf("Renamed %s to %s\n", filename.c_str(), newFilename.c_str());
     else
     {
@@ -612,7 +622,11 @@ bool CWalletDB::Recover(CDBEnv& dbenv, std::string filename, bool fOnlyKeys)
     }
 
     std::vector<CDBEnv::KeyValPair> salvagedData;
-    bool allOK = dbenv.Salvage(newFilename, true, salvagedData);
+    bool allOK;
+    if (fLogDb)
+        allOK = CLogDB::Salvage(GetDataDir() / newFilename, salvagedData);
+    else
+        allOK = dbenv.Salvage(newFilename, true, salvagedData);
     if (salvagedData.empty())
     {
         printf("Salvage(aggressive) found no records in %s.\n", newFilename.c_str());
@@ -621,17 +635,32 @@ bool CWalletDB::Recover(CDBEnv& dbenv, std::string filename, bool fOnlyKeys)
     printf("Salvage(aggressive) found %"PRIszu" records\n", salvagedData.size());
 
     bool fSuccess = allOK;
-    Db* pdbCopy = new Db(&dbenv.dbenv, 0);
-    int ret = pdbCopy->open(NULL,               // Txn pointer
-                            filename.c_str(),   // Filename
-                            "main",             // Logical db name
-                            DB_BTREE,           // Database type
-                            DB_CREATE,          // Flags
-                            0);
-    if (ret > 0)
+    CLogDB logCopy;
+    CLogDB::CBatch batchCopy;
+    unsigned int nBatchSize = 0;
+    Db* pdbCopy = NULL;
+    if (fLogDb)
     {
-        printf("Cannot create database file %s\n", filename.c_str());
-        return false;
+        if (!logCopy.Open(GetDataDir() / filename, true))
+        {
+            printf("Cannot create database file %s\n", filename.c_str());
+            return false;
+        }
+    }
+    else
+    {
+        pdbCopy = new Db(&dbenv.dbenv, 0);
+        int ret = pdbCopy->open(NULL,               // Txn pointer
+                                filename.c_str(),   // Filename
+                                "main",             // Logical db name
+                                DB_BTREE,           // Database type
+                                DB_CREATE,          // Flags
+                                0);
+        if (ret > 0)
+        {
+            printf("Cannot create database file %s\n", filename.c_str());
+            return false;
+        }
     }
     CWallet dummyWallet;
     int nFileVersion = 0;
@@ -639,7 +668,7 @@ bool CWalletDB::Recover(CDBEnv& dbenv, std::string filename, bool fOnlyKeys)
     bool fIsEncrypted = false;
     bool fAnyUnordered = false;
 
-    DbTxn* ptxn = dbenv.TxnBegin();
+    DbTxn* ptxn = fLogDb ? NULL : dbenv.TxnBegin();
     BOOST_FOREACH(CDBEnv::KeyValPair& row, salvagedData)
     {
         if (fOnlyKeys)
@@ -659,15 +688,37 @@ bool CWalletDB::Recover(CDBEnv& dbenv, std::string filename, bool fOnlyKeys)
                 continue;
             }
         }
+        if (fLogDb)
+        {
+            batchCopy.Write(row.first, CLogDB::value_type(row.second.begin(), row.second.end()));
+            nBatchSize += row.first.size() + row.second.size();
+            if (nBatchSize >= 1000000)
+            {
+                if (!logCopy.Commit(batchCopy))
+                    fSuccess = false;
+                batchCopy.clear();
+                nBatchSize = 0;
+            }
+            continue;
+        }
         Dbt datKey(&row.first[0], row.first.size());
         Dbt datValue(&row.second[0], row.second.size());
         int ret2 = pdbCopy->put(ptxn, &datKey, &datValue, DB_NOOVERWRITE);
         if (ret2 > 0)
             fSuccess = false;
     }
-    ptxn->commit(0);
-    pdbCopy->close(0);
-    delete pdbCopy;
+    if (fLogDb)
+    {
+        if (!logCopy.Commit(batchCopy) || !logCopy.Flush())
+            fSuccess = false;
+        logCopy.Close();
+    }
+    else
+    {
+        ptxn->commit(0);
+        pdbCopy->close(0);
+        delete pdbCopy;
+    }
 
     return fSuccess;
 }